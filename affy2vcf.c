@@ -34,6 +34,7 @@
 #include <htslib/vcf.h>
 #include <htslib/kseq.h>
 #include <htslib/sam.h>
+#include <htslib/thread_pool.h>
 #include "bcftools.h"
 #include "htslib/khash_str2int.h"
 #include "gtc2vcf.h"
@@ -1089,6 +1090,7 @@ typedef struct {
 	snp_t *snps[2];
 	int n_snps[2];
 	int m_snps[2];
+	arena_t arena; // probeset IDs
 } models_t;
 
 static inline void brlmmp_cluster_init(const char *s, const int *off, cluster_t *cluster)
@@ -1162,7 +1164,7 @@ static models_t *models_init(const char *fn)
 		hts_expand(snp_t, models->n_snps[idx] + 1, models->m_snps[idx],
 			   models->snps[idx]);
 		snp = &models->snps[idx][models->n_snps[idx]];
-		snp->probe_set_id = strdup(&str.s[off1[0]]);
+		snp->probe_set_id = arena_strndup(&models->arena, col_str, len);
 		snp->copynumber = copynumber;
 		khash_str2int_inc(models->probe_set_id[idx], snp->probe_set_id);
 
@@ -1224,10 +1226,9 @@ static void models_destroy(models_t *models)
 {
 	for (int i = 0; i < 2; i++) {
 		khash_str2int_destroy(models->probe_set_id[i]);
-		for (int j = 0; j < models->n_snps[i]; j++)
-			free(models->snps[i][j].probe_set_id);
 		free(models->snps[i]);
 	}
+	arena_destroy(&models->arena);
 	free(models);
 }
 
@@ -1249,6 +1250,7 @@ typedef struct {
 	void *probe_set_id;
 	record_t *records;
 	int n_records, m_records;
+	arena_t arena; // strings of the records
 } annot_t;
 
 static inline char *unquote(char *str)
@@ -1267,7 +1269,7 @@ static annot_t *annot_init(const char *fn, const char *sam_fn, const char *out_f
 	FILE *out_txt = get_file_handle(out_fn);
 	htsFile *hts = NULL;
 	sam_hdr_t *sam_hdr = NULL;
-	bam1_t *b = NULL;
+	flank_job_t job = {0};
 	if (sam_fn) {
 		hts = hts_open(sam_fn, "r");
 		if (hts == NULL || hts_get_format(hts)->category != sequence_data)
@@ -1275,9 +1277,7 @@ static annot_t *annot_init(const char *fn, const char *sam_fn, const char *out_f
 		sam_hdr = sam_hdr_read(hts);
 		if (sam_hdr == NULL)
 			error("Reading header from \"%s\" failed", sam_fn);
-		b = bam_init1();
-		if (b == NULL)
-			error("Cannot create SAM record\n");
+		flank_job_init(&job, sam_hdr, 0);
 	}
 	kstring_t str = {0, 0, NULL};
 
@@ -1387,11 +1387,15 @@ static annot_t *annot_init(const char *fn, const char *sam_fn, const char *out_f
 							probe_set_id);
 					n_unmapped++;
 				} else {
-					idx = get_position(hts, sam_hdr, b, probe_set_id, flank,
-							   0, &chromosome, &position, &strand);
-					if (idx < 0)
+					job.n = 0;
+					if (flank_job_read(&job, hts, probe_set_id, flank) < 0)
 						error("Reading from %s failed", sam_fn);
-					else if (idx == 0) {
+					flank_job_run(&job);
+					idx = job.rets[0];
+					chromosome = job.chromosomes[0];
+					position = job.positions[0];
+					strand = job.strands[0];
+					if (idx == 0) {
 						if (flags & VERBOSE)
 							fprintf(stderr,
 								"Unable to determine position for marker %s\n",
@@ -1470,27 +1474,28 @@ static annot_t *annot_init(const char *fn, const char *sam_fn, const char *out_f
 				hts_expand0(record_t, annot->n_records + 1, annot->m_records,
 					    annot->records);
 				annot->records[annot->n_records].probe_set_id =
-					strdup(probe_set_id);
+					arena_strdup(&annot->arena, probe_set_id);
 				khash_str2int_inc(
 					annot->probe_set_id,
 					annot->records[annot->n_records].probe_set_id);
 				const char *dbsnp_rs_id = unquote(&str.s[off[dbsnp_rs_id_idx]]);
 				if (dbsnp_rs_id)
 					annot->records[annot->n_records].dbsnp_rs_id =
-						strdup(dbsnp_rs_id);
+						arena_strdup(&annot->arena, dbsnp_rs_id);
 				if (affy_snp_id_idx >= 0) {
 					const char *affy_snp_id =
 						unquote(&str.s[off[affy_snp_id_idx]]);
 					if (affy_snp_id)
 						annot->records[annot->n_records].affy_snp_id =
-							strdup(affy_snp_id);
+							arena_strdup(&annot->arena, affy_snp_id);
 				}
 				if (chromosome)
 					annot->records[annot->n_records].chromosome =
-						strdup(chromosome);
+						arena_strdup(&annot->arena, chromosome);
 				annot->records[annot->n_records].position = position;
 				if (flank) {
-					annot->records[annot->n_records].flank = strdup(flank);
+					annot->records[annot->n_records].flank =
+						arena_strdup(&annot->arena, flank);
 					// check whether alleles A and B need to be flipped in
 					// the flank sequence (happens with T/C and T/G SNPs
 					// only)
@@ -1517,7 +1522,7 @@ static annot_t *annot_init(const char *fn, const char *sam_fn, const char *out_f
 			fprintf(stderr, "Lines   total/unmapped:\t%d/%d\n", n_total,
 				n_unmapped);
 
-		bam_destroy1(b);
+		flank_job_destroy(&job);
 		sam_hdr_destroy(sam_hdr);
 		if (hts && hts_close(hts) < 0)
 			error("closing \"%s\" failed", fn);
@@ -1535,14 +1540,8 @@ static annot_t *annot_init(const char *fn, const char *sam_fn, const char *out_f
 static void annot_destroy(annot_t *annot)
 {
 	khash_str2int_destroy(annot->probe_set_id);
-	for (int i = 0; i < annot->n_records; i++) {
-		free(annot->records[i].probe_set_id);
-		free(annot->records[i].affy_snp_id);
-		free(annot->records[i].dbsnp_rs_id);
-		free(annot->records[i].chromosome);
-		free(annot->records[i].flank);
-	}
 	free(annot->records);
+	arena_destroy(&annot->arena);
 	free(annot);
 }
 
@@ -1603,16 +1602,44 @@ static void report_destroy(report_t *report)
  ****************************************/
 
 #define MAX_LENGTH_PROBE_SET_ID 17
+// number of CHP rows read at once from each data set
+#define BLOCK_ROWS 256
+// default number of CHP rows in each window read ahead from each data set when prefetching
+#define WINDOW_ROWS 16384
 typedef struct {
 	int nsmpl;
 	int nrow;
 
 	DataSet **data_sets;
 	int *is_axiom;
+	int block_beg; // index of the first row in the block
+	int block_len;
+	char **blocks; // raw rows of each data set
+	// when prefetching the blocks are copied from windows of rows of each data set, while the
+	// following windows are read ahead
+	prefetch_t *prefetch;
+	int window_rows; // a multiple of the block rows so that blocks never straddle windows
+	int *window_beg;
+	char **windows;
+	char **aheads;
+	prefetch_slot_t *slots;
+	uint64_t n_bytes; // bytes of the windows read
+	int *block_gts;
+	float *block_conf;
+	float *block_norm_x;
+	float *block_norm_y;
+	float *block_delta;
+	float *block_size;
 	htsFile *calls_fp;
 	htsFile *confidences_fp;
 	htsFile *summary_fp;
 	char probe_set_id[MAX_LENGTH_PROBE_SET_ID + 1];
+	// line buffers and probe set IDs of the calls, confidences, and summary files which are
+	// kept across rows and parsed in parallel if a thread pool is available
+	kstring_t str[3];
+	char *ids[3];
+	hts_tpool *pool;
+	hts_tpool_process *q;
 
 	int *gts;
 	float *conf_arr;
@@ -1636,7 +1663,18 @@ static void varitr_init_common(varitr_t *varitr)
 	varitr->lrr_arr = (float *)malloc(varitr->nsmpl * sizeof(float));
 }
 
-static varitr_t *varitr_init_cc(bcf_hdr_t *hdr, agcc_t **agcc, int n)
+// read a window of rows of a data set, also called by the I/O threads when prefetching
+static int data_set_read(void *data, char *buf, int64_t off, size_t len)
+{
+	DataSet *data_set = (DataSet *)data;
+	if (hseek(data_set->fp, off, SEEK_SET) < 0 || hread(data_set->fp, buf, len) < (ssize_t)len)
+		return -1;
+	return 0;
+}
+
+// with a prefetch pool the buffer memory, if any, is split across two windows per data set
+static varitr_t *varitr_init_cc(bcf_hdr_t *hdr, agcc_t **agcc, int n, prefetch_t *prefetch,
+				size_t buffer_memory)
 {
 	varitr_t *varitr = (varitr_t *)calloc(1, sizeof(varitr_t));
 	varitr->nsmpl = n;
@@ -1678,14 +1716,61 @@ static varitr_t *varitr_init_cc(bcf_hdr_t *hdr, agcc_t **agcc, int n)
 		bcf_hdr_add_sample(hdr, agcc[i]->display_name);
 		varitr->data_sets[i] = data_set;
 	}
+	varitr->blocks = (char **)malloc(n * sizeof(char *));
+	for (int i = 0; i < n; i++)
+		varitr->blocks[i] = (char *)malloc(BLOCK_ROWS * varitr->data_sets[i]->n_buffer);
+	if (prefetch) {
+		size_t window_rows = WINDOW_ROWS;
+		if (buffer_memory > 0) {
+			size_t row_size = 0;
+			for (int i = 0; i < n; i++)
+				row_size += 2 * varitr->data_sets[i]->n_buffer;
+			window_rows = row_size > 0 ? buffer_memory / row_size : WINDOW_ROWS;
+		}
+		// no window needs more rows than the data sets have, which keeps it an int
+		size_t n_rows = 0;
+		for (int i = 0; i < n; i++)
+			if (n_rows < (size_t)varitr->data_sets[i]->n_rows)
+				n_rows = (size_t)varitr->data_sets[i]->n_rows;
+		if (window_rows > n_rows)
+			window_rows = n_rows;
+		window_rows = (window_rows + BLOCK_ROWS - 1) / BLOCK_ROWS * BLOCK_ROWS;
+		varitr->prefetch = prefetch;
+		varitr->window_rows = window_rows > 0 ? window_rows : BLOCK_ROWS;
+		varitr->window_beg = (int *)malloc(n * sizeof(int));
+		varitr->windows = (char **)malloc(n * sizeof(char *));
+		varitr->aheads = (char **)malloc(n * sizeof(char *));
+		varitr->slots = (prefetch_slot_t *)malloc(n * sizeof(prefetch_slot_t));
+		for (int i = 0; i < n; i++) {
+			size_t size = (size_t)varitr->window_rows * varitr->data_sets[i]->n_buffer;
+			varitr->window_beg[i] = -1;
+			varitr->windows[i] = (char *)malloc(size);
+			varitr->aheads[i] = (char *)malloc(size);
+			prefetch_slot_init(&varitr->slots[i], prefetch, data_set_read,
+					   (void *)varitr->data_sets[i]);
+		}
+	}
+	size_t n_cells = (size_t)n * BLOCK_ROWS;
+	varitr->block_gts = (int *)malloc(n_cells * sizeof(int));
+	varitr->block_conf = (float *)malloc(n_cells * sizeof(float));
+	varitr->block_norm_x = (float *)malloc(n_cells * sizeof(float));
+	varitr->block_norm_y = (float *)malloc(n_cells * sizeof(float));
+	varitr->block_delta = (float *)malloc(n_cells * sizeof(float));
+	varitr->block_size = (float *)malloc(n_cells * sizeof(float));
 	varitr_init_common(varitr);
 	return varitr;
 }
 
 static varitr_t *varitr_init_txt(bcf_hdr_t *hdr, const char *calls_fn,
-				 const char *confidences_fn, const char *summary_fn)
+				 const char *confidences_fn, const char *summary_fn,
+				 hts_tpool *pool)
 {
 	varitr_t *varitr = (varitr_t *)calloc(1, sizeof(varitr_t));
+	// the files are parsed in parallel only when there is more than one
+	if (pool && (calls_fn != NULL) + (confidences_fn != NULL) + (summary_fn != NULL) > 1) {
+		varitr->pool = pool;
+		varitr->q = hts_tpool_process_init(pool, 3, 1);
+	}
 
 	kstring_t str = {0, 0, NULL};
 	int moff = 0, *off = NULL, ncols;
@@ -1771,146 +1856,352 @@ static inline void check_probe_set_id(char *dest, const char *src)
 	}
 }
 
-static int varitr_loop(varitr_t *varitr)
+static inline float be_float(const char *ptr)
 {
-	varitr->probe_set_id[0] = '\0';
-	if (varitr->data_sets) {
-		varitr->nrow++;
-		// check whether you have arrived at the last element
-		static const int gt[16] = {-1,	  -1, -1, -1,	 -1, -1, GT_AA, GT_BB,
-					   GT_AB, -1, -1, GT_NC, -1, -1, -1,	-1};
-		for (int i = 0; i < varitr->nsmpl; i++) {
-			DataSet *data_set = varitr->data_sets[i];
-			if (varitr->nrow > data_set->n_rows)
-				return -1;
-			read_bytes(data_set->fp, (void *)data_set->buffer, data_set->n_buffer);
-			uint32_t n =
-				ntohl(*(uint32_t *)&data_set->buffer[data_set->col_offsets[0]]);
-			check_n_probe_set_id(varitr->probe_set_id,
-					     &data_set->buffer[data_set->col_offsets[0] + 4],
-					     (size_t)n);
-			varitr->gts[i] = gt[data_set->buffer[data_set->col_offsets[1]] & 0x0F];
-			union {
-				uint32_t u;
-				float f;
-			} convert;
-			convert.u =
-				ntohl(*(uint32_t *)&data_set->buffer[data_set->col_offsets[2]]);
-			varitr->conf_arr[i] = convert.f;
+	union {
+		uint32_t u;
+		float f;
+	} convert;
+	convert.u = ntohl(*(uint32_t *)ptr);
+	return convert.f;
+}
+
+// copy the rows of the block of a data set from its window, moving to the window read ahead
+// once the block is past the current window and reading ahead the window that follows
+static void varitr_window_block(varitr_t *varitr, int i, char *block, int len)
+{
+	DataSet *data_set = varitr->data_sets[i];
+	size_t row_size = data_set->n_buffer;
+	int beg = varitr->block_beg - varitr->block_beg % varitr->window_rows;
+	if (varitr->window_beg[i] != beg) {
+		int64_t off = data_set->pos_first_element + (int64_t)beg * row_size;
+		size_t n_rows = min(varitr->window_rows, (int)data_set->n_rows - beg);
+		prefetch_slot_t *slot = &varitr->slots[i];
+		if (prefetch_wait(slot) == PREFETCH_DONE && slot->off == off) {
+			char *tmp = varitr->windows[i];
+			varitr->windows[i] = varitr->aheads[i];
+			varitr->aheads[i] = tmp;
+			prefetch_used(varitr->prefetch, n_rows * row_size);
+		} else if (data_set_read((void *)data_set, varitr->windows[i], off,
+					 n_rows * row_size)
+			   < 0) {
+			error("Failed to read %ld bytes from stream\n", n_rows * row_size);
+		}
+		varitr->window_beg[i] = beg;
+		varitr->n_bytes += n_rows * row_size;
+		int next = beg + varitr->window_rows;
+		if (next < (int)data_set->n_rows)
+			prefetch_issue(slot, varitr->aheads[i],
+				       data_set->pos_first_element + (int64_t)next * row_size,
+				       min(varitr->window_rows, (int)data_set->n_rows - next)
+					       * row_size);
+	}
+	memcpy((void *)block,
+	       (const void *)(varitr->windows[i] + (size_t)(varitr->block_beg - beg) * row_size),
+	       (size_t)len * row_size);
+}
+
+// reads the next block of rows from all data sets with one read per data set, then converts
+// the columns and computes the intensities for the whole block
+static int varitr_read_block(varitr_t *varitr)
+{
+	static const int gt[16] = {-1,	  -1, -1, -1,	 -1, -1, GT_AA, GT_BB,
+				   GT_AB, -1, -1, GT_NC, -1, -1, -1,	-1};
+	varitr->block_beg += varitr->block_len;
+	int len = BLOCK_ROWS;
+	for (int i = 0; i < varitr->nsmpl; i++)
+		if ((int)varitr->data_sets[i]->n_rows - varitr->block_beg < len)
+			len = (int)varitr->data_sets[i]->n_rows - varitr->block_beg;
+	varitr->block_len = len > 0 ? len : 0;
+	if (len <= 0)
+		return -1;
+
+	for (int i = 0; i < varitr->nsmpl; i++) {
+		DataSet *data_set = varitr->data_sets[i];
+		char *block = varitr->blocks[i];
+		if (varitr->prefetch)
+			varitr_window_block(varitr, i, block, len);
+		else
+			read_bytes(data_set->fp, (void *)block, (size_t)len * data_set->n_buffer);
+		const uint32_t *off = data_set->col_offsets;
+		size_t k = (size_t)i * BLOCK_ROWS;
+		int *gts = varitr->block_gts + k;
+		float *conf = varitr->block_conf + k;
+		float *norm_x = varitr->block_norm_x + k;
+		float *norm_y = varitr->block_norm_y + k;
+		float *delta = varitr->block_delta + k;
+		float *size = varitr->block_size + k;
+		for (int r = 0; r < len; r++) {
+			const char *row = block + (size_t)r * data_set->n_buffer;
+			gts[r] = gt[row[off[1]] & 0x0F];
+			conf[r] = be_float(&row[off[2]]);
 			if (varitr->is_axiom[i]) {
-				convert.u = ntohl(*(uint32_t *)&data_set
-							   ->buffer[data_set->col_offsets[3]]);
-				varitr->delta_arr[i] = convert.f;
-				convert.u = ntohl(*(uint32_t *)&data_set
-							   ->buffer[data_set->col_offsets[4]]);
-				varitr->size_arr[i] = convert.f;
-				varitr->norm_x_arr[i] =
-					expf((varitr->size_arr[i] + varitr->delta_arr[i] * 0.5f)
-					     * (float)M_LN2);
-				varitr->norm_y_arr[i] =
-					expf((varitr->size_arr[i] - varitr->delta_arr[i] * 0.5f)
-					     * (float)M_LN2);
+				delta[r] = be_float(&row[off[3]]);
+				size[r] = be_float(&row[off[4]]);
 			} else {
-				convert.u = ntohl(*(uint32_t *)&data_set
-							   ->buffer[data_set->col_offsets[3]]);
-				varitr->norm_x_arr[i] = convert.f;
-				convert.u = ntohl(*(uint32_t *)&data_set
-							   ->buffer[data_set->col_offsets[4]]);
-				varitr->norm_y_arr[i] = convert.f;
-				float log2x = logf(varitr->norm_x_arr[i]) * (float)M_LOG2E;
-				float log2y = logf(varitr->norm_y_arr[i]) * (float)M_LOG2E;
-				varitr->delta_arr[i] = log2x - log2y;
-				varitr->size_arr[i] = (log2x + log2y) * 0.5f;
+				norm_x[r] = be_float(&row[off[3]]);
+				norm_y[r] = be_float(&row[off[4]]);
 			}
 		}
-	} else {
-		kstring_t str = {0, 0, NULL};
-		int moff = 0, *off = NULL, ncols;
-		char *tmp, buf[MAX_LENGTH_PROBE_SET_ID];
+		if (varitr->is_axiom[i]) {
+			for (int r = 0; r < len; r++) {
+				norm_x[r] = expf((size[r] + delta[r] * 0.5f) * (float)M_LN2);
+				norm_y[r] = expf((size[r] - delta[r] * 0.5f) * (float)M_LN2);
+			}
+		} else {
+			for (int r = 0; r < len; r++) {
+				float log2x = logf(norm_x[r]) * (float)M_LOG2E;
+				float log2y = logf(norm_y[r]) * (float)M_LOG2E;
+				delta[r] = log2x - log2y;
+				size[r] = (log2x + log2y) * 0.5f;
+			}
+		}
+	}
+	return 0;
+}
 
-		// read genotypes
-		if (varitr->calls_fp) {
-			if (hts_getline(varitr->calls_fp, KS_SEP_LINE, &str) < 0)
-				return -1;
-			ncols = ksplit_core(str.s, '\t', &moff, &off);
-			if (ncols != 1 + varitr->nsmpl)
-				error("Expected %d columns but %d columns found in the calls file\n",
-				      1 + varitr->nsmpl, ncols);
-			for (int i = 1; i < 1 + varitr->nsmpl; i++)
-				varitr->gts[i - 1] = strtol(&str.s[off[i]], &tmp, 10);
-			check_probe_set_id(varitr->probe_set_id, &str.s[off[0]]);
+static inline int count_fields(const char *s)
+{
+	int n = 1;
+	for (; *s; s++)
+		n += *s == '\t';
+	return n;
+}
+
+// exact for values with at most seven significant digits and ten decimals, as both operands of
+// the division are then exactly representable, otherwise strtof() is used
+static inline float parse_float(const char *s, char **endptr)
+{
+	static const float pow10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+				      1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+	const char *p = s;
+	int neg = *p == '-';
+	if (*p == '-' || *p == '+')
+		p++;
+	uint32_t m = 0;
+	int n_digits = 0, n_decimals = 0;
+	for (; *p >= '0' && *p <= '9'; p++, n_digits++)
+		if ((m = m * 10 + (*p - '0')) >= 1 << 24)
+			return strtof(s, endptr);
+	if (*p == '.')
+		for (p++; *p >= '0' && *p <= '9'; p++, n_digits++, n_decimals++)
+			if ((m = m * 10 + (*p - '0')) >= 1 << 24 || n_decimals == 10)
+				return strtof(s, endptr);
+	if (n_digits == 0 || *p == 'e' || *p == 'E')
+		return strtof(s, endptr);
+	*endptr = (char *)p;
+	float f = (float)m / pow10[n_decimals];
+	return neg ? -f : f;
+}
+
+// splits the probe set ID from a tab-separated line and returns the first value
+static char *split_id(kstring_t *str, int nsmpl, const char *name)
+{
+	char *tab = (char *)memchr(str->s, '\t', str->l);
+	if (!tab)
+		error("Expected %d columns but 1 columns found in the %s file\n", 1 + nsmpl, name);
+	*tab = '\0';
+	return tab + 1;
+}
+
+// parses a value per sample, skipping over the rest of the fields as strtol() and strtof() do,
+// with empty fields read as 0 as strtol() and strtof() would skip the tab and read the next field
+static void parse_values(char *s, int nsmpl, int *int_arr, float *float_arr, const char *name)
+{
+	char *p = s, *end;
+	for (int i = 0; i < nsmpl; i++) {
+		int is_empty = *p == '\t' || *p == '\0';
+		if (int_arr)
+			int_arr[i] = is_empty ? 0 : strtol(p, &end, 10);
+		else
+			float_arr[i] = is_empty ? 0.0f : parse_float(p, &end);
+		if (is_empty)
+			end = p;
+		char *tab = *end == '\t' ? end : strchr(end, '\t');
+		if (i + 1 < nsmpl && !tab) {
+			error("Expected %d columns but %d columns found in the %s file\n", 1 + nsmpl,
+			      2 + i, name);
+		} else if (i + 1 == nsmpl && tab) {
+			error("Expected %d columns but %d columns found in the %s file\n", 1 + nsmpl,
+			      1 + i + count_fields(tab), name);
 		}
+		p = tab + 1;
+	}
+}
+
+static int varitr_read_calls(varitr_t *varitr)
+{
+	kstring_t *str = &varitr->str[0];
+	if (hts_getline(varitr->calls_fp, KS_SEP_LINE, str) < 0)
+		return -1;
+	char *values = split_id(str, varitr->nsmpl, "calls");
+	parse_values(values, varitr->nsmpl, varitr->gts, NULL, "calls");
+	varitr->ids[0] = str->s;
+	return 0;
+}
 
-		// read confidences
-		if (varitr->confidences_fp) {
-			if (hts_getline(varitr->confidences_fp, KS_SEP_LINE, &str) < 0)
+static int varitr_read_confidences(varitr_t *varitr)
+{
+	kstring_t *str = &varitr->str[1];
+	if (hts_getline(varitr->confidences_fp, KS_SEP_LINE, str) < 0)
+		return -1;
+	char *values = split_id(str, varitr->nsmpl, "confidences");
+	parse_values(values, varitr->nsmpl, NULL, varitr->conf_arr, "confidences");
+	varitr->ids[1] = str->s;
+	return 0;
+}
+
+static int varitr_read_summary(varitr_t *varitr)
+{
+	kstring_t *str = &varitr->str[2];
+	char *values, buf[MAX_LENGTH_PROBE_SET_ID];
+	int ret, len;
+	do {
+		if ((ret = hts_getline(varitr->summary_fp, KS_SEP_LINE, str)) < 0)
+			return -1;
+		values = split_id(str, varitr->nsmpl, "summary");
+		len = values - 1 - str->s;
+		if (len < 2 || str->s[len - 2] != '-' || str->s[len - 1] != 'A')
+			error("Found Probe Set ID %s while a -A was expected\n", str->s);
+		str->s[len - 2] = '\0';
+		// check whether the next line contains the expected -B probeset_id
+		if (len - 2 > MAX_LENGTH_PROBE_SET_ID)
+			error("Cannot read Probe Set %s intensities\n", str->s);
+		ret = hpeek(varitr->summary_fp->fp.hfile, buf, len);
+	} while (ret < len || strncmp(str->s, buf, len - 2) != 0 || buf[len - 2] != '-'
+		 || buf[len - 1] != 'B');
+	if (ret < 0)
+		return -1;
+	parse_values(values, varitr->nsmpl, NULL, varitr->norm_x_arr, "summary");
+
+	if (hts_getline(varitr->summary_fp, KS_SEP_LINE, str) <= 0)
+		error("Summary file ended prematurely\n");
+	values = split_id(str, varitr->nsmpl, "summary");
+	str->s[values - 3 - str->s] = '\0';
+	parse_values(values, varitr->nsmpl, NULL, varitr->norm_y_arr, "summary");
+	for (int i = 0; i < varitr->nsmpl; i++) {
+		float log2x = logf(varitr->norm_x_arr[i]) * (float)M_LOG2E;
+		float log2y = logf(varitr->norm_y_arr[i]) * (float)M_LOG2E;
+		varitr->delta_arr[i] = log2x - log2y;
+		varitr->size_arr[i] = (log2x + log2y) * 0.5f;
+	}
+	varitr->ids[2] = str->s;
+	return 0;
+}
+
+typedef struct {
+	varitr_t *varitr;
+	int (*read)(varitr_t *);
+	int ret;
+} txt_job_t;
+
+static void *txt_job_run(void *arg)
+{
+	txt_job_t *job = (txt_job_t *)arg;
+	job->ret = job->read ? job->read(job->varitr) : 0;
+	return NULL;
+}
+
+static int varitr_loop(varitr_t *varitr)
+{
+	varitr->probe_set_id[0] = '\0';
+	txt_job_t txt_jobs[3] = {
+		{varitr, varitr->calls_fp ? varitr_read_calls : NULL, 0},
+		{varitr, varitr->confidences_fp ? varitr_read_confidences : NULL, 0},
+		{varitr, varitr->summary_fp ? varitr_read_summary : NULL, 0}};
+	if (varitr->data_sets) {
+		int r = varitr->nrow++ - varitr->block_beg;
+		if (r >= varitr->block_len) {
+			if (varitr_read_block(varitr) < 0)
 				return -1;
-			ncols = ksplit_core(str.s, '\t', &moff, &off);
-			if (ncols != 1 + varitr->nsmpl)
-				error("Expected %d columns but %d columns found in the confidences file\n",
-				      1 + varitr->nsmpl, ncols);
-			for (int i = 1; i < 1 + varitr->nsmpl; i++)
-				varitr->conf_arr[i - 1] = strtof(&str.s[off[i]], &tmp);
-			check_probe_set_id(varitr->probe_set_id, &str.s[off[0]]);
+			r = 0;
 		}
-
-		// read intensities
-		if (varitr->summary_fp) {
-			int ret, len;
-			do {
-				if ((ret = hts_getline(varitr->summary_fp, KS_SEP_LINE, &str))
+		for (int i = 0; i < varitr->nsmpl; i++) {
+			DataSet *data_set = varitr->data_sets[i];
+			const char *row = varitr->blocks[i] + (size_t)r * data_set->n_buffer;
+			const char *name = &row[data_set->col_offsets[0]];
+			check_n_probe_set_id(varitr->probe_set_id, name + 4,
+					     (size_t)ntohl(*(uint32_t *)name));
+			size_t k = (size_t)i * BLOCK_ROWS + r;
+			varitr->gts[i] = varitr->block_gts[k];
+			varitr->conf_arr[i] = varitr->block_conf[k];
+			varitr->norm_x_arr[i] = varitr->block_norm_x[k];
+			varitr->norm_y_arr[i] = varitr->block_norm_y[k];
+			varitr->delta_arr[i] = varitr->block_delta[k];
+			varitr->size_arr[i] = varitr->block_size[k];
+		}
+	} else {
+		if (varitr->pool) {
+			for (int i = 0; i < 3; i++)
+				if (hts_tpool_dispatch(varitr->pool, varitr->q, txt_job_run,
+						       (void *)&txt_jobs[i])
 				    < 0)
-					return -1;
-				ncols = ksplit_core(str.s, '\t', &moff, &off);
-				if (ncols != 1 + varitr->nsmpl)
-					error("Expected %d columns but %d columns found in the summary file\n",
-					      1 + varitr->nsmpl, ncols);
-				len = strlen(&str.s[off[0]]);
-				if (str.s[off[0] + len - 2] != '-'
-				    || str.s[off[0] + len - 1] != 'A')
-					error("Found Probe Set ID %s while a -A was expected\n",
-					      &str.s[off[0]]);
-				str.s[off[0] + len - 2] = '\0';
-				// check whether the next line contains the expected -B
-				// probeset_id
-				if (len - 2 > MAX_LENGTH_PROBE_SET_ID)
-					error("Cannot read Probe Set %s intensities\n",
-					      &str.s[off[0]]);
-				ret = hpeek(varitr->summary_fp->fp.hfile, buf, len);
-			} while (ret < len || strncmp(&str.s[off[0]], buf, len - 2) != 0
-				 || buf[len - 2] != '-' || buf[len - 1] != 'B');
-			if (ret < 0)
+					error("Failed to dispatch job to the thread pool\n");
+			if (hts_tpool_process_flush(varitr->q) < 0)
+				error("Failed to flush the thread pool\n");
+		} else {
+			for (int i = 0; i < 3; i++)
+				txt_job_run((void *)&txt_jobs[i]);
+		}
+		// the rows of the three files meet at the probe set ID
+		for (int i = 0; i < 3; i++)
+			if (txt_jobs[i].ret < 0)
 				return -1;
+		for (int i = 0; i < 3; i++)
+			if (varitr->ids[i])
+				check_probe_set_id(varitr->probe_set_id, varitr->ids[i]);
+	}
+	return 0;
+}
 
-			for (int i = 1; i < 1 + varitr->nsmpl; i++)
-				varitr->norm_x_arr[i - 1] = strtof(&str.s[off[i]], &tmp);
-			if (hts_getline(varitr->summary_fp, KS_SEP_LINE, &str) <= 0)
-				error("Summary file ended prematurely\n");
-			ncols = ksplit_core(str.s, '\t', &moff, &off);
-			if (ncols != 1 + varitr->nsmpl)
-				error("Expected %d columns but %d columns found in the summary file\n",
-				      1 + varitr->nsmpl, ncols);
-			len = strlen(&str.s[off[0]]);
-			str.s[off[0] + len - 2] = '\0';
-			for (int i = 1; i < 1 + varitr->nsmpl; i++) {
-				varitr->norm_y_arr[i - 1] = strtof(&str.s[off[i]], &tmp);
-				float log2x = logf(varitr->norm_x_arr[i - 1]) * (float)M_LOG2E;
-				float log2y = logf(varitr->norm_y_arr[i - 1]) * (float)M_LOG2E;
-				varitr->delta_arr[i - 1] = log2x - log2y;
-				varitr->size_arr[i - 1] = (log2x + log2y) * 0.5f;
-			}
-			check_probe_set_id(varitr->probe_set_id, &str.s[off[0]]);
+// bytes read so far from the CHP files or from the tab delimited files
+static uint64_t varitr_bytes_read(const varitr_t *varitr)
+{
+	uint64_t n_bytes = 0;
+	if (varitr->prefetch) {
+		// the files are also read by the I/O threads
+		n_bytes = varitr->n_bytes;
+	} else if (varitr->data_sets) {
+		for (int i = 0; i < varitr->nsmpl; i++) {
+			off_t off = htell(varitr->data_sets[i]->fp);
+			n_bytes += off > 0 ? off : 0;
 		}
-
-		free(str.s);
-		free(off);
+	} else {
+		n_bytes = hts_bytes_read(varitr->calls_fp) + hts_bytes_read(varitr->confidences_fp)
+			  + hts_bytes_read(varitr->summary_fp);
 	}
-	return 0;
+	return n_bytes;
 }
 
 static void varitr_destroy(varitr_t *varitr)
 {
 	free(varitr->is_axiom);
+	for (int i = 0; i < 3; i++)
+		free(varitr->str[i].s);
+	if (varitr->q)
+		hts_tpool_process_destroy(varitr->q);
+	if (varitr->blocks) {
+		for (int i = 0; i < varitr->nsmpl; i++)
+			free(varitr->blocks[i]);
+		free(varitr->blocks);
+	}
+	if (varitr->prefetch) {
+		for (int i = 0; i < varitr->nsmpl; i++) {
+			prefetch_wait(&varitr->slots[i]);
+			free(varitr->windows[i]);
+			free(varitr->aheads[i]);
+		}
+		free(varitr->window_beg);
+		free(varitr->windows);
+		free(varitr->aheads);
+		free(varitr->slots);
+	}
+	free(varitr->block_gts);
+	free(varitr->block_conf);
+	free(varitr->block_norm_x);
+	free(varitr->block_norm_y);
+	free(varitr->block_delta);
+	free(varitr->block_size);
 	if (varitr->calls_fp) {
 		if (hgetc(varitr->calls_fp->fp.hfile) != EOF)
 			fprintf(stderr, "Warning: End of calls file was not reached\n");
@@ -2233,8 +2524,40 @@ static void compute_baf_lrr(const float *norm_x, const float *norm_y, int n, con
 	}
 }
 
-static void process(faidx_t *fai, const annot_t *annot, models_t *models, varitr_t *varitr,
-		    htsFile *out_fh, bcf_hdr_t *hdr, int flags)
+// the calls, manifest and models files usually list probe sets in the same order, so the next
+// index is predicted from the previous match and the hash tables are only used on a mismatch
+typedef struct {
+	int annot_idx;
+	int model_idx[2];
+	int n_hashed;
+} join_t;
+
+static inline int join_annot(join_t *join, const annot_t *annot, const char *probe_set_id)
+{
+	int idx = join->annot_idx + 1;
+	if (idx >= annot->n_records || strcmp(annot->records[idx].probe_set_id, probe_set_id)) {
+		join->n_hashed++;
+		if (khash_str2int_get(annot->probe_set_id, probe_set_id, &idx) < 0)
+			return -1;
+	}
+	join->annot_idx = idx;
+	return idx;
+}
+
+static inline int join_model(join_t *join, const models_t *models, int i,
+			     const char *probe_set_id)
+{
+	int idx = join->model_idx[i] + 1;
+	if (idx >= models->n_snps[i] || strcmp(models->snps[i][idx].probe_set_id, probe_set_id)) {
+		if (khash_str2int_get(models->probe_set_id[i], probe_set_id, &idx) < 0)
+			return -1;
+	}
+	join->model_idx[i] = idx;
+	return idx;
+}
+
+static void process(ref_cache_t *ref, const annot_t *annot, models_t *models, varitr_t *varitr,
+		    htsFile *out_fh, bcf_hdr_t *hdr, progress_t *progress, int flags)
 {
 	if (bcf_hdr_write(out_fh, hdr) < 0)
 		error("Unable to write to output VCF file\n");
@@ -2257,6 +2580,12 @@ static void process(faidx_t *fai, const annot_t *annot, models_t *models, varitr
 	float *baf_arr = (float *)malloc(nsmpl * sizeof(float));
 	float *lrr_arr = (float *)malloc(nsmpl * sizeof(float));
 
+	join_t join = {-1, {-1, -1}, 0};
+	double t_beg = wall_time();
+	if (progress)
+		progress_begin(progress,
+			       varitr ? (varitr->data_sets ? "chp" : "txt") : "csv",
+			       annot->n_records, nsmpl);
 	int i = 0, n_missing = 0, n_no_models = 0, n_skipped = 0;
 	for (i = 0; i < annot->n_records; i++) {
 		// identify variants to use for next VCF record
@@ -2264,9 +2593,8 @@ static void process(faidx_t *fai, const annot_t *annot, models_t *models, varitr
 		if (varitr) {
 			if (varitr_loop(varitr) < 0)
 				break;
-			int ret = khash_str2int_get(annot->probe_set_id, varitr->probe_set_id,
-						    &idx);
-			if (ret < 0)
+			idx = join_annot(&join, annot, varitr->probe_set_id);
+			if (idx < 0)
 				error("Probe Set %s not found in manifest file\n",
 				      varitr->probe_set_id);
 		} else {
@@ -2297,7 +2625,7 @@ static void process(faidx_t *fai, const annot_t *annot, models_t *models, varitr
 		allele_a.l = allele_b.l = 0;
 		if (strchr(flank.s, '-')) {
 			int ref_is_del =
-				get_indel_alleles(flank.s, fai, bcf_seqname(hdr, rec), rec->pos,
+				get_indel_alleles(flank.s, ref, bcf_seqname(hdr, rec), rec->pos,
 						  0, ref_base, &allele_a, &allele_b);
 			if (ref_is_del < 0) {
 				if (flags & VERBOSE)
@@ -2318,7 +2646,7 @@ static void process(faidx_t *fai, const annot_t *annot, models_t *models, varitr
 
 			kputsn(left + 1, middle - left - 1, &allele_a);
 			kputsn(middle + 1, right - middle - 1, &allele_b);
-			ref_base[0] = get_ref_base(fai, hdr, rec);
+			ref_base[0] = get_ref_base(ref, hdr, rec);
 			allele_b_idx = get_allele_b_idx(ref_base[0], allele_a.s, allele_b.s);
 		}
 		int32_t allele_a_idx = get_allele_a_idx(allele_b_idx);
@@ -2387,8 +2715,8 @@ static void process(faidx_t *fai, const annot_t *annot, models_t *models, varitr
 		if (models) {
 			int rets[2], idxs[2];
 			for (int i = 0; i < 2; i++) {
-				rets[i] = khash_str2int_get(models->probe_set_id[i],
-							    record->probe_set_id, &idxs[i]);
+				idxs[i] = join_model(&join, models, i, record->probe_set_id);
+				rets[i] = idxs[i] < 0 ? -1 : 0;
 			}
 			static const char *hap_info_str[] = {
 				"meanX_AA.1",	 "meanX_AB.1",	  "meanX_BB.1",
@@ -2440,8 +2768,20 @@ static void process(faidx_t *fai, const annot_t *annot, models_t *models, varitr
 			}
 		}
 
+		double t0 = progress ? wall_time() : 0.0;
 		if (bcf_write(out_fh, hdr, rec) < 0)
 			error("Unable to write to output VCF file\n");
+		if (progress) {
+			progress->write += wall_time() - t0;
+			if (progress_update(progress, i + 1)) {
+				progress->n_bytes = varitr ? varitr_bytes_read(varitr) : 0;
+				progress_write(progress, 0);
+			}
+		}
+	}
+	if (progress) {
+		progress->n_bytes = varitr ? varitr_bytes_read(varitr) : 0;
+		progress_end(progress, i);
 	}
 	if (models)
 		fprintf(stderr,
@@ -2450,6 +2790,10 @@ static void process(faidx_t *fai, const annot_t *annot, models_t *models, varitr
 	else
 		fprintf(stderr, "Lines   total/missing-reference/skipped:\t%d/%d/%d\n", i,
 			n_missing, n_skipped);
+	if (varitr && (flags & VERBOSE))
+		fprintf(stderr, "Lines   total/out-of-order:\t%d/%d\n", i, join.n_hashed);
+	if (flags & VERBOSE)
+		print_throughput(stderr, wall_time() - t_beg, i, nsmpl);
 
 	free(gt_arr);
 	free(baf_arr);
@@ -2483,6 +2827,7 @@ static const char *usage_text(void)
 	       "    -c, --csv <file>              CSV manifest file\n"
 	       "    -f, --fasta-ref <file>        reference sequence in fasta format\n"
 	       "        --set-cache-size <int>    select fasta cache size in bytes\n"
+	       "        --ref-cache <int>         memory in MB used to cache reference sequences [256]\n"
 	       "        --calls <file>            apt-probeset-genotype calls output\n"
 	       "        --confidences <file>      apt-probeset-genotype confidences output\n"
 	       "        --summary <file>          apt-probeset-genotype summary output\n"
@@ -2495,7 +2840,10 @@ static const char *usage_text(void)
 	       "        --no-version              do not append version and command line to the header\n"
 	       "    -o, --output <file>           write output to a file [standard output]\n"
 	       "    -O, --output-type <b|u|z|v>   b: compressed BCF, u: uncompressed BCF, z: compressed VCF, v: uncompressed VCF [v]\n"
-	       "        --threads <int>           number of extra output compression threads [0]\n"
+	       "        --threads <int>           number of extra output compression and parsing threads [0]\n"
+	       "        --prefetch <int>          number of threads reading the CHP files ahead of the conversion [0]\n"
+	       "        --buffer-memory <int>     memory in MB used to read ahead the CHP files [16384 rows per file]\n"
+	       "        --stats <file>            write progress snapshots of the conversion as JSON lines to a file, overwriting it\n"
 	       "    -v, --verbose                 print verbose information\n"
 	       "\n"
 	       "Manifest options:\n"
@@ -2538,10 +2886,14 @@ int run(int argc, char *argv[])
 	const char *pathname = NULL;
 	const char *output_fname = "-";
 	const char *sam_fname = NULL;
+	const char *stats_fname = NULL;
 	int flags = 0;
 	int output_type = FT_VCF;
 	int cache_size = 0;
+	int ref_cache_size = REF_CACHE_SIZE;
 	int n_threads = 0;
+	int n_prefetch = 0;
+	int buffer_memory = 0;
 	int record_cmd_line = 1;
 	int fasta_flank = 0;
 	faidx_t *fai = NULL;
@@ -2549,6 +2901,7 @@ int run(int argc, char *argv[])
 	static struct option loptions[] = {{"csv", required_argument, NULL, 'c'},
 					   {"fasta-ref", required_argument, NULL, 'f'},
 					   {"set-cache-size", required_argument, NULL, 1},
+					   {"ref-cache", required_argument, NULL, 13},
 					   {"calls", required_argument, NULL, 2},
 					   {"confidences", required_argument, NULL, 3},
 					   {"summary", required_argument, NULL, 4},
@@ -2565,6 +2918,9 @@ int run(int argc, char *argv[])
 					   {"verbose", no_argument, NULL, 'v'},
 					   {"fasta-flank", no_argument, NULL, 12},
 					   {"sam-flank", required_argument, NULL, 's'},
+					   {"stats", required_argument, NULL, 14},
+					   {"prefetch", required_argument, NULL, 15},
+					   {"buffer-memory", required_argument, NULL, 16},
 					   {NULL, 0, NULL, 0}};
 	int c;
 	while ((c = getopt_long(argc, argv, "h?c:f:x:o:O:vs:", loptions, NULL)) >= 0) {
@@ -2642,9 +2998,27 @@ int run(int argc, char *argv[])
 		case 12:
 			fasta_flank = 1;
 			break;
+		case 13:
+			ref_cache_size = strtol(optarg, NULL, 0);
+			if (ref_cache_size < 0)
+				error("Invalid reference cache size: --ref-cache %s\n", optarg);
+			break;
 		case 's':
 			sam_fname = optarg;
 			break;
+		case 14:
+			stats_fname = optarg;
+			break;
+		case 15:
+			n_prefetch = strtol(optarg, NULL, 0);
+			if (n_prefetch < 0)
+				error("Invalid number of prefetch threads: --prefetch %s\n", optarg);
+			break;
+		case 16:
+			buffer_memory = strtol(optarg, NULL, 0);
+			if (buffer_memory < 0)
+				error("Invalid buffer memory: --buffer-memory %s\n", optarg);
+			break;
 		case 'h':
 		case '?':
 		default:
@@ -2655,7 +3029,7 @@ int run(int argc, char *argv[])
 	int nfiles = 0;
 	char **filenames = NULL;
 	if (pathname) {
-		filenames = get_file_list(pathname, flags & LOAD_CEL ? "CEL" : "chp", &nfiles);
+		filenames = get_file_list(pathname, flags & LOAD_CEL ? "CEL" : "chp", 0, &nfiles);
 	} else {
 		nfiles = argc - optind;
 		filenames = argv + optind;
@@ -2675,6 +3049,9 @@ int run(int argc, char *argv[])
 			      usage_text());
 		if (sex_fname && !report_fname)
 			error("Expected --report option with --sex option\n%s", usage_text());
+		if (stats_fname && !strcmp(stats_fname, "-") && !strcmp(output_fname, "-"))
+			error("The --stats option can only write to standard output with the --output option\n%s",
+			      usage_text());
 		if (nfiles > 0 && (calls_fname || confidences_fname || summary_fname))
 			error("Cannot load tables --calls, --confidences, --summary if CHP files provided instead\n%s",
 			      usage_text());
@@ -2757,6 +3134,7 @@ int run(int argc, char *argv[])
 			error("Could not load the reference %s\n", ref_fname);
 		if (cache_size)
 			fai_set_cache_size(fai, cache_size);
+		ref_cache_t *ref = ref_cache_init(fai, (size_t)ref_cache_size << 20);
 		if (models_fname)
 			fprintf(stderr, "Reading SNP file %s\n", models_fname);
 		models_t *models = models_fname ? models_init(models_fname) : NULL;
@@ -2779,22 +3157,42 @@ int run(int argc, char *argv[])
 		htsFile *out_fh = hts_open(output_fname, hts_bcf_wmode(output_type));
 		if (out_fh == NULL)
 			error("Can't write to \"%s\": %s\n", output_fname, strerror(errno));
-		if (n_threads)
-			hts_set_threads(out_fh, n_threads);
+		htsThreadPool tpool = {NULL, 0};
+		if (n_threads) {
+			tpool.pool = hts_tpool_init(n_threads);
+			if (!tpool.pool)
+				error("Failed to create thread pool with %d threads\n", n_threads);
+			hts_set_thread_pool(out_fh, &tpool);
+		}
+		prefetch_t *prefetch = n_prefetch && nfiles > 0 ? prefetch_init(n_prefetch) : NULL;
 		varitr_t *varitr = NULL;
 		if (nfiles > 0)
-			varitr = varitr_init_cc(hdr, (agcc_t **)files, nfiles);
+			varitr = varitr_init_cc(hdr, (agcc_t **)files, nfiles, prefetch,
+						(size_t)buffer_memory << 20);
 		else if (calls_fname || confidences_fname || summary_fname)
 			varitr = varitr_init_txt(hdr, calls_fname, confidences_fname,
-						 summary_fname);
-		process(fai, annot, models, varitr, out_fh, hdr, flags);
+						 summary_fname, tpool.pool);
+		progress_t *progress =
+			stats_fname ? progress_init(get_file_handle(stats_fname), ref) : NULL;
+		if (progress)
+			progress->prefetch = prefetch;
+		process(ref, annot, models, varitr, out_fh, hdr, progress, flags);
+		progress_destroy(progress);
+		if (flags & VERBOSE)
+			ref_cache_print_stats(ref, stderr);
+		if ((flags & VERBOSE) && prefetch)
+			prefetch_print_stats(prefetch, stderr);
 		if (varitr)
 			varitr_destroy(varitr);
+		prefetch_destroy(prefetch);
 		if (models)
 			models_destroy(models);
+		ref_cache_destroy(ref);
 		fai_destroy(fai);
 		bcf_hdr_destroy(hdr);
 		hts_close(out_fh);
+		if (tpool.pool)
+			hts_tpool_destroy(tpool.pool);
 		annot_destroy(annot);
 	}
 
@@ -27,11 +27,20 @@
 #include <getopt.h>
 #include <errno.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <htslib/hfile.h>
+#include <htslib/bgzf.h>
 #include <htslib/faidx.h>
 #include <htslib/vcf.h>
 #include <htslib/kseq.h>
 #include <htslib/sam.h>
+#include <htslib/thread_pool.h>
+#include <htslib/regidx.h>
+#include <htslib/khash_str2int.h>
 #include "bcftools.h"
 #include "tsv2vcf.h"
 #include "gtc2vcf.h"
@@ -60,38 +69,41 @@
 #define FORMAT_THETA (1 << 14)
 #define FORMAT_X (1 << 15)
 #define FORMAT_Y (1 << 16)
+#define SORT_OUTPUT (1 << 17)
+#define WRITE_INDEX (1 << 18)
+#define CLUSTER_STATS (1 << 19)
 
 /****************************************
- * hFILE READING FUNCTIONS              *
+ * BGZF READING FUNCTIONS               *
  ****************************************/
 
-// tests the end-of-file indicator for an hFILE
-static inline int heof(hFILE *fp)
+// input files are read through BGZF so that uncompressed and compressed files share the same
+// code, while only BGZF compressed files with a .gzi index can be sought
+
+// tests the end-of-file indicator for a BGZF stream
+static inline int heof(BGZF *fp)
 {
-	if (hgetc(fp) == EOF)
-		return 1;
-	fp->begin--;
-	return 0;
+	return bgzf_peek(fp) < 0;
 }
 
 // read or skip a fixed number of bytes
-static inline void read_bytes(hFILE *fp, void *buffer, size_t nbytes)
+static inline void read_bytes(BGZF *fp, void *buffer, size_t nbytes)
 {
 	if (buffer) {
-		if (hread(fp, buffer, nbytes) < nbytes) {
+		if (bgzf_read(fp, buffer, nbytes) < nbytes) {
 			error("Failed to read %ld bytes from stream\n", nbytes);
 		}
 	} else {
 		int c = 0;
 		for (int i = 0; i < nbytes; i++)
-			c = hgetc(fp);
-		if (c == EOF)
+			c = bgzf_getc(fp);
+		if (c < 0)
 			error("Failed to reposition stream forward %ld bytes\n", nbytes);
 	}
 }
 
 // read or skip a fixed length array
-static inline void read_array(hFILE *fp, void **arr, size_t *m_arr, size_t nmemb, size_t size,
+static inline void read_array(BGZF *fp, void **arr, size_t *m_arr, size_t nmemb, size_t size,
 			      size_t term)
 {
 	if (arr) {
@@ -106,23 +118,23 @@ static inline void read_array(hFILE *fp, void **arr, size_t *m_arr, size_t nmemb
 			*arr = tmp;
 			*m_arr = nmemb + term;
 		}
-		if (hread(fp, *arr, nmemb * size) < nmemb * size) {
+		if (bgzf_read(fp, *arr, nmemb * size) < nmemb * size) {
 			error("Failed to read %ld bytes from stream\n", nmemb * size);
 		}
 	} else {
 		int c = 0;
 		for (int i = 0; i < nmemb * size; i++)
-			c = hgetc(fp);
-		if (c == EOF)
+			c = bgzf_getc(fp);
+		if (c < 0)
 			error("Failed to reposition stream forward %ld bytes\n", nmemb * size);
 	}
 }
 
 // read or skip a length-prefixed array
-static inline void read_pfx_array(hFILE *fp, void **arr, size_t *m_arr, size_t item_size)
+static inline void read_pfx_array(BGZF *fp, void **arr, size_t *m_arr, size_t item_size)
 {
 	int32_t n;
-	if (hread(fp, (void *)&n, 4) < 4) {
+	if (bgzf_read(fp, (void *)&n, 4) < 4) {
 		error("Failed to read 4 bytes from stream\n");
 	}
 	read_array(fp, arr, m_arr, n, item_size, 0);
@@ -130,12 +142,12 @@ static inline void read_pfx_array(hFILE *fp, void **arr, size_t *m_arr, size_t i
 
 // read or skip a length-prefixed string
 // http://en.wikipedia.org/wiki/LEB128#Decode_unsigned_integer
-static inline void read_pfx_string(hFILE *fp, char **str, size_t *m_str)
+static inline void read_pfx_string(BGZF *fp, char **str, size_t *m_str)
 {
 	uint8_t byte;
 	size_t n = 0, shift = 0;
 	while (1) {
-		if (hread(fp, (void *)&byte, 1) < 1) {
+		if (bgzf_read(fp, (void *)&byte, 1) < 1) {
 			error("Failed to read 1 byte from stream\n");
 		}
 		n |= (size_t)(byte & 0x7F) << shift;
@@ -150,66 +162,434 @@ static inline void read_pfx_string(hFILE *fp, char **str, size_t *m_str)
 	}
 }
 
-static inline int is_gzip(hFILE *fp)
+// read a length-prefixed string into the arena or return NULL if it is empty
+static inline char *read_pfx_string_arena(BGZF *fp, arena_t *arena)
+{
+	uint8_t byte;
+	size_t n = 0, shift = 0;
+	while (1) {
+		if (bgzf_read(fp, (void *)&byte, 1) < 1) {
+			error("Failed to read 1 byte from stream\n");
+		}
+		n |= (size_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			break;
+		shift += 7;
+	}
+	if (!n)
+		return NULL;
+	char *str = (char *)arena_alloc(arena, n + 1);
+	if (bgzf_read(fp, (void *)str, n) < n)
+		error("Failed to read %ld bytes from stream\n", n);
+	str[n] = '\0';
+	return str;
+}
+
+// fgets() style reader so that kgetline() can read lines from a BGZF stream
+static char *bgzf_gets(char *buf, int size, void *fp)
+{
+	int i = 0, c = 0;
+	while (i < size - 1 && (c = bgzf_getc((BGZF *)fp)) >= 0) {
+		buf[i++] = (char)c;
+		if (c == '\n')
+			break;
+	}
+	if (i == 0 || c < -1)
+		return NULL;
+	buf[i] = '\0';
+	return buf;
+}
+
+// open a file for reading, files that need to be sought can be uncompressed or BGZF compressed
+// with a .gzi index as written by the --recompress option or by bgzip -i
+static BGZF *bgzf_open_input(const char *fn, int seekable)
+{
+	BGZF *fp = bgzf_open(fn, "r");
+	if (fp == NULL)
+		error("Could not open %s: %s\n", fn, strerror(errno));
+	if (!seekable)
+		return fp;
+	if (bgzf_compression(fp) == gzip)
+		error("File %s is gzip compressed and cannot be sought, use the --recompress option to compress it with BGZF\n",
+		      fn);
+	if (bgzf_compression(fp) == bgzf && bgzf_index_load(fp, fn, ".gzi") < 0)
+		error("Could not load the index %s.gzi, use the --recompress option or bgzip -i to build it\n",
+		      fn);
+	return fp;
+}
+
+static int bgzf_is_indexed(const char *fn)
+{
+	BGZF *fp = bgzf_open(fn, "r");
+	if (fp == NULL)
+		return 0;
+	int ret = bgzf_compression(fp) == bgzf && bgzf_index_load(fp, fn, ".gzi") == 0;
+	if (bgzf_close(fp) < 0)
+		error("Error closing %s\n", fn);
+	return ret;
+}
+
+// compress a file with BGZF next to a .gzi index so that it can be sought, files already
+// compressed are replaced by their BGZF version, and files already compressed with BGZF and
+// indexed, possibly by a previous run, are left untouched
+static void recompress_file(const char *fn, hts_tpool *pool)
+{
+	int is_gz = gz_suffix_len(fn) > 0;
+	kstring_t str = {0, 0, NULL};
+	ksprintf(&str, is_gz ? "%s.tmp" : "%s.gz", fn);
+	const char *out_fn = is_gz ? fn : str.s;
+	if (bgzf_is_indexed(out_fn)) {
+		fprintf(stderr, "Skipping %s as %s and %s.gzi are already written\n", fn, out_fn,
+			out_fn);
+		free(str.s);
+		return;
+	}
+	BGZF *in = bgzf_open_input(fn, 0);
+	BGZF *out = bgzf_open(str.s, "w");
+	if (!out)
+		error("Failed to open %s: %s\n", str.s, strerror(errno));
+	if (pool && bgzf_thread_pool(out, pool, 0) < 0)
+		error("Failed to use the thread pool for %s\n", str.s);
+	if (bgzf_index_build_init(out) < 0)
+		error("Failed to initialize the index of %s\n", str.s);
+	char buffer[BGZF_BLOCK_SIZE];
+	ssize_t len;
+	while ((len = bgzf_read(in, buffer, BGZF_BLOCK_SIZE)) > 0)
+		if (bgzf_write(out, buffer, len) != len)
+			error("Failed to write to %s\n", str.s);
+	if (len < 0)
+		error("Failed to read from %s\n", fn);
+	if (bgzf_close(in) < 0)
+		error("Error closing %s\n", fn);
+	if (bgzf_flush(out) < 0 || bgzf_index_dump(out, out_fn, ".gzi") < 0)
+		error("Failed to write the index of %s\n", out_fn);
+	if (bgzf_close(out) < 0)
+		error("Error closing %s\n", str.s);
+	if (is_gz && rename(str.s, fn) < 0)
+		error("Failed to rename %s to %s: %s\n", str.s, fn, strerror(errno));
+	fprintf(stderr, "Writing %s and %s.gzi\n", out_fn, out_fn);
+	free(str.s);
+}
+
+/****************************************
+ * FILE HANDLES POOL                    *
+ ****************************************/
+
+// input files can be transparently closed and reopened so that no more than a given number of
+// file descriptors are in use at once, handles not in use are kept in a least recently used list
+// and uncompressed local files are also memory mapped so that arrays can be read in place
+typedef struct file_handle_t {
+	char *fn;
+	BGZF *fp;
+	pthread_mutex_t lock; // held while the stream is sought and read
+	char *map;
+	size_t map_size;
+	int n_users;
+	int n_opens;
+	struct file_handle_t *prev;
+	struct file_handle_t *next;
+} file_handle_t;
+
+// the limit is a soft cap, as a file is still opened when all open handles are in use, which
+// does not happen as long as the limit is at least the number of threads holding one file each
+static struct {
+	int n_open;
+	int max_open; // 0 means no limit
+	int n_reopened;
+	int n_peak; // most files open at once
+	file_handle_t *head;
+	file_handle_t *tail;
+	pthread_mutex_t lock;
+} file_handles = {0, 0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER};
+
+static void file_handles_unlink(file_handle_t *handle)
+{
+	if (handle->prev)
+		handle->prev->next = handle->next;
+	else if (file_handles.head == handle)
+		file_handles.head = handle->next;
+	if (handle->next)
+		handle->next->prev = handle->prev;
+	else if (file_handles.tail == handle)
+		file_handles.tail = handle->prev;
+	handle->prev = handle->next = NULL;
+}
+
+// close the least recently used handles until a new file can be opened, or until no handle is
+// left that is not in use
+static void file_handles_evict(void)
+{
+	while (file_handles.max_open > 0 && file_handles.n_open >= file_handles.max_open
+	       && file_handles.tail) {
+		file_handle_t *handle = file_handles.tail;
+		file_handles_unlink(handle);
+		if (bgzf_close(handle->fp) < 0)
+			error("Error closing file %s\n", handle->fn);
+		handle->fp = NULL;
+		file_handles.n_open--;
+	}
+}
+
+// return an open stream for the handle which stays open until released
+static BGZF *file_handle_acquire(file_handle_t *handle)
+{
+	pthread_mutex_lock(&file_handles.lock);
+	if (handle->fp) {
+		if (handle->n_users == 0)
+			file_handles_unlink(handle);
+	} else {
+		file_handles_evict();
+		handle->fp = bgzf_open_input(handle->fn, 1);
+		if (handle->n_opens++ > 0)
+			file_handles.n_reopened++;
+		if (++file_handles.n_open > file_handles.n_peak)
+			file_handles.n_peak = file_handles.n_open;
+	}
+	handle->n_users++;
+	pthread_mutex_unlock(&file_handles.lock);
+	return handle->fp;
+}
+
+static void file_handle_release(file_handle_t *handle)
+{
+	pthread_mutex_lock(&file_handles.lock);
+	if (--handle->n_users == 0 && handle->map) {
+		// mapped files do not need the file descriptor anymore
+		if (bgzf_close(handle->fp) < 0)
+			error("Error closing file %s\n", handle->fn);
+		handle->fp = NULL;
+		file_handles.n_open--;
+	} else if (handle->n_users == 0) {
+		handle->prev = NULL;
+		handle->next = file_handles.head;
+		if (file_handles.head)
+			file_handles.head->prev = handle;
+		file_handles.head = handle;
+		if (!file_handles.tail)
+			file_handles.tail = handle;
+	}
+	pthread_mutex_unlock(&file_handles.lock);
+}
+
+// on failure or for compressed files the file is silently accessed through BGZF instead
+static void file_handle_map(file_handle_t *handle)
+{
+	if (strcmp(handle->fn, "-") == 0 || hisremote(handle->fn))
+		return;
+	int fd = open(handle->fn, O_RDONLY);
+	if (fd < 0)
+		return;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED && st.st_size >= 2 && ((uint8_t *)map)[0] == 0x1f
+		    && ((uint8_t *)map)[1] == 0x8b) {
+			munmap(map, st.st_size);
+		} else if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			handle->map = (char *)map;
+			handle->map_size = st.st_size;
+		}
+	}
+	close(fd);
+}
+
+static file_handle_t *file_handle_init(const char *fn)
+{
+	file_handle_t *handle = (file_handle_t *)calloc(1, sizeof(file_handle_t));
+	handle->fn = strdup(fn);
+	pthread_mutex_init(&handle->lock, NULL);
+	file_handle_map(handle);
+	return handle;
+}
+
+static void file_handle_destroy(file_handle_t *handle)
 {
-	uint8_t buffer[2];
-	if (hpeek(fp, (void *)buffer, 2) < 2) {
-		error("Failed to read 2 bytes from stream\n");
+	if (!handle)
+		return;
+	pthread_mutex_lock(&file_handles.lock);
+	if (handle->fp) {
+		if (handle->n_users == 0)
+			file_handles_unlink(handle);
+		if (bgzf_close(handle->fp) < 0)
+			error("Error closing file %s\n", handle->fn);
+		file_handles.n_open--;
 	}
-	return (buffer[0] == 0x1f && buffer[1] == 0x8b);
+	pthread_mutex_unlock(&file_handles.lock);
+	if (handle->map)
+		munmap((void *)handle->map, handle->map_size);
+	pthread_mutex_destroy(&handle->lock);
+	free(handle->fn);
+	free(handle);
 }
 
 /****************************************
  * BUFFER ARRAY IMPLEMENTATION          *
  ****************************************/
 
+// default number of elements buffered for each array
+#define BUFFER_CAPACITY 32768
+
+// when set the window following the one in use is read ahead for arrays that are not mapped
+static prefetch_t *buffer_prefetch = NULL;
+
 typedef struct {
-	hFILE *fp;
+	file_handle_t *handle;
 	off_t offset;
 	int32_t item_num;
 	int32_t item_offset;
 	size_t item_capacity;
+	size_t item_filled; // number of elements currently in the buffer
 	size_t item_size;
 	char *buffer;
+	int is_mapped; // whether buffer points to the whole array in the file mapping
+	int is_staged; // whether the array holds the selected elements in output order
+	uint64_t n_refills, n_bytes; // reads from the file, or from the mapping if mapped
+	char *ahead;		     // window read ahead when prefetching
+	size_t ahead_offset;
+	size_t ahead_filled;
+	prefetch_slot_t slot;
 } buffer_array_t;
 
-static buffer_array_t *buffer_array_init(hFILE *fp, size_t capacity, size_t item_size)
+// read a window of the array, also called by the I/O threads when prefetching
+static int buffer_array_read(void *data, char *buf, int64_t off, size_t len)
+{
+	buffer_array_t *arr = (buffer_array_t *)data;
+	pthread_mutex_lock(&arr->handle->lock);
+	BGZF *fp = file_handle_acquire(arr->handle);
+	int ret = bgzf_useek(fp, off, SEEK_SET) < 0 || bgzf_read(fp, buf, len) < (ssize_t)len
+			  ? -1
+			  : 0;
+	file_handle_release(arr->handle);
+	pthread_mutex_unlock(&arr->handle->lock);
+	return ret;
+}
+
+// the file handle must be acquired and positioned at the beginning of the array
+static buffer_array_t *buffer_array_init(file_handle_t *handle, size_t capacity,
+					 size_t item_size)
 {
 	buffer_array_t *arr = (buffer_array_t *)malloc(1 * sizeof(buffer_array_t));
-	arr->fp = fp;
+	arr->handle = handle;
+	BGZF *fp = handle->fp;
 	read_bytes(fp, (void *)&arr->item_num, sizeof(int32_t));
-	arr->offset = htell(arr->fp);
+	arr->offset = bgzf_utell(fp);
 	arr->item_offset = 0;
-	arr->item_capacity = (capacity <= 0) ? 32768 : capacity;
 	arr->item_size = item_size;
+	arr->ahead = NULL;
+	arr->is_staged = 0;
+	prefetch_slot_init(&arr->slot, handle->map ? NULL : buffer_prefetch, buffer_array_read,
+			   (void *)arr);
+	if (handle->map) {
+		if (arr->item_num < 0
+		    || arr->offset + (size_t)arr->item_num * item_size > handle->map_size)
+			error("File %s is truncated\n", handle->fn);
+		arr->item_capacity = arr->item_num;
+		arr->item_filled = arr->item_num;
+		arr->buffer = handle->map + arr->offset;
+		arr->is_mapped = 1;
+		arr->n_refills = arr->n_bytes = 0;
+		return arr;
+	}
+	arr->item_capacity = (capacity <= 0) ? BUFFER_CAPACITY : capacity;
 	arr->buffer = (char *)malloc(arr->item_capacity * item_size);
-	read_bytes(fp, (void *)arr->buffer,
-		   (arr->item_num < arr->item_capacity ? arr->item_num : arr->item_capacity)
-			   * item_size);
+	arr->is_mapped = 0;
+	arr->item_filled =
+		arr->item_num < arr->item_capacity ? arr->item_num : arr->item_capacity;
+	read_bytes(fp, (void *)arr->buffer, arr->item_filled * item_size);
+	arr->n_refills = 0;
+	arr->n_bytes = arr->item_filled * item_size;
 	return arr;
 }
 
+// an array held in memory rather than read from a file, which takes ownership of the buffer
+static buffer_array_t *buffer_array_wrap(void *buffer, int32_t item_num, size_t item_size)
+{
+	buffer_array_t *arr = (buffer_array_t *)calloc(1, sizeof(buffer_array_t));
+	arr->item_num = item_num;
+	arr->item_capacity = item_num;
+	arr->item_filled = item_num;
+	arr->item_size = item_size;
+	arr->buffer = (char *)buffer;
+	return arr;
+}
+
+// refill the buffer with up to n_items elements starting from a given element
+static void buffer_array_fill(buffer_array_t *arr, size_t item_idx, size_t n_items)
+{
+	prefetch_t *prefetch = arr->slot.prefetch;
+	if (prefetch && prefetch_wait(&arr->slot) == PREFETCH_DONE && item_idx >= arr->ahead_offset
+	    && item_idx < arr->ahead_offset + arr->ahead_filled) {
+		// the window read ahead covers the element
+		char *tmp = arr->buffer;
+		arr->buffer = arr->ahead;
+		arr->ahead = tmp;
+		arr->item_offset = arr->ahead_offset;
+		arr->item_filled = arr->ahead_filled;
+		prefetch_used(prefetch, arr->item_filled * arr->item_size);
+	} else {
+		arr->item_offset = item_idx;
+		arr->item_filled =
+			min(min(n_items, arr->item_capacity), arr->item_num - item_idx);
+		if (buffer_array_read((void *)arr, arr->buffer,
+				      arr->offset + item_idx * arr->item_size,
+				      arr->item_filled * arr->item_size)
+		    < 0)
+			error("Failed to read %ld bytes at position %ld in file %s\n",
+			      arr->item_filled * arr->item_size,
+			      arr->offset + item_idx * arr->item_size, arr->handle->fn);
+	}
+	arr->n_refills++;
+	arr->n_bytes += arr->item_filled * arr->item_size;
+
+	// read the following window while this one is used
+	size_t next = arr->item_offset + arr->item_filled;
+	if (prefetch && next < arr->item_num) {
+		if (!arr->ahead)
+			arr->ahead = (char *)malloc(arr->item_capacity * arr->item_size);
+		arr->ahead_offset = next;
+		arr->ahead_filled = min(arr->item_capacity, arr->item_num - next);
+		prefetch_issue(&arr->slot, arr->ahead, arr->offset + next * arr->item_size,
+			       arr->ahead_filled * arr->item_size);
+	}
+}
+
 static inline int get_element(buffer_array_t *arr, void *dst, size_t item_idx)
 {
 	if (!arr || item_idx >= arr->item_num) {
 		return -1;
-	} else if (item_idx - arr->item_offset < arr->item_capacity) {
+	} else if (item_idx - arr->item_offset < arr->item_filled) {
 		memcpy(dst,
 		       (void *)(arr->buffer + (item_idx - arr->item_offset) * arr->item_size),
 		       arr->item_size);
 		return 0;
 	}
-	arr->item_offset = item_idx;
-	if (hseek(arr->fp, arr->offset + item_idx * arr->item_size, SEEK_SET) < 0) {
-		error("Fail to seek to position %ld in file\n",
-		      arr->offset + item_idx * arr->item_size);
-	}
-	read_bytes(arr->fp, (void *)arr->buffer,
-		   ((arr->item_num - arr->item_offset) < arr->item_capacity
-			    ? (arr->item_num - arr->item_offset)
-			    : arr->item_capacity)
-			   * arr->item_size);
-	memcpy(dst, (void *)arr->buffer, arr->item_size);
+	buffer_array_fill(arr, item_idx, arr->item_capacity);
+	memcpy(dst, (void *)(arr->buffer + (item_idx - arr->item_offset) * arr->item_size),
+	       arr->item_size);
+	return 0;
+}
+
+// copy a run of consecutive elements refilling the buffer as few times as possible
+static int get_elements(buffer_array_t *arr, void *dst, size_t item_idx, size_t n_items)
+{
+	if (!arr || item_idx + n_items > arr->item_num)
+		return -1;
+	char *ptr = (char *)dst;
+	while (n_items > 0) {
+		if (item_idx < arr->item_offset
+		    || item_idx - arr->item_offset >= arr->item_filled)
+			buffer_array_fill(arr, item_idx, arr->item_capacity);
+		size_t n = arr->item_offset + arr->item_filled - item_idx;
+		if (n > n_items)
+			n = n_items;
+		memcpy((void *)ptr,
+		       (void *)(arr->buffer + (item_idx - arr->item_offset) * arr->item_size),
+		       n * arr->item_size);
+		ptr += n * arr->item_size;
+		item_idx += n;
+		n_items -= n;
+	}
 	return 0;
 }
 
@@ -217,7 +597,11 @@ static void buffer_array_destroy(buffer_array_t *arr)
 {
 	if (!arr)
 		return;
-	free(arr->buffer);
+	if (arr->slot.prefetch)
+		prefetch_wait(&arr->slot);
+	if (!arr->is_mapped)
+		free(arr->buffer);
+	free(arr->ahead);
 	free(arr);
 }
 
@@ -300,37 +684,37 @@ static uint8_t get_assay_type(const char *allele_a_probe_seq, const char *allele
 	error("Unable to retrieve assay type: %s %s\n", allele_a_probe_seq, source_seq);
 }
 
-static void locusentry_read(LocusEntry *locus_entry, hFILE *fp)
+static void locusentry_read(LocusEntry *locus_entry, BGZF *fp, arena_t *arena)
 {
 	locus_entry->norm_id = 0xFF;
 	read_bytes(fp, (void *)&locus_entry->version, sizeof(int32_t));
 	if (locus_entry->version < 4 || locus_entry->version == 5 || locus_entry->version > 8)
 		error("Locus version %d in manifest file not supported\n",
 		      locus_entry->version);
-	read_pfx_string(fp, &locus_entry->ilmn_id, NULL);
-	read_pfx_string(fp, &locus_entry->name, NULL);
+	locus_entry->ilmn_id = read_pfx_string_arena(fp, arena);
+	locus_entry->name = read_pfx_string_arena(fp, arena);
 	read_pfx_string(fp, NULL, NULL);
 	read_pfx_string(fp, NULL, NULL);
 	read_pfx_string(fp, NULL, NULL);
 	read_bytes(fp, (void *)&locus_entry->index, sizeof(int32_t));
 	read_pfx_string(fp, NULL, NULL);
-	read_pfx_string(fp, &locus_entry->ilmn_strand, NULL);
-	read_pfx_string(fp, &locus_entry->snp, NULL);
-	read_pfx_string(fp, &locus_entry->chrom, NULL);
-	read_pfx_string(fp, &locus_entry->ploidy, NULL);
-	read_pfx_string(fp, &locus_entry->species, NULL);
-	read_pfx_string(fp, &locus_entry->map_info, NULL);
-	read_pfx_string(fp, &locus_entry->top_genomic_seq, NULL); // only version 4
-	read_pfx_string(fp, &locus_entry->customer_strand, NULL);
+	locus_entry->ilmn_strand = read_pfx_string_arena(fp, arena);
+	locus_entry->snp = read_pfx_string_arena(fp, arena);
+	locus_entry->chrom = read_pfx_string_arena(fp, arena);
+	locus_entry->ploidy = read_pfx_string_arena(fp, arena);
+	locus_entry->species = read_pfx_string_arena(fp, arena);
+	locus_entry->map_info = read_pfx_string_arena(fp, arena);
+	locus_entry->top_genomic_seq = read_pfx_string_arena(fp, arena); // only version 4
+	locus_entry->customer_strand = read_pfx_string_arena(fp, arena);
 	read_bytes(fp, (void *)&locus_entry->address_a, sizeof(int32_t));
 	read_bytes(fp, (void *)&locus_entry->address_b, sizeof(int32_t));
-	read_pfx_string(fp, &locus_entry->allele_a_probe_seq, NULL); // only version 4
-	read_pfx_string(fp, &locus_entry->allele_b_probe_seq, NULL); // only version 4
-	read_pfx_string(fp, &locus_entry->genome_build, NULL);
-	read_pfx_string(fp, &locus_entry->source, NULL);
-	read_pfx_string(fp, &locus_entry->source_version, NULL);
-	read_pfx_string(fp, &locus_entry->source_strand, NULL);
-	read_pfx_string(fp, &locus_entry->source_seq, NULL); // only version 4
+	locus_entry->allele_a_probe_seq = read_pfx_string_arena(fp, arena); // only version 4
+	locus_entry->allele_b_probe_seq = read_pfx_string_arena(fp, arena); // only version 4
+	locus_entry->genome_build = read_pfx_string_arena(fp, arena);
+	locus_entry->source = read_pfx_string_arena(fp, arena);
+	locus_entry->source_version = read_pfx_string_arena(fp, arena);
+	locus_entry->source_strand = read_pfx_string_arena(fp, arena);
+	locus_entry->source_seq = read_pfx_string_arena(fp, arena); // only version 4
 	if (locus_entry->source_seq) {
 		char *ptr = strchr(locus_entry->source_seq, '-');
 		if (ptr && *(ptr - 1) == '/') {
@@ -364,12 +748,22 @@ static void locusentry_read(LocusEntry *locus_entry, hFILE *fp)
 		read_bytes(fp, &locus_entry->frac_g, sizeof(float));
 	}
 	if (locus_entry->version >= 8)
-		read_pfx_string(fp, &locus_entry->ref_strand, NULL);
+		locus_entry->ref_strand = read_pfx_string_arena(fp, arena);
 }
 
+// fields read for every locus and sample packed together, while the locus entries and cluster
+// records are only read once per locus for the text and INFO fields, the coordinates and the
+// alleles resolved against the reference are kept with the marker sites
+typedef struct {
+	uint8_t norm_lookup;		// transform index or 0xFF if unavailable
+	int8_t strand;			// RefStrand with 0 for +, 1 for -, and -1 if unknown
+	char allele_a, allele_b;	// SNP alleles on the design strand
+	float theta_mean[3], r_mean[3]; // AA, AB, and BB cluster centers
+} locus_t;
+
 typedef struct {
 	char *fn;
-	hFILE *fp;
+	BGZF *fp;
 	int32_t version;
 	char *manifest_name;  // Name of manifest
 	char *control_config; // Control description from manifest
@@ -381,6 +775,8 @@ typedef struct {
 	uint8_t *norm_lookups;
 	char **header;
 	size_t m_header;
+	arena_t arena; // names and strings of the locus entries
+	locus_t *loci; // built by bpm_loci_init()
 } bpm_t;
 
 static uint8_t *bpm_norm_lookups(bpm_t *bpm)
@@ -407,14 +803,10 @@ static bpm_t *bpm_init(const char *fn)
 {
 	bpm_t *bpm = (bpm_t *)calloc(1, sizeof(bpm_t));
 	bpm->fn = strdup(fn);
-	bpm->fp = hopen(bpm->fn, "rb");
-	if (bpm->fp == NULL)
-		error("Could not open %s: %s\n", bpm->fn, strerror(errno));
-	if (is_gzip(bpm->fp))
-		error("File %s is gzip compressed and currently cannot be sought\n", bpm->fn);
+	bpm->fp = bgzf_open_input(bpm->fn, 0);
 
 	uint8_t buffer[4];
-	if (hread(bpm->fp, (void *)buffer, 4) < 4)
+	if (bgzf_read(bpm->fp, (void *)buffer, 4) < 4)
 		error("Failed to read magic number from %s file\n", bpm->fn);
 	if (memcmp(buffer, "BPM", 3) != 0)
 		error("BPM file %s format identifier is bad\n", bpm->fn);
@@ -435,14 +827,14 @@ static bpm_t *bpm_init(const char *fn)
 	read_array(bpm->fp, (void **)&bpm->indexes, NULL, bpm->num_loci, sizeof(int32_t), 0);
 	bpm->names = (char **)malloc(bpm->num_loci * sizeof(char *));
 	for (int i = 0; i < bpm->num_loci; i++)
-		read_pfx_string(bpm->fp, &bpm->names[i], NULL);
+		bpm->names[i] = read_pfx_string_arena(bpm->fp, &bpm->arena);
 	read_array(bpm->fp, (void **)&bpm->norm_ids, NULL, bpm->num_loci, sizeof(uint8_t), 0);
 
 	bpm->locus_entries = (LocusEntry *)malloc(bpm->num_loci * sizeof(LocusEntry));
 	LocusEntry locus_entry;
 	for (int i = 0; i < bpm->num_loci; i++) {
 		memset(&locus_entry, 0, sizeof(LocusEntry));
-		locusentry_read(&locus_entry, bpm->fp);
+		locusentry_read(&locus_entry, bpm->fp, &bpm->arena);
 		int idx = locus_entry.index - 1;
 		if (idx < 0 || idx >= bpm->num_loci)
 			error("Locus entry index %d is out of boundaries\n", locus_entry.index);
@@ -471,7 +863,7 @@ static bpm_t *bpm_init(const char *fn)
 
 	if (!heof(bpm->fp))
 		error("BPM reader did not reach the end of file %s at position %ld\n", bpm->fn,
-		      htell(bpm->fp));
+		      bgzf_utell(bpm->fp));
 
 	return bpm;
 }
@@ -481,43 +873,20 @@ static void bpm_destroy(bpm_t *bpm)
 	if (!bpm)
 		return;
 	free(bpm->fn);
-	if (hclose(bpm->fp) < 0)
+	if (bgzf_close(bpm->fp) < 0)
 		error("Error closing BPM file\n");
 	free(bpm->manifest_name);
 	free(bpm->control_config);
 	free(bpm->indexes);
-	if (bpm->names) {
-		for (int i = 0; i < bpm->num_loci; i++)
-			free(bpm->names[i]);
-		free(bpm->names);
-	}
+	free(bpm->names);
 	free(bpm->norm_ids);
-	for (int i = 0; i < bpm->num_loci; i++) {
-		LocusEntry *locus_entry = &bpm->locus_entries[i];
-		free(locus_entry->ilmn_id);
-		free(locus_entry->name);
-		free(locus_entry->ilmn_strand);
-		free(locus_entry->snp);
-		free(locus_entry->chrom);
-		free(locus_entry->ploidy);
-		free(locus_entry->species);
-		free(locus_entry->map_info);
-		free(locus_entry->customer_strand);
-		free(locus_entry->allele_a_probe_seq);
-		free(locus_entry->allele_b_probe_seq);
-		free(locus_entry->genome_build);
-		free(locus_entry->source);
-		free(locus_entry->source_version);
-		free(locus_entry->source_strand);
-		free(locus_entry->source_seq);
-		free(locus_entry->top_genomic_seq);
-		free(locus_entry->ref_strand);
-	}
 	free(bpm->locus_entries);
 	free(bpm->norm_lookups);
 	for (int i = 0; i < bpm->m_header; i++)
 		free(bpm->header[i]);
 	free(bpm->header);
+	free(bpm->loci);
+	arena_destroy(&bpm->arena);
 	free(bpm);
 }
 
@@ -633,17 +1002,19 @@ static int tsv_read_float(tsv_t *tsv, bcf1_t *rec, void *usr)
 	return 0;
 }
 
+// string columns are copied into an arena
+typedef struct {
+	arena_t *arena;
+	char **str;
+} tsv_string_t;
+
 static int tsv_read_string(tsv_t *tsv, bcf1_t *rec, void *usr)
 {
-	char **str = (char **)usr;
-	if (tsv->se == tsv->ss) {
-		*str = NULL;
-	} else {
-		char tmp = *tsv->se;
-		*tsv->se = 0;
-		*str = strdup(tsv->ss);
-		*tsv->se = tmp;
-	}
+	tsv_string_t *string = (tsv_string_t *)usr;
+	if (tsv->se == tsv->ss)
+		*string->str = NULL;
+	else
+		*string->str = arena_strndup(string->arena, tsv->ss, tsv->se - tsv->ss);
 	return 0;
 }
 
@@ -670,89 +1041,55 @@ static int csv_parse(tsv_t *tsv, bcf1_t *rec, char *str)
 	return status ? 0 : -1;
 }
 
+// strings of both entries are owned by the arena of the manifest
 static void locus_merge(LocusEntry *dest, LocusEntry *src)
 {
 	if (src->version)
 		dest->version = src->version;
 	if (src->norm_id != 0xFF)
 		dest->norm_id = src->norm_id;
-	if (strcmp(dest->ilmn_id, src->ilmn_id)) {
+	if (strcmp(dest->ilmn_id, src->ilmn_id))
 		error("BPM and CSV manifests have conflicting IDs: %s and %s\n", dest->ilmn_id,
 		      src->ilmn_id);
-	} else {
-		free(dest->ilmn_id);
-		dest->ilmn_id = src->ilmn_id;
-	}
-	if (src->name) {
-		free(dest->name);
+	dest->ilmn_id = src->ilmn_id;
+	if (src->name)
 		dest->name = src->name;
-	}
 	if (src->index != 0)
 		dest->index = src->index;
-	if (src->ilmn_strand) {
-		free(dest->ilmn_strand);
+	if (src->ilmn_strand)
 		dest->ilmn_strand = src->ilmn_strand;
-	}
-	if (src->snp) {
-		free(dest->snp);
+	if (src->snp)
 		dest->snp = src->snp;
-	}
-	if (src->chrom) {
-		free(dest->chrom);
+	if (src->chrom)
 		dest->chrom = src->chrom;
-	}
-	if (src->ploidy) {
-		free(dest->ploidy);
+	if (src->ploidy)
 		dest->ploidy = src->ploidy;
-	}
-	if (src->species) {
-		free(dest->species);
+	if (src->species)
 		dest->species = src->species;
-	}
-	if (src->map_info) {
-		free(dest->map_info);
+	if (src->map_info)
 		dest->map_info = src->map_info;
-	}
-	if (src->customer_strand) {
-		free(dest->customer_strand);
+	if (src->customer_strand)
 		dest->customer_strand = src->customer_strand;
-	}
 	if (src->address_a != 0)
 		dest->address_a = src->address_a;
-	if (src->allele_a_probe_seq) {
-		free(dest->allele_a_probe_seq);
+	if (src->allele_a_probe_seq)
 		dest->allele_a_probe_seq = src->allele_a_probe_seq;
-	}
 	if (src->address_b != 0)
 		dest->address_b = src->address_b;
-	if (src->allele_b_probe_seq) {
-		free(dest->allele_b_probe_seq);
+	if (src->allele_b_probe_seq)
 		dest->allele_b_probe_seq = src->allele_b_probe_seq;
-	}
-	if (src->genome_build) {
-		free(dest->genome_build);
+	if (src->genome_build)
 		dest->genome_build = src->genome_build;
-	}
-	if (src->source) {
-		free(dest->source);
+	if (src->source)
 		dest->source = src->source;
-	}
-	if (src->source_version) {
-		free(dest->source_version);
+	if (src->source_version)
 		dest->source_version = src->source_version;
-	}
-	if (src->source_strand) {
-		free(dest->source_strand);
+	if (src->source_strand)
 		dest->source_strand = src->source_strand;
-	}
-	if (src->source_seq) {
-		free(dest->source_seq);
+	if (src->source_seq)
 		dest->source_seq = src->source_seq;
-	}
-	if (src->top_genomic_seq) {
-		free(dest->top_genomic_seq);
+	if (src->top_genomic_seq)
 		dest->top_genomic_seq = src->top_genomic_seq;
-	}
 	if (src->beadset_id)
 		dest->beadset_id = src->beadset_id;
 	if (src->exp_clusters)
@@ -769,10 +1106,8 @@ static void locus_merge(LocusEntry *dest, LocusEntry *src)
 		dest->frac_g = src->frac_g;
 	if (src->frac_t)
 		dest->frac_t = src->frac_t;
-	if (src->ref_strand) {
-		free(dest->ref_strand);
+	if (src->ref_strand)
 		dest->ref_strand = src->ref_strand;
-	}
 }
 
 // this line will read a CSV file and if a BPM object is provided it will fill it rather than
@@ -786,16 +1121,12 @@ static bpm_t *bpm_csv_init(const char *fn, bpm_t *bpm)
 
 	free(bpm->fn);
 	bpm->fn = strdup(fn);
-	if (bpm->fp && hclose(bpm->fp) < 0)
+	if (bpm->fp && bgzf_close(bpm->fp) < 0)
 		error("Error closing BPM file\n");
-	bpm->fp = hopen(bpm->fn, "r");
-	if (bpm->fp == NULL)
-		error("Could not open %s: %s\n", bpm->fn, strerror(errno));
-	if (is_gzip(bpm->fp))
-		error("File %s is gzip compressed and currently cannot be sought\n", bpm->fn);
+	bpm->fp = bgzf_open_input(bpm->fn, 0);
 
 	kstring_t str = {0, 0, NULL};
-	if (kgetline(&str, (kgets_func *)hgets, bpm->fp) < 0)
+	if (kgetline(&str, bgzf_gets, bpm->fp) < 0)
 		error("Empty file: %s\n", bpm->fn);
 	if (strncmp(str.s, "Illumina", 8) && strncmp(str.s, "\"Illumina", 9))
 		error("Header of file %s is incorrect: %s\n", bpm->fn, str.s);
@@ -815,7 +1146,7 @@ static bpm_t *bpm_csv_init(const char *fn, bpm_t *bpm)
 		}
 		kputc('\n', &str);
 		prev = str.l;
-		if (kgetline(&str, (kgets_func *)hgets, bpm->fp) < 0)
+		if (kgetline(&str, bgzf_gets, bpm->fp) < 0)
 			error("Error reading from file: %s\n", bpm->fn);
 	}
 	if (bpm->num_loci == 0)
@@ -835,31 +1166,41 @@ static bpm_t *bpm_csv_init(const char *fn, bpm_t *bpm)
 	free(off);
 
 	str.l = 0;
-	if (kgetline(&str, (kgets_func *)hgets, bpm->fp) < 0)
+	if (kgetline(&str, bgzf_gets, bpm->fp) < 0)
 		error("Error reading from file: %s\n", bpm->fn);
 
 	LocusEntry locus_entry;
+	arena_t *arena = &bpm->arena;
 	tsv_t *tsv = tsv_init(str.s);
 	tsv_register(tsv, "Index", tsv_read_int32, &locus_entry.index);
 	int norm_id = tsv_register(tsv, "NormID", tsv_read_uint8, &locus_entry.norm_id);
-	tsv_register(tsv, "IlmnID", tsv_read_string, &locus_entry.ilmn_id);
-	tsv_register(tsv, "Name", tsv_read_string, &locus_entry.name);
-	tsv_register(tsv, "IlmnStrand", tsv_read_string, &locus_entry.ilmn_strand);
-	tsv_register(tsv, "SNP", tsv_read_string, &locus_entry.snp);
+	tsv_register(tsv, "IlmnID", tsv_read_string, &(tsv_string_t){arena, &locus_entry.ilmn_id});
+	tsv_register(tsv, "Name", tsv_read_string, &(tsv_string_t){arena, &locus_entry.name});
+	tsv_register(tsv, "IlmnStrand", tsv_read_string,
+		     &(tsv_string_t){arena, &locus_entry.ilmn_strand});
+	tsv_register(tsv, "SNP", tsv_read_string, &(tsv_string_t){arena, &locus_entry.snp});
 	tsv_register(tsv, "AddressA_ID", tsv_read_int32, &locus_entry.address_a);
-	tsv_register(tsv, "AlleleA_ProbeSeq", tsv_read_string, &locus_entry.allele_a_probe_seq);
+	tsv_register(tsv, "AlleleA_ProbeSeq", tsv_read_string,
+		     &(tsv_string_t){arena, &locus_entry.allele_a_probe_seq});
 	tsv_register(tsv, "AddressB_ID", tsv_read_int32, &locus_entry.address_b);
-	tsv_register(tsv, "AlleleB_ProbeSeq", tsv_read_string, &locus_entry.allele_b_probe_seq);
-	tsv_register(tsv, "GenomeBuild", tsv_read_string, &locus_entry.genome_build);
-	tsv_register(tsv, "Chr", tsv_read_string, &locus_entry.chrom);
-	tsv_register(tsv, "MapInfo", tsv_read_string, &locus_entry.map_info);
-	tsv_register(tsv, "Ploidy", tsv_read_string, &locus_entry.ploidy);
-	tsv_register(tsv, "Species", tsv_read_string, &locus_entry.species);
-	tsv_register(tsv, "Source", tsv_read_string, &locus_entry.source);
-	tsv_register(tsv, "SourceVersion", tsv_read_string, &locus_entry.source_version);
-	tsv_register(tsv, "SourceStrand", tsv_read_string, &locus_entry.source_strand);
-	tsv_register(tsv, "SourceSeq", tsv_read_string, &locus_entry.source_seq);
-	tsv_register(tsv, "TopGenomicSeq", tsv_read_string, &locus_entry.top_genomic_seq);
+	tsv_register(tsv, "AlleleB_ProbeSeq", tsv_read_string,
+		     &(tsv_string_t){arena, &locus_entry.allele_b_probe_seq});
+	tsv_register(tsv, "GenomeBuild", tsv_read_string,
+		     &(tsv_string_t){arena, &locus_entry.genome_build});
+	tsv_register(tsv, "Chr", tsv_read_string, &(tsv_string_t){arena, &locus_entry.chrom});
+	tsv_register(tsv, "MapInfo", tsv_read_string,
+		     &(tsv_string_t){arena, &locus_entry.map_info});
+	tsv_register(tsv, "Ploidy", tsv_read_string, &(tsv_string_t){arena, &locus_entry.ploidy});
+	tsv_register(tsv, "Species", tsv_read_string, &(tsv_string_t){arena, &locus_entry.species});
+	tsv_register(tsv, "Source", tsv_read_string, &(tsv_string_t){arena, &locus_entry.source});
+	tsv_register(tsv, "SourceVersion", tsv_read_string,
+		     &(tsv_string_t){arena, &locus_entry.source_version});
+	tsv_register(tsv, "SourceStrand", tsv_read_string,
+		     &(tsv_string_t){arena, &locus_entry.source_strand});
+	tsv_register(tsv, "SourceSeq", tsv_read_string,
+		     &(tsv_string_t){arena, &locus_entry.source_seq});
+	tsv_register(tsv, "TopGenomicSeq", tsv_read_string,
+		     &(tsv_string_t){arena, &locus_entry.top_genomic_seq});
 	tsv_register(tsv, "BeadSetID", tsv_read_int32, &locus_entry.beadset_id);
 	tsv_register(tsv, "Exp_Clusters", tsv_read_uint8, &locus_entry.exp_clusters);
 	tsv_register(tsv, "Intensity_Only", tsv_read_uint8, &locus_entry.intensity_only);
@@ -868,7 +1209,8 @@ static bpm_t *bpm_csv_init(const char *fn, bpm_t *bpm)
 	tsv_register(tsv, "Frac G", tsv_read_float, &locus_entry.frac_g);
 	tsv_register(tsv, "Frac T", tsv_read_float, &locus_entry.frac_t);
 	int ref_strand =
-		tsv_register(tsv, "RefStrand", tsv_read_string, &locus_entry.ref_strand);
+		tsv_register(tsv, "RefStrand", tsv_read_string,
+			     &(tsv_string_t){arena, &locus_entry.ref_strand});
 	if (ref_strand < 0)
 		fprintf(stderr, "Warning: RefStrand annotation missing from manifest file %s\n",
 			bpm->fn);
@@ -878,8 +1220,7 @@ static bpm_t *bpm_csv_init(const char *fn, bpm_t *bpm)
 	for (int i = 0; i < bpm->num_loci; i++) {
 		memset(&locus_entry, 0, sizeof(LocusEntry));
 		locus_entry.norm_id = 0xFF;
-		str.l = 0;
-		if (kgetline(&str, (kgets_func *)hgets, bpm->fp) < 0)
+		if (bgzf_getline(bpm->fp, '\n', &str) < 0)
 			error("Error reading from file: %s\n", bpm->fn);
 		if (csv_parse(tsv, NULL, str.s) < 0)
 			error("Could not parse the manifest file: %s\n", str.s);
@@ -906,12 +1247,12 @@ static bpm_t *bpm_csv_init(const char *fn, bpm_t *bpm)
 	tsv_destroy(tsv);
 
 	str.l = 0;
-	if (kgetline(&str, (kgets_func *)hgets, bpm->fp) < 0)
+	if (kgetline(&str, bgzf_gets, bpm->fp) < 0)
 		error("Error reading from file: %s\n", bpm->fn);
 	if (strncmp(str.s, "[Controls]", 10) != 0)
 		error("Missing [Controls] section from manifest file: %s\n", bpm->fn);
 	str.l = 0;
-	while (kgetline(&str, (kgets_func *)hgets, bpm->fp) >= 0)
+	while (kgetline(&str, bgzf_gets, bpm->fp) >= 0)
 		kputc('\n', &str);
 	free(bpm->control_config);
 	bpm->control_config = str.s;
@@ -957,7 +1298,7 @@ typedef struct {
 
 typedef struct {
 	char *fn;
-	hFILE *fp;
+	BGZF *fp;
 	int32_t version;
 	char *gencall_version;	     // The GenCall version
 	char *cluster_version;	     // The clustering algorithm version
@@ -971,9 +1312,10 @@ typedef struct {
 	int32_t num_records;
 	ClusterRecord *cluster_records;
 	char **loci_names;
+	arena_t arena; // names of the loci
 } egt_t;
 
-static void clusterscore_read(ClusterScore *clusterscore, hFILE *fp)
+static void clusterscore_read(ClusterScore *clusterscore, BGZF *fp)
 {
 	read_bytes(fp, (void *)&clusterscore->cluster_separation, sizeof(float));
 	read_bytes(fp, (void *)&clusterscore->total_score, sizeof(float));
@@ -981,7 +1323,7 @@ static void clusterscore_read(ClusterScore *clusterscore, hFILE *fp)
 	read_bytes(fp, (void *)&clusterscore->edited, sizeof(uint8_t));
 }
 
-static void clusterrecord_read(ClusterRecord *clusterrecord, hFILE *fp,
+static void clusterrecord_read(ClusterRecord *clusterrecord, BGZF *fp,
 			       int32_t data_block_version)
 {
 	read_bytes(fp, (void *)&clusterrecord->aa_cluster_stats.N, sizeof(int32_t));
@@ -1009,11 +1351,7 @@ static egt_t *egt_init(const char *fn)
 {
 	egt_t *egt = (egt_t *)calloc(1, sizeof(egt_t));
 	egt->fn = strdup(fn);
-	egt->fp = hopen(egt->fn, "rb");
-	if (egt->fp == NULL)
-		error("Could not open %s: %s\n", egt->fn, strerror(errno));
-	if (is_gzip(egt->fp))
-		error("File %s is gzip compressed and currently cannot be sought\n", egt->fn);
+	egt->fp = bgzf_open_input(egt->fn, 0);
 
 	read_bytes(egt->fp, (void *)&egt->version, sizeof(int32_t));
 	if (egt->version != 3)
@@ -1052,7 +1390,7 @@ static egt_t *egt_init(const char *fn)
 
 	egt->loci_names = (char **)malloc(egt->num_records * sizeof(char *));
 	for (int i = 0; i < egt->num_records; i++) {
-		read_pfx_string(egt->fp, &egt->loci_names[i], NULL);
+		egt->loci_names[i] = read_pfx_string_arena(egt->fp, &egt->arena);
 	}
 	for (int i = 0; i < egt->num_records; i++)
 		read_bytes(egt->fp, (void *)&egt->cluster_records[i].address, sizeof(int32_t));
@@ -1072,7 +1410,7 @@ static egt_t *egt_init(const char *fn)
 		read_bytes(egt->fp, NULL, egt->num_records * sizeof(float));
 	if (!heof(egt->fp))
 		error("EGT reader did not reach the end of file %s at position %ld\n", egt->fn,
-		      htell(egt->fp));
+		      bgzf_utell(egt->fp));
 
 	return egt;
 }
@@ -1082,7 +1420,7 @@ static void egt_destroy(egt_t *egt)
 	if (!egt)
 		return;
 	free(egt->fn);
-	if (hclose(egt->fp) < 0)
+	if (bgzf_close(egt->fp) < 0)
 		error("Error closing EGT file\n");
 	free(egt->gencall_version);
 	free(egt->cluster_version);
@@ -1091,9 +1429,8 @@ static void egt_destroy(egt_t *egt)
 	free(egt->date_created);
 	free(egt->manifest_name);
 	free(egt->cluster_records);
-	for (int i = 0; i < egt->num_records; i++)
-		free(egt->loci_names[i]);
 	free(egt->loci_names);
+	arena_destroy(&egt->arena);
 	free(egt);
 }
 
@@ -1146,6 +1483,51 @@ static void egt_to_csv(const egt_t *egt, FILE *stream, int verbose)
 	}
 }
 
+/****************************************
+ * HOT LOCUS DATA                       *
+ ****************************************/
+
+static inline void locus_set_clusters(locus_t *locus, const ClusterRecord *cluster_record)
+{
+	const ClusterStats *stats[3] = {&cluster_record->aa_cluster_stats,
+					&cluster_record->ab_cluster_stats,
+					&cluster_record->bb_cluster_stats};
+	for (int i = 0; i < 3; i++) {
+		locus->theta_mean[i] = stats[i]->theta_mean;
+		locus->r_mean[i] = stats[i]->r_mean;
+	}
+}
+
+// built once the manifest, the coordinates, and the cluster centers are final
+static void bpm_loci_init(bpm_t *bpm, const egt_t *egt)
+{
+	free(bpm->loci);
+	bpm->loci = (locus_t *)malloc(bpm->num_loci * sizeof(locus_t));
+	for (int j = 0; j < bpm->num_loci; j++) {
+		const LocusEntry *locus_entry = &bpm->locus_entries[j];
+		locus_t *locus = &bpm->loci[j];
+		locus->norm_lookup = 0xFF;
+		if (bpm->norm_lookups && locus_entry->norm_id != 0xFF)
+			locus->norm_lookup = bpm->norm_lookups[locus_entry->norm_id];
+		const char *ref_strand = locus_entry->ref_strand;
+		locus->strand = -1;
+		if (ref_strand && strcmp(ref_strand, "+") == 0)
+			locus->strand = 0;
+		else if (ref_strand && strcmp(ref_strand, "-") == 0)
+			locus->strand = 1;
+		const char *snp = locus_entry->snp;
+		int len = snp ? strlen(snp) : 0;
+		locus->allele_a = len > 1 ? snp[1] : '\0';
+		locus->allele_b = len > 3 ? snp[3] : '\0';
+		if (egt) {
+			locus_set_clusters(locus, &egt->cluster_records[j]);
+		} else {
+			for (int i = 0; i < 3; i++)
+				locus->theta_mean[i] = locus->r_mean[i] = NAN;
+		}
+	}
+}
+
 /****************************************
  * IDAT FILE IMPLEMENTATION             *
  ****************************************/
@@ -1251,7 +1633,9 @@ typedef struct {
 
 typedef struct {
 	char *fn;
-	hFILE *fp;
+	file_handle_t *handle;
+	BGZF *fp; // only set while the header is parsed
+	size_t capacity;
 	int64_t version;
 	int32_t number_toc_entries;
 	uint16_t *id;
@@ -1288,7 +1672,7 @@ static int idat_read(idat_t *idat, uint16_t id)
 		;
 	if (i == idat->number_toc_entries)
 		return -1;
-	if (hseek(idat->fp, idat->toc[i], SEEK_SET) < 0)
+	if (bgzf_useek(idat->fp, idat->toc[i], SEEK_SET) < 0)
 		error("Fail to seek to position %ld in IDAT %s file\n", idat->toc[i], idat->fn);
 
 	switch (id) {
@@ -1296,19 +1680,19 @@ static int idat_read(idat_t *idat, uint16_t id)
 		read_bytes(idat->fp, (void *)&idat->num_snps, sizeof(int32_t));
 		break;
 	case ILLUMINA_ID:
-		idat->ilmn_id = buffer_array_init(idat->fp, 0, sizeof(int32_t));
+		idat->ilmn_id = buffer_array_init(idat->handle, idat->capacity, sizeof(int32_t));
 		break;
 	case SD:
-		idat->sd = buffer_array_init(idat->fp, 0, sizeof(uint16_t));
+		idat->sd = buffer_array_init(idat->handle, idat->capacity, sizeof(uint16_t));
 		break;
 	case MEAN:
-		idat->mean = buffer_array_init(idat->fp, 0, sizeof(uint16_t));
+		idat->mean = buffer_array_init(idat->handle, idat->capacity, sizeof(uint16_t));
 		break;
 	case NBEADS:
-		idat->nbeads = buffer_array_init(idat->fp, 0, sizeof(uint8_t));
+		idat->nbeads = buffer_array_init(idat->handle, idat->capacity, sizeof(uint8_t));
 		break;
 	case MID_BLOCK:
-		idat->mid_block = buffer_array_init(idat->fp, 0, sizeof(uint8_t));
+		idat->mid_block = buffer_array_init(idat->handle, idat->capacity, sizeof(uint8_t));
 		break;
 	case RED_GREEN:
 		read_bytes(idat->fp, (void *)&idat->red_green, 4 * sizeof(uint8_t));
@@ -1364,18 +1748,16 @@ static int idat_read(idat_t *idat, uint16_t id)
 	return 0;
 }
 
-static idat_t *idat_init(const char *fn)
+static idat_t *idat_init(const char *fn, size_t capacity)
 {
 	idat_t *idat = (idat_t *)calloc(1, sizeof(idat_t));
 	idat->fn = strdup(fn);
-	idat->fp = hopen(idat->fn, "rb");
-	if (idat->fp == NULL)
-		error("Could not open %s: %s\n", idat->fn, strerror(errno));
-	if (is_gzip(idat->fp))
-		error("File %s is gzip compressed and currently cannot be sought\n", idat->fn);
+	idat->handle = file_handle_init(idat->fn);
+	idat->fp = file_handle_acquire(idat->handle);
+	idat->capacity = capacity;
 
 	uint8_t buffer[4];
-	if (hread(idat->fp, (void *)buffer, 4) < 4)
+	if (bgzf_read(idat->fp, (void *)buffer, 4) < 4)
 		error("Failed to read magic number from %s file\n", idat->fn);
 	if (memcmp(buffer, "IDAT", 4) != 0)
 		error("IDAT file %s format identifier is bad\n", idat->fn);
@@ -1410,6 +1792,8 @@ static idat_t *idat_init(const char *fn)
 		idat->scanner_data = idat->run_infos[i].block_pars;
 	}
 
+	file_handle_release(idat->handle);
+	idat->fp = NULL;
 	return idat;
 }
 
@@ -1418,8 +1802,7 @@ static void idat_destroy(idat_t *idat)
 	if (!idat)
 		return;
 	free(idat->fn);
-	if (hclose(idat->fp) < 0)
-		error("Error closing IDAT file\n");
+	file_handle_destroy(idat->handle);
 	free(idat->id);
 	free(idat->toc);
 	free(idat->snp_manifest);
@@ -1595,17 +1978,6 @@ typedef struct {
 
 typedef char BaseCall[2];
 
-typedef struct {
-	uint16_t raw_x;
-	uint16_t raw_y;
-	float norm_x;
-	float norm_y;
-	float ilmn_theta;
-	float ilmn_r;
-	float baf;
-	float lrr;
-} intensities_t;
-
 typedef struct {
 	char *scanner_name;
 	int32_t pmt_green;
@@ -1625,7 +1997,9 @@ typedef uint16_t Percentiles[3];
 
 typedef struct {
 	char *fn;
-	hFILE *fp;
+	file_handle_t *handle;
+	BGZF *fp; // only set while the header is parsed
+	size_t capacity;
 	int32_t version;
 	int32_t number_toc_entries;
 	uint16_t *id;
@@ -1679,7 +2053,7 @@ static int gtc_read(gtc_t *gtc, uint16_t id)
 	if (i == gtc->number_toc_entries)
 		return -1;
 	if (id != NUM_SNPS && id != PLOIDY && id != PLOIDY_TYPE) {
-		if (hseek(gtc->fp, gtc->toc[i], SEEK_SET) < 0)
+		if (bgzf_useek(gtc->fp, gtc->toc[i], SEEK_SET) < 0)
 			error("Fail to seek to position %d in GTC %s file \n", gtc->toc[i],
 			      gtc->fn);
 	}
@@ -1731,19 +2105,19 @@ static int gtc_read(gtc_t *gtc, uint16_t id)
 			       sizeof(uint16_t));
 		break;
 	case RAW_X:
-		gtc->raw_x = buffer_array_init(gtc->fp, 0, sizeof(uint16_t));
+		gtc->raw_x = buffer_array_init(gtc->handle, gtc->capacity, sizeof(uint16_t));
 		break;
 	case RAW_Y:
-		gtc->raw_y = buffer_array_init(gtc->fp, 0, sizeof(uint16_t));
+		gtc->raw_y = buffer_array_init(gtc->handle, gtc->capacity, sizeof(uint16_t));
 		break;
 	case GENOTYPES:
-		gtc->genotypes = buffer_array_init(gtc->fp, 0, sizeof(uint8_t));
+		gtc->genotypes = buffer_array_init(gtc->handle, gtc->capacity, sizeof(uint8_t));
 		break;
 	case BASE_CALLS:
-		gtc->base_calls = buffer_array_init(gtc->fp, 0, sizeof(BaseCall));
+		gtc->base_calls = buffer_array_init(gtc->handle, gtc->capacity, sizeof(BaseCall));
 		break;
 	case GENOTYPE_SCORES:
-		gtc->genotype_scores = buffer_array_init(gtc->fp, 0, sizeof(float));
+		gtc->genotype_scores = buffer_array_init(gtc->handle, gtc->capacity, sizeof(float));
 		break;
 	case SCANNER_DATA:
 		read_pfx_string(gtc->fp, &gtc->scanner_data.scanner_name, NULL);
@@ -1771,10 +2145,10 @@ static int gtc_read(gtc_t *gtc, uint16_t id)
 		read_bytes(gtc->fp, (void *)&gtc->sample_data, sizeof(SampleData));
 		break;
 	case B_ALLELE_FREQS:
-		gtc->b_allele_freqs = buffer_array_init(gtc->fp, 0, sizeof(float));
+		gtc->b_allele_freqs = buffer_array_init(gtc->handle, gtc->capacity, sizeof(float));
 		break;
 	case LOGR_RATIOS:
-		gtc->logr_ratios = buffer_array_init(gtc->fp, 0, sizeof(float));
+		gtc->logr_ratios = buffer_array_init(gtc->handle, gtc->capacity, sizeof(float));
 		break;
 	case PERCENTILES_X:
 		read_bytes(gtc->fp, (void *)&gtc->percentiles_x, sizeof(Percentiles));
@@ -1792,18 +2166,16 @@ static int gtc_read(gtc_t *gtc, uint16_t id)
 	return 0;
 }
 
-static gtc_t *gtc_init(const char *fn)
+static gtc_t *gtc_init(const char *fn, size_t capacity)
 {
 	gtc_t *gtc = (gtc_t *)calloc(1, sizeof(gtc_t));
 	gtc->fn = strdup(fn);
-	gtc->fp = hopen(gtc->fn, "rb");
-	if (gtc->fp == NULL)
-		error("Could not open %s: %s\n", gtc->fn, strerror(errno));
-	if (is_gzip(gtc->fp))
-		error("File %s is gzip compressed and currently cannot be sought\n", gtc->fn);
+	gtc->handle = file_handle_init(gtc->fn);
+	gtc->fp = file_handle_acquire(gtc->handle);
+	gtc->capacity = capacity;
 
 	uint8_t buffer[4];
-	if (hread(gtc->fp, (void *)buffer, 4) < 4)
+	if (bgzf_read(gtc->fp, (void *)buffer, 4) < 4)
 		error("Failed to read magic number from %s file\n", gtc->fn);
 	if (memcmp(buffer, "gtc", 3) != 0)
 		error("GTC file %s format identifier is bad\n", gtc->fn);
@@ -1823,7 +2195,7 @@ static gtc_t *gtc_init(const char *fn)
 		gtc_read(gtc, gtc->id[i]);
 
 	const char *ptr = strrchr(gtc->fn, '/') ? strrchr(gtc->fn, '/') + 1 : gtc->fn;
-	gtc->display_name = strndup(ptr, strlen(ptr) - 4);
+	gtc->display_name = strndup(ptr, strlen(ptr) - 4 - gz_suffix_len(ptr));
 
 	gtc->sin_theta = (float *)malloc(gtc->m_normalization_transforms * sizeof(float));
 	gtc->cos_theta = (float *)malloc(gtc->m_normalization_transforms * sizeof(float));
@@ -1832,6 +2204,8 @@ static gtc_t *gtc_init(const char *fn)
 		gtc->cos_theta[i] = cosf(gtc->normalization_transforms[i].theta);
 	}
 
+	file_handle_release(gtc->handle);
+	gtc->fp = NULL;
 	return gtc;
 }
 
@@ -1840,8 +2214,7 @@ static void gtc_destroy(gtc_t *gtc)
 	if (!gtc)
 		return;
 	free(gtc->fn);
-	if (hclose(gtc->fp) < 0)
-		error("Error closing GTC file\n");
+	file_handle_destroy(gtc->handle);
 	free(gtc->id);
 	free(gtc->toc);
 	free(gtc->sample_name);
@@ -1874,6 +2247,221 @@ static void gtc_destroy(gtc_t *gtc)
 	free(gtc);
 }
 
+// raw GTC values for a block of consecutive loci across samples, in locus-major order so that
+// the values for locus k are the contiguous arrays starting at index k * n_samples
+typedef struct {
+	int n_samples;
+	int n_loci;
+	int m_loci;
+	uint16_t *raw_x;
+	uint16_t *raw_y;
+	uint8_t *genotypes;
+	BaseCall *base_calls;
+	float *genotype_scores;
+	float *b_allele_freqs;
+	float *logr_ratios;
+} gtc_block_t;
+
+static gtc_block_t *gtc_block_init(int n_samples, int m_loci)
+{
+	gtc_block_t *block = (gtc_block_t *)calloc(1, sizeof(gtc_block_t));
+	block->n_samples = n_samples;
+	block->m_loci = m_loci;
+	size_t n_cells = (size_t)m_loci * n_samples;
+	block->raw_x = (uint16_t *)malloc(n_cells * sizeof(uint16_t));
+	block->raw_y = (uint16_t *)malloc(n_cells * sizeof(uint16_t));
+	block->genotypes = (uint8_t *)malloc(n_cells * sizeof(uint8_t));
+	block->base_calls = (BaseCall *)malloc(n_cells * sizeof(BaseCall));
+	block->genotype_scores = (float *)malloc(n_cells * sizeof(float));
+	block->b_allele_freqs = (float *)malloc(n_cells * sizeof(float));
+	block->logr_ratios = (float *)malloc(n_cells * sizeof(float));
+	return block;
+}
+
+static void gtc_block_destroy(gtc_block_t *block)
+{
+	if (!block)
+		return;
+	free(block->raw_x);
+	free(block->raw_y);
+	free(block->genotypes);
+	free(block->base_calls);
+	free(block->genotype_scores);
+	free(block->b_allele_freqs);
+	free(block->logr_ratios);
+	free(block);
+}
+
+// read a run of elements and scatter them with a fixed stride, filling with a default value
+// when the array is missing or shorter than expected
+static void transpose_elements(buffer_array_t *arr, void *dst, size_t stride, size_t item_idx,
+			       size_t n_items, size_t item_size, void *buffer,
+			       const void *missing)
+{
+	char *ptr = (char *)dst;
+	const char *src = (const char *)buffer;
+	size_t n_avail = 0;
+	if (arr && arr->item_size == item_size && item_idx < arr->item_num) {
+		n_avail = min(n_items, arr->item_num - item_idx);
+		if (arr->is_mapped) {
+			src = arr->buffer + item_idx * item_size;
+			arr->n_bytes += n_avail * item_size;
+		} else {
+			get_elements(arr, buffer, item_idx, n_avail);
+		}
+	}
+	switch (item_size) {
+	case 1:
+		for (size_t k = 0; k < n_avail; k++)
+			ptr[k * stride] = src[k];
+		break;
+	case 2:
+		for (size_t k = 0; k < n_avail; k++)
+			memcpy((void *)(ptr + k * stride * 2), (const void *)(src + k * 2), 2);
+		break;
+	case 4:
+		for (size_t k = 0; k < n_avail; k++)
+			memcpy((void *)(ptr + k * stride * 4), (const void *)(src + k * 4), 4);
+		break;
+	default:
+		for (size_t k = 0; k < n_avail; k++)
+			memcpy((void *)(ptr + k * stride * item_size),
+			       (const void *)(src + k * item_size), item_size);
+		break;
+	}
+	for (size_t k = n_avail; k < n_items; k++)
+		memcpy((void *)(ptr + k * stride * item_size), missing, item_size);
+}
+
+// gather the elements at the given indexes and scatter them with a fixed stride, visiting the
+// indexes in increasing order through order, if given, and reading only the spans of the file
+// that contain the requested elements
+static void gather_elements(buffer_array_t *arr, void *dst, size_t stride, const int *loci,
+			    const int *order, size_t n_items, size_t item_size, const void *missing)
+{
+	char *ptr = (char *)dst;
+	size_t n_copied = 0;
+	for (size_t r = 0; r < n_items; r++) {
+		size_t k = order ? order[r] : r;
+		size_t idx = loci[k];
+		char *out = ptr + k * stride * item_size;
+		if (!arr || arr->item_size != item_size || idx >= arr->item_num) {
+			memcpy((void *)out, missing, item_size);
+			continue;
+		}
+		n_copied++;
+		if (idx < arr->item_offset || idx - arr->item_offset >= arr->item_filled) {
+			size_t last = r, next;
+			while (last + 1 < n_items) {
+				next = order ? order[last + 1] : last + 1;
+				if (loci[next] - idx >= arr->item_capacity)
+					break;
+				last++;
+			}
+			next = order ? order[last] : last;
+			buffer_array_fill(arr, idx, loci[next] - idx + 1);
+		}
+		const char *src = arr->buffer + (idx - arr->item_offset) * item_size;
+		memcpy((void *)out, (const void *)src, item_size);
+	}
+	if (arr && arr->is_mapped)
+		arr->n_bytes += n_copied * item_size;
+}
+
+// staged arrays already hold the selected elements in the order of the selection
+static void select_elements(buffer_array_t *arr, void *dst, size_t stride, int locus_beg,
+			    const int *loci, const int *order, size_t n_items, size_t item_size,
+			    void *buffer, const void *missing)
+{
+	if (arr && arr->is_staged)
+		transpose_elements(arr, dst, stride, locus_beg, n_items, item_size, buffer,
+				   missing);
+	else
+		gather_elements(arr, dst, stride, loci + locus_beg, order, n_items, item_size,
+				missing);
+}
+
+// fill the columns of samples in [sample_beg, sample_end) for n_loci loci starting at
+// locus_beg, or at loci[locus_beg] onwards if a list of selected loci is given together with
+// the order of the block rows by increasing locus, buffer must hold at least n_loci four-byte
+// values and the caller is responsible for setting the number of loci in the block
+static void gtc_block_read(gtc_t **gtc, gtc_block_t *block, int locus_beg, int n_loci,
+			   const int *loci, const int *order, int sample_beg, int sample_end,
+			   void *buffer)
+{
+	static const uint16_t raw_missing = 0;
+	static const uint8_t genotype_missing = 0;
+	static const BaseCall base_call_missing = {'-', '-'};
+	const float float_missing = NAN;
+	size_t n = block->n_samples;
+	if (loci) {
+		for (int i = sample_beg; i < sample_end; i++) {
+			select_elements(gtc[i]->raw_x, (void *)&block->raw_x[i], n, locus_beg,
+					loci, order, n_loci, sizeof(uint16_t), buffer,
+					(const void *)&raw_missing);
+			select_elements(gtc[i]->raw_y, (void *)&block->raw_y[i], n, locus_beg,
+					loci, order, n_loci, sizeof(uint16_t), buffer,
+					(const void *)&raw_missing);
+			select_elements(gtc[i]->genotypes, (void *)&block->genotypes[i], n,
+					locus_beg, loci, order, n_loci, sizeof(uint8_t), buffer,
+					(const void *)&genotype_missing);
+			select_elements(gtc[i]->base_calls, (void *)&block->base_calls[i], n,
+					locus_beg, loci, order, n_loci, sizeof(BaseCall), buffer,
+					(const void *)&base_call_missing);
+			select_elements(gtc[i]->genotype_scores, (void *)&block->genotype_scores[i],
+					n, locus_beg, loci, order, n_loci, sizeof(float), buffer,
+					(const void *)&float_missing);
+			select_elements(gtc[i]->b_allele_freqs, (void *)&block->b_allele_freqs[i],
+					n, locus_beg, loci, order, n_loci, sizeof(float), buffer,
+					(const void *)&float_missing);
+			select_elements(gtc[i]->logr_ratios, (void *)&block->logr_ratios[i], n,
+					locus_beg, loci, order, n_loci, sizeof(float), buffer,
+					(const void *)&float_missing);
+		}
+		return;
+	}
+	for (int i = sample_beg; i < sample_end; i++) {
+		transpose_elements(gtc[i]->raw_x, (void *)&block->raw_x[i], n, locus_beg, n_loci,
+				   sizeof(uint16_t), buffer, (const void *)&raw_missing);
+		transpose_elements(gtc[i]->raw_y, (void *)&block->raw_y[i], n, locus_beg, n_loci,
+				   sizeof(uint16_t), buffer, (const void *)&raw_missing);
+		transpose_elements(gtc[i]->genotypes, (void *)&block->genotypes[i], n, locus_beg,
+				   n_loci, sizeof(uint8_t), buffer,
+				   (const void *)&genotype_missing);
+		transpose_elements(gtc[i]->base_calls, (void *)&block->base_calls[i], n,
+				   locus_beg, n_loci, sizeof(BaseCall), buffer,
+				   (const void *)&base_call_missing);
+		transpose_elements(gtc[i]->genotype_scores, (void *)&block->genotype_scores[i], n,
+				   locus_beg, n_loci, sizeof(float), buffer,
+				   (const void *)&float_missing);
+		transpose_elements(gtc[i]->b_allele_freqs, (void *)&block->b_allele_freqs[i], n,
+				   locus_beg, n_loci, sizeof(float), buffer,
+				   (const void *)&float_missing);
+		transpose_elements(gtc[i]->logr_ratios, (void *)&block->logr_ratios[i], n,
+				   locus_beg, n_loci, sizeof(float), buffer,
+				   (const void *)&float_missing);
+	}
+}
+
+// buffer refills and bytes read so far from the arrays of samples in [sample_beg, sample_end)
+static void gtc_io_counts(gtc_t **gtc, int sample_beg, int sample_end, uint64_t *n_refills,
+			  uint64_t *n_bytes)
+{
+	*n_refills = *n_bytes = 0;
+	for (int i = sample_beg; i < sample_end; i++) {
+		const buffer_array_t *arrs[] = {gtc[i]->raw_x,		 gtc[i]->raw_y,
+						gtc[i]->genotypes,	 gtc[i]->base_calls,
+						gtc[i]->genotype_scores, gtc[i]->b_allele_freqs,
+						gtc[i]->logr_ratios};
+		for (int j = 0; j < sizeof(arrs) / sizeof(arrs[0]); j++) {
+			if (!arrs[j])
+				continue;
+			*n_refills += arrs[j]->n_refills;
+			*n_bytes += arrs[j]->n_bytes;
+		}
+	}
+}
+
 static void gtc_to_csv(const gtc_t *gtc, FILE *stream, int verbose)
 {
 	fprintf(stream, "Illumina, Inc.\n");
@@ -1925,22 +2513,23 @@ static void gtc_to_csv(const gtc_t *gtc, FILE *stream, int verbose)
 	if (verbose) {
 		fprintf(stream,
 			"Raw X,Raw Y,GType,Top Alleles,Score,B Allele Freq,Log R Ratio\n");
-		for (int i = 0; i < gtc->num_snps; i++) {
-			uint16_t raw_x = 0, raw_y = 0;
-			get_element(gtc->raw_x, (void *)&raw_x, i);
-			get_element(gtc->raw_y, (void *)&raw_y, i);
-			uint8_t genotype = 0;
-			get_element(gtc->genotypes, (void *)&genotype, i);
-			BaseCall base_call = {'-', '-'};
-			get_element(gtc->base_calls, (void *)&base_call, i);
-			float genotype_score = NAN, b_allele_freq = NAN, logr_ratio = NAN;
-			get_element(gtc->genotype_scores, (void *)&genotype_score, i);
-			get_element(gtc->b_allele_freqs, (void *)&b_allele_freq, i);
-			get_element(gtc->logr_ratios, (void *)&logr_ratio, i);
-			fprintf(stream, "%d,%d,%s,%c%c,%f,%f,%f\n", raw_x, raw_y,
-				code2genotype[genotype], base_call[0], base_call[1],
-				genotype_score, b_allele_freq, logr_ratio);
+		gtc_block_t *block = gtc_block_init(1, 32768);
+		float *buffer = (float *)malloc(block->m_loci * sizeof(float));
+		for (int j = 0; j < gtc->num_snps; j += block->m_loci) {
+			block->n_loci = min(block->m_loci, gtc->num_snps - j);
+			gtc_block_read((gtc_t **)&gtc, block, j, block->n_loci, NULL, NULL, 0, 1,
+				       (void *)buffer);
+			for (int k = 0; k < block->n_loci; k++) {
+				uint8_t genotype = block->genotypes[k];
+				fprintf(stream, "%d,%d,%s,%c%c,%f,%f,%f\n", block->raw_x[k],
+					block->raw_y[k], code2genotype[genotype],
+					block->base_calls[k][0], block->base_calls[k][1],
+					block->genotype_scores[k], block->b_allele_freqs[k],
+					block->logr_ratios[k]);
+			}
 		}
+		free(buffer);
+		gtc_block_destroy(block);
 	} else {
 		fprintf(stream, "... use --verbose to visualize assay data ...\n");
 	}
@@ -1993,55 +2582,97 @@ static void gtcs_to_tsv(gtc_t **gtcs, int n, FILE *stream)
  * SAM FILE IMPLEMENTATION              *
  ****************************************/
 
-static bpm_t *sam_csv_init(const char *fn, bpm_t *bpm, const char *genome_build, int flags)
+// alignments are read in chunks by the main thread, resolved by the thread pool, and the
+// coordinates are updated in order by the main thread
+static bpm_t *sam_csv_init(const char *fn, bpm_t *bpm, const char *genome_build,
+			   htsThreadPool *tpool, int flags)
 {
 	htsFile *hts = hts_open(fn, "r");
 	if (hts == NULL || hts_get_format(hts)->category != sequence_data)
 		error("File %s does not contain sequence data\n", fn);
+	if (tpool->pool)
+		hts_set_thread_pool(hts, tpool);
 	sam_hdr_t *sam_hdr = sam_hdr_read(hts);
 	if (sam_hdr == NULL)
 		error("Reading header from \"%s\" failed", fn);
-	bam1_t *b = bam_init1();
-	if (b == NULL)
-		error("Cannot create SAM record\n");
 
+	hts_tpool *pool = tpool->pool;
+	int n_jobs = pool ? 2 * hts_tpool_size(pool) : 1;
+	flank_job_t *jobs = (flank_job_t *)malloc(n_jobs * sizeof(flank_job_t));
+	for (int i = 0; i < n_jobs; i++)
+		flank_job_init(&jobs[i], sam_hdr, 1);
+
+	// strings shared by all markers are stored once in the arena of the manifest
+	char *build = arena_strdup(&bpm->arena, genome_build);
+	char *plus = arena_strdup(&bpm->arena, "+"), *minus = arena_strdup(&bpm->arena, "-");
 	kstring_t str = {0, 0, NULL};
-	const char *chromosome = NULL;
-	int strand = -1, position = 0, n_unmapped = 0;
-	for (int i = 0; i < bpm->num_loci; i++) {
-		LocusEntry *locus_entry = &bpm->locus_entries[i];
-		int idx = get_position(hts, sam_hdr, b, locus_entry->ilmn_id,
-				       locus_entry->source_seq, 1, &chromosome, &position,
-				       &strand);
-		if (idx < 0) {
-			error("Reading from %s failed", fn);
-		} else if (idx == 0) {
-			if (flags & VERBOSE)
-				fprintf(stderr, "Unable to determine position for marker %s\n",
-					locus_entry->ilmn_id);
-			n_unmapped++;
-		}
-		free(locus_entry->genome_build);
-		locus_entry->genome_build = strdup(genome_build);
-		free(locus_entry->chrom);
-		locus_entry->chrom = strdup(chromosome ? chromosome : "0");
-		free(locus_entry->map_info);
-		str.l = 0;
-		kputw(position, &str);
-		locus_entry->map_info = strdup(str.s);
-		free(locus_entry->ref_strand);
-		locus_entry->ref_strand =
-			((strand < 0)
-			 || ((strcasecmp(locus_entry->ilmn_strand, locus_entry->source_strand)
-			      != 0)
-			     == strand))
-				? strdup("+")
-				: strdup("-");
+	int n_unmapped = 0, i_read = 0, i_done = 0;
+	hts_tpool_process *q = pool ? hts_tpool_process_init(pool, n_jobs, 0) : NULL;
+	int n_read = 0, n_done = 0;
+	while (1) {
+		while (i_read < bpm->num_loci && n_read - n_done < n_jobs) {
+			flank_job_t *job = &jobs[n_read % n_jobs];
+			job->n = 0;
+			for (; job->n < FLANK_CHUNK && i_read < bpm->num_loci; i_read++) {
+				LocusEntry *locus_entry = &bpm->locus_entries[i_read];
+				if (flank_job_read(job, hts, locus_entry->ilmn_id,
+						   locus_entry->source_seq)
+				    < 0)
+					error("Reading from %s failed", fn);
+			}
+			if (!pool)
+				flank_job_run(job);
+			else if (hts_tpool_dispatch(pool, q, flank_job_run, (void *)job) < 0)
+				error("Failed to dispatch job to the thread pool\n");
+			n_read++;
+		}
+		if (n_done == n_read)
+			break;
+		flank_job_t *job = &jobs[n_done % n_jobs];
+		if (pool) {
+			hts_tpool_result *r = hts_tpool_next_result_wait(q);
+			if (!r)
+				error("Failed to retrieve result from the thread pool\n");
+			job = (flank_job_t *)hts_tpool_result_data(r);
+			hts_tpool_delete_result(r, 0);
+		}
+		n_done++;
+
+		for (int j = 0; j < job->n; j++, i_done++) {
+			LocusEntry *locus_entry = &bpm->locus_entries[i_done];
+			const char *chromosome = job->chromosomes[j];
+			int strand = job->strands[j];
+			if (job->rets[j] == 0) {
+				if (flags & VERBOSE)
+					fprintf(stderr,
+						"Unable to determine position for marker %s\n",
+						locus_entry->ilmn_id);
+				n_unmapped++;
+			}
+			locus_entry->genome_build = build;
+			locus_entry->chrom =
+				arena_strdup(&bpm->arena, chromosome ? chromosome : "0");
+			str.l = 0;
+			kputw(job->positions[j], &str);
+			locus_entry->map_info = arena_strndup(&bpm->arena, str.s, str.l);
+			locus_entry->ref_strand =
+				((strand < 0)
+				 || ((strcasecmp(locus_entry->ilmn_strand,
+						 locus_entry->source_strand)
+				      != 0)
+				     == strand))
+					? plus
+					: minus;
+		}
 	}
+	if (q)
+		hts_tpool_process_destroy(q);
 	fprintf(stderr, "Lines   total/unmapped:\t%d/%d\n", bpm->num_loci, n_unmapped);
 	free(str.s);
 
-	bam_destroy1(b);
+	for (int i = 0; i < n_jobs; i++)
+		flank_job_destroy(&jobs[i]);
+	free(jobs);
 	sam_hdr_destroy(sam_hdr);
 	if (hts_close(hts) < 0)
 		error("closing \"%s\" failed", fn);
@@ -2052,22 +2683,134 @@ static bpm_t *sam_csv_init(const char *fn, bpm_t *bpm, const char *genome_build,
  * INTENSITIES COMPUTATIONS             *
  ****************************************/
 
+// hot kernels are compiled for several instruction sets and dispatched at runtime where the
+// toolchain supports it, otherwise they are compiled for the baseline instruction set
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 6 && defined(__x86_64__)         \
+	&& defined(__ELF__)
+#define TARGET_CLONES __attribute__((target_clones("avx2", "sse4.2", "default")))
+#else
+#define TARGET_CLONES
+#endif
+
+#define VEC_LEN 8
+typedef float vfloat_t __attribute__((vector_size(VEC_LEN * sizeof(float))));
+typedef int32_t vint_t __attribute__((vector_size(VEC_LEN * sizeof(int32_t))));
+
+// helpers are macros since passing vectors wider than the baseline instruction set by value
+// changes the ABI
+#define vec_set1(x)                                                                            \
+	({                                                                                     \
+		float _x = (x);                                                                \
+		(vfloat_t){_x, _x, _x, _x, _x, _x, _x, _x};                                    \
+	})
+
+#define vec_select(mask, a, b) ((vfloat_t)(((mask) & (vint_t)(a)) | (~(mask) & (vint_t)(b))))
+
+#define vec_load_u16(ptr)                                                                      \
+	({                                                                                     \
+		const uint16_t *_p = (ptr);                                                    \
+		vfloat_t _v;                                                                   \
+		for (int _l = 0; _l < VEC_LEN; _l++)                                           \
+			_v[_l] = (float)_p[_l];                                                \
+		_v;                                                                            \
+	})
+
+#define vec_load(ptr)                                                                          \
+	({                                                                                     \
+		vfloat_t _v;                                                                   \
+		memcpy((void *)&_v, (const void *)(ptr), sizeof(vfloat_t));                    \
+		_v;                                                                            \
+	})
+
+#define vec_store(ptr, v)                                                                      \
+	({                                                                                     \
+		vfloat_t _v = (v);                                                             \
+		memcpy((void *)(ptr), (const void *)&_v, sizeof(vfloat_t));                    \
+	})
+
+// normalization coefficients of one normalization ID across a row of samples
+typedef struct {
+	float *offset_x;
+	float *offset_y;
+	float *cos_theta;
+	float *sin_theta;
+	float *shear;
+	float *scale_x;
+	float *scale_y;
+} xform_row_t;
+
+// normalization coefficients of all samples packed by normalization ID so that the
+// coefficients needed by a locus are contiguous across samples
+typedef struct {
+	int n_samples;
+	int n_norm_ids;
+	float *coeffs;
+} xform_table_t;
+
+#define XFORM_COEFFS 7
+
+// built once all GTC files are loaded, samples missing a normalization ID get NaN coefficients
+static xform_table_t *xform_table_init(gtc_t **gtc, int n)
+{
+	xform_table_t *table = (xform_table_t *)calloc(1, sizeof(xform_table_t));
+	table->n_samples = n;
+	for (int i = 0; i < n; i++)
+		if (table->n_norm_ids < gtc[i]->m_normalization_transforms)
+			table->n_norm_ids = gtc[i]->m_normalization_transforms;
+	table->coeffs = (float *)malloc((size_t)table->n_norm_ids * XFORM_COEFFS * n
+					* sizeof(float));
+	for (int norm_id = 0; norm_id < table->n_norm_ids; norm_id++) {
+		float *ptr = table->coeffs + (size_t)norm_id * XFORM_COEFFS * n;
+		for (int i = 0; i < n; i++) {
+			if (norm_id < gtc[i]->m_normalization_transforms) {
+				const XForm *xform = gtc[i]->normalization_transforms + norm_id;
+				ptr[i] = xform->offset_x;
+				ptr[n + i] = xform->offset_y;
+				ptr[2 * n + i] = gtc[i]->cos_theta[norm_id];
+				ptr[3 * n + i] = gtc[i]->sin_theta[norm_id];
+				ptr[4 * n + i] = xform->shear;
+				ptr[5 * n + i] = xform->scale_x;
+				ptr[6 * n + i] = xform->scale_y;
+			} else {
+				for (int c = 0; c < XFORM_COEFFS; c++)
+					ptr[c * n + i] = NAN;
+			}
+		}
+	}
+	return table;
+}
+
+static void xform_table_destroy(xform_table_t *table)
+{
+	if (!table)
+		return;
+	free(table->coeffs);
+	free(table);
+}
+
+// coefficients of a normalization ID for the samples starting from sample_beg
+static inline xform_row_t xform_table_row(const xform_table_t *table, int norm_id,
+					  int sample_beg)
+{
+	int n = table->n_samples;
+	float *ptr = table->coeffs + (size_t)norm_id * XFORM_COEFFS * n + sample_beg;
+	xform_row_t row = {ptr,		ptr + n,     ptr + 2 * n, ptr + 3 * n,
+			   ptr + 4 * n, ptr + 5 * n, ptr + 6 * n};
+	return row;
+}
+
 // compute normalized X Y intensities
-static void get_norm_xy(uint16_t raw_x, uint16_t raw_y, const gtc_t *gtc, const bpm_t *bpm,
-			int idx, float *norm_x, float *norm_y)
-{
-	if (bpm->norm_lookups && bpm->locus_entries[idx].norm_id != 0xFF) {
-		int norm_id = bpm->norm_lookups[bpm->locus_entries[idx].norm_id];
-		XForm *xform = gtc->normalization_transforms + norm_id;
-		float temp_x = (float)raw_x - xform->offset_x;
-		float temp_y = (float)raw_y - xform->offset_y;
-		float temp_x2 =
-			gtc->cos_theta[norm_id] * temp_x + gtc->sin_theta[norm_id] * temp_y;
-		float temp_y2 =
-			-gtc->sin_theta[norm_id] * temp_x + gtc->cos_theta[norm_id] * temp_y;
-		float temp_x3 = temp_x2 - xform->shear * temp_y2;
-		*norm_x = temp_x3 < 0.0f ? 0.0f : temp_x3 / xform->scale_x;
-		*norm_y = temp_y2 < 0.0f ? 0.0f : temp_y2 / xform->scale_y;
+static inline void get_norm_xy(uint16_t raw_x, uint16_t raw_y, const xform_row_t *xform, int i,
+			       float *norm_x, float *norm_y)
+{
+	if (xform) {
+		float temp_x = (float)raw_x - xform->offset_x[i];
+		float temp_y = (float)raw_y - xform->offset_y[i];
+		float temp_x2 = xform->cos_theta[i] * temp_x + xform->sin_theta[i] * temp_y;
+		float temp_y2 = -xform->sin_theta[i] * temp_x + xform->cos_theta[i] * temp_y;
+		float temp_x3 = temp_x2 - xform->shear[i] * temp_y2;
+		*norm_x = temp_x3 < 0.0f ? 0.0f : temp_x3 / xform->scale_x[i];
+		*norm_y = temp_y2 < 0.0f ? 0.0f : temp_y2 / xform->scale_y[i];
 	} else {
 		*norm_x = NAN;
 		*norm_y = NAN;
@@ -2082,46 +2825,102 @@ static inline void get_ilmn_theta_r(float norm_x, float norm_y, float *ilmn_thet
 	*ilmn_r = norm_x + norm_y;
 }
 
-static inline void get_intensities(gtc_t *gtc, const bpm_t *bpm, const egt_t *egt, int idx,
-				   intensities_t *intensities)
-{
-	get_element(gtc->raw_x, (void *)&intensities->raw_x, idx);
-	get_element(gtc->raw_y, (void *)&intensities->raw_y, idx);
-	get_norm_xy(intensities->raw_x, intensities->raw_y, gtc, bpm, idx, &intensities->norm_x,
-		    &intensities->norm_y);
-	get_ilmn_theta_r(intensities->norm_x, intensities->norm_y, &intensities->ilmn_theta,
-			 &intensities->ilmn_r);
-
-	if (bpm->norm_lookups && egt) {
-		get_baf_lrr(intensities->ilmn_theta, intensities->ilmn_r,
-			    egt->cluster_records[idx].aa_cluster_stats.theta_mean,
-			    egt->cluster_records[idx].ab_cluster_stats.theta_mean,
-			    egt->cluster_records[idx].bb_cluster_stats.theta_mean,
-			    egt->cluster_records[idx].aa_cluster_stats.r_mean,
-			    egt->cluster_records[idx].ab_cluster_stats.r_mean,
-			    egt->cluster_records[idx].bb_cluster_stats.r_mean,
-			    &intensities->baf, &intensities->lrr);
-	} else if (gtc->b_allele_freqs && gtc->logr_ratios) {
-		get_element(gtc->b_allele_freqs, (void *)&intensities->baf, idx);
-		get_element(gtc->logr_ratios, (void *)&intensities->lrr, idx);
-	} else {
-		intensities->baf = NAN;
-		intensities->lrr = NAN;
+// compute normalized intensities, Theta and R for a row of samples, the vector code performs
+// the same floating point operations in the same order as get_norm_xy() and
+// get_ilmn_theta_r() so the results do not depend on the instruction set used
+TARGET_CLONES static void get_intensities_row(const uint16_t *raw_x, const uint16_t *raw_y,
+					      const xform_row_t *xform, int n, float *norm_x,
+					      float *norm_y, float *ilmn_theta, float *ilmn_r)
+{
+	int i = 0;
+	if (xform) {
+		for (; i + VEC_LEN <= n; i += VEC_LEN) {
+			vfloat_t temp_x = vec_load_u16(raw_x + i) - vec_load(xform->offset_x + i);
+			vfloat_t temp_y = vec_load_u16(raw_y + i) - vec_load(xform->offset_y + i);
+			vfloat_t cos_theta = vec_load(xform->cos_theta + i);
+			vfloat_t sin_theta = vec_load(xform->sin_theta + i);
+			vfloat_t temp_x2 = cos_theta * temp_x + sin_theta * temp_y;
+			vfloat_t temp_y2 = -sin_theta * temp_x + cos_theta * temp_y;
+			vfloat_t temp_x3 = temp_x2 - vec_load(xform->shear + i) * temp_y2;
+			vfloat_t zero = vec_set1(0.0f);
+			vfloat_t x = vec_select(temp_x3 < zero, zero,
+						temp_x3 / vec_load(xform->scale_x + i));
+			vfloat_t y = vec_select(temp_y2 < zero, zero,
+						temp_y2 / vec_load(xform->scale_y + i));
+			vec_store(norm_x + i, x);
+			vec_store(norm_y + i, y);
+			vec_store(ilmn_theta + i, y / x);
+			vec_store(ilmn_r + i, x + y);
+		}
+	}
+	for (; i < n; i++) {
+		get_norm_xy(raw_x[i], raw_y[i], xform, i, &norm_x[i], &norm_y[i]);
+		ilmn_theta[i] = norm_y[i] / norm_x[i];
+		ilmn_r[i] = norm_x[i] + norm_y[i];
+	}
+	// there is no vectorized arctangent in the C library
+	for (i = 0; i < n; i++)
+		ilmn_theta[i] = atanf(ilmn_theta[i]) * (float)M_2_PI;
+}
+
+// compute BAF and LRR for a row of samples from the cluster centers of a locus, the vector code
+// performs the same floating point operations in the same order as get_baf_lrr()
+TARGET_CLONES static void get_baf_lrr_row(const float *ilmn_theta, const float *ilmn_r, int n,
+					  const locus_t *locus, float *baf, float *lrr)
+{
+	float aa_theta = locus->theta_mean[0];
+	float ab_theta = locus->theta_mean[1];
+	float bb_theta = locus->theta_mean[2];
+	float aa_r = locus->r_mean[0];
+	float ab_r = locus->r_mean[1];
+	float bb_r = locus->r_mean[2];
+	float slope_aa = (aa_r - ab_r) / (aa_theta - ab_theta);
+	float b_aa = aa_r - (aa_theta * slope_aa);
+	float slope_bb = (ab_r - bb_r) / (ab_theta - bb_theta);
+	float b_bb = ab_r - (ab_theta * slope_bb);
+
+	// the reference R value is stored in lrr until the logarithm is taken
+	int i = 0;
+	for (; i + VEC_LEN <= n; i += VEC_LEN) {
+		vfloat_t theta = vec_load(ilmn_theta + i);
+		vfloat_t nan = vec_set1(NAN);
+		vint_t eq = theta == ab_theta;
+		vint_t lt = theta < ab_theta;
+		vint_t gt = theta > ab_theta;
+		vfloat_t r_ref_aa = (slope_aa * theta) + b_aa;
+		vfloat_t r_ref_bb = (slope_bb * theta) + b_bb;
+		vfloat_t baf_aa = 0.5f - (ab_theta - theta) * 0.5f / (ab_theta - aa_theta);
+		vfloat_t baf_bb = 1.0f - (bb_theta - theta) * 0.5f / (bb_theta - ab_theta);
+		vec_store(lrr + i,
+			  vec_select(eq, vec_set1(ab_r),
+				     vec_select(lt, r_ref_aa, vec_select(gt, r_ref_bb, nan))));
+		vec_store(baf + i, vec_select(eq, vec_set1(0.5f),
+					      vec_select(lt, baf_aa, vec_select(gt, baf_bb, nan))));
 	}
+	for (; i < n; i++)
+		get_baf_lrr(ilmn_theta[i], ilmn_r[i], aa_theta, ab_theta, bb_theta, aa_r, ab_r,
+			    bb_r, &baf[i], &lrr[i]);
+	// there is no vectorized logarithm in the C library
+	for (i = 0; i < n - n % VEC_LEN; i++)
+		lrr[i] = isunordered(ilmn_theta[i], ab_theta)
+				 ? NAN
+				 : logf(ilmn_r[i] / lrr[i]) * (float)M_LOG2E;
 }
 
+// when resuming, the cluster record holds the counts and means of previously adjusted samples
+// which are updated exactly as if all samples had been adjusted at once
 static void adjust_clusters(const uint8_t *gts, const float *ilmn_theta, const float *ilmn_r,
-			    int n, ClusterRecord *cluster_record)
-{
-	cluster_record->aa_cluster_stats.N = 0;
-	cluster_record->ab_cluster_stats.N = 0;
-	cluster_record->bb_cluster_stats.N = 0;
-	cluster_record->aa_cluster_stats.theta_mean *= 0.2f;
-	cluster_record->ab_cluster_stats.theta_mean *= 0.2f;
-	cluster_record->bb_cluster_stats.theta_mean *= 0.2f;
-	cluster_record->aa_cluster_stats.r_mean *= 0.2f;
-	cluster_record->ab_cluster_stats.r_mean *= 0.2f;
-	cluster_record->bb_cluster_stats.r_mean *= 0.2f;
+			    int n, ClusterRecord *cluster_record, int resume)
+{
+	ClusterStats *stats[3] = {&cluster_record->aa_cluster_stats,
+				  &cluster_record->ab_cluster_stats,
+				  &cluster_record->bb_cluster_stats};
+	for (int i = 0; i < 3; i++) {
+		if (!resume)
+			stats[i]->N = 0;
+		stats[i]->theta_mean *= (float)stats[i]->N + 0.2f;
+		stats[i]->r_mean *= (float)stats[i]->N + 0.2f;
+	}
 
 	for (int i = 0; i < n; i++) {
 		switch (gts[i]) {
@@ -2160,48 +2959,715 @@ static void adjust_clusters(const uint8_t *gts, const float *ilmn_theta, const f
 }
 
 /****************************************
- * CONVERSION UTILITIES                 *
+ * LOCUS TILES COMPUTATIONS             *
  ****************************************/
 
-static inline char rev_allele(char allele)
+// number of sample by locus cells read and computed at once
+#define TILE_CELLS (1 << 18)
+
+// seconds spent in each conversion stage and input reads, summed across threads
+typedef struct {
+	double read;
+	double compute;
+	double encode;
+	double write;
+	double wait; // time the writer spent waiting for the other stages
+	uint64_t n_refills;
+	uint64_t n_bytes;
+} stage_times_t;
+
+// raw values and derived intensities for a block of consecutive loci, in locus-major order so
+// that the row for locus k is the contiguous array starting at index k * n_samples
+typedef struct {
+	int n_samples;
+	int n_loci;
+	int m_loci;
+	gtc_block_t *block;
+	xform_table_t *xforms;
+	int32_t *gq_arr;
+	float *baf_arr;
+	float *lrr_arr;
+	float *norm_x_arr;
+	float *norm_y_arr;
+	float *ilmn_r_arr;
+	float *ilmn_theta_arr;
+	int32_t *raw_x_arr;
+	int32_t *raw_y_arr;
+	const int *loci; // selected loci, or NULL if all loci are converted
+	int *order;	 // rows of the tile by increasing locus when loci are selected
+	int n_jobs;
+	struct tile_job_t *jobs; // jobs of the fill in flight
+} tile_t;
+
+typedef struct tile_job_t {
+	gtc_t **gtc;
+	const bpm_t *bpm;
+	const egt_t *egt;
+	tile_t *tile;
+	int locus_beg;
+	int sample_beg;
+	int sample_end;
+	stage_times_t times;
+} tile_job_t;
+
+static tile_t *tile_init(gtc_t **gtc, int n_samples, int num_loci)
 {
-	static const char allele_complement[128] = {
-		0, 0, 0, 0, 0,	 0,   0, 0,   0,   0, 0, 0,   0, 0,   0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0,	 0,   0, 0,   0,   0, 0, 0,   0, 0,   0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0,	 0,   0, 0,   0,   0, 0, 0,   0, 0,   0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 0,	 'T', 0, 'G', 'I', 0, 0, 'C', 0, 'D', 0, 0, 0, 0, 0, 0,
-		0, 0, 0, 0, 'A', 0,   0, 0,   0,   0, 0, 0,   0, 0,   0, 0,
-	};
-	if (allele > 95)
-		return 0;
-	return allele_complement[(int)allele];
+	tile_t *tile = (tile_t *)calloc(1, sizeof(tile_t));
+	tile->n_samples = n_samples;
+	tile->m_loci = n_samples > 0 ? TILE_CELLS / n_samples : 1;
+	if (tile->m_loci < 1)
+		tile->m_loci = 1;
+	if (tile->m_loci > num_loci)
+		tile->m_loci = num_loci > 0 ? num_loci : 1;
+	tile->block = gtc_block_init(n_samples, tile->m_loci);
+	tile->xforms = xform_table_init(gtc, n_samples);
+	size_t n_cells = (size_t)tile->m_loci * n_samples;
+	tile->gq_arr = (int32_t *)malloc(n_cells * sizeof(int32_t));
+	tile->baf_arr = (float *)malloc(n_cells * sizeof(float));
+	tile->lrr_arr = (float *)malloc(n_cells * sizeof(float));
+	tile->norm_x_arr = (float *)malloc(n_cells * sizeof(float));
+	tile->norm_y_arr = (float *)malloc(n_cells * sizeof(float));
+	tile->ilmn_r_arr = (float *)malloc(n_cells * sizeof(float));
+	tile->ilmn_theta_arr = (float *)malloc(n_cells * sizeof(float));
+	tile->raw_x_arr = (int32_t *)malloc(n_cells * sizeof(int32_t));
+	tile->raw_y_arr = (int32_t *)malloc(n_cells * sizeof(int32_t));
+	return tile;
 }
 
-static void gtcs_to_gs(gtc_t **gtc, int n, const bpm_t *bpm, const egt_t *egt, FILE *stream)
+// manifest index of the k-th locus of a tile starting at locus_beg
+static inline int tile_locus(const tile_t *tile, int locus_beg, int k)
 {
-	// print header
-	fprintf(stream,
-		"Index\tName\tAddress\tChr\tPosition\tGenTrain Score\tFrac A\tFrac C\tFrac G\tFrac T");
-	for (int i = 0; i < n; i++)
-		fprintf(stream,
-			"\t%s.GType\t%s.Score\t%s.Theta\t%s.R\t%s.B Allele Freq\t%s.Log R Ratio\t%s.Top Alleles\t%s.Plus/Minus Alleles",
-			gtc[i]->display_name, gtc[i]->display_name, gtc[i]->display_name,
-			gtc[i]->display_name, gtc[i]->display_name, gtc[i]->display_name,
-			gtc[i]->display_name, gtc[i]->display_name);
-	fprintf(stream, "\n");
+	return tile->loci ? tile->loci[locus_beg + k] : locus_beg + k;
+}
 
-	// print loci
-	for (int j = 0; j < bpm->num_loci; j++) {
-		LocusEntry *locus_entry = &bpm->locus_entries[j];
-		int strand =
-			!locus_entry->ref_strand
-				? -1
-				: (strcmp(locus_entry->ref_strand, "+") == 0
-					   ? 0
-					   : (strcmp(locus_entry->ref_strand, "-") == 0 ? 1
-											: -1));
-		if (strand < 0)
-			error("Unable to process reference strand %s\n",
+static void tile_destroy(tile_t *tile)
+{
+	if (!tile)
+		return;
+	gtc_block_destroy(tile->block);
+	xform_table_destroy(tile->xforms);
+	free(tile->gq_arr);
+	free(tile->baf_arr);
+	free(tile->lrr_arr);
+	free(tile->norm_x_arr);
+	free(tile->norm_y_arr);
+	free(tile->ilmn_r_arr);
+	free(tile->ilmn_theta_arr);
+	free(tile->raw_x_arr);
+	free(tile->raw_y_arr);
+	free(tile->jobs);
+	free(tile->order);
+	free(tile);
+}
+
+// each sample only touches its own GTC buffers and its own column of the tile so that
+// disjoint sample ranges can be read and computed concurrently
+static void tile_compute(gtc_t **gtc, const bpm_t *bpm, const egt_t *egt, tile_t *tile,
+			 int locus_beg, int sample_beg, int sample_end, stage_times_t *times)
+{
+	int n = tile->n_samples;
+	int m = sample_end - sample_beg;
+	gtc_block_t *block = tile->block;
+	double t0 = wall_time();
+	uint64_t n_refills, n_bytes, n_refills_end, n_bytes_end;
+	gtc_io_counts(gtc, sample_beg, sample_end, &n_refills, &n_bytes);
+	float *buffer = (float *)malloc(tile->n_loci * sizeof(float));
+	gtc_block_read(gtc, block, locus_beg, tile->n_loci, tile->loci, tile->order, sample_beg,
+		       sample_end, (void *)buffer);
+	free(buffer);
+	gtc_io_counts(gtc, sample_beg, sample_end, &n_refills_end, &n_bytes_end);
+	times->n_refills += n_refills_end - n_refills;
+	times->n_bytes += n_bytes_end - n_bytes;
+	double t1 = wall_time();
+	for (int k = 0; k < tile->n_loci; k++) {
+		int j = tile_locus(tile, locus_beg, k);
+		size_t row = (size_t)k * n + sample_beg;
+		for (size_t idx = row; idx < row + m; idx++) {
+			// IDAT files have no genotype scores, which are then NaN
+			float score = block->genotype_scores[idx];
+			if (isnan(score)) {
+				tile->gq_arr[idx] = bcf_int32_missing;
+			} else {
+				tile->gq_arr[idx] = (int)(-10 * log10(1 - score) + .5);
+				if (tile->gq_arr[idx] < 0)
+					tile->gq_arr[idx] = 0;
+				if (tile->gq_arr[idx] > 50)
+					tile->gq_arr[idx] = 50;
+			}
+			tile->raw_x_arr[idx] = (int32_t)block->raw_x[idx];
+			tile->raw_y_arr[idx] = (int32_t)block->raw_y[idx];
+		}
+
+		xform_row_t xform_row;
+		const xform_row_t *xform = NULL;
+		const locus_t *locus = &bpm->loci[j];
+		if (locus->norm_lookup != 0xFF) {
+			int norm_id = locus->norm_lookup;
+			if (norm_id < tile->xforms->n_norm_ids) {
+				xform_row = xform_table_row(tile->xforms, norm_id, sample_beg);
+				xform = &xform_row;
+			}
+		}
+		get_intensities_row(block->raw_x + row, block->raw_y + row, xform, m,
+				    tile->norm_x_arr + row, tile->norm_y_arr + row,
+				    tile->ilmn_theta_arr + row, tile->ilmn_r_arr + row);
+
+		if (bpm->norm_lookups && egt) {
+			get_baf_lrr_row(tile->ilmn_theta_arr + row, tile->ilmn_r_arr + row, m,
+					locus, tile->baf_arr + row, tile->lrr_arr + row);
+		} else {
+			for (int i = 0; i < m; i++) {
+				const gtc_t *g = gtc[sample_beg + i];
+				int has_baf_lrr = g->b_allele_freqs && g->logr_ratios;
+				tile->baf_arr[row + i] =
+					has_baf_lrr ? block->b_allele_freqs[row + i] : NAN;
+				tile->lrr_arr[row + i] =
+					has_baf_lrr ? block->logr_ratios[row + i] : NAN;
+			}
+		}
+	}
+	times->read += t1 - t0;
+	times->compute += wall_time() - t1;
+}
+
+static void *tile_job_run(void *arg)
+{
+	tile_job_t *job = (tile_job_t *)arg;
+	tile_compute(job->gtc, job->bpm, job->egt, job->tile, job->locus_beg, job->sample_beg,
+		     job->sample_end, &job->times);
+	return NULL;
+}
+
+static int int_pair_cmp(const void *a, const void *b)
+{
+	const int *x = (const int *)a, *y = (const int *)b;
+	return x[0] != y[0] ? (x[0] < y[0] ? -1 : 1) : (x[1] > y[1]) - (x[1] < y[1]);
+}
+
+// selected loci need not be in manifest order so the rows of the tile are read by increasing
+// locus to keep the input buffers moving forward
+static void tile_order(tile_t *tile, int locus_beg)
+{
+	if (!tile->order)
+		tile->order = (int *)malloc(tile->m_loci * sizeof(int));
+	int *pairs = (int *)malloc(tile->n_loci * 2 * sizeof(int));
+	for (int k = 0; k < tile->n_loci; k++) {
+		pairs[2 * k] = tile->loci[locus_beg + k];
+		pairs[2 * k + 1] = k;
+	}
+	qsort(pairs, tile->n_loci, 2 * sizeof(int), int_pair_cmp);
+	for (int k = 0; k < tile->n_loci; k++)
+		tile->order[k] = pairs[2 * k + 1];
+	free(pairs);
+}
+
+// start reading and computing a tile of loci splitting the samples across the thread pool
+// workers, without a thread pool the tile is filled before returning
+static void tile_dispatch(gtc_t **gtc, const bpm_t *bpm, const egt_t *egt, tile_t *tile,
+			  int locus_beg, int n_loci, hts_tpool *pool, hts_tpool_process *q)
+{
+	int n = tile->n_samples;
+	tile->n_loci = n_loci;
+	tile->block->n_loci = n_loci;
+	if (tile->loci)
+		tile_order(tile, locus_beg);
+	int n_jobs = pool ? hts_tpool_size(pool) : 1;
+	if (n_jobs > n)
+		n_jobs = n > 0 ? n : 1;
+	if (!tile->jobs)
+		tile->jobs = (tile_job_t *)malloc(n_jobs * sizeof(tile_job_t));
+	tile->n_jobs = n_jobs;
+	for (int i = 0; i < n_jobs; i++) {
+		tile_job_t *job = &tile->jobs[i];
+		job->gtc = gtc;
+		job->bpm = bpm;
+		job->egt = egt;
+		job->tile = tile;
+		job->locus_beg = locus_beg;
+		job->sample_beg = (int)((int64_t)n * i / n_jobs);
+		job->sample_end = (int)((int64_t)n * (i + 1) / n_jobs);
+		memset(&job->times, 0, sizeof(stage_times_t));
+		if (!pool)
+			tile_job_run((void *)job);
+		else if (hts_tpool_dispatch(pool, q, tile_job_run, (void *)job) < 0)
+			error("Failed to dispatch job to the thread pool\n");
+	}
+}
+
+// wait for a dispatched tile to be filled, results do not depend on the number of threads used
+static void tile_wait(tile_t *tile, hts_tpool_process *q, stage_times_t *times)
+{
+	double t0 = wall_time();
+	if (q && hts_tpool_process_flush(q) < 0)
+		error("Failed to flush the thread pool\n");
+	if (times) {
+		times->wait += wall_time() - t0;
+		for (int i = 0; i < tile->n_jobs; i++) {
+			times->read += tile->jobs[i].times.read;
+			times->compute += tile->jobs[i].times.compute;
+			times->n_refills += tile->jobs[i].times.n_refills;
+			times->n_bytes += tile->jobs[i].times.n_bytes;
+		}
+	}
+}
+
+static void tile_fill(gtc_t **gtc, const bpm_t *bpm, const egt_t *egt, tile_t *tile,
+		      int locus_beg, int n_loci, hts_tpool *pool, hts_tpool_process *q)
+{
+	tile_dispatch(gtc, bpm, egt, tile, locus_beg, n_loci, pool, q);
+	tile_wait(tile, q, NULL);
+}
+
+// with coordinate sorted output each tile holds loci from across the whole manifest, so rather
+// than refilling the buffers of every array for every tile the selected elements of the arrays
+// read from a stream are gathered once in file order and kept in memory in output order
+static buffer_array_t *buffer_array_stage(buffer_array_t *arr, const int *loci, const int *order,
+					  int n_loci, const void *missing)
+{
+	if (!arr || arr->is_mapped || !arr->handle)
+		return arr;
+	char *buffer = (char *)malloc((size_t)n_loci * arr->item_size);
+	gather_elements(arr, (void *)buffer, 1, loci, order, n_loci, arr->item_size, missing);
+	buffer_array_t *staged = buffer_array_wrap((void *)buffer, n_loci, arr->item_size);
+	staged->is_staged = 1;
+	staged->n_refills = arr->n_refills;
+	staged->n_bytes = arr->n_bytes;
+	buffer_array_destroy(arr);
+	return staged;
+}
+
+typedef struct {
+	gtc_t *gtc;
+	const int *loci;
+	const int *order;
+	int n_loci;
+} stage_job_t;
+
+static void *stage_job_run(void *arg)
+{
+	static const uint16_t raw_missing = 0;
+	static const uint8_t genotype_missing = 0;
+	static const BaseCall base_call_missing = {'-', '-'};
+	const float float_missing = NAN;
+	stage_job_t *job = (stage_job_t *)arg;
+	gtc_t *gtc = job->gtc;
+	const int *loci = job->loci, *order = job->order;
+	int n = job->n_loci;
+	gtc->raw_x = buffer_array_stage(gtc->raw_x, loci, order, n, (const void *)&raw_missing);
+	gtc->raw_y = buffer_array_stage(gtc->raw_y, loci, order, n, (const void *)&raw_missing);
+	gtc->genotypes =
+		buffer_array_stage(gtc->genotypes, loci, order, n, (const void *)&genotype_missing);
+	gtc->base_calls = buffer_array_stage(gtc->base_calls, loci, order, n,
+					     (const void *)&base_call_missing);
+	gtc->genotype_scores = buffer_array_stage(gtc->genotype_scores, loci, order, n,
+						  (const void *)&float_missing);
+	gtc->b_allele_freqs = buffer_array_stage(gtc->b_allele_freqs, loci, order, n,
+						 (const void *)&float_missing);
+	gtc->logr_ratios =
+		buffer_array_stage(gtc->logr_ratios, loci, order, n, (const void *)&float_missing);
+	return NULL;
+}
+
+// loci selected in manifest order are read by moving the buffers forward and are not staged
+static void gtcs_stage_loci(gtc_t **gtc, int n, const int *loci, int n_loci, hts_tpool *pool)
+{
+	if (!loci)
+		return;
+	int l;
+	for (l = 1; l < n_loci && loci[l - 1] < loci[l]; l++)
+		;
+	if (l >= n_loci)
+		return;
+	fprintf(stderr, "Reading the %d selected loci of the GTC files in manifest order\n",
+		n_loci);
+	int *pairs = (int *)malloc(n_loci * 2 * sizeof(int));
+	for (int k = 0; k < n_loci; k++) {
+		pairs[2 * k] = loci[k];
+		pairs[2 * k + 1] = k;
+	}
+	qsort(pairs, n_loci, 2 * sizeof(int), int_pair_cmp);
+	int *order = (int *)malloc(n_loci * sizeof(int));
+	for (int k = 0; k < n_loci; k++)
+		order[k] = pairs[2 * k + 1];
+	free(pairs);
+
+	stage_job_t *jobs = (stage_job_t *)malloc(n * sizeof(stage_job_t));
+	hts_tpool_process *q =
+		pool ? hts_tpool_process_init(pool, 2 * hts_tpool_size(pool), 1) : NULL;
+	for (int i = 0; i < n; i++) {
+		stage_job_t *job = &jobs[i];
+		job->gtc = gtc[i];
+		job->loci = loci;
+		job->order = order;
+		job->n_loci = n_loci;
+		if (!pool)
+			stage_job_run((void *)job);
+		else if (hts_tpool_dispatch(pool, q, stage_job_run, (void *)job) < 0)
+			error("Failed to dispatch job to the thread pool\n");
+	}
+	if (q && hts_tpool_process_flush(q) < 0)
+		error("Failed to flush the thread pool\n");
+	if (q)
+		hts_tpool_process_destroy(q);
+	free(jobs);
+	free(order);
+}
+
+/****************************************
+ * INPUT FILES LOADING                  *
+ ****************************************/
+
+typedef struct {
+	const char *fn;
+	size_t capacity;
+	const bpm_t *bpm; // manifest to check GTC files against, if any
+	int flags;
+	void *file;
+	int mismatch;
+	double time;
+} load_job_t;
+
+static void *load_job_run(void *arg)
+{
+	load_job_t *job = (load_job_t *)arg;
+	double t0 = wall_time();
+	if (job->flags & LOAD_IDAT) {
+		job->file = (void *)idat_init(job->fn, job->capacity);
+	} else {
+		gtc_t *gtc = gtc_init(job->fn, job->capacity);
+		// GenCall fills the GTC SNP manifest with the BPM file name rather than the BPM
+		// manifest name
+		const bpm_t *bpm = job->bpm;
+		job->mismatch =
+			bpm && strcmp(bpm->manifest_name, gtc->snp_manifest)
+			&& strcmp(strrchr(bpm->fn, '/') ? strrchr(bpm->fn, '/') + 1 : bpm->fn,
+				  gtc->snp_manifest);
+		job->file = (void *)gtc;
+	}
+	job->time = wall_time() - t0;
+	return NULL;
+}
+
+// open the input files and read their metadata across the thread pool, with messages and
+// manifest mismatches reported in input order
+static void files_load(char **filenames, int nfiles, size_t capacity, const bpm_t *bpm,
+		       hts_tpool *pool, int flags, void **files)
+{
+	if (nfiles == 0)
+		return;
+	const char *type = flags & LOAD_IDAT ? "IDAT" : "GTC";
+	fprintf(stderr, "Reading %d %s files\n", nfiles, type);
+	double t0 = wall_time();
+	load_job_t *jobs = (load_job_t *)calloc(nfiles, sizeof(load_job_t));
+	hts_tpool_process *q =
+		pool ? hts_tpool_process_init(pool, 2 * hts_tpool_size(pool), 1) : NULL;
+	for (int i = 0; i < nfiles; i++) {
+		load_job_t *job = &jobs[i];
+		job->fn = filenames[i];
+		job->capacity = capacity;
+		job->bpm = bpm;
+		job->flags = flags;
+		if (!pool)
+			load_job_run((void *)job);
+		else if (hts_tpool_dispatch(pool, q, load_job_run, (void *)job) < 0)
+			error("Failed to dispatch job to the thread pool\n");
+	}
+	if (q && hts_tpool_process_flush(q) < 0)
+		error("Failed to flush the thread pool\n");
+
+	double time = 0.0;
+	for (int i = 0; i < nfiles; i++) {
+		if (flags & VERBOSE)
+			fprintf(stderr, "Read %s file %s in %.2f seconds\n", type, jobs[i].fn,
+				jobs[i].time);
+		if (jobs[i].mismatch) {
+			gtc_t *gtc = (gtc_t *)jobs[i].file;
+			error("Manifest name %s in BPM file %s does not match manifest name %s in GTC file %s\nUse --do-not-check-bpm to suppress this check\n",
+			      bpm->manifest_name, bpm->fn, gtc->snp_manifest, gtc->fn);
+		}
+		files[i] = jobs[i].file;
+		time += jobs[i].time;
+	}
+	fprintf(stderr, "Seconds elapsed/reading:\t%.2f/%.2f\n", wall_time() - t0, time);
+
+	if (q)
+		hts_tpool_process_destroy(q);
+	free(jobs);
+}
+
+/****************************************
+ * IDAT INTENSITIES                     *
+ ****************************************/
+
+// IDAT files of the same chip list the same bead type addresses, so the positions of the raw X
+// and Y intensities of each locus are looked up once and shared across all pairs of files,
+// positions index the green means followed by the red means, or are -1 if missing
+typedef struct {
+	int32_t num_snps;
+	int32_t *ilmn_ids;
+	int32_t *x_idx;
+	int32_t *y_idx;
+} address_table_t;
+
+static int32_t *idat_ilmn_ids(idat_t *idat)
+{
+	int32_t *ilmn_ids = (int32_t *)malloc(idat->num_snps * sizeof(int32_t));
+	if (get_elements(idat->ilmn_id, (void *)ilmn_ids, 0, idat->num_snps) < 0)
+		error("Failed to read the bead type addresses from IDAT file %s\n", idat->fn);
+	return ilmn_ids;
+}
+
+static inline int address_lookup(const int *pairs, int n, int32_t address)
+{
+	if (address == 0)
+		return -1;
+	int lo = 0, hi = n;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		if (pairs[2 * mid] < address)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < n && pairs[2 * lo] == address ? pairs[2 * lo + 1] : -1;
+}
+
+// the table takes ownership of the list of bead type addresses
+static address_table_t *address_table_init(const bpm_t *bpm, int32_t *ilmn_ids, int num_snps)
+{
+	address_table_t *table = (address_table_t *)calloc(1, sizeof(address_table_t));
+	table->num_snps = num_snps;
+	table->ilmn_ids = ilmn_ids;
+	int *pairs = (int *)malloc(num_snps * 2 * sizeof(int));
+	for (int i = 0; i < num_snps; i++) {
+		pairs[2 * i] = ilmn_ids[i];
+		pairs[2 * i + 1] = i;
+	}
+	qsort(pairs, num_snps, 2 * sizeof(int), int_pair_cmp);
+
+	table->x_idx = (int32_t *)malloc(bpm->num_loci * sizeof(int32_t));
+	table->y_idx = (int32_t *)malloc(bpm->num_loci * sizeof(int32_t));
+	for (int j = 0; j < bpm->num_loci; j++) {
+		const LocusEntry *locus_entry = &bpm->locus_entries[j];
+		int idx_a = address_lookup(pairs, num_snps, locus_entry->address_a);
+		int idx_b = address_lookup(pairs, num_snps, locus_entry->address_b);
+		int x_idx = -1, y_idx = -1;
+		if (locus_entry->address_b == 0) {
+			// Infinium II beads report the A allele in red and the B allele in green
+			if (idx_a >= 0) {
+				x_idx = num_snps + idx_a;
+				y_idx = idx_a;
+			}
+		} else if (locus_entry->assay_type == 1 || locus_entry->assay_type == 2) {
+			// Infinium I beads report both alleles in red for A/T or green for G/C
+			int offset = locus_entry->assay_type == 1 ? num_snps : 0;
+			if (idx_a >= 0)
+				x_idx = offset + idx_a;
+			if (idx_b >= 0)
+				y_idx = offset + idx_b;
+		}
+		table->x_idx[j] = x_idx;
+		table->y_idx[j] = y_idx;
+	}
+	free(pairs);
+	return table;
+}
+
+static void address_table_destroy(address_table_t *table)
+{
+	if (!table)
+		return;
+	free(table->ilmn_ids);
+	free(table->x_idx);
+	free(table->y_idx);
+	free(table);
+}
+
+static inline int address_table_match(const address_table_t *table, const int32_t *ilmn_ids,
+				      int num_snps)
+{
+	return table->num_snps == num_snps
+	       && !memcmp(table->ilmn_ids, ilmn_ids, num_snps * sizeof(int32_t));
+}
+
+typedef struct {
+	idat_t *grn;
+	idat_t *red;
+	const bpm_t *bpm;
+	const address_table_t *table;
+	gtc_t *gtc;
+} idat_job_t;
+
+// build a GTC structure with only the raw intensities of a pair of green and red IDAT files
+static void *idat_job_run(void *arg)
+{
+	idat_job_t *job = (idat_job_t *)arg;
+	idat_t *grn = job->grn, *red = job->red;
+	int num_snps = grn->num_snps;
+	int32_t *ilmn_ids = idat_ilmn_ids(grn);
+	int32_t *red_ilmn_ids = idat_ilmn_ids(red);
+	if (red->num_snps != num_snps
+	    || memcmp(ilmn_ids, red_ilmn_ids, num_snps * sizeof(int32_t)))
+		error("IDAT files %s and %s do not list the same bead types\n", grn->fn, red->fn);
+	free(red_ilmn_ids);
+	address_table_t *table = NULL;
+	if (address_table_match(job->table, ilmn_ids, num_snps))
+		free(ilmn_ids);
+	else
+		table = address_table_init(job->bpm, ilmn_ids, num_snps);
+	const address_table_t *t = table ? table : job->table;
+
+	uint16_t *means = (uint16_t *)malloc(num_snps * 2 * sizeof(uint16_t));
+	if (get_elements(grn->mean, (void *)means, 0, num_snps) < 0)
+		error("Failed to read the mean intensities from IDAT file %s\n", grn->fn);
+	if (get_elements(red->mean, (void *)(means + num_snps), 0, num_snps) < 0)
+		error("Failed to read the mean intensities from IDAT file %s\n", red->fn);
+	int num_loci = job->bpm->num_loci;
+	uint16_t *raw_x = (uint16_t *)malloc(num_loci * sizeof(uint16_t));
+	uint16_t *raw_y = (uint16_t *)malloc(num_loci * sizeof(uint16_t));
+	for (int j = 0; j < num_loci; j++) {
+		raw_x[j] = t->x_idx[j] < 0 ? 0 : means[t->x_idx[j]];
+		raw_y[j] = t->y_idx[j] < 0 ? 0 : means[t->y_idx[j]];
+	}
+	free(means);
+	address_table_destroy(table);
+
+	gtc_t *gtc = (gtc_t *)calloc(1, sizeof(gtc_t));
+	const char *ptr = strrchr(grn->fn, '/') ? strrchr(grn->fn, '/') + 1 : grn->fn;
+	gtc->fn = strndup(grn->fn, strlen(grn->fn) - 9 - gz_suffix_len(grn->fn));
+	gtc->display_name = strndup(ptr, strlen(ptr) - 9 - gz_suffix_len(ptr));
+	gtc->num_snps = num_loci;
+	gtc->gender = 'U';
+	gtc->raw_x = buffer_array_wrap((void *)raw_x, num_loci, sizeof(uint16_t));
+	gtc->raw_y = buffer_array_wrap((void *)raw_y, num_loci, sizeof(uint16_t));
+	job->gtc = gtc;
+	return NULL;
+}
+
+static inline int idat_channel(const char *fn)
+{
+	size_t len = strlen(fn) - gz_suffix_len(fn);
+	if (len >= 9 && !strncmp(fn + len - 9, "_Grn.idat", 9))
+		return 0;
+	if (len >= 9 && !strncmp(fn + len - 9, "_Red.idat", 9))
+		return 1;
+	return -1;
+}
+
+// pair green and red IDAT files by name and extract their raw intensities across the thread
+// pool, samples are in order of first appearance of either file of the pair
+static gtc_t **idats_to_gtcs(idat_t **idats, int n, const bpm_t *bpm, hts_tpool *pool,
+			     int *n_pairs)
+{
+	void *prefixes = khash_str2int_init();
+	idat_job_t *jobs = (idat_job_t *)calloc(n, sizeof(idat_job_t));
+	int m = 0;
+	for (int i = 0; i < n; i++) {
+		int channel = idat_channel(idats[i]->fn);
+		if (channel < 0)
+			error("IDAT file %s is neither a _Grn.idat nor a _Red.idat file\n",
+			      idats[i]->fn);
+		size_t len = strlen(idats[i]->fn) - 9 - gz_suffix_len(idats[i]->fn);
+		char *prefix = strndup(idats[i]->fn, len);
+		int idx;
+		if (khash_str2int_get(prefixes, prefix, &idx) < 0) {
+			idx = m++;
+			khash_str2int_set(prefixes, prefix, idx);
+		} else {
+			free(prefix);
+		}
+		idat_t **ptr = channel ? &jobs[idx].red : &jobs[idx].grn;
+		if (*ptr)
+			error("IDAT file %s is listed more than once\n", idats[i]->fn);
+		*ptr = idats[i];
+	}
+	khash_str2int_destroy_free(prefixes);
+	for (int i = 0; i < m; i++)
+		if (!jobs[i].grn || !jobs[i].red)
+			error("IDAT file %s has no matching %s file\n",
+			      jobs[i].grn ? jobs[i].grn->fn : jobs[i].red->fn,
+			      jobs[i].grn ? "_Red.idat" : "_Grn.idat");
+
+	fprintf(stderr, "Extracting intensities from %d pairs of IDAT files\n", m);
+	double t0 = wall_time();
+	address_table_t *table =
+		m > 0 ? address_table_init(bpm, idat_ilmn_ids(jobs[0].grn), jobs[0].grn->num_snps)
+		      : NULL;
+	hts_tpool_process *q =
+		pool ? hts_tpool_process_init(pool, 2 * hts_tpool_size(pool), 1) : NULL;
+	for (int i = 0; i < m; i++) {
+		idat_job_t *job = &jobs[i];
+		job->bpm = bpm;
+		job->table = table;
+		if (!pool)
+			idat_job_run((void *)job);
+		else if (hts_tpool_dispatch(pool, q, idat_job_run, (void *)job) < 0)
+			error("Failed to dispatch job to the thread pool\n");
+	}
+	if (q && hts_tpool_process_flush(q) < 0)
+		error("Failed to flush the thread pool\n");
+	fprintf(stderr, "Seconds elapsed:\t%.2f\n", wall_time() - t0);
+
+	gtc_t **gtcs = (gtc_t **)malloc(m * sizeof(gtc_t *));
+	for (int i = 0; i < m; i++)
+		gtcs[i] = jobs[i].gtc;
+	if (q)
+		hts_tpool_process_destroy(q);
+	address_table_destroy(table);
+	free(jobs);
+	*n_pairs = m;
+	return gtcs;
+}
+
+/****************************************
+ * CONVERSION UTILITIES                 *
+ ****************************************/
+
+static inline char rev_allele(char allele)
+{
+	static const char allele_complement[128] = {
+		0, 0, 0, 0, 0,	 0,   0, 0,   0,   0, 0, 0,   0, 0,   0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0,	 0,   0, 0,   0,   0, 0, 0,   0, 0,   0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0,	 0,   0, 0,   0,   0, 0, 0,   0, 0,   0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0,	 'T', 0, 'G', 'I', 0, 0, 'C', 0, 'D', 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 'A', 0,   0, 0,   0,   0, 0, 0,   0, 0,   0, 0,
+	};
+	if (allele > 95)
+		return 0;
+	return allele_complement[(int)allele];
+}
+
+static void gtcs_to_gs(gtc_t **gtc, int n, const bpm_t *bpm, const egt_t *egt,
+		       const int *loci, int n_selected, FILE *stream, hts_tpool *pool)
+{
+	// print header
+	fprintf(stream,
+		"Index\tName\tAddress\tChr\tPosition\tGenTrain Score\tFrac A\tFrac C\tFrac G\tFrac T");
+	for (int i = 0; i < n; i++)
+		fprintf(stream,
+			"\t%s.GType\t%s.Score\t%s.Theta\t%s.R\t%s.B Allele Freq\t%s.Log R Ratio\t%s.Top Alleles\t%s.Plus/Minus Alleles",
+			gtc[i]->display_name, gtc[i]->display_name, gtc[i]->display_name,
+			gtc[i]->display_name, gtc[i]->display_name, gtc[i]->display_name,
+			gtc[i]->display_name, gtc[i]->display_name);
+	fprintf(stream, "\n");
+
+	// print loci
+	int n_loci = loci ? n_selected : bpm->num_loci;
+	tile_t *tile = tile_init(gtc, n, n_loci);
+	tile->loci = loci;
+	fprintf(stderr, "Processing tiles of %d loci by %d samples\n", tile->m_loci, n);
+	hts_tpool_process *q =
+		pool ? hts_tpool_process_init(pool, 2 * hts_tpool_size(pool), 1) : NULL;
+	for (int l = 0; l < n_loci; l++) {
+		int j = loci ? loci[l] : l;
+		int k = l % tile->m_loci;
+		if (k == 0)
+			tile_fill(gtc, bpm, egt, tile, l, min(tile->m_loci, n_loci - l), pool, q);
+		LocusEntry *locus_entry = &bpm->locus_entries[j];
+		const locus_t *locus = &bpm->loci[j];
+		int strand = locus->strand;
+		if (strand < 0)
+			error("Unable to process reference strand %s\n",
 			      locus_entry->ref_strand);
 		fprintf(stream, "%d\t%s\t%d\t%s\t%s\t%f\t%f\t%f\t%f\t%f",
 			bpm->indexes ? bpm->indexes[j] : j, locus_entry->name,
@@ -2210,18 +3676,12 @@ static void gtcs_to_gs(gtc_t **gtc, int n, const bpm_t *bpm, const egt_t *egt, F
 			locus_entry->frac_a, locus_entry->frac_c, locus_entry->frac_g,
 			locus_entry->frac_t);
 		for (int i = 0; i < n; i++) {
-			uint8_t genotype;
-			get_element(gtc[i]->genotypes, (void *)&genotype, j);
-			float genotype_score;
-			get_element(gtc[i]->genotype_scores, (void *)&genotype_score, j);
-			BaseCall base_call;
-			get_element(gtc[i]->base_calls, (void *)&base_call, j);
-			intensities_t intensities;
-			get_intensities(gtc[i], bpm, egt, j, &intensities);
-			char allele_a =
-				strand ? rev_allele(locus_entry->snp[1]) : locus_entry->snp[1];
-			char allele_b =
-				strand ? rev_allele(locus_entry->snp[3]) : locus_entry->snp[3];
+			size_t idx = (size_t)k * n + i;
+			uint8_t genotype = tile->block->genotypes[idx];
+			float genotype_score = tile->block->genotype_scores[idx];
+			const char *base_call = tile->block->base_calls[idx];
+			char allele_a = strand ? rev_allele(locus->allele_a) : locus->allele_a;
+			char allele_b = strand ? rev_allele(locus->allele_b) : locus->allele_b;
 			BaseCall ref_call;
 			switch (genotype) {
 			case GT_NC:
@@ -2245,12 +3705,16 @@ static void gtcs_to_gs(gtc_t **gtc, int n, const bpm_t *bpm, const egt_t *egt, F
 				break;
 			}
 			fprintf(stream, "\t%s\t%f\t%f\t%f\t%f\t%f\t%c%c\t%c%c",
-				code2genotype[genotype], genotype_score, intensities.ilmn_theta,
-				intensities.ilmn_r, intensities.baf, intensities.lrr,
-				base_call[0], base_call[1], ref_call[0], ref_call[1]);
+				code2genotype[genotype], genotype_score,
+				tile->ilmn_theta_arr[idx], tile->ilmn_r_arr[idx],
+				tile->baf_arr[idx], tile->lrr_arr[idx], base_call[0],
+				base_call[1], ref_call[0], ref_call[1]);
 		}
 		fprintf(stream, "\n");
 	}
+	tile_destroy(tile);
+	if (q)
+		hts_tpool_process_destroy(q);
 }
 
 static bcf_hdr_t *hdr_init(const faidx_t *fai, int flags)
@@ -2433,266 +3897,1593 @@ static int gts_to_gt_arr(int32_t *gt_arr, const uint8_t *gts, int n, int allele_
 	return 0;
 }
 
-static void gtcs_to_vcf(faidx_t *fai, const bpm_t *bpm, const egt_t *egt, gtc_t **gtc, int n,
-			htsFile *out_fh, bcf_hdr_t *hdr, int flags)
+/****************************************
+ * MARKER SITES                         *
+ ****************************************/
+
+// position and alleles of a marker resolved against the reference
+typedef struct {
+	int32_t rid; // negative if the marker could not be localized
+	hts_pos_t pos;
+	int32_t allele_a_idx, allele_b_idx;
+	int32_t nals;
+	int32_t missing; // whether the reference alleles could not be determined
+	size_t alleles_offset; // alleles are stored NUL-separated in the string pool
+} site_t;
+
+typedef struct {
+	int n_sites;
+	site_t *sites;
+	kstring_t alleles;
+} sites_t;
+
+static int site_cmp(const void *a, const void *b)
 {
-	if (bcf_hdr_write(out_fh, hdr) < 0)
-		error("Unable to write to output VCF file\n");
+	const site_t *x = *(const site_t **)a, *y = *(const site_t **)b;
+	if (x->rid != y->rid)
+		return x->rid < y->rid ? -1 : 1;
+	if (x->pos != y->pos)
+		return x->pos < y->pos ? -1 : 1;
+	return x < y ? -1 : (x > y);
+}
+
+// markers are resolved in coordinate order so that each reference window is only loaded once,
+// if a list of selected loci is given the other markers are left unresolved
+static sites_t *sites_init(ref_cache_t *ref, const bpm_t *bpm, const bcf_hdr_t *hdr,
+			   const int *loci, int n_selected, int flags)
+{
+	sites_t *sites = (sites_t *)calloc(1, sizeof(sites_t));
+	sites->n_sites = bpm->num_loci;
+	sites->sites = (site_t *)calloc(bpm->num_loci, sizeof(site_t));
+	int *strands = (int *)malloc(bpm->num_loci * sizeof(int));
+	site_t **order = (site_t **)malloc(bpm->num_loci * sizeof(site_t *));
+	int n_order = 0;
+
+	if (loci)
+		for (int j = 0; j < bpm->num_loci; j++)
+			sites->sites[j].rid = -1;
+	int n_loci = loci ? n_selected : bpm->num_loci;
+	for (int l = 0; l < n_loci; l++) {
+		int j = loci ? loci[l] : l;
+		LocusEntry *locus_entry = &bpm->locus_entries[j];
+		site_t *site = &sites->sites[j];
+		site->rid = bcf_hdr_name2id_flexible(hdr, locus_entry->chrom);
+		char *endptr;
+		site->pos = strtol(locus_entry->map_info, &endptr, 10) - 1;
+		if (locus_entry->map_info == endptr)
+			error("Map info %s for marker %s is not understood\n",
+			      locus_entry->map_info, locus_entry->ilmn_id);
+		strands[j] = bpm->loci[j].strand;
+		if (site->rid < 0 || site->pos < 0 || strands[j] < 0) {
+			if (flags & VERBOSE)
+				fprintf(stderr, "Skipping unlocalized marker %s\n",
+					locus_entry->ilmn_id);
+			site->rid = -1;
+			continue;
+		}
+		order[n_order++] = site;
+	}
+	qsort(order, n_order, sizeof(site_t *), site_cmp);
+
 	bcf1_t *rec = bcf_init();
 	char ref_base[] = {'\0', '\0'};
 	kstring_t allele_a = {0, 0, NULL};
 	kstring_t allele_b = {0, 0, NULL};
 	kstring_t flank = {0, 0, NULL};
+	for (int i = 0; i < n_order; i++) {
+		site_t *site = order[i];
+		int j = site - sites->sites;
+		LocusEntry *locus_entry = &bpm->locus_entries[j];
+		int strand = strands[j];
+		rec->rid = site->rid;
+		rec->pos = site->pos;
+
+		int32_t allele_b_idx;
+		allele_a.l = allele_b.l = 0;
+		int ref_is_del = 0;
+		if (locus_entry->snp[1] == 'N' && locus_entry->snp[3] == 'A') {
+			ref_base[0] = get_ref_base(ref, hdr, rec);
+			allele_b_idx = -1;
+		} else if (locus_entry->source_seq && strchr(locus_entry->source_seq, '-')) {
+			flank.l = 0;
+			kputs(locus_entry->source_seq, &flank);
+			strupper(flank.s);
+			if ((strcasecmp(locus_entry->ilmn_strand, locus_entry->source_strand)
+			     != 0)
+			    != strand)
+				flank_reverse_complement(flank.s);
+			flank_left_shift(flank.s);
+
+			int allele_b_is_del = locus_entry->snp[3] == 'D';
+			ref_is_del = get_indel_alleles(flank.s, ref, bcf_seqname(hdr, rec),
+						       rec->pos, allele_b_is_del, ref_base,
+						       &allele_a, &allele_b);
+			if (ref_is_del == 0)
+				rec->pos--;
+			allele_b_idx = ref_is_del < 0 ? 1 : ref_is_del ^ allele_b_is_del;
+		} else {
+			kputc(strand ? rev_allele(locus_entry->snp[1]) : locus_entry->snp[1],
+			      &allele_a);
+			kputc(strand ? rev_allele(locus_entry->snp[3]) : locus_entry->snp[3],
+			      &allele_b);
+			ref_base[0] = get_ref_base(ref, hdr, rec);
+			allele_b_idx = get_allele_b_idx(ref_base[0], allele_a.s, allele_b.s);
+			if (locus_entry->snp[1] == 'D' || locus_entry->snp[3] == 'I'
+			    || locus_entry->snp[1] == 'D' || locus_entry->snp[3] == 'I')
+				ref_is_del = -1;
+		}
+		if (ref_is_del < 0) {
+			if (flags & VERBOSE)
+				fprintf(stderr, "Unable to determine alleles for indel %s\n",
+					locus_entry->ilmn_id);
+			site->missing = 1;
+		}
+		int32_t allele_a_idx = get_allele_a_idx(allele_b_idx);
+		const char *alleles[3];
+		int nals = alleles_ab_to_vcf(alleles, ref_base, allele_a.s, allele_b.s,
+					     allele_b_idx);
+		if (nals < 0)
+			error("Unable to process marker %s\n", locus_entry->ilmn_id);
+		site->pos = rec->pos;
+		site->allele_a_idx = allele_a_idx;
+		site->allele_b_idx = allele_b_idx;
+		site->nals = nals;
+		site->alleles_offset = sites->alleles.l;
+		for (int k = 0; k < nals; k++)
+			kputsn(alleles[k], strlen(alleles[k]) + 1, &sites->alleles);
+	}
+	free(allele_a.s);
+	free(allele_b.s);
+	free(flank.s);
+	bcf_destroy(rec);
+	free(order);
+	free(strands);
+	return sites;
+}
+
+static void sites_destroy(sites_t *sites)
+{
+	free(sites->sites);
+	free(sites->alleles.s);
+	free(sites);
+}
+
+// returns the alleles of a site
+static int site_alleles(const sites_t *sites, const site_t *site, const char **alleles)
+{
+	const char *str = sites->alleles.s + site->alleles_offset;
+	for (int k = 0; k < site->nals; k++) {
+		alleles[k] = str;
+		str += strlen(str) + 1;
+	}
+	return site->nals;
+}
+
+/****************************************
+ * LOCUS SELECTION                      *
+ ****************************************/
+
+static regidx_t *regions_init(const char *str, int is_file)
+{
+	regidx_t *idx = is_file ? regidx_init(str, NULL, NULL, 0, NULL)
+				: regidx_init_string(str, regidx_parse_reg, NULL, 0, NULL);
+	if (!idx)
+		error("Failed to read the regions: %s\n", str);
+	return idx;
+}
+
+typedef struct {
+	const char *chrom;
+	hts_pos_t pos;
+	int idx;
+} locus_coord_t;
+
+static int locus_coord_cmp(const void *a, const void *b)
+{
+	const locus_coord_t *x = (const locus_coord_t *)a, *y = (const locus_coord_t *)b;
+	int ret = strcmp(x->chrom, y->chrom);
+	if (ret)
+		return ret;
+	if (x->pos != y->pos)
+		return x->pos < y->pos ? -1 : 1;
+	return (x->idx > y->idx) - (x->idx < y->idx);
+}
+
+// coordinates of a marker, its resolved coordinates when the sites are given and otherwise its
+// manifest coordinates, with contig names of the output header when available
+static int locus_coord(const bpm_t *bpm, const bcf_hdr_t *hdr, const sites_t *sites, int j,
+		       locus_coord_t *coord)
+{
+	LocusEntry *locus_entry = &bpm->locus_entries[j];
+	coord->idx = j;
+	if (sites) {
+		const site_t *site = &sites->sites[j];
+		coord->chrom = site->rid < 0 ? NULL : bcf_hdr_id2name(hdr, site->rid);
+		coord->pos = site->pos;
+		return coord->chrom && coord->pos >= 0;
+	}
+	coord->chrom = locus_entry->chrom;
+	if (hdr) {
+		int rid = bcf_hdr_name2id_flexible(hdr, locus_entry->chrom);
+		coord->chrom = rid < 0 ? NULL : bcf_hdr_id2name(hdr, rid);
+	}
+	char *endptr;
+	coord->pos = locus_entry->map_info ? strtol(locus_entry->map_info, &endptr, 10) - 1 : -1;
+	return coord->chrom && coord->pos >= 0 && locus_entry->map_info != endptr;
+}
+
+// flags the markers overlapping the regions, looked up by binary search in the markers sorted
+// by coordinates, extending each region by the given number of bases to its right
+static void regions_flag(regidx_t *idx, const locus_coord_t *coords, int n, int extend,
+			 uint8_t *flags, uint8_t flag)
+{
+	regitr_t *itr = regitr_init(idx);
+	while (regitr_loop(itr)) {
+		int lo = 0, hi = n;
+		while (lo < hi) {
+			int mid = lo + (hi - lo) / 2;
+			int cmp = strcmp(coords[mid].chrom, itr->seq);
+			if (cmp < 0 || (cmp == 0 && coords[mid].pos < itr->beg))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (int i = lo; i < n && coords[i].pos <= itr->end + extend
+				 && strcmp(coords[i].chrom, itr->seq) == 0;
+		     i++)
+			flags[coords[i].idx] |= flag;
+	}
+	regitr_destroy(itr);
+}
+
+#define LOCUS_IN_REGIONS 1
+#define LOCUS_IN_TARGETS 2
+
+// returns the manifest indexes of the markers overlapping the regions, passing the targets,
+// and listed among the IDs, in manifest order so that the input arrays are still read forward
+// markers are selected by their resolved coordinates when the sites are given, as those are the
+// coordinates of the records, and otherwise by their manifest coordinates, which with preselect
+// set only narrow down the markers to resolve before selecting them again by their resolved
+// coordinates, as an indel is anchored to the base before its manifest coordinate, so that the
+// regions are extended by one base and the targets are not yet excluded
+static int *loci_select(const bpm_t *bpm, const bcf_hdr_t *hdr, const sites_t *sites,
+			regidx_t *regions, regidx_t *targets, int targets_exclude, void *ids,
+			int preselect, int *n_selected)
+{
+	uint8_t *flags = NULL;
+	if (regions || targets) {
+		locus_coord_t *coords =
+			(locus_coord_t *)malloc(bpm->num_loci * sizeof(locus_coord_t));
+		int n_coords = 0;
+		for (int j = 0; j < bpm->num_loci; j++)
+			n_coords += locus_coord(bpm, hdr, sites, j, &coords[n_coords]);
+		qsort(coords, n_coords, sizeof(locus_coord_t), locus_coord_cmp);
+		flags = (uint8_t *)calloc(bpm->num_loci, sizeof(uint8_t));
+		if (regions)
+			regions_flag(regions, coords, n_coords, preselect, flags, LOCUS_IN_REGIONS);
+		if (targets)
+			regions_flag(targets, coords, n_coords, preselect, flags, LOCUS_IN_TARGETS);
+		free(coords);
+	}
+
+	int *loci = (int *)malloc(bpm->num_loci * sizeof(int));
+	int n = 0;
+	for (int j = 0; j < bpm->num_loci; j++) {
+		if (ids && !khash_str2int_has_key(ids, bpm->locus_entries[j].name))
+			continue;
+		if (regions && !(flags[j] & LOCUS_IN_REGIONS))
+			continue;
+		if (targets && !(preselect && targets_exclude)
+		    && !!(flags[j] & LOCUS_IN_TARGETS) == targets_exclude)
+			continue;
+		loci[n++] = j;
+	}
+	free(flags);
+	*n_selected = n;
+	return loci;
+}
+
+typedef struct {
+	int32_t rid;
+	hts_pos_t pos;
+	int idx;
+} locus_key_t;
+
+static int locus_key_cmp(const void *a, const void *b)
+{
+	const locus_key_t *x = (const locus_key_t *)a, *y = (const locus_key_t *)b;
+	if (x->rid != y->rid)
+		return x->rid < y->rid ? -1 : 1;
+	if (x->pos != y->pos)
+		return x->pos < y->pos ? -1 : 1;
+	return (x->idx > y->idx) - (x->idx < y->idx);
+}
+
+// permutes the selected loci, or all loci if none are selected, in coordinate order of the
+// output header with markers that are not output moved to the end, consuming loci
+static int *loci_sort(const sites_t *sites, int *loci, int *n_selected)
+{
+	int n = loci ? *n_selected : sites->n_sites;
+	locus_key_t *keys = (locus_key_t *)malloc(n * sizeof(locus_key_t));
+	for (int l = 0; l < n; l++) {
+		int j = loci ? loci[l] : l;
+		const site_t *site = &sites->sites[j];
+		keys[l].rid = site->rid < 0 ? INT32_MAX : site->rid;
+		keys[l].pos = site->pos;
+		keys[l].idx = j;
+	}
+	qsort(keys, n, sizeof(locus_key_t), locus_key_cmp);
+	if (!loci)
+		loci = (int *)malloc(n * sizeof(int));
+	for (int l = 0; l < n; l++)
+		loci[l] = keys[l].idx;
+	free(keys);
+	*n_selected = n;
+	return loci;
+}
+
+// restricts the loci, or all loci if none are selected, to the i-th of n contiguous shards of
+// equal size so that shards of the same output can be concatenated in order, consuming loci
+static int *loci_shard(int *loci, int *n_selected, int num_loci, int shard, int n_shards,
+		       int *shard_beg)
+{
+	int n = loci ? *n_selected : num_loci;
+	int beg = (int)((int64_t)n * (shard - 1) / n_shards);
+	int end = (int)((int64_t)n * shard / n_shards);
+	int *ret = (int *)malloc((end > beg ? end - beg : 1) * sizeof(int));
+	for (int l = beg; l < end; l++)
+		ret[l - beg] = loci ? loci[l] : l;
+	free(loci);
+	*n_selected = end - beg;
+	*shard_beg = beg;
+	return ret;
+}
+
+// the sidecar file describes which markers and samples a shard covers so that the shards can
+// be checked before merging
+static void shard_write(const char *fn, const bpm_t *bpm, const int *loci, int n_selected,
+			int shard, int n_shards, int shard_beg, int n_samples, int flags)
+{
+	FILE *stream = get_file_handle(fn);
+	fprintf(stream, "shard\t%d/%d\n", shard, n_shards);
+	fprintf(stream, "loci\t%d-%d\n", shard_beg + 1, shard_beg + n_selected);
+	fprintf(stream, "n_loci\t%d\n", n_selected);
+	fprintf(stream, "first\t%s\n",
+		n_selected > 0 ? bpm->locus_entries[loci[0]].name : ".");
+	fprintf(stream, "last\t%s\n",
+		n_selected > 0 ? bpm->locus_entries[loci[n_selected - 1]].name : ".");
+	fprintf(stream, "n_samples\t%d\n", n_samples);
+	fprintf(stream, "order\t%s\n", flags & SORT_OUTPUT ? "coordinate" : "manifest");
+	if (stream != stdout && stream != stderr)
+		fclose(stream);
+}
+
+/****************************************
+ * MANIFEST CACHE                       *
+ ****************************************/
+
+#define MANIFEST_CACHE_MAGIC "GTC2VCF\x02"
+// each site is stored as int32 rid, int64 pos, int32 allele_a_idx, int32 allele_b_idx, int32
+// nals, int32 missing, and uint64 alleles_offset, with no padding
+#define SITE_RECORD_SIZE 36
+
+static void md5_update_file(hts_md5_context *md5, const char *fn)
+{
+	hFILE *fp = hopen(fn, "rb");
+	if (fp == NULL)
+		error("Could not open %s: %s\n", fn, strerror(errno));
+	char buffer[BUFSIZ];
+	ssize_t len;
+	while ((len = hread(fp, buffer, BUFSIZ)) > 0)
+		hts_md5_update(md5, buffer, len);
+	if (len < 0)
+		error("Failed to read from %s\n", fn);
+	if (hclose(fp) < 0)
+		error("Error closing %s\n", fn);
+}
+
+// writes the MD5 of a file as a NUL-terminated hexadecimal string of 33 characters
+static void md5_file_hex(const char *fn, char *hex)
+{
+	hts_md5_context *md5 = hts_md5_init();
+	if (!md5)
+		error("Failed to initialize MD5 context\n");
+	md5_update_file(md5, fn);
+	uint8_t digest[16];
+	hts_md5_final(digest, md5);
+	hts_md5_hex(hex, digest);
+	hts_md5_destroy(md5);
+}
+
+// the key covers the manifest files, the alignments, and the reference layout, with the
+// reference summarized by its index, size, and modification time rather than hashed in full,
+// so a reference edited in place without changing its index, size, or modification time
+// leaves the key unchanged and the cache must then be deleted by hand
+static void manifest_cache_key(const char *bpm_fname, const char *csv_fname,
+			       const char *sam_fname, const char *ref_fname,
+			       const char *genome_build, uint8_t *key)
+{
+	hts_md5_context *md5 = hts_md5_init();
+	if (!md5)
+		error("Failed to initialize MD5 context\n");
+	const char *fnames[] = {bpm_fname, csv_fname, sam_fname};
+	for (int i = 0; i < 3; i++) {
+		hts_md5_update(md5, fnames[i] ? "1" : "0", 1);
+		if (fnames[i])
+			md5_update_file(md5, fnames[i]);
+	}
+	kstring_t str = {0, 0, NULL};
+	ksprintf(&str, "%s.fai", ref_fname);
+	md5_update_file(md5, str.s);
+	struct stat st;
+	if (stat(ref_fname, &st) < 0)
+		error("Could not stat %s: %s\n", ref_fname, strerror(errno));
+	str.l = 0;
+	ksprintf(&str, "%s:%" PRId64 ":%" PRId64, genome_build, (int64_t)st.st_size,
+		 (int64_t)st.st_mtime);
+	hts_md5_update(md5, str.s, str.l);
+	hts_md5_final(key, md5);
+	hts_md5_destroy(md5);
+	free(str.s);
+}
+
+// checks that a cached site holds the allele indexes the builder assigns and that its alleles
+// lie within the alleles table
+static int site_is_valid(const site_t *site, const char *alleles, size_t len)
+{
+	if (site->rid < 0)
+		return 1;
+	if (site->nals < 0 || site->nals > 3 || site->allele_a_idx < -1 || site->allele_a_idx > 2
+	    || site->allele_b_idx < -1 || site->allele_b_idx > 2 || site->alleles_offset > len)
+		return 0;
+	size_t offset = site->alleles_offset;
+	for (int k = 0; k < site->nals; k++) {
+		const char *ptr = (const char *)memchr(alleles + offset, '\0', len - offset);
+		if (!ptr)
+			return 0;
+		offset = ptr - alleles + 1;
+	}
+	return 1;
+}
+
+// returns NULL if the cache file is missing, was built from different inputs, or is truncated
+// or damaged, so that it is rebuilt
+static sites_t *sites_load(const char *fn, const uint8_t *key, int num_loci)
+{
+	BGZF *fp = bgzf_open(fn, "r");
+	if (fp == NULL)
+		return NULL;
+	char magic[8];
+	uint8_t cache_key[16];
+	int32_t n_sites, record_size;
+	if (bgzf_read(fp, magic, 8) < 8 || memcmp(magic, MANIFEST_CACHE_MAGIC, 8)
+	    || bgzf_read(fp, cache_key, 16) < 16 || memcmp(cache_key, key, 16)
+	    || bgzf_read(fp, &record_size, 4) < 4 || record_size != SITE_RECORD_SIZE
+	    || bgzf_read(fp, &n_sites, 4) < 4 || n_sites != num_loci) {
+		if (bgzf_close(fp) < 0)
+			error("Error closing %s\n", fn);
+		return NULL;
+	}
+
+	sites_t *sites = (sites_t *)calloc(1, sizeof(sites_t));
+	sites->n_sites = n_sites;
+	sites->sites = (site_t *)calloc(n_sites, sizeof(site_t));
+	uint64_t len = 0;
+	size_t size = (size_t)n_sites * SITE_RECORD_SIZE;
+	uint8_t *buffer = (uint8_t *)malloc(size);
+	int is_valid = bgzf_read(fp, &len, 8) == 8 && (buffer || size == 0)
+		       && bgzf_read(fp, buffer, size) == (ssize_t)size && len < SIZE_MAX;
+	for (int j = 0; is_valid && j < n_sites; j++) {
+		const uint8_t *ptr = buffer + (size_t)j * SITE_RECORD_SIZE;
+		site_t *site = &sites->sites[j];
+		int64_t pos;
+		uint64_t alleles_offset;
+		memcpy(&site->rid, ptr, 4);
+		memcpy(&pos, ptr + 4, 8);
+		memcpy(&site->allele_a_idx, ptr + 12, 4);
+		memcpy(&site->allele_b_idx, ptr + 16, 4);
+		memcpy(&site->nals, ptr + 20, 4);
+		memcpy(&site->missing, ptr + 24, 4);
+		memcpy(&alleles_offset, ptr + 28, 8);
+		site->pos = (hts_pos_t)pos;
+		site->alleles_offset = (size_t)alleles_offset;
+	}
+	free(buffer);
+	if (is_valid) {
+		sites->alleles.s = (char *)malloc(len + 1);
+		is_valid = sites->alleles.s && bgzf_read(fp, sites->alleles.s, len) == (ssize_t)len;
+	}
+	// the alleles table must end the file
+	uint8_t byte;
+	is_valid = is_valid && bgzf_read(fp, &byte, 1) == 0;
+	for (int j = 0; is_valid && j < n_sites; j++)
+		is_valid = site_is_valid(&sites->sites[j], sites->alleles.s, len);
+	if (bgzf_close(fp) < 0)
+		error("Error closing %s\n", fn);
+	if (!is_valid) {
+		fprintf(stderr, "Warning: manifest cache %s is damaged and will be rebuilt\n", fn);
+		sites_destroy(sites);
+		return NULL;
+	}
+	sites->alleles.l = len;
+	sites->alleles.m = len + 1;
+	sites->alleles.s[len] = '\0';
+	return sites;
+}
+
+// the cache is written to a temporary file renamed into place, so that an interrupted run or
+// concurrent runs sharing the cache never leave a partial file behind
+static void sites_save(const sites_t *sites, const char *fn, const uint8_t *key)
+{
+	kstring_t tmp_fn = {0, 0, NULL};
+	ksprintf(&tmp_fn, "%s.tmp.%d", fn, (int)getpid());
+	FILE *stream = fopen(tmp_fn.s, "wb");
+	if (!stream)
+		error("Failed to open %s: %s\n", tmp_fn.s, strerror(errno));
+	int32_t record_size = SITE_RECORD_SIZE;
+	uint64_t len = sites->alleles.l;
+	uint8_t *buffer = (uint8_t *)calloc(sites->n_sites, SITE_RECORD_SIZE);
+	for (int j = 0; j < sites->n_sites; j++) {
+		uint8_t *ptr = buffer + (size_t)j * SITE_RECORD_SIZE;
+		const site_t *site = &sites->sites[j];
+		int64_t pos = site->pos;
+		uint64_t alleles_offset = site->alleles_offset;
+		memcpy(ptr, &site->rid, 4);
+		memcpy(ptr + 4, &pos, 8);
+		memcpy(ptr + 12, &site->allele_a_idx, 4);
+		memcpy(ptr + 16, &site->allele_b_idx, 4);
+		memcpy(ptr + 20, &site->nals, 4);
+		memcpy(ptr + 24, &site->missing, 4);
+		memcpy(ptr + 28, &alleles_offset, 8);
+	}
+	if (fwrite(MANIFEST_CACHE_MAGIC, 1, 8, stream) != 8 || fwrite(key, 1, 16, stream) != 16
+	    || fwrite(&record_size, 4, 1, stream) != 1 || fwrite(&sites->n_sites, 4, 1, stream) != 1
+	    || fwrite(&len, 8, 1, stream) != 1
+	    || fwrite(buffer, SITE_RECORD_SIZE, sites->n_sites, stream) != sites->n_sites
+	    || fwrite(sites->alleles.s, 1, len, stream) != len)
+		error("Failed to write to %s\n", tmp_fn.s);
+	free(buffer);
+	if (fclose(stream) < 0)
+		error("Error closing %s\n", tmp_fn.s);
+	if (rename(tmp_fn.s, fn) < 0)
+		error("Failed to rename %s to %s: %s\n", tmp_fn.s, fn, strerror(errno));
+	free(tmp_fn.s);
+}
+
+/****************************************
+ * CLUSTER STATISTICS                   *
+ ****************************************/
+
+#define CLUSTER_STATS_MAGIC "GTCSTAT\x02"
+
+// per locus and genotype counts and sums of the normalized intensities, which can be summed
+// across files covering different samples or different markers, with the MD5 of the manifest
+// and cluster files the intensities were normalized with and the MD5 of the sample names, so
+// that files covering different markers of the same samples count these samples once
+typedef struct {
+	uint8_t key[16];
+	uint8_t samples_key[16];
+	int32_t num_loci;
+	int32_t n_samples;
+	int32_t *n;	  // num_loci x 3
+	double *sum_theta; // num_loci x 3
+	double *sum_r;	  // num_loci x 3
+} cluster_stats_t;
+
+static cluster_stats_t *cluster_stats_init(int num_loci)
+{
+	cluster_stats_t *stats = (cluster_stats_t *)calloc(1, sizeof(cluster_stats_t));
+	stats->num_loci = num_loci;
+	stats->n = (int32_t *)calloc(num_loci * 3, sizeof(int32_t));
+	stats->sum_theta = (double *)calloc(num_loci * 3, sizeof(double));
+	stats->sum_r = (double *)calloc(num_loci * 3, sizeof(double));
+	return stats;
+}
+
+static void cluster_stats_destroy(cluster_stats_t *stats)
+{
+	if (!stats)
+		return;
+	free(stats->n);
+	free(stats->sum_theta);
+	free(stats->sum_r);
+	free(stats);
+}
+
+static void cluster_stats_add(cluster_stats_t *stats, int j, const uint8_t *gts,
+			      const float *ilmn_theta, const float *ilmn_r, int n)
+{
+	int32_t *n_gt = stats->n + 3 * j;
+	double *sum_theta = stats->sum_theta + 3 * j;
+	double *sum_r = stats->sum_r + 3 * j;
+	for (int i = 0; i < n; i++) {
+		if (gts[i] < GT_AA || gts[i] > GT_BB)
+			continue;
+		int g = gts[i] - GT_AA;
+		n_gt[g]++;
+		sum_theta[g] += ilmn_theta[i];
+		sum_r[g] += ilmn_r[i];
+	}
+}
+
+// streams the samples through the locus tiles once without encoding any record
+static void cluster_stats_compute(cluster_stats_t *stats, gtc_t **gtc, int n, const bpm_t *bpm,
+				  const egt_t *egt, const int *loci, int n_selected,
+				  hts_tpool *pool)
+{
+	int n_loci = loci ? n_selected : bpm->num_loci;
+	tile_t *tiles[2];
+	tiles[0] = tile_init(gtc, n, n_loci);
+	tiles[1] = tile_init(gtc, n, n_loci);
+	tiles[0]->loci = tiles[1]->loci = loci;
+	int m_loci = tiles[0]->m_loci;
+	fprintf(stderr, "Processing tiles of %d loci by %d samples\n", m_loci, n);
+	hts_tpool_process *q =
+		pool ? hts_tpool_process_init(pool, 2 * hts_tpool_size(pool), 1) : NULL;
+
+	int n_tiles = (n_loci + m_loci - 1) / m_loci;
+	if (n_tiles > 0)
+		tile_dispatch(gtc, bpm, egt, tiles[0], 0, min(m_loci, n_loci), pool, q);
+	for (int t = 0; t < n_tiles; t++) {
+		tile_t *tile = tiles[t & 1];
+		int locus_beg = t * m_loci;
+		tile_wait(tile, q, NULL);
+		if (t + 1 < n_tiles)
+			tile_dispatch(gtc, bpm, egt, tiles[(t + 1) & 1], locus_beg + m_loci,
+				      min(m_loci, n_loci - locus_beg - m_loci), pool, q);
+		for (int k = 0; k < tile->n_loci; k++) {
+			size_t row = (size_t)k * n;
+			cluster_stats_add(stats, tile_locus(tile, locus_beg, k),
+					  tile->block->genotypes + row, tile->ilmn_theta_arr + row,
+					  tile->ilmn_r_arr + row, n);
+		}
+	}
+	stats->n_samples = n;
+
+	tile_destroy(tiles[0]);
+	tile_destroy(tiles[1]);
+	if (q)
+		hts_tpool_process_destroy(q);
+}
+
+static void cluster_stats_key(const char *bpm_fname, const char *egt_fname, uint8_t *key)
+{
+	hts_md5_context *md5 = hts_md5_init();
+	if (!md5)
+		error("Failed to initialize MD5 context\n");
+	md5_update_file(md5, bpm_fname);
+	md5_update_file(md5, egt_fname);
+	hts_md5_final(key, md5);
+	hts_md5_destroy(md5);
+}
+
+static void cluster_stats_samples_key(const bcf_hdr_t *hdr, uint8_t *key)
+{
+	hts_md5_context *md5 = hts_md5_init();
+	if (!md5)
+		error("Failed to initialize MD5 context\n");
+	for (int i = 0; i < bcf_hdr_nsamples(hdr); i++)
+		hts_md5_update(md5, hdr->samples[i], strlen(hdr->samples[i]) + 1);
+	hts_md5_final(key, md5);
+	hts_md5_destroy(md5);
+}
+
+static void cluster_stats_save(const cluster_stats_t *stats, const char *fn)
+{
+	FILE *stream = fopen(fn, "wb");
+	if (!stream)
+		error("Failed to open %s: %s\n", fn, strerror(errno));
+	size_t len = (size_t)stats->num_loci * 3;
+	if (fwrite(CLUSTER_STATS_MAGIC, 1, 8, stream) != 8
+	    || fwrite(stats->key, 1, 16, stream) != 16
+	    || fwrite(stats->samples_key, 1, 16, stream) != 16
+	    || fwrite(&stats->num_loci, 4, 1, stream) != 1
+	    || fwrite(&stats->n_samples, 4, 1, stream) != 1
+	    || fwrite(stats->n, sizeof(int32_t), len, stream) != len
+	    || fwrite(stats->sum_theta, sizeof(double), len, stream) != len
+	    || fwrite(stats->sum_r, sizeof(double), len, stream) != len)
+		error("Failed to write to %s\n", fn);
+	if (fclose(stream) < 0)
+		error("Error closing %s\n", fn);
+}
+
+// sums the statistics from a comma-separated list of files, the samples are counted once for
+// each set of sample names, whose files must agree on the number of samples
+static cluster_stats_t *cluster_stats_load(const char *str, int num_loci, const uint8_t *key)
+{
+	int n_files;
+	char **fnames = hts_readlist(str, 0, &n_files);
+	if (!fnames || n_files == 0)
+		error("Failed to parse the cluster statistics files %s\n", str);
+	cluster_stats_t *stats = cluster_stats_init(num_loci);
+	cluster_stats_t *part = cluster_stats_init(num_loci);
+	size_t len = (size_t)num_loci * 3;
+	uint8_t *samples_keys = (uint8_t *)malloc(n_files * 16);
+	int32_t *samples_counts = (int32_t *)malloc(n_files * sizeof(int32_t));
+	int n_sample_sets = 0;
+	for (int i = 0; i < n_files; i++) {
+		fprintf(stderr, "Reading cluster statistics file %s\n", fnames[i]);
+		BGZF *fp = bgzf_open_input(fnames[i], 0);
+		char magic[8];
+		int32_t n_loci;
+		if (bgzf_read(fp, magic, 8) < 8 || memcmp(magic, CLUSTER_STATS_MAGIC, 8))
+			error("File %s is not a cluster statistics file of this version\n",
+			      fnames[i]);
+		read_bytes(fp, part->key, 16);
+		if (memcmp(part->key, key, 16))
+			error("File %s has statistics computed with different BPM or EGT files\n",
+			      fnames[i]);
+		read_bytes(fp, part->samples_key, 16);
+		read_bytes(fp, &n_loci, sizeof(int32_t));
+		if (n_loci != num_loci)
+			error("File %s has statistics for %d loci while the manifest has %d loci\n",
+			      fnames[i], n_loci, num_loci);
+		read_bytes(fp, &part->n_samples, sizeof(int32_t));
+		read_bytes(fp, part->n, len * sizeof(int32_t));
+		read_bytes(fp, part->sum_theta, len * sizeof(double));
+		read_bytes(fp, part->sum_r, len * sizeof(double));
+		if (bgzf_close(fp) < 0)
+			error("Error closing %s\n", fnames[i]);
+		int k = 0;
+		while (k < n_sample_sets && memcmp(samples_keys + 16 * k, part->samples_key, 16))
+			k++;
+		if (k == n_sample_sets) {
+			memcpy(samples_keys + 16 * k, part->samples_key, 16);
+			samples_counts[n_sample_sets++] = part->n_samples;
+			stats->n_samples += part->n_samples;
+		} else if (samples_counts[k] != part->n_samples) {
+			error("File %s has statistics from %d samples while another file with the same samples has %d\n",
+			      fnames[i], part->n_samples, samples_counts[k]);
+		}
+		for (size_t l = 0; l < len; l++) {
+			stats->n[l] += part->n[l];
+			stats->sum_theta[l] += part->sum_theta[l];
+			stats->sum_r[l] += part->sum_r[l];
+		}
+		free(fnames[i]);
+	}
+	free(fnames);
+	free(samples_keys);
+	free(samples_counts);
+	cluster_stats_destroy(part);
+	return stats;
+}
+
+// finalizes the cluster centers with the same shrinkage towards the cluster file centers used
+// by adjust_clusters()
+static void cluster_stats_apply(const cluster_stats_t *stats, egt_t *egt)
+{
+	for (int j = 0; j < stats->num_loci; j++) {
+		ClusterRecord *cluster_record = &egt->cluster_records[j];
+		ClusterStats *cluster_stats[3] = {&cluster_record->aa_cluster_stats,
+						  &cluster_record->ab_cluster_stats,
+						  &cluster_record->bb_cluster_stats};
+		for (int g = 0; g < 3; g++) {
+			ClusterStats *cs = cluster_stats[g];
+			int l = 3 * j + g;
+			cs->N = stats->n[l];
+			double w = cs->N + 0.2;
+			cs->theta_mean = (float)((0.2 * cs->theta_mean + stats->sum_theta[l]) / w);
+			cs->r_mean = (float)((0.2 * cs->r_mean + stats->sum_r[l]) / w);
+		}
+	}
+}
+
+/****************************************
+ * INTENSITY SIDECAR                    *
+ ****************************************/
+
+// the sidecar is a BGZF file with a .gzi index, so that any value can be reached with
+// bgzf_useek() at an uncompressed offset computed from the header, laid out as follows:
+//   magic, int32 encoding, fields, samples, rows, and rows per chunk
+//   for each field its name in 8 bytes and float offset and scale of its uint16 encoding, or a
+//   zero scale if the field is stored in half precision
+//   int32 number of contigs followed by int32 length and name of each contig
+//   int32 length and name of each sample
+//   int32 contig index and int32 0-based position of each row, in the order of the records
+//   chunks of rows, each holding for each field the rows x samples little-endian values
+#define INTENSITIES_MAGIC "GTCINTS\x01"
+#define INTENSITIES_CHUNK_CELLS (1 << 20) // values of each field in a chunk
+#define INTENSITIES_MISSING 0xFFFF	  // uint16 value for missing data
+#define INTENSITIES_UINT16 0
+#define INTENSITIES_FLOAT16 1
+#define N_INTENSITIES 8
+
+// uint16 values cover [min, max] in steps of (max - min) / 65534 and are clamped to that range,
+// raw intensities are integers always stored as uint16 whatever the encoding
+static const struct {
+	int flag;
+	const char *name;
+	float min, max;
+} intensity_fields[N_INTENSITIES] = {
+	{FORMAT_BAF, "BAF", 0.0f, 1.0f},       {FORMAT_LRR, "LRR", -8.0f, 8.0f},
+	{FORMAT_NORMX, "NORMX", 0.0f, 16.0f},  {FORMAT_NORMY, "NORMY", 0.0f, 16.0f},
+	{FORMAT_R, "R", 0.0f, 16.0f},	       {FORMAT_THETA, "THETA", 0.0f, 1.0f},
+	{FORMAT_X, "X", 0.0f, 65534.0f},       {FORMAT_Y, "Y", 0.0f, 65534.0f}};
+
+// the raw X and Y intensities are the last fields
+static inline int intensity_is_raw(int f)
+{
+	return f >= N_INTENSITIES - 2;
+}
+
+typedef struct {
+	BGZF *fp;
+	char *fn;
+	int encoding;
+	int n_fields;
+	int fields[N_INTENSITIES]; // indexes of the fields written in intensity_fields
+	int n_samples;
+	int chunk_rows;
+	int n_rows; // rows of the current chunk
+	uint16_t *chunk;
+} intensities_t;
+
+static intensities_t *intensities_init(const char *fn, int encoding, int flags,
+				       hts_tpool *pool)
+{
+	intensities_t *intensities = (intensities_t *)calloc(1, sizeof(intensities_t));
+	intensities->fp = bgzf_open(fn, "w");
+	if (!intensities->fp)
+		error("Failed to open %s: %s\n", fn, strerror(errno));
+	if (pool && bgzf_thread_pool(intensities->fp, pool, 0) < 0)
+		error("Failed to use the thread pool for %s\n", fn);
+	if (bgzf_index_build_init(intensities->fp) < 0)
+		error("Failed to initialize the index of %s\n", fn);
+	intensities->fn = strdup(fn);
+	intensities->encoding = encoding;
+	for (int f = 0; f < N_INTENSITIES; f++)
+		if (flags & intensity_fields[f].flag)
+			intensities->fields[intensities->n_fields++] = f;
+	return intensities;
+}
+
+static void intensities_write(intensities_t *intensities, const void *data, size_t len)
+{
+	if (bgzf_write(intensities->fp, data, len) != (ssize_t)len)
+		error("Failed to write to %s\n", intensities->fn);
+}
+
+static void intensities_write_str(intensities_t *intensities, const char *str)
+{
+	int32_t len = strlen(str);
+	intensities_write(intensities, &len, sizeof(int32_t));
+	intensities_write(intensities, str, len);
+}
+
+static void intensities_write_header(intensities_t *intensities, const bcf_hdr_t *hdr,
+				     const sites_t *sites, const int *loci, int n_loci)
+{
+	int32_t n_rows = 0;
+	for (int l = 0; l < n_loci; l++)
+		n_rows += sites->sites[loci ? loci[l] : l].rid >= 0;
+	int32_t n_samples = bcf_hdr_nsamples(hdr);
+	int32_t chunk_rows = n_samples > 0 ? INTENSITIES_CHUNK_CELLS / n_samples : 1;
+	if (chunk_rows < 1)
+		chunk_rows = 1;
+	int32_t values[] = {intensities->encoding, intensities->n_fields, n_samples, n_rows,
+			    chunk_rows};
+	intensities_write(intensities, INTENSITIES_MAGIC, 8);
+	intensities_write(intensities, values, sizeof(values));
+	for (int i = 0; i < intensities->n_fields; i++) {
+		int f = intensities->fields[i];
+		char name[8] = {0};
+		memcpy(name, intensity_fields[f].name, strlen(intensity_fields[f].name));
+		float offset = intensity_fields[f].min;
+		float scale = (intensity_fields[f].max - intensity_fields[f].min) / 65534.0f;
+		if (intensities->encoding == INTENSITIES_FLOAT16 && !intensity_is_raw(f))
+			offset = scale = 0.0f;
+		intensities_write(intensities, name, sizeof(name));
+		intensities_write(intensities, &offset, sizeof(float));
+		intensities_write(intensities, &scale, sizeof(float));
+	}
+	int32_t n_contigs = hdr->n[BCF_DT_CTG];
+	intensities_write(intensities, &n_contigs, sizeof(int32_t));
+	for (int rid = 0; rid < n_contigs; rid++)
+		intensities_write_str(intensities, bcf_hdr_id2name(hdr, rid));
+	for (int i = 0; i < n_samples; i++)
+		intensities_write_str(intensities, hdr->samples[i]);
+	for (int l = 0; l < n_loci; l++) {
+		const site_t *site = &sites->sites[loci ? loci[l] : l];
+		if (site->rid < 0)
+			continue;
+		int32_t row[2] = {site->rid, (int32_t)site->pos};
+		intensities_write(intensities, row, sizeof(row));
+	}
+	intensities->n_samples = n_samples;
+	intensities->chunk_rows = chunk_rows;
+	intensities->chunk = (uint16_t *)malloc((size_t)intensities->n_fields * chunk_rows
+						* n_samples * sizeof(uint16_t));
+}
+
+// IEEE half precision with round to nearest even, overflowing to infinity
+static inline uint16_t float_to_half(float f)
+{
+	union {
+		float f;
+		uint32_t u;
+	} x = {f};
+	uint32_t sign = (x.u >> 16) & 0x8000;
+	uint32_t abs = x.u & 0x7FFFFFFF;
+	if (abs > 0x7F800000)
+		return sign | 0x7E00;
+	if (abs >= 0x477FF000) // rounds to at least 65536
+		return sign | 0x7C00;
+	if (abs < 0x38800000) { // subnormal or zero
+		if (abs < 0x33000000)
+			return sign;
+		uint32_t mant = (abs & 0x7FFFFF) | 0x800000;
+		int shift = 126 - (abs >> 23);
+		uint32_t half = mant >> shift;
+		uint32_t rem = mant & ((1u << shift) - 1), mid = 1u << (shift - 1);
+		half += rem > mid || (rem == mid && (half & 1));
+		return sign | half;
+	}
+	uint32_t half = ((abs - 0x38000000) >> 13);
+	uint32_t rem = abs & 0x1FFF;
+	half += rem > 0x1000 || (rem == 0x1000 && (half & 1));
+	return sign | half;
+}
+
+static inline uint16_t intensity_quantize(float value, float min, float max)
+{
+	if (isnan(value))
+		return INTENSITIES_MISSING;
+	if (value <= min)
+		return 0;
+	if (value >= max)
+		return 65534;
+	return (uint16_t)lrintf((value - min) / (max - min) * 65534.0f);
+}
+
+static void intensities_flush(intensities_t *intensities)
+{
+	size_t n_cells = (size_t)intensities->n_rows * intensities->n_samples;
+	size_t stride = (size_t)intensities->chunk_rows * intensities->n_samples;
+	for (int i = 0; i < intensities->n_fields; i++)
+		intensities_write(intensities, intensities->chunk + i * stride,
+				  n_cells * sizeof(uint16_t));
+	intensities->n_rows = 0;
+}
+
+// appends the rows of the markers of a tile that are output, once the tile is final
+static void intensities_add_tile(intensities_t *intensities, const sites_t *sites,
+				 const tile_t *tile, int locus_beg)
+{
+	int n = intensities->n_samples;
+	size_t stride = (size_t)intensities->chunk_rows * n;
+	for (int k = 0; k < tile->n_loci; k++) {
+		if (sites->sites[tile_locus(tile, locus_beg, k)].rid < 0)
+			continue;
+		size_t row = (size_t)k * n;
+		// in the order of intensity_fields, raw intensities are integers
+		const float *float_arrs[] = {tile->baf_arr + row,    tile->lrr_arr + row,
+					     tile->norm_x_arr + row, tile->norm_y_arr + row,
+					     tile->ilmn_r_arr + row, tile->ilmn_theta_arr + row};
+		const int32_t *int_arrs[] = {tile->raw_x_arr + row, tile->raw_y_arr + row};
+		int n_float = sizeof(float_arrs) / sizeof(float_arrs[0]);
+		for (int i = 0; i < intensities->n_fields; i++) {
+			int f = intensities->fields[i];
+			uint16_t *dst =
+				intensities->chunk + i * stride + (size_t)intensities->n_rows * n;
+			float min = intensity_fields[f].min, max = intensity_fields[f].max;
+			if (intensity_is_raw(f)) {
+				const int32_t *src = int_arrs[f - n_float];
+				for (int s = 0; s < n; s++)
+					dst[s] = (uint16_t)min(src[s], 65534);
+			} else if (intensities->encoding == INTENSITIES_FLOAT16) {
+				for (int s = 0; s < n; s++)
+					dst[s] = float_to_half(float_arrs[f][s]);
+			} else {
+				for (int s = 0; s < n; s++)
+					dst[s] = intensity_quantize(float_arrs[f][s], min, max);
+			}
+		}
+		if (++intensities->n_rows == intensities->chunk_rows)
+			intensities_flush(intensities);
+	}
+}
+
+static void intensities_destroy(intensities_t *intensities)
+{
+	if (!intensities)
+		return;
+	if (intensities->n_rows > 0)
+		intensities_flush(intensities);
+	if (bgzf_flush(intensities->fp) < 0
+	    || bgzf_index_dump(intensities->fp, intensities->fn, ".gzi") < 0)
+		error("Failed to write the index of %s\n", intensities->fn);
+	if (bgzf_close(intensities->fp) < 0)
+		error("Error closing %s\n", intensities->fn);
+	free(intensities->fn);
+	free(intensities->chunk);
+	free(intensities);
+}
+
+/****************************************
+ * RECORD ENCODER                       *
+ ****************************************/
+
+// every record of a run has the same layout so tag IDs are resolved once and the shared and
+// per-sample blocks are encoded directly, producing the same bytes as bcf_update_*()
+enum {
+	TAG_ALLELE_A,
+	TAG_ALLELE_B,
+	TAG_FRAC_A,
+	TAG_FRAC_C,
+	TAG_FRAC_G,
+	TAG_FRAC_T,
+	TAG_NORM_ID,
+	TAG_BEADSET_ID,
+	TAG_ASSAY_TYPE,
+	TAG_GENTRAIN_SCORE,
+	TAG_ORIG_SCORE,
+	TAG_EDITED,
+	TAG_CLUSTER_SEP,
+	TAG_N_AA,
+	TAG_N_AB,
+	TAG_N_BB,
+	TAG_DEVR_AA,
+	TAG_DEVR_AB,
+	TAG_DEVR_BB,
+	TAG_DEVTHETA_AA,
+	TAG_DEVTHETA_AB,
+	TAG_DEVTHETA_BB,
+	TAG_MEANR_AA,
+	TAG_MEANR_AB,
+	TAG_MEANR_BB,
+	TAG_MEANTHETA_AA,
+	TAG_MEANTHETA_AB,
+	TAG_MEANTHETA_BB,
+	TAG_INTENSITY_THRESHOLD,
+	TAG_GT,
+	TAG_GQ,
+	TAG_IGC,
+	TAG_BAF,
+	TAG_LRR,
+	TAG_NORMX,
+	TAG_NORMY,
+	TAG_R,
+	TAG_THETA,
+	TAG_X,
+	TAG_Y,
+	N_TAGS
+};
+
+static const char *tag_names[N_TAGS] = {
+	"ALLELE_A",	"ALLELE_B",	"FRAC_A",	"FRAC_C",	"FRAC_G",
+	"FRAC_T",	"NORM_ID",	"BEADSET_ID",	"ASSAY_TYPE",	"GenTrain_Score",
+	"Orig_Score",	"Edited",	"Cluster_Sep",	"N_AA",		"N_AB",
+	"N_BB",		"devR_AA",	"devR_AB",	"devR_BB",	"devTHETA_AA",
+	"devTHETA_AB",	"devTHETA_BB",	"meanR_AA",	"meanR_AB",	"meanR_BB",
+	"meanTHETA_AA", "meanTHETA_AB", "meanTHETA_BB", "Intensity_Threshold",
+	"GT",		"GQ",		"IGC",		"BAF",		"LRR",
+	"NORMX",	"NORMY",	"R",		"THETA",	"X",
+	"Y"};
+
+// flags under any of which encode_records() writes each tag, or 0 if it is always written
+static const int tag_flags[N_TAGS] = {
+	0, 0, BPM_LOADED, BPM_LOADED, BPM_LOADED, BPM_LOADED, BPM_LOADED, CSV_LOADED,
+	BPM_LOADED | CSV_LOADED,
+	// from GenTrain_Score to Intensity_Threshold
+	EGT_LOADED, EGT_LOADED, EGT_LOADED, EGT_LOADED, EGT_LOADED, EGT_LOADED, EGT_LOADED,
+	EGT_LOADED, EGT_LOADED, EGT_LOADED, EGT_LOADED, EGT_LOADED, EGT_LOADED, EGT_LOADED,
+	EGT_LOADED, EGT_LOADED, EGT_LOADED, EGT_LOADED, EGT_LOADED, EGT_LOADED,
+	// from GT to Y
+	0, 0, FORMAT_IGC, FORMAT_BAF, FORMAT_LRR, FORMAT_NORMX, FORMAT_NORMY, FORMAT_R,
+	FORMAT_THETA, FORMAT_X, FORMAT_Y};
+
+// tags missing from the header are set to -1, which is an error for the tags to be written
+static void tag_ids_init(int *ids, const bcf_hdr_t *hdr, int flags)
+{
+	for (int i = 0; i < N_TAGS; i++) {
+		ids[i] = bcf_hdr_id2int(hdr, BCF_DT_ID, tag_names[i]);
+		if (ids[i] < 0 && (!tag_flags[i] || (flags & tag_flags[i])))
+			error("Tag %s to be written is missing from the header\n", tag_names[i]);
+	}
+}
+
+// encodes the ID and the alleles as bcf_update_id() and bcf_update_alleles() followed by
+// bcf1_sync() would, with an empty FILTER field
+static void enc_shared(bcf1_t *rec, const char *id, const char **alleles, int nals)
+{
+	kstring_t *str = &rec->shared;
+	if (id && strcmp(id, "."))
+		bcf_enc_vchar(str, strlen(id), id);
+	else
+		bcf_enc_size(str, 0, BCF_BT_CHAR);
+	for (int i = 0; i < nals; i++)
+		bcf_enc_vchar(str, strlen(alleles[i]), alleles[i]);
+	rec->n_allele = nals;
+	rec->rlen = strlen(alleles[0]);
+	bcf_enc_vint(str, 0, NULL, -1);
+}
+
+static inline void enc_info_int32(bcf1_t *rec, int id, int32_t value)
+{
+	bcf_enc_int1(&rec->shared, id);
+	bcf_enc_vint(&rec->shared, 1, &value, -1);
+	rec->n_info++;
+}
+
+static inline void enc_info_float(bcf1_t *rec, int id, float value)
+{
+	bcf_enc_int1(&rec->shared, id);
+	bcf_enc_vfloat(&rec->shared, 1, &value);
+	rec->n_info++;
+}
+
+static inline void enc_info_flag(bcf1_t *rec, int id)
+{
+	bcf_enc_int1(&rec->shared, id);
+	bcf_enc_size(&rec->shared, 0, BCF_BT_NULL);
+	rec->n_info++;
+}
+
+static inline void enc_format_int32(bcf1_t *rec, int id, int32_t *values, int n, int nps)
+{
+	bcf_enc_int1(&rec->indiv, id);
+	bcf_enc_vint(&rec->indiv, n, values, nps);
+	rec->n_fmt++;
+}
+
+// floats are stored as little endian like the other binary formats read by this plugin
+static inline void enc_format_float(bcf1_t *rec, int id, const float *values, int n)
+{
+	bcf_enc_int1(&rec->indiv, id);
+	bcf_enc_size(&rec->indiv, 1, BCF_BT_FLOAT);
+	kputsn((const char *)values, n * sizeof(float), &rec->indiv);
+	rec->n_fmt++;
+}
+
+/****************************************
+ * CONVERSION PIPELINE                  *
+ ****************************************/
+
+// tiles are filled by the thread pool one tile ahead of the tile being encoded, records are
+// encoded in chunks of loci by the thread pool, and the calling thread writes the chunks in
+// order as they become available so that reading, computing, and writing overlap
+typedef struct {
+	const sites_t *sites;
+	const bpm_t *bpm;
+	const egt_t *egt;
+	tile_t *tile;
+	bcf_hdr_t *hdr;
+	int flags;
+	int locus_beg; // first locus of the tile
+	int k_beg, k_end;
+	const int *tag_ids;
+	bcf1_t **recs;
+	int32_t *gt_arr;
+	const bcf_hdr_t *append_hdr; // header of the file samples are appended to, if any
+	bcf1_t **append_recs;
+	void *append_arr;
+	int m_append_arr;
+	char *merge_arr;
+	int m_merge_arr;
+	double time;
+} encode_job_t;
+
+// values of the previous samples followed by the values of the new samples
+static void *append_values(encode_job_t *job, bcf1_t *old, int tag, int type, void *values,
+			   int n, int nps)
+{
+	if (!old)
+		return values;
+	int n_old = bcf_hdr_nsamples(job->append_hdr) * nps;
+	if (bcf_get_format_values(job->append_hdr, old, tag_names[tag], &job->append_arr,
+				  &job->m_append_arr, type)
+	    != n_old)
+		error("Missing or malformed FORMAT/%s at marker %s of the appended file\n",
+		      tag_names[tag], old->d.id);
+	int size = (n_old + n * nps) * 4;
+	hts_expand(char, size, job->m_merge_arr, job->merge_arr);
+	memcpy(job->merge_arr, job->append_arr, n_old * 4);
+	memcpy(job->merge_arr + n_old * 4, values, n * nps * 4);
+	return (void *)job->merge_arr;
+}
+
+static void *append_info(encode_job_t *job, bcf1_t *old, int tag, int type)
+{
+	if (bcf_get_info_values(job->append_hdr, old, tag_names[tag], &job->append_arr,
+				&job->m_append_arr, type)
+	    != 1)
+		error("Missing INFO/%s at marker %s of the appended file\n", tag_names[tag],
+		      old->d.id);
+	return job->append_arr;
+}
+
+// the cluster counts and means of the previous samples are recovered from the INFO fields
+static void append_clusters(encode_job_t *job, bcf1_t *old, ClusterRecord *cluster_record)
+{
+	ClusterStats *stats[3] = {&cluster_record->aa_cluster_stats,
+				  &cluster_record->ab_cluster_stats,
+				  &cluster_record->bb_cluster_stats};
+	for (int i = 0; i < 3; i++) {
+		stats[i]->N = *(int32_t *)append_info(job, old, TAG_N_AA + i, BCF_HT_INT);
+		stats[i]->r_mean = *(float *)append_info(job, old, TAG_MEANR_AA + i, BCF_HT_REAL);
+		stats[i]->theta_mean =
+			*(float *)append_info(job, old, TAG_MEANTHETA_AA + i, BCF_HT_REAL);
+	}
+}
+
+static void encode_records(encode_job_t *job)
+{
+	double t0 = wall_time();
+	const sites_t *sites = job->sites;
+	const bpm_t *bpm = job->bpm;
+	const egt_t *egt = job->egt;
+	tile_t *tile = job->tile;
+	const int *ids = job->tag_ids;
+	int flags = job->flags;
+	int n = tile->n_samples;
+	int n_out = n + (job->append_hdr ? bcf_hdr_nsamples(job->append_hdr) : 0);
+	for (int k = job->k_beg; k < job->k_end; k++) {
+		int j = tile_locus(tile, job->locus_beg, k);
+		uint8_t *gts = tile->block->genotypes + (size_t)k * n;
+		float *igc_arr = tile->block->genotype_scores + (size_t)k * n;
+		int32_t *gq_arr = tile->gq_arr + (size_t)k * n;
+		float *baf_arr = tile->baf_arr + (size_t)k * n;
+		float *lrr_arr = tile->lrr_arr + (size_t)k * n;
+		float *norm_x_arr = tile->norm_x_arr + (size_t)k * n;
+		float *norm_y_arr = tile->norm_y_arr + (size_t)k * n;
+		float *ilmn_r_arr = tile->ilmn_r_arr + (size_t)k * n;
+		float *ilmn_theta_arr = tile->ilmn_theta_arr + (size_t)k * n;
+		int32_t *raw_x_arr = tile->raw_x_arr + (size_t)k * n;
+		int32_t *raw_y_arr = tile->raw_y_arr + (size_t)k * n;
+
+		LocusEntry *locus_entry = &bpm->locus_entries[j];
+		const site_t *site = &sites->sites[j];
+		if (site->rid < 0)
+			continue;
+		bcf1_t *rec = job->recs[k];
+		bcf1_t *old = job->append_recs ? job->append_recs[k] : NULL;
+		bcf_clear(rec);
+		rec->n_sample = n_out;
+		rec->rid = site->rid;
+		rec->pos = site->pos;
+
+		int32_t allele_a_idx = site->allele_a_idx;
+		int32_t allele_b_idx = site->allele_b_idx;
+		const char *alleles[3];
+		int nals = site_alleles(sites, site, alleles);
+		enc_shared(rec, locus_entry->name, alleles, nals);
+		enc_info_int32(rec, ids[TAG_ALLELE_A], allele_a_idx);
+		enc_info_int32(rec, ids[TAG_ALLELE_B], allele_b_idx);
+
+		if (flags & BPM_LOADED) {
+			enc_info_float(rec, ids[TAG_FRAC_A], locus_entry->frac_a);
+			enc_info_float(rec, ids[TAG_FRAC_C], locus_entry->frac_c);
+			enc_info_float(rec, ids[TAG_FRAC_G], locus_entry->frac_g);
+			enc_info_float(rec, ids[TAG_FRAC_T], locus_entry->frac_t);
+			enc_info_int32(rec, ids[TAG_NORM_ID], locus_entry->norm_id);
+		}
+		if (flags & CSV_LOADED)
+			enc_info_int32(rec, ids[TAG_BEADSET_ID], locus_entry->beadset_id);
+		if ((flags & BPM_LOADED) | (flags & CSV_LOADED))
+			enc_info_int32(rec, ids[TAG_ASSAY_TYPE], (int32_t)locus_entry->assay_type);
+		if (flags & EGT_LOADED) {
+			ClusterRecord *cluster_record = &egt->cluster_records[j];
+			// clusters finalized from cohort statistics were already used by the tiles
+			if ((flags & ADJUST_CLUSTERS) && !(flags & CLUSTER_STATS)) {
+				// only the cluster INFO fields are recomputed for appended samples
+				if (old)
+					append_clusters(job, old, cluster_record);
+				adjust_clusters(gts, ilmn_theta_arr, ilmn_r_arr, n, cluster_record,
+						old != NULL);
+				locus_t adjusted = bpm->loci[j];
+				locus_set_clusters(&adjusted, cluster_record);
+				get_baf_lrr_row(ilmn_theta_arr, ilmn_r_arr, n, &adjusted, baf_arr,
+						lrr_arr);
+			}
+			const ClusterScore *score = &cluster_record->cluster_score;
+			enc_info_float(rec, ids[TAG_GENTRAIN_SCORE], score->total_score);
+			enc_info_float(rec, ids[TAG_ORIG_SCORE], score->original_score);
+			if (score->edited)
+				enc_info_flag(rec, ids[TAG_EDITED]);
+			enc_info_float(rec, ids[TAG_CLUSTER_SEP], score->cluster_separation);
+			const ClusterStats *aa = &cluster_record->aa_cluster_stats;
+			const ClusterStats *ab = &cluster_record->ab_cluster_stats;
+			const ClusterStats *bb = &cluster_record->bb_cluster_stats;
+			enc_info_int32(rec, ids[TAG_N_AA], aa->N);
+			enc_info_int32(rec, ids[TAG_N_AB], ab->N);
+			enc_info_int32(rec, ids[TAG_N_BB], bb->N);
+			enc_info_float(rec, ids[TAG_DEVR_AA], aa->r_dev);
+			enc_info_float(rec, ids[TAG_DEVR_AB], ab->r_dev);
+			enc_info_float(rec, ids[TAG_DEVR_BB], bb->r_dev);
+			enc_info_float(rec, ids[TAG_DEVTHETA_AA], aa->theta_dev);
+			enc_info_float(rec, ids[TAG_DEVTHETA_AB], ab->theta_dev);
+			enc_info_float(rec, ids[TAG_DEVTHETA_BB], bb->theta_dev);
+			enc_info_float(rec, ids[TAG_MEANR_AA], aa->r_mean);
+			enc_info_float(rec, ids[TAG_MEANR_AB], ab->r_mean);
+			enc_info_float(rec, ids[TAG_MEANR_BB], bb->r_mean);
+			enc_info_float(rec, ids[TAG_MEANTHETA_AA], aa->theta_mean);
+			enc_info_float(rec, ids[TAG_MEANTHETA_AB], ab->theta_mean);
+			enc_info_float(rec, ids[TAG_MEANTHETA_BB], bb->theta_mean);
+			enc_info_float(rec, ids[TAG_INTENSITY_THRESHOLD],
+				       cluster_record->intensity_threshold);
+		}
+
+		gts_to_gt_arr(job->gt_arr, gts, n, allele_a_idx, allele_b_idx);
+		void *values = append_values(job, old, TAG_GT, BCF_HT_INT, job->gt_arr, n, 2);
+		enc_format_int32(rec, ids[TAG_GT], (int32_t *)values, n_out * 2, 2);
+		values = append_values(job, old, TAG_GQ, BCF_HT_INT, gq_arr, n, 1);
+		enc_format_int32(rec, ids[TAG_GQ], (int32_t *)values, n_out, 1);
+		const struct {
+			int flag, tag;
+			float *arr;
+		} float_tags[] = {{FORMAT_IGC, TAG_IGC, igc_arr},
+				  {FORMAT_BAF, TAG_BAF, baf_arr},
+				  {FORMAT_LRR, TAG_LRR, lrr_arr},
+				  {FORMAT_NORMX, TAG_NORMX, norm_x_arr},
+				  {FORMAT_NORMY, TAG_NORMY, norm_y_arr},
+				  {FORMAT_R, TAG_R, ilmn_r_arr},
+				  {FORMAT_THETA, TAG_THETA, ilmn_theta_arr}};
+		for (int i = 0; i < (int)(sizeof(float_tags) / sizeof(float_tags[0])); i++) {
+			if (!(flags & float_tags[i].flag))
+				continue;
+			int tag = float_tags[i].tag;
+			values = append_values(job, old, tag, BCF_HT_REAL, float_tags[i].arr, n, 1);
+			enc_format_float(rec, ids[tag], (const float *)values, n_out);
+		}
+		if (flags & FORMAT_X) {
+			values = append_values(job, old, TAG_X, BCF_HT_INT, raw_x_arr, n, 1);
+			enc_format_int32(rec, ids[TAG_X], (int32_t *)values, n_out, 1);
+		}
+		if (flags & FORMAT_Y) {
+			values = append_values(job, old, TAG_Y, BCF_HT_INT, raw_y_arr, n, 1);
+			enc_format_int32(rec, ids[TAG_Y], (int32_t *)values, n_out, 1);
+		}
+	}
+	job->time = wall_time() - t0;
+}
+
+static void *encode_job_run(void *arg)
+{
+	encode_records((encode_job_t *)arg);
+	return arg;
+}
+
+static void write_records(const encode_job_t *job, htsFile *out_fh, stage_times_t *times)
+{
+	double t0 = wall_time();
+	for (int k = job->k_beg; k < job->k_end; k++) {
+		if (job->sites->sites[tile_locus(job->tile, job->locus_beg, k)].rid < 0)
+			continue;
+		if (bcf_write(out_fh, job->hdr, job->recs[k]) < 0)
+			error("Unable to write to output VCF file\n");
+	}
+	times->encode += job->time;
+	times->write += wall_time() - t0;
+}
+
+// reads the records of the appended file matching the markers of a tile, which must be in the
+// same order as the markers that are output
+static void append_read(htsFile *fh, bcf_hdr_t *append_hdr, const sites_t *sites,
+			const bpm_t *bpm, const bcf_hdr_t *hdr, const tile_t *tile, int locus_beg,
+			bcf1_t **recs)
+{
+	for (int k = 0; k < tile->n_loci; k++) {
+		int j = tile_locus(tile, locus_beg, k);
+		const site_t *site = &sites->sites[j];
+		if (site->rid < 0)
+			continue;
+		const char *name = bpm->locus_entries[j].name;
+		if (bcf_read(fh, append_hdr, recs[k]) < 0)
+			error("The appended file %s ends before marker %s\n", fh->fn, name);
+		bcf_unpack(recs[k], BCF_UN_STR);
+		if (recs[k]->pos != site->pos || strcmp(recs[k]->d.id, name)
+		    || strcmp(bcf_seqname(append_hdr, recs[k]), bcf_hdr_id2name(hdr, site->rid)))
+			error("Marker %s at %s:%" PRId64 " of the appended file %s does not match marker %s\n",
+			      recs[k]->d.id, bcf_seqname(append_hdr, recs[k]),
+			      (int64_t)recs[k]->pos + 1, fh->fn, name);
+	}
+}
+
+// the appended file must come from the same manifest, cluster, and alignment files and carry
+// the same INFO and FORMAT fields, and its clusters can only be updated if they were adjusted
+// from the same manifest and cluster files, as recorded by the ##gtc2vcf_adjust_clusters line
+static void append_check_header(const bcf_hdr_t *append_hdr, const bcf_hdr_t *hdr,
+				const char *fn, int flags)
+{
+	if ((flags & ADJUST_CLUSTERS) && !(flags & CLUSTER_STATS)) {
+		bcf_hrec_t *a = bcf_hdr_get_hrec(append_hdr, BCF_HL_GEN, "gtc2vcf_adjust_clusters",
+						 NULL, NULL);
+		bcf_hrec_t *b =
+			bcf_hdr_get_hrec(hdr, BCF_HL_GEN, "gtc2vcf_adjust_clusters", NULL, NULL);
+		if (!a)
+			error("The appended file %s was not converted with the --adjust-clusters option\n",
+			      fn);
+		if (strcmp(a->value, b->value))
+			error("The clusters of the appended file %s were adjusted from different BPM or EGT files\n",
+			      fn);
+	}
+	const char *keys[] = {"BPM", "CSV", "EGT", "SAM"};
+	for (int i = 0; i < 4; i++) {
+		bcf_hrec_t *a = bcf_hdr_get_hrec(append_hdr, BCF_HL_GEN, keys[i], NULL, NULL);
+		bcf_hrec_t *b = bcf_hdr_get_hrec(hdr, BCF_HL_GEN, keys[i], NULL, NULL);
+		if (!a != !b || (a && strcmp(a->value, b->value)))
+			error("Header line ##%s of the appended file %s does not match\n", keys[i],
+			      fn);
+	}
+	for (int i = 0; i < N_TAGS; i++) {
+		int a = bcf_hdr_id2int(append_hdr, BCF_DT_ID, tag_names[i]);
+		int b = bcf_hdr_id2int(hdr, BCF_DT_ID, tag_names[i]);
+		if (bcf_hdr_idinfo_exists(append_hdr, BCF_HL_INFO, a)
+			    != bcf_hdr_idinfo_exists(hdr, BCF_HL_INFO, b)
+		    || bcf_hdr_idinfo_exists(append_hdr, BCF_HL_FMT, a)
+			       != bcf_hdr_idinfo_exists(hdr, BCF_HL_FMT, b))
+			error("Field %s of the appended file %s does not match the requested fields\n",
+			      tag_names[i], fn);
+	}
+}
 
-	uint8_t *gts = (uint8_t *)malloc(n * sizeof(uint8_t));
-	int32_t *gt_arr = (int32_t *)malloc(n * 2 * sizeof(int32_t));
-	int32_t *gq_arr = (int32_t *)malloc(n * sizeof(int32_t));
-	float *igc_arr = (float *)malloc(n * sizeof(float));
-	float *baf_arr = (float *)malloc(n * sizeof(float));
-	float *lrr_arr = (float *)malloc(n * sizeof(float));
-	float *norm_x_arr = (float *)malloc(n * sizeof(float));
-	float *norm_y_arr = (float *)malloc(n * sizeof(float));
-	float *ilmn_r_arr = (float *)malloc(n * sizeof(float));
-	float *ilmn_theta_arr = (float *)malloc(n * sizeof(float));
-	int32_t *raw_x_arr = (int32_t *)malloc(n * sizeof(int32_t));
-	int32_t *raw_y_arr = (int32_t *)malloc(n * sizeof(int32_t));
+static void gtcs_to_vcf(const sites_t *sites, const bpm_t *bpm, const egt_t *egt, gtc_t **gtc,
+			int n, const int *loci, int n_selected, htsFile *out_fh, bcf_hdr_t *hdr,
+			htsFile *append_fh, bcf_hdr_t *append_hdr, intensities_t *intensities,
+			hts_tpool *pool, progress_t *progress, int flags)
+{
+	double t_beg = wall_time();
+	if (bcf_hdr_write(out_fh, hdr) < 0)
+		error("Unable to write to output VCF file\n");
+	// records are sorted so the index can be built while they are written
+	kstring_t fnidx = {0, 0, NULL};
+	if (flags & WRITE_INDEX) {
+		ksprintf(&fnidx, "%s.csi", out_fh->fn);
+		if (bcf_idx_init(out_fh, hdr, 14, fnidx.s) < 0)
+			error("Unable to initialize index %s\n", fnidx.s);
+	}
 
+	int n_loci = loci ? n_selected : bpm->num_loci;
 	int n_missing = 0, n_skipped = 0;
-	for (int j = 0; j < bpm->num_loci; j++) {
-		LocusEntry *locus_entry = &bpm->locus_entries[j];
-		bcf_clear(rec);
-		rec->n_sample = n;
-		rec->rid = bcf_hdr_name2id_flexible(hdr, locus_entry->chrom);
-		char *endptr;
-		rec->pos = strtol(locus_entry->map_info, &endptr, 10) - 1;
-		if (locus_entry->map_info == endptr)
-			error("Map info %s for marker %s is not understood\n",
-			      locus_entry->map_info, locus_entry->ilmn_id);
-		int strand =
-			!locus_entry->ref_strand
-				? -1
-				: (strcmp(locus_entry->ref_strand, "+") == 0
-					   ? 0
-					   : (strcmp(locus_entry->ref_strand, "-") == 0 ? 1
-											: -1));
-		if (rec->rid < 0 || rec->pos < 0 || strand < 0) {
-			if (flags & VERBOSE)
-				fprintf(stderr, "Skipping unlocalized marker %s\n",
-					locus_entry->ilmn_id);
+	for (int l = 0; l < n_loci; l++) {
+		const site_t *site = &sites->sites[loci ? loci[l] : l];
+		if (site->rid < 0)
 			n_skipped++;
-			continue;
-		}
-		bcf_update_id(hdr, rec, locus_entry->name);
-
-		int32_t allele_b_idx;
-		allele_a.l = allele_b.l = 0;
-		int ref_is_del = 0;
-		if (locus_entry->snp[1] == 'N' && locus_entry->snp[3] == 'A') {
-			ref_base[0] = get_ref_base(fai, hdr, rec);
-			allele_b_idx = -1;
-		} else if (locus_entry->source_seq && strchr(locus_entry->source_seq, '-')) {
-			flank.l = 0;
-			kputs(locus_entry->source_seq, &flank);
-			strupper(flank.s);
-			if ((strcasecmp(locus_entry->ilmn_strand, locus_entry->source_strand)
-			     != 0)
-			    != strand)
-				flank_reverse_complement(flank.s);
-			flank_left_shift(flank.s);
-
-			int allele_b_is_del = locus_entry->snp[3] == 'D';
-			ref_is_del = get_indel_alleles(flank.s, fai, bcf_seqname(hdr, rec),
-						       rec->pos, allele_b_is_del, ref_base,
-						       &allele_a, &allele_b);
-			if (ref_is_del == 0)
-				rec->pos--;
-			allele_b_idx = ref_is_del < 0 ? 1 : ref_is_del ^ allele_b_is_del;
-		} else {
-			kputc(strand ? rev_allele(locus_entry->snp[1]) : locus_entry->snp[1],
-			      &allele_a);
-			kputc(strand ? rev_allele(locus_entry->snp[3]) : locus_entry->snp[3],
-			      &allele_b);
-			ref_base[0] = get_ref_base(fai, hdr, rec);
-			allele_b_idx = get_allele_b_idx(ref_base[0], allele_a.s, allele_b.s);
-			if (locus_entry->snp[1] == 'D' || locus_entry->snp[3] == 'I'
-			    || locus_entry->snp[1] == 'D' || locus_entry->snp[3] == 'I')
-				ref_is_del = -1;
-		}
-		if (ref_is_del < 0) {
-			if (flags & VERBOSE)
-				fprintf(stderr, "Unable to determine alleles for indel %s\n",
-					locus_entry->ilmn_id);
+		else if (site->missing)
 			n_missing++;
-		}
-		int32_t allele_a_idx = get_allele_a_idx(allele_b_idx);
-		const char *alleles[3];
-		int nals = alleles_ab_to_vcf(alleles, ref_base, allele_a.s, allele_b.s,
-					     allele_b_idx);
-		if (nals < 0)
-			error("Unable to process marker %s\n", locus_entry->ilmn_id);
-		bcf_update_alleles(hdr, rec, alleles, nals);
-		bcf_update_info_int32(hdr, rec, "ALLELE_A", &allele_a_idx, 1);
-		bcf_update_info_int32(hdr, rec, "ALLELE_B", &allele_b_idx, 1);
+	}
 
-		for (int i = 0; i < n; i++) {
-			get_element(gtc[i]->genotypes, (void *)&gts[i], j);
-			get_element(gtc[i]->genotype_scores, (void *)&igc_arr[i], j);
-			gq_arr[i] = (int)(-10 * log10(1 - igc_arr[i]) + .5);
-			if (gq_arr[i] < 0)
-				gq_arr[i] = 0;
-			if (gq_arr[i] > 50)
-				gq_arr[i] = 50;
-			intensities_t intensities;
-			get_intensities(gtc[i], bpm, egt, j, &intensities);
-			baf_arr[i] = intensities.baf;
-			lrr_arr[i] = intensities.lrr;
-			norm_x_arr[i] = intensities.norm_x;
-			norm_y_arr[i] = intensities.norm_y;
-			ilmn_r_arr[i] = intensities.ilmn_r;
-			ilmn_theta_arr[i] = intensities.ilmn_theta;
-			raw_x_arr[i] = (int32_t)intensities.raw_x;
-			raw_y_arr[i] = (int32_t)intensities.raw_y;
-		}
+	if (intensities)
+		intensities_write_header(intensities, hdr, sites, loci, n_loci);
+
+	tile_t *tiles[2];
+	tiles[0] = tile_init(gtc, n, n_loci);
+	tiles[1] = tile_init(gtc, n, n_loci);
+	tiles[0]->loci = tiles[1]->loci = loci;
+	int m_loci = tiles[0]->m_loci;
+	fprintf(stderr, "Processing tiles of %d loci by %d samples\n", m_loci, n);
+	bcf1_t **recs = (bcf1_t **)malloc(m_loci * sizeof(bcf1_t *));
+	for (int k = 0; k < m_loci; k++)
+		recs[k] = bcf_init();
+	bcf1_t **append_recs = NULL;
+	if (append_fh) {
+		append_recs = (bcf1_t **)malloc(m_loci * sizeof(bcf1_t *));
+		for (int k = 0; k < m_loci; k++)
+			append_recs[k] = bcf_init();
+	}
 
-		if (flags & BPM_LOADED) {
-			bcf_update_info_float(hdr, rec, "FRAC_A", &locus_entry->frac_a, 1);
-			bcf_update_info_float(hdr, rec, "FRAC_C", &locus_entry->frac_c, 1);
-			bcf_update_info_float(hdr, rec, "FRAC_G", &locus_entry->frac_g, 1);
-			bcf_update_info_float(hdr, rec, "FRAC_T", &locus_entry->frac_t, 1);
-			bcf_update_info_int32(hdr, rec, "NORM_ID", &locus_entry->norm_id, 1);
+	int tag_ids[N_TAGS];
+	tag_ids_init(tag_ids, hdr, flags);
+	int n_chunks = pool ? min(2 * hts_tpool_size(pool), m_loci) : 1;
+	encode_job_t *jobs = (encode_job_t *)calloc(n_chunks, sizeof(encode_job_t));
+	for (int i = 0; i < n_chunks; i++) {
+		jobs[i].sites = sites;
+		jobs[i].bpm = bpm;
+		jobs[i].egt = egt;
+		jobs[i].hdr = hdr;
+		jobs[i].flags = flags;
+		jobs[i].tag_ids = tag_ids;
+		jobs[i].recs = recs;
+		jobs[i].gt_arr = (int32_t *)malloc(n * 2 * sizeof(int32_t));
+		jobs[i].append_hdr = append_hdr;
+		jobs[i].append_recs = append_recs;
+	}
+	hts_tpool_process *fill_q =
+		pool ? hts_tpool_process_init(pool, 2 * hts_tpool_size(pool), 1) : NULL;
+	hts_tpool_process *encode_q = pool ? hts_tpool_process_init(pool, n_chunks, 0) : NULL;
+
+	stage_times_t times = {0};
+	if (loci) {
+		uint64_t n_refills, n_bytes, n_refills_end, n_bytes_end;
+		gtc_io_counts(gtc, 0, n, &n_refills, &n_bytes);
+		gtcs_stage_loci(gtc, n, loci, n_loci, pool);
+		gtc_io_counts(gtc, 0, n, &n_refills_end, &n_bytes_end);
+		times.n_refills += n_refills_end - n_refills;
+		times.n_bytes += n_bytes_end - n_bytes;
+	}
+	if (progress)
+		progress_begin(progress, "gtc", n_loci, n);
+	int n_tiles = (n_loci + m_loci - 1) / m_loci;
+	if (n_tiles > 0)
+		tile_dispatch(gtc, bpm, egt, tiles[0], 0, min(m_loci, n_loci), pool, fill_q);
+	for (int t = 0; t < n_tiles; t++) {
+		tile_t *tile = tiles[t & 1];
+		int locus_beg = t * m_loci;
+		tile_wait(tile, fill_q, &times);
+		if (t + 1 < n_tiles)
+			tile_dispatch(gtc, bpm, egt, tiles[(t + 1) & 1], locus_beg + m_loci,
+				      min(m_loci, n_loci - locus_beg - m_loci), pool, fill_q);
+		if (append_fh)
+			append_read(append_fh, append_hdr, sites, bpm, hdr, tile, locus_beg,
+				    append_recs);
+
+		for (int i = 0; i < n_chunks; i++) {
+			encode_job_t *job = &jobs[i];
+			job->tile = tile;
+			job->locus_beg = locus_beg;
+			job->k_beg = (int)((int64_t)tile->n_loci * i / n_chunks);
+			job->k_end = (int)((int64_t)tile->n_loci * (i + 1) / n_chunks);
+			if (!pool) {
+				encode_records(job);
+				write_records(job, out_fh, &times);
+			} else if (hts_tpool_dispatch(pool, encode_q, encode_job_run, (void *)job)
+				   < 0) {
+				error("Failed to dispatch job to the thread pool\n");
+			}
 		}
-		if (flags & CSV_LOADED) {
-			bcf_update_info_int32(hdr, rec, "BEADSET_ID", &locus_entry->beadset_id,
-					      1);
+		for (int i = 0; pool && i < n_chunks; i++) {
+			double t0 = wall_time();
+			hts_tpool_result *r = hts_tpool_next_result_wait(encode_q);
+			if (!r)
+				error("Failed to retrieve result from the thread pool\n");
+			times.wait += wall_time() - t0;
+			write_records((encode_job_t *)hts_tpool_result_data(r), out_fh, &times);
+			hts_tpool_delete_result(r, 0);
 		}
-		if ((flags & BPM_LOADED) | (flags & CSV_LOADED)) {
-			int32_t assay_type = (int32_t)locus_entry->assay_type;
-			bcf_update_info_int32(hdr, rec, "ASSAY_TYPE", &assay_type, 1);
+		// adjusted clusters update the tile while the records are encoded
+		if (intensities)
+			intensities_add_tile(intensities, sites, tile, locus_beg);
+		if (progress) {
+			progress->n_refills = times.n_refills;
+			progress->n_bytes = times.n_bytes;
+			progress->write = times.write;
+			if (progress_update(progress, locus_beg + tile->n_loci))
+				progress_write(progress, 0);
 		}
-		if (flags & EGT_LOADED) {
-			if (flags & ADJUST_CLUSTERS) {
-				adjust_clusters(gts, ilmn_theta_arr, ilmn_r_arr, n,
-						&egt->cluster_records[j]);
-				for (int i = 0; i < n; i++) {
-					get_baf_lrr(
-						ilmn_theta_arr[i], ilmn_r_arr[i],
-						egt->cluster_records[j]
-							.aa_cluster_stats.theta_mean,
-						egt->cluster_records[j]
-							.ab_cluster_stats.theta_mean,
-						egt->cluster_records[j]
-							.bb_cluster_stats.theta_mean,
-						egt->cluster_records[j].aa_cluster_stats.r_mean,
-						egt->cluster_records[j].ab_cluster_stats.r_mean,
-						egt->cluster_records[j].bb_cluster_stats.r_mean,
-						&baf_arr[i], &lrr_arr[i]);
-				}
-			}
-			bcf_update_info_float(
-				hdr, rec, "GenTrain_Score",
-				&egt->cluster_records[j].cluster_score.total_score, 1);
-			bcf_update_info_float(
-				hdr, rec, "Orig_Score",
-				&egt->cluster_records[j].cluster_score.original_score, 1);
-			if (egt->cluster_records[j].cluster_score.edited)
-				bcf_update_info_flag(hdr, rec, "Edited", NULL, 1);
-			bcf_update_info_float(
-				hdr, rec, "Cluster_Sep",
-				&egt->cluster_records[j].cluster_score.cluster_separation, 1);
-			bcf_update_info_int32(hdr, rec, "N_AA",
-					      &egt->cluster_records[j].aa_cluster_stats.N, 1);
-			bcf_update_info_int32(hdr, rec, "N_AB",
-					      &egt->cluster_records[j].ab_cluster_stats.N, 1);
-			bcf_update_info_int32(hdr, rec, "N_BB",
-					      &egt->cluster_records[j].bb_cluster_stats.N, 1);
-			bcf_update_info_float(hdr, rec, "devR_AA",
-					      &egt->cluster_records[j].aa_cluster_stats.r_dev,
-					      1);
-			bcf_update_info_float(hdr, rec, "devR_AB",
-					      &egt->cluster_records[j].ab_cluster_stats.r_dev,
-					      1);
-			bcf_update_info_float(hdr, rec, "devR_BB",
-					      &egt->cluster_records[j].bb_cluster_stats.r_dev,
-					      1);
-			bcf_update_info_float(
-				hdr, rec, "devTHETA_AA",
-				&egt->cluster_records[j].aa_cluster_stats.theta_dev, 1);
-			bcf_update_info_float(
-				hdr, rec, "devTHETA_AB",
-				&egt->cluster_records[j].ab_cluster_stats.theta_dev, 1);
-			bcf_update_info_float(
-				hdr, rec, "devTHETA_BB",
-				&egt->cluster_records[j].bb_cluster_stats.theta_dev, 1);
-			bcf_update_info_float(hdr, rec, "meanR_AA",
-					      &egt->cluster_records[j].aa_cluster_stats.r_mean,
-					      1);
-			bcf_update_info_float(hdr, rec, "meanR_AB",
-					      &egt->cluster_records[j].ab_cluster_stats.r_mean,
-					      1);
-			bcf_update_info_float(hdr, rec, "meanR_BB",
-					      &egt->cluster_records[j].bb_cluster_stats.r_mean,
-					      1);
-			bcf_update_info_float(
-				hdr, rec, "meanTHETA_AA",
-				&egt->cluster_records[j].aa_cluster_stats.theta_mean, 1);
-			bcf_update_info_float(
-				hdr, rec, "meanTHETA_AB",
-				&egt->cluster_records[j].ab_cluster_stats.theta_mean, 1);
-			bcf_update_info_float(
-				hdr, rec, "meanTHETA_BB",
-				&egt->cluster_records[j].bb_cluster_stats.theta_mean, 1);
-			bcf_update_info_float(hdr, rec, "Intensity_Threshold",
-					      &egt->cluster_records[j].intensity_threshold, 1);
-		}
-
-		gts_to_gt_arr(gt_arr, gts, n, allele_a_idx, allele_b_idx);
-		bcf_update_genotypes(hdr, rec, gt_arr, n * 2);
-		bcf_update_format_int32(hdr, rec, "GQ", gq_arr, n);
-		if (flags & FORMAT_IGC)
-			bcf_update_format_float(hdr, rec, "IGC", igc_arr, n);
-		if (flags & FORMAT_BAF)
-			bcf_update_format_float(hdr, rec, "BAF", baf_arr, n);
-		if (flags & FORMAT_LRR)
-			bcf_update_format_float(hdr, rec, "LRR", lrr_arr, n);
-		if (flags & FORMAT_NORMX)
-			bcf_update_format_float(hdr, rec, "NORMX", norm_x_arr, n);
-		if (flags & FORMAT_NORMY)
-			bcf_update_format_float(hdr, rec, "NORMY", norm_y_arr, n);
-		if (flags & FORMAT_R)
-			bcf_update_format_float(hdr, rec, "R", ilmn_r_arr, n);
-		if (flags & FORMAT_THETA)
-			bcf_update_format_float(hdr, rec, "THETA", ilmn_theta_arr, n);
-		if (flags & FORMAT_X)
-			bcf_update_format_int32(hdr, rec, "X", raw_x_arr, n);
-		if (flags & FORMAT_Y)
-			bcf_update_format_int32(hdr, rec, "Y", raw_y_arr, n);
-		if (bcf_write(out_fh, hdr, rec) < 0)
-			error("Unable to write to output VCF file\n");
 	}
-	fprintf(stderr, "Lines   total/missing-reference/skipped:\t%d/%d/%d\n", bpm->num_loci,
+	if (progress)
+		progress_end(progress, n_loci);
+	fprintf(stderr, "Lines   total/missing-reference/skipped:\t%d/%d/%d\n", n_loci,
 		n_missing, n_skipped);
+	if (flags & VERBOSE) {
+		fprintf(stderr,
+			"Seconds read/compute/encode/write/wait:\t%.2f/%.2f/%.2f/%.2f/%.2f\n",
+			times.read, times.compute, times.encode, times.write, times.wait);
+		print_throughput(stderr, wall_time() - t_beg, n_loci, n);
+	}
 
-	free(gts);
-	free(gt_arr);
-	free(gq_arr);
-	free(igc_arr);
-	free(baf_arr);
-	free(lrr_arr);
-	free(norm_x_arr);
-	free(norm_y_arr);
-	free(ilmn_r_arr);
-	free(ilmn_theta_arr);
-	free(raw_x_arr);
-	free(raw_y_arr);
-
-	free(allele_a.s);
-	free(allele_b.s);
-	free(flank.s);
-
-	bcf_destroy(rec);
+	for (int i = 0; i < n_chunks; i++) {
+		free(jobs[i].gt_arr);
+		free(jobs[i].append_arr);
+		free(jobs[i].merge_arr);
+	}
+	free(jobs);
+	for (int k = 0; k < m_loci; k++)
+		bcf_destroy(recs[k]);
+	free(recs);
+	if (append_fh) {
+		bcf1_t *rec = append_recs[0];
+		if (bcf_read(append_fh, append_hdr, rec) == 0)
+			error("The appended file %s has more records than markers output\n",
+			      append_fh->fn);
+		for (int k = 0; k < m_loci; k++)
+			bcf_destroy(append_recs[k]);
+		free(append_recs);
+	}
+	tile_destroy(tiles[0]);
+	tile_destroy(tiles[1]);
+	if (fill_q)
+		hts_tpool_process_destroy(fill_q);
+	if (encode_q)
+		hts_tpool_process_destroy(encode_q);
+
+	if ((flags & WRITE_INDEX) && bcf_idx_save(out_fh) < 0)
+		error("Unable to write index %s\n", fnidx.s);
 	bcf_hdr_destroy(hdr);
 	if (hts_close(out_fh) < 0)
 		error("Close failed: %s\n", out_fh->fn);
+	free(fnidx.s);
 }
 
 #define GS_GT 0
@@ -2707,6 +5498,21 @@ static void gtcs_to_vcf(faidx_t *fai, const bpm_t *bpm, const egt_t *egt, gtc_t
 #define GS_THETA 9
 #define GS_X 10
 #define GS_Y 11
+#define N_GS 12
+
+#define N_GS_INFO 5
+#define GS_CHUNK_SIZE (1 << 24) // bytes of text parsed by each job
+#define GS_CHUNK_LINES 1024
+
+static const char *gs_ids[N_GS] = {"GT",  "TOP_STRAND", "REF_STRAND", "IGC",
+				   "BAF", "LRR",	"NORMX",      "NORMY",
+				   "R",	  "THETA",	"X",	      "Y"};
+static const int gs_size[N_GS] = {1, 2, 2, 4, 4, 4, 4, 4, 4, 4, 4, 4};
+static const int gs_flags[N_GS] = {0,	       0,	     0,		   FORMAT_IGC,
+				   FORMAT_BAF, FORMAT_LRR,   FORMAT_NORMX, FORMAT_NORMY,
+				   FORMAT_R,   FORMAT_THETA, FORMAT_X,	   FORMAT_Y};
+static const char *gs_info_ids[N_GS_INFO] = {"GENTRAIN_SCORE", "FRAC_A", "FRAC_C", "FRAC_G",
+					     "FRAC_T"};
 
 typedef struct {
 	int *col2sample;
@@ -2792,12 +5598,13 @@ static int tsv_parse_delimiter(tsv_t *tsv, bcf1_t *rec, char *str, int delimiter
 	tsv->icol = 0;
 	tsv->ss = tsv->se = str;
 	while (*tsv->ss && tsv->icol < tsv->ncols) {
-		if (delimiter)
-			while (*tsv->se && (*tsv->se) != delimiter)
-				tsv->se++;
-		else
+		if (delimiter) {
+			char *ptr = strchr(tsv->se, delimiter);
+			tsv->se = ptr ? ptr : tsv->se + strlen(tsv->se);
+		} else {
 			while (*tsv->se && !isspace(*tsv->se))
 				tsv->se++;
+		}
 		if (tsv->cols[tsv->icol].setter) {
 			int ret =
 				tsv->cols[tsv->icol].setter(tsv, rec, tsv->cols[tsv->icol].usr);
@@ -2805,19 +5612,153 @@ static int tsv_parse_delimiter(tsv_t *tsv, bcf1_t *rec, char *str, int delimiter
 				return -1;
 			status++;
 		}
-		if (delimiter)
-			tsv->se++;
-		else
+		if (delimiter) {
+			if (*tsv->se)
+				tsv->se++;
+		} else {
 			while (*tsv->se && isspace(*tsv->se))
 				tsv->se++;
+		}
 		tsv->ss = tsv->se;
 		tsv->icol++;
 	}
 	return status ? 0 : -1;
 }
 
-static void gs_to_vcf(faidx_t *fai, htsFile *gs_fh, htsFile *out_fh, bcf_hdr_t *hdr, int flags)
+// registers the GenomeStudio columns with a parser and returns which ones are present
+static void gs_register(tsv_t *tsv, bcf_hdr_t *hdr, gs_col_t *gs_cols, float *info,
+			int *info_ret, int *col_ret, int flags)
+{
+	if (tsv_register(tsv, "CHROM", tsv_setter_chrom_flexible, hdr) < 0)
+		error("Expected CHROM column\n");
+	if (tsv_register(tsv, "POS", tsv_setter_pos, NULL) < 0)
+		error("Expected POS column\n");
+	tsv_register(tsv, "ID", tsv_setter_id, hdr);
+	for (int k = 0; k < N_GS_INFO; k++)
+		info_ret[k] = tsv_register(tsv, gs_info_ids[k], tsv_read_float, &info[k]);
+	for (int k = 0; k < N_GS; k++) {
+		col_ret[k] = -1;
+		if (!gs_flags[k] || (flags & gs_flags[k]))
+			col_ret[k] =
+				tsv_register_all(tsv, gs_ids[k], tsv_setter_gs_col, &gs_cols[k]);
+	}
+	if (col_ret[GS_GT] < 0)
+		error("Expected GType column\n");
+}
+
+// a chunk of lines of the GenomeStudio table parsed into per line sample arrays
+typedef struct {
+	tsv_t *tsv;
+	gs_col_t gs_cols[N_GS];
+	float info[N_GS_INFO];
+	int nsamples;
+	int use[N_GS];
+	kstring_t buf;
+	int *off;
+	int n_lines, m_lines;
+	int *ret;
+	bcf1_t **recs;
+	float *infos;
+	void *arrs[N_GS];
+	int m_arrs;
+} gs_job_t;
+
+static void gs_job_init(gs_job_t *job, const char *names, bcf_hdr_t *hdr, int *col2sample,
+			int nsamples, int *info_ret, int *col_ret, int flags)
+{
+	memset(job, 0, sizeof(gs_job_t));
+	job->tsv = tsv_init(names);
+	for (int k = 0; k < N_GS; k++) {
+		job->gs_cols[k].col2sample = col2sample;
+		job->gs_cols[k].type = k;
+	}
+	gs_register(job->tsv, hdr, job->gs_cols, job->info, info_ret, col_ret, flags);
+	job->nsamples = nsamples;
+	for (int k = 0; k < N_GS; k++)
+		job->use[k] = k <= GS_REF_STRAND || col_ret[k] == 0;
+}
+
+static void gs_job_destroy(gs_job_t *job)
+{
+	tsv_destroy(job->tsv);
+	free(job->buf.s);
+	free(job->off);
+	free(job->ret);
+	for (int j = 0; j < job->m_arrs; j++)
+		bcf_destroy(job->recs[j]);
+	free(job->recs);
+	free(job->infos);
+	for (int k = 0; k < N_GS; k++)
+		free(job->arrs[k]);
+}
+
+// reads the next chunk of lines, skipping comments
+static int gs_job_read(gs_job_t *job, htsFile *gs_fh, kstring_t *line)
+{
+	job->buf.l = 0;
+	job->n_lines = 0;
+	while (job->n_lines < GS_CHUNK_LINES && job->buf.l < GS_CHUNK_SIZE
+	       && hts_getline(gs_fh, KS_SEP_LINE, line) > 0) {
+		if (line->s[0] == '#')
+			continue; // skip comments
+		hts_expand(int, job->n_lines + 1, job->m_lines, job->off);
+		job->off[job->n_lines++] = job->buf.l;
+		kputsn(line->s, line->l, &job->buf);
+		kputc('\0', &job->buf);
+	}
+	return job->n_lines;
+}
+
+static inline void *gs_job_arr(const gs_job_t *job, int k, int j)
+{
+	return (char *)job->arrs[k] + (size_t)j * job->nsamples * gs_size[k];
+}
+
+static void gs_job_parse(gs_job_t *job)
+{
+	if (job->m_arrs < job->n_lines) {
+		job->ret = (int *)realloc(job->ret, job->n_lines * sizeof(int));
+		job->recs = (bcf1_t **)realloc(job->recs, job->n_lines * sizeof(bcf1_t *));
+		for (int j = job->m_arrs; j < job->n_lines; j++)
+			job->recs[j] = bcf_init();
+		job->infos = (float *)realloc(job->infos,
+					      job->n_lines * N_GS_INFO * sizeof(float));
+		for (int k = 0; k < N_GS; k++)
+			if (job->use[k])
+				job->arrs[k] = realloc(job->arrs[k], (size_t)job->n_lines
+									     * job->nsamples
+									     * gs_size[k]);
+		job->m_arrs = job->n_lines;
+	}
+	for (int j = 0; j < job->n_lines; j++) {
+		bcf1_t *rec = job->recs[j];
+		bcf_clear(rec);
+		rec->n_sample = job->nsamples;
+		for (int k = 0; k < N_GS; k++)
+			job->gs_cols[k].ptr = job->use[k] ? gs_job_arr(job, k, j) : NULL;
+		job->ret[j] = tsv_parse_delimiter(job->tsv, rec, &job->buf.s[job->off[j]], '\t');
+		memcpy(&job->infos[j * N_GS_INFO], job->info, N_GS_INFO * sizeof(float));
+	}
+}
+
+static void *gs_job_run(void *arg)
+{
+	gs_job_parse((gs_job_t *)arg);
+	return arg;
+}
+
+static void gs_to_vcf(ref_cache_t *ref, htsFile *gs_fh, htsFile *out_fh, bcf_hdr_t *hdr,
+		      const char *skip_columns, hts_tpool *pool, progress_t *progress, int flags)
 {
+	void *skip = khash_str2int_init();
+	if (skip_columns) {
+		int n;
+		char **names = hts_readlist(skip_columns, 0, &n);
+		for (int i = 0; i < n; i++)
+			khash_str2int_inc(skip, names[i]);
+		free(names);
+	}
+
 	// read the header of the table
 	kstring_t line = {0, 0, NULL};
 	if (hts_getline(gs_fh, KS_SEP_LINE, &line) <= 0)
@@ -2833,7 +5774,9 @@ static void gs_to_vcf(faidx_t *fai, htsFile *gs_fh, htsFile *out_fh, bcf_hdr_t *
 			*ptr++ = '\0';
 			if ((bcf_hdr_id2int(hdr, BCF_DT_SAMPLE, &line.s[off[i]]) < 0))
 				bcf_hdr_add_sample(hdr, &line.s[off[i]]);
-			if (strcmp(ptr, "GType") == 0)
+			if (khash_str2int_has_key(skip, ptr))
+				kputc('-', &str);
+			else if (strcmp(ptr, "GType") == 0)
 				kputs("GT", &str);
 			else if (strcmp(ptr, "Score") == 0)
 				kputs("IGC", &str);
@@ -2872,7 +5815,9 @@ static void gs_to_vcf(faidx_t *fai, htsFile *gs_fh, htsFile *out_fh, bcf_hdr_t *
 			col2sample[i] = bcf_hdr_id2int(hdr, BCF_DT_SAMPLE, &line.s[off[i]]);
 		} else {
 			ptr = &line.s[off[i]];
-			if (strcmp(ptr, "Index") == 0)
+			if (khash_str2int_has_key(skip, ptr))
+				kputc('-', &str);
+			else if (strcmp(ptr, "Index") == 0)
 				kputc('-', &str);
 			else if (strcmp(ptr, "Name") == 0)
 				kputs("ID", &str);
@@ -2904,65 +5849,45 @@ static void gs_to_vcf(faidx_t *fai, htsFile *gs_fh, htsFile *out_fh, bcf_hdr_t *
 		}
 	}
 	free(off);
+	khash_str2int_destroy_free(skip);
 	if (bcf_hdr_sync(hdr) < 0)
 		error_errno("[%s] Failed to update header",
 			    __func__); // updates the number of samples
 	int nsamples = bcf_hdr_nsamples(hdr);
 
-	tsv_t *tsv = tsv_init(str.s);
-	if (tsv_register(tsv, "CHROM", tsv_setter_chrom_flexible, hdr) < 0)
-		error("Expected CHROM column\n");
-	if (tsv_register(tsv, "POS", tsv_setter_pos, NULL) < 0)
-		error("Expected POS column\n");
-	tsv_register(tsv, "ID", tsv_setter_id, hdr);
+	// each job parses its lines with its own parser
+	int info_ret[N_GS_INFO], col_ret[N_GS];
+	int n_jobs = pool ? 2 * hts_tpool_size(pool) : 1;
+	gs_job_t *jobs = (gs_job_t *)malloc(n_jobs * sizeof(gs_job_t));
+	for (int i = 0; i < n_jobs; i++)
+		gs_job_init(&jobs[i], str.s, hdr, col2sample, nsamples, info_ret, col_ret, flags);
 
-	float total_score;
-	int gentrain_score = tsv_register(tsv, "GENTRAIN_SCORE", tsv_read_float, &total_score);
-	if (gentrain_score)
+	if (info_ret[0])
 		bcf_hdr_append(
 			hdr,
 			"##INFO=<ID=GenTrain_Score,Number=1,Type=Float,Description=\"The SNP cluster quality from the GenTrain clustering algorithm\">");
-	float frac[4];
-	int frac_a = tsv_register(tsv, "FRAC_A", tsv_read_float, &frac[0]);
-	if (frac_a == 0)
+	if (info_ret[1] == 0)
 		bcf_hdr_append(
 			hdr,
 			"##INFO=<ID=FRAC_A,Number=1,Type=Float,Description=\"Fraction of the A nucleotide in the top genomic sequence\">");
-	int frac_c = tsv_register(tsv, "FRAC_C", tsv_read_float, &frac[1]);
-	if (frac_c == 0)
+	if (info_ret[2] == 0)
 		bcf_hdr_append(
 			hdr,
 			"##INFO=<ID=FRAC_C,Number=1,Type=Float,Description=\"Fraction of the C nucleotide in the top genomic sequence\">");
-	int frac_g = tsv_register(tsv, "FRAC_G", tsv_read_float, &frac[2]);
-	if (frac_g == 0)
+	if (info_ret[3] == 0)
 		bcf_hdr_append(
 			hdr,
 			"##INFO=<ID=FRAC_G,Number=1,Type=Float,Description=\"Fraction of the G nucleotide in the top genomic sequence\">");
-	int frac_t = tsv_register(tsv, "FRAC_T", tsv_read_float, &frac[3]);
-	if (frac_t == 0)
+	if (info_ret[4] == 0)
 		bcf_hdr_append(
 			hdr,
 			"##INFO=<ID=FRAC_T,Number=1,Type=Float,Description=\"Fraction of the T nucleotide in the top genomic sequence\">");
 
-	uint8_t *gts = (uint8_t *)malloc(nsamples * sizeof(uint8_t));
-	int32_t *gt_arr = (int32_t *)malloc(nsamples * 2 * sizeof(int32_t));
-	gs_col_t gs_gts = {col2sample, GS_GT, gts};
-	if (tsv_register_all(tsv, "GT", tsv_setter_gs_col, &gs_gts) < 0)
-		error("Expected GType column\n");
-	int32_t *gq_arr = (int32_t *)malloc(nsamples * sizeof(int32_t));
-
-	char *top_strand_alleles = (char *)malloc(nsamples * 2 * sizeof(char));
-	gs_col_t gs_top_strand = {col2sample, GS_TOP_STRAND, top_strand_alleles};
-	tsv_register_all(tsv, "TOP_STRAND", tsv_setter_gs_col, &gs_top_strand);
-	const char *strand_alleles = top_strand_alleles;
-
-	char *ref_strand_alleles = (char *)malloc(nsamples * 2 * sizeof(char));
-	gs_col_t gs_ref_strand = {col2sample, GS_REF_STRAND, ref_strand_alleles};
-	if (tsv_register_all(tsv, "REF_STRAND", tsv_setter_gs_col, &gs_ref_strand) < 0) {
+	int ref_strand = col_ret[GS_REF_STRAND] == 0;
+	if (!ref_strand) {
 		fprintf(stderr,
 			"Warning: Plus/Minus Alleles column is missing from the GenomeStudio table\nThis type of conversion is not recommended and will require +fixref -m top\n");
 	} else {
-		strand_alleles = ref_strand_alleles;
 		bcf_hdr_append(
 			hdr,
 			"##INFO=<ID=ALLELE_A,Number=1,Type=Integer,Description=\"A allele\">");
@@ -2971,66 +5896,63 @@ static void gs_to_vcf(faidx_t *fai, htsFile *gs_fh, htsFile *out_fh, bcf_hdr_t *
 			"##INFO=<ID=ALLELE_B,Number=1,Type=Integer,Description=\"B allele\">");
 	}
 
-	gs_col_t gs_igc = {col2sample, GS_IGC, NULL};
-	if ((flags & FORMAT_IGC)
-	    && tsv_register_all(tsv, "IGC", tsv_setter_gs_col, &gs_igc) == 0)
-		gs_igc.ptr = malloc(nsamples * sizeof(float));
-
-	gs_col_t gs_baf = {col2sample, GS_BAF, NULL};
-	if ((flags & FORMAT_BAF)
-	    && tsv_register_all(tsv, "BAF", tsv_setter_gs_col, &gs_baf) == 0)
-		gs_baf.ptr = malloc(nsamples * sizeof(float));
-
-	gs_col_t gs_lrr = {col2sample, GS_LRR, NULL};
-	if ((flags & FORMAT_LRR)
-	    && tsv_register_all(tsv, "LRR", tsv_setter_gs_col, &gs_lrr) == 0)
-		gs_lrr.ptr = malloc(nsamples * sizeof(float));
-
-	gs_col_t gs_norm_x = {col2sample, GS_NORMX, NULL};
-	if ((flags & FORMAT_NORMX)
-	    && tsv_register_all(tsv, "NORMX", tsv_setter_gs_col, &gs_norm_x) == 0)
-		gs_norm_x.ptr = malloc(nsamples * sizeof(float));
-
-	gs_col_t gs_norm_y = {col2sample, GS_NORMY, NULL};
-	if ((flags & FORMAT_NORMY)
-	    && tsv_register_all(tsv, "NORMY", tsv_setter_gs_col, &gs_norm_y) == 0)
-		gs_norm_y.ptr = malloc(nsamples * sizeof(float));
-
-	gs_col_t gs_ilmn_r = {col2sample, GS_R, NULL};
-	if ((flags & FORMAT_R)
-	    && tsv_register_all(tsv, "R", tsv_setter_gs_col, &gs_ilmn_r) == 0)
-		gs_ilmn_r.ptr = malloc(nsamples * sizeof(float));
-
-	gs_col_t gs_ilmn_theta = {col2sample, GS_THETA, NULL};
-	if ((flags & FORMAT_THETA)
-	    && tsv_register_all(tsv, "THETA", tsv_setter_gs_col, &gs_ilmn_theta) == 0)
-		gs_ilmn_theta.ptr = malloc(nsamples * sizeof(float));
-
-	gs_col_t gs_raw_x = {col2sample, GS_X, NULL};
-	if ((flags & FORMAT_X) && tsv_register_all(tsv, "X", tsv_setter_gs_col, &gs_raw_x) == 0)
-		gs_raw_x.ptr = malloc(nsamples * sizeof(int32_t));
-
-	gs_col_t gs_raw_y = {col2sample, GS_Y, NULL};
-	if ((flags & FORMAT_Y) && tsv_register_all(tsv, "Y", tsv_setter_gs_col, &gs_raw_y) == 0)
-		gs_raw_y.ptr = malloc(nsamples * sizeof(int32_t));
-
 	if (bcf_hdr_write(out_fh, hdr) < 0)
 		error("Unable to write to output VCF file\n");
 
-	bcf1_t *rec = bcf_init();
+	int32_t *gt_arr = (int32_t *)malloc(nsamples * 2 * sizeof(int32_t));
+	int32_t *gq_arr = (int32_t *)malloc(nsamples * sizeof(int32_t));
 	char ref_base[] = {'\0', '\0'};
 	char allele_a[] = {'\0', '\0'};
 	char allele_b[] = {'\0', '\0'};
 	int32_t allele_a_idx, allele_b_idx;
 	int n_total = 0, n_missing = 0, n_skipped = 0;
-	while (hts_getline(gs_fh, KS_SEP_LINE, &line) > 0) {
-		if (line.s[0] == '#')
-			continue; // skip comments
-		bcf_clear(rec);
-		rec->n_sample = nsamples;
+	double t_beg = wall_time();
+	if (progress)
+		progress_begin(progress, "genome-studio", 0, nsamples);
+
+	// lines are parsed in chunks by the thread pool and encoded in order by the main thread
+	hts_tpool_process *q = pool ? hts_tpool_process_init(pool, n_jobs, 0) : NULL;
+	int n_read = 0, n_done = 0, eof = 0;
+	while (1) {
+		while (!eof && n_read - n_done < n_jobs) {
+			gs_job_t *job = &jobs[n_read % n_jobs];
+			if (gs_job_read(job, gs_fh, &line) == 0) {
+				eof = 1;
+				break;
+			}
+			if (!pool)
+				gs_job_parse(job);
+			else if (hts_tpool_dispatch(pool, q, gs_job_run, (void *)job) < 0)
+				error("Failed to dispatch job to the thread pool\n");
+			n_read++;
+		}
+		if (n_done == n_read)
+			break;
+		gs_job_t *job = &jobs[n_done % n_jobs];
+		if (pool) {
+			hts_tpool_result *r = hts_tpool_next_result_wait(q);
+			if (!r)
+				error("Failed to retrieve result from the thread pool\n");
+			job = (gs_job_t *)hts_tpool_result_data(r);
+			hts_tpool_delete_result(r, 0);
+		}
+		n_done++;
+
+		for (int j = 0; j < job->n_lines; j++) {
+			bcf1_t *rec = job->recs[j];
+			const uint8_t *gts = (uint8_t *)gs_job_arr(job, GS_GT, j);
+			const char *strand_alleles = (char *)gs_job_arr(
+				job, ref_strand ? GS_REF_STRAND : GS_TOP_STRAND, j);
+			const float *info = &job->infos[j * N_GS_INFO];
+			n_total++;
+			if (job->ret[j] < 0) {
+				if (flags & VERBOSE)
+					fprintf(stderr, "Skipping unlocalized marker %s\n",
+						rec->d.id);
+				n_skipped++;
+				continue;
+			}
 
-		n_total++;
-		if (!tsv_parse_delimiter(tsv, rec, line.s, '\t')) {
 			// determine A and B alleles
 			allele_a[0] = '.';
 			allele_b[0] = '.';
@@ -3056,9 +5978,8 @@ static void gs_to_vcf(faidx_t *fai, htsFile *gs_fh, htsFile *out_fh, bcf_hdr_t *
 
 			if (allele_a[0] == '.' && allele_b[0] == '.') {
 				allele_b_idx = -1;
-			} else if (strand_alleles == top_strand_alleles || allele_a[0] == 'D'
-				   || allele_a[0] == 'I' || allele_b[0] == 'D'
-				   || allele_b[0] == 'I') {
+			} else if (!ref_strand || allele_a[0] == 'D' || allele_a[0] == 'I'
+				   || allele_b[0] == 'D' || allele_b[0] == 'I') {
 				if (allele_a[0] == 'D' && allele_b[0] == '.')
 					allele_b[0] = 'I';
 				if (allele_a[0] == 'I' && allele_b[0] == '.')
@@ -3070,7 +5991,7 @@ static void gs_to_vcf(faidx_t *fai, htsFile *gs_fh, htsFile *out_fh, bcf_hdr_t *
 				allele_b_idx = 1;
 				n_missing++;
 			} else {
-				ref_base[0] = get_ref_base(fai, hdr, rec);
+				ref_base[0] = get_ref_base(ref, hdr, rec);
 				allele_b_idx =
 					get_allele_b_idx(ref_base[0], allele_a, allele_b);
 			}
@@ -3081,93 +6002,74 @@ static void gs_to_vcf(faidx_t *fai, htsFile *gs_fh, htsFile *out_fh, bcf_hdr_t *
 			if (nals < 0)
 				error("Unable to process marker %s\n", rec->d.id);
 			bcf_update_alleles(hdr, rec, alleles, nals);
-			if (strand_alleles == ref_strand_alleles) {
+			if (ref_strand) {
 				bcf_update_info_int32(hdr, rec, "ALLELE_A", &allele_a_idx, 1);
 				bcf_update_info_int32(hdr, rec, "ALLELE_B", &allele_b_idx, 1);
 			}
-			if (gentrain_score == 0)
-				bcf_update_info_float(hdr, rec, "GenTrain_Score", &total_score,
-						      1);
-			if (frac_a == 0)
-				bcf_update_info_float(hdr, rec, "FRAC_A", &frac[0], 1);
-			if (frac_c == 0)
-				bcf_update_info_float(hdr, rec, "FRAC_C", &frac[1], 1);
-			if (frac_g == 0)
-				bcf_update_info_float(hdr, rec, "FRAC_G", &frac[2], 1);
-			if (frac_t == 0)
-				bcf_update_info_float(hdr, rec, "FRAC_T", &frac[3], 1);
+			if (info_ret[0] == 0)
+				bcf_update_info_float(hdr, rec, "GenTrain_Score", &info[0], 1);
+			if (info_ret[1] == 0)
+				bcf_update_info_float(hdr, rec, "FRAC_A", &info[1], 1);
+			if (info_ret[2] == 0)
+				bcf_update_info_float(hdr, rec, "FRAC_C", &info[2], 1);
+			if (info_ret[3] == 0)
+				bcf_update_info_float(hdr, rec, "FRAC_G", &info[3], 1);
+			if (info_ret[4] == 0)
+				bcf_update_info_float(hdr, rec, "FRAC_T", &info[4], 1);
 
 			gts_to_gt_arr(gt_arr, gts, nsamples, allele_a_idx, allele_b_idx);
 			bcf_update_genotypes(hdr, rec, gt_arr, nsamples * 2);
-			if (gs_igc.ptr) {
+			if (col_ret[GS_IGC] == 0) {
+				const float *igc = (float *)gs_job_arr(job, GS_IGC, j);
 				for (int i = 0; i < nsamples; i++) {
-					gq_arr[i] =
-						(int)(-10 * log10(1 - ((float *)gs_igc.ptr)[i])
-						      + .5);
+					gq_arr[i] = (int)(-10 * log10(1 - igc[i]) + .5);
 					if (gq_arr[i] < 0)
 						gq_arr[i] = 0;
 					if (gq_arr[i] > 50)
 						gq_arr[i] = 50;
 				}
 				bcf_update_format_int32(hdr, rec, "GQ", gq_arr, nsamples);
-				bcf_update_format_float(hdr, rec, "IGC", (float *)gs_igc.ptr,
-							nsamples);
 			}
-			if (gs_baf.ptr)
-				bcf_update_format_float(hdr, rec, "BAF", (float *)gs_baf.ptr,
-							nsamples);
-			if (gs_lrr.ptr)
-				bcf_update_format_float(hdr, rec, "LRR", (float *)gs_lrr.ptr,
-							nsamples);
-			if (gs_norm_x.ptr)
-				bcf_update_format_float(hdr, rec, "NORMX",
-							(float *)gs_norm_x.ptr, nsamples);
-			if (gs_norm_y.ptr)
-				bcf_update_format_float(hdr, rec, "NORMY",
-							(float *)gs_norm_y.ptr, nsamples);
-			if (gs_ilmn_r.ptr)
-				bcf_update_format_float(hdr, rec, "R", (float *)gs_ilmn_r.ptr,
-							nsamples);
-			if (gs_ilmn_theta.ptr)
-				bcf_update_format_float(hdr, rec, "THETA",
-							(float *)gs_ilmn_theta.ptr, nsamples);
-			if (gs_raw_x.ptr)
-				bcf_update_format_int32(hdr, rec, "X", (int32_t *)gs_raw_x.ptr,
-							nsamples);
-			if (gs_raw_y.ptr)
-				bcf_update_format_int32(hdr, rec, "Y", (int32_t *)gs_raw_y.ptr,
-							nsamples);
+			for (int k = GS_IGC; k <= GS_THETA; k++)
+				if (col_ret[k] == 0)
+					bcf_update_format_float(hdr, rec, gs_ids[k],
+								gs_job_arr(job, k, j), nsamples);
+			for (int k = GS_X; k <= GS_Y; k++)
+				if (col_ret[k] == 0)
+					bcf_update_format_int32(hdr, rec, gs_ids[k],
+								gs_job_arr(job, k, j), nsamples);
+			double t0 = progress ? wall_time() : 0.0;
 			if (bcf_write(out_fh, hdr, rec) < 0)
 				error("Unable to write to output VCF file\n");
-		} else {
-			if (flags & VERBOSE)
-				fprintf(stderr, "Skipping unlocalized marker %s\n", rec->d.id);
-			n_skipped++;
+			if (progress) {
+				progress->write += wall_time() - t0;
+				if (progress_update(progress, n_total)) {
+					progress->n_bytes = hts_bytes_read(gs_fh);
+					progress_write(progress, 0);
+				}
+			}
 		}
 	}
+	if (progress) {
+		progress->n_bytes = hts_bytes_read(gs_fh);
+		progress_end(progress, n_total);
+	}
 	fprintf(stderr, "Lines   total/missing-reference/skipped:\t%d/%d/%d\n", n_total,
 		n_missing, n_skipped);
+	if (flags & VERBOSE)
+		print_throughput(stderr, wall_time() - t_beg, n_total, nsamples);
 	free(line.s);
 
+	if (q)
+		hts_tpool_process_destroy(q);
+	for (int i = 0; i < n_jobs; i++)
+		gs_job_destroy(&jobs[i]);
+	free(jobs);
 	free(col2sample);
-	free(gts);
 	free(gt_arr);
 	free(gq_arr);
-	free(top_strand_alleles);
-	free(ref_strand_alleles);
-	free(gs_igc.ptr);
-	free(gs_baf.ptr);
-	free(gs_lrr.ptr);
-	free(gs_norm_x.ptr);
-	free(gs_norm_y.ptr);
-	free(gs_ilmn_r.ptr);
-	free(gs_ilmn_theta.ptr);
-	free(gs_raw_x.ptr);
-	free(gs_raw_y.ptr);
-	tsv_destroy(tsv);
 	free(str.s);
 
-	bcf_destroy(rec);
 	bcf_hdr_destroy(hdr);
 	if (hts_close(out_fh) < 0)
 		error("Close failed: %s\n", out_fh->fn);
@@ -3199,18 +6101,40 @@ static const char *usage_text(void)
 	       "    -e, --egt <file>                EGT cluster file\n"
 	       "    -f, --fasta-ref <file>          reference sequence in fasta format\n"
 	       "        --set-cache-size <int>      select fasta cache size in bytes\n"
+	       "        --ref-cache <int>           memory in MB used to cache reference sequences [256]\n"
 	       "    -g, --gtcs <dir|file>           GTC genotype files from directory or list from file\n"
 	       "    -i, --idat                      input IDAT files rather than GTC files\n"
+	       "                                    (pairs of _Grn and _Red files only provide the X and Y tags)\n"
 	       "        --adjust-clusters           adjust cluster centers in (Theta, R) space (requires --bpm and --egt)\n"
 	       "    -x, --sex <file>                output GenCall gender estimate into file\n"
 	       "        --use-gtc-sample-names      use sample name in GTC files rather than GTC file name\n"
 	       "        --do-not-check-bpm          do not check whether BPM and GTC files match manifest file name\n"
+	       "    -r, --regions <region>          restrict to comma-separated list of regions\n"
+	       "    -R, --regions-file <file>       restrict to regions listed in a file\n"
+	       "        --targets [^]<region>       similar to --regions but excludes regions if prefixed with ^\n"
+	       "        --targets-file [^]<file>    similar to --regions-file but excludes regions if prefixed with ^\n"
+	       "        --include-ids <file>        restrict to markers with IDs listed in a file\n"
+	       "        --manifest-cache <file>     load resolved marker alleles from file or save them if outdated\n"
 	       "        --genome-studio <file>      input a GenomeStudio final report file (in matrix format)\n"
+	       "        --skip-columns <list>       comma-separated list of GenomeStudio columns to ignore (e.g. Theta,R)\n"
 	       "        --no-version                do not append version and command line to the header\n"
 	       "    -o, --output <file>             write output to a file [standard output]\n"
 	       "    -O, --output-type <b|u|z|v|t>   b: compressed BCF, u: uncompressed BCF, z: compressed VCF\n"
 	       "                                    v: uncompressed VCF, t: GenomeStudio tab-delimited text output [v]\n"
-	       "        --threads <int>             number of extra output compression threads [0]\n"
+	       "        --sort                      output markers in coordinate order rather than manifest order\n"
+	       "        --write-index               sort and write a CSI index alongside the compressed output file\n"
+	       "        --shard <int>/<int>         convert only the i-th of N equal consecutive sets of markers\n"
+	       "        --append <file>             add the samples to those of a VCF previously output with the same options\n"
+	       "        --cluster-stats-out <file>  only write genotype cluster statistics to be used by --cluster-stats\n"
+	       "        --cluster-stats <file,...>  adjust cluster centers using statistics summed across the listed files\n"
+	       "        --intensities <file>        write the intensity tags to a BGZF columnar file rather than to the VCF\n"
+	       "        --intensities-type <type>   uint16: quantized to fixed ranges, float16: half precision [uint16]\n"
+	       "        --threads <int>             number of extra compression and computation threads [0]\n"
+	       "        --max-open-files <int>      maximum number of input files open at once [no limit]\n"
+	       "        --prefetch <int>            number of threads reading the input files ahead of the conversion [0]\n"
+	       "        --buffer-memory <int>       memory in MB used to buffer the input files [32768 elements per array]\n"
+	       "        --recompress                compress the GTC or IDAT files with BGZF and a .gzi index and exit\n"
+	       "        --stats <file>              write progress snapshots of the conversion as JSON lines to a file, overwriting it\n"
 	       "    -v, --verbose                   print verbose information\n"
 	       "\n"
 	       "Manifest options:\n"
@@ -3289,6 +6213,10 @@ int run(int argc, char *argv[])
 	const char *csv_fname = NULL;
 	const char *egt_fname = NULL;
 	const char *gs_fname = NULL;
+	const char *skip_columns = NULL;
+	const char *stats_fname = NULL;
+	const char *intensities_fname = NULL;
+	int intensities_encoding = INTENSITIES_UINT16;
 	const char *output_fname = "-";
 	const char *ref_fname = NULL;
 	const char *pathname = NULL;
@@ -3298,15 +6226,33 @@ int run(int argc, char *argv[])
 	int flags = 0;
 	int output_type = FT_VCF;
 	int cache_size = 0;
+	int ref_cache_size = REF_CACHE_SIZE;
+	const char *manifest_cache_fname = NULL;
+	const char *regions_list = NULL;
+	const char *targets_list = NULL;
+	const char *include_ids_fname = NULL;
+	int shard = 0, n_shards = 0;
+	const char *append_fname = NULL;
+	const char *cluster_stats_fname = NULL;
+	const char *cluster_stats_out_fname = NULL;
+	int regions_is_file = 0;
+	int targets_is_file = 0;
 	int gtc_sample_names = 0;
 	int bpm_check = 1;
 	int n_threads = 0;
+	int max_open_files = 0;
+	int n_prefetch = 0;
+	int buffer_memory = 0;
+	int recompress = 0;
 	int record_cmd_line = 1;
 	int binary_to_csv = 0;
 	int beadset_order = 0;
 	int fasta_flank = 0;
 	faidx_t *fai = NULL;
+	ref_cache_t *ref = NULL;
+	progress_t *progress = NULL;
 	htsFile *out_fh = NULL;
+	htsThreadPool tpool = {NULL, 0};
 	FILE *out_txt = NULL;
 	FILE *out_sex = NULL;
 
@@ -3333,9 +6279,30 @@ int run(int argc, char *argv[])
 					   {"fasta-flank", no_argument, NULL, 7},
 					   {"sam-flank", required_argument, NULL, 's'},
 					   {"genome-build", required_argument, NULL, 10},
+					   {"max-open-files", required_argument, NULL, 11},
+					   {"buffer-memory", required_argument, NULL, 12},
+					   {"ref-cache", required_argument, NULL, 13},
+					   {"manifest-cache", required_argument, NULL, 14},
+					   {"regions", required_argument, NULL, 'r'},
+					   {"regions-file", required_argument, NULL, 'R'},
+					   {"targets", required_argument, NULL, 15},
+					   {"targets-file", required_argument, NULL, 16},
+					   {"include-ids", required_argument, NULL, 17},
+					   {"sort", no_argument, NULL, 18},
+					   {"write-index", no_argument, NULL, 19},
+					   {"shard", required_argument, NULL, 20},
+					   {"append", required_argument, NULL, 21},
+					   {"cluster-stats-out", required_argument, NULL, 22},
+					   {"cluster-stats", required_argument, NULL, 23},
+					   {"skip-columns", required_argument, NULL, 24},
+					   {"stats", required_argument, NULL, 25},
+					   {"intensities", required_argument, NULL, 26},
+					   {"intensities-type", required_argument, NULL, 27},
+					   {"recompress", no_argument, NULL, 28},
+					   {"prefetch", required_argument, NULL, 29},
 					   {NULL, 0, NULL, 0}};
 	int c;
-	while ((c = getopt_long(argc, argv, "h?lt:b:c:e:f:g:ix:o:O:vs:", loptions, NULL))
+	while ((c = getopt_long(argc, argv, "h?lt:b:c:e:f:g:ix:o:O:vs:r:R:", loptions, NULL))
 	       >= 0) {
 		switch (c) {
 		case 'l':
@@ -3425,12 +6392,121 @@ int run(int argc, char *argv[])
 		case 10:
 			genome_build = optarg;
 			break;
+		case 11:
+			max_open_files = strtol(optarg, NULL, 0);
+			if (max_open_files < 0)
+				error("Invalid number of open files: --max-open-files %s\n", optarg);
+			break;
+		case 12:
+			buffer_memory = strtol(optarg, NULL, 0);
+			if (buffer_memory < 0)
+				error("Invalid buffer memory: --buffer-memory %s\n", optarg);
+			break;
+		case 13:
+			ref_cache_size = strtol(optarg, NULL, 0);
+			if (ref_cache_size < 0)
+				error("Invalid reference cache size: --ref-cache %s\n", optarg);
+			break;
+		case 14:
+			manifest_cache_fname = optarg;
+			break;
+		case 'r':
+			regions_list = optarg;
+			break;
+		case 'R':
+			regions_list = optarg;
+			regions_is_file = 1;
+			break;
+		case 15:
+			targets_list = optarg;
+			break;
+		case 16:
+			targets_list = optarg;
+			targets_is_file = 1;
+			break;
+		case 17:
+			include_ids_fname = optarg;
+			break;
+		case 18:
+			flags |= SORT_OUTPUT;
+			break;
+		case 19:
+			flags |= SORT_OUTPUT | WRITE_INDEX;
+			break;
+		case 20: {
+			char *endptr;
+			shard = strtol(optarg, &endptr, 0);
+			n_shards = *endptr == '/' ? strtol(endptr + 1, &endptr, 0) : 0;
+			if (*endptr || shard < 1 || n_shards < shard)
+				error("Invalid shard: --shard %s\n", optarg);
+			break;
+		}
+		case 21:
+			append_fname = optarg;
+			break;
+		case 22:
+			cluster_stats_out_fname = optarg;
+			break;
+		case 23:
+			cluster_stats_fname = optarg;
+			flags |= ADJUST_CLUSTERS | CLUSTER_STATS;
+			break;
+		case 24:
+			skip_columns = optarg;
+			break;
+		case 25:
+			stats_fname = optarg;
+			break;
+		case 26:
+			intensities_fname = optarg;
+			break;
+		case 27:
+			if (!strcmp(optarg, "uint16"))
+				intensities_encoding = INTENSITIES_UINT16;
+			else if (!strcmp(optarg, "float16"))
+				intensities_encoding = INTENSITIES_FLOAT16;
+			else
+				error("The intensities type \"%s\" not recognised\n", optarg);
+			break;
+		case 28:
+			recompress = 1;
+			break;
+		case 29:
+			n_prefetch = strtol(optarg, NULL, 0);
+			if (n_prefetch < 0)
+				error("Invalid number of prefetch threads: --prefetch %s\n", optarg);
+			break;
 		case 'h':
 		case '?':
 		default:
 			error("%s", usage_text());
 		}
 	}
+
+	// compress the input files for storage rather than converting them
+	if (recompress) {
+		if ((argc - optind > 0) == (pathname != NULL))
+			error("The --recompress option requires GTC or IDAT files listed through either the command interface or a file list\n%s",
+			      usage_text());
+		int n = argc - optind;
+		char **fnames = argv + optind;
+		if (pathname)
+			fnames = get_file_list(pathname, flags & LOAD_IDAT ? "idat" : "gtc", 1, &n);
+		hts_tpool *pool = n_threads ? hts_tpool_init(n_threads) : NULL;
+		if (n_threads && !pool)
+			error("Failed to create thread pool with %d threads\n", n_threads);
+		for (int i = 0; i < n; i++)
+			recompress_file(fnames[i], pool);
+		if (pathname) {
+			for (int i = 0; i < n; i++)
+				free(fnames[i]);
+			free(fnames);
+		}
+		if (pool)
+			hts_tpool_destroy(pool);
+		return 0;
+	}
+
 	if (((bpm_fname != NULL) || (csv_fname != NULL)) + (egt_fname != NULL)
 		    + (ref_fname != NULL) + (gs_fname != NULL) + (argc - optind > 0)
 		    + (pathname != NULL)
@@ -3438,6 +6514,9 @@ int run(int argc, char *argv[])
 		binary_to_csv = 1;
 	if (sam_fname && (csv_fname == NULL))
 		error("The --sam-flank option requires the --csv option\n%s", usage_text());
+	if (cluster_stats_fname && (!bpm_fname || !egt_fname))
+		error("The --cluster-stats option requires the --bpm and --egt options\n%s",
+		      usage_text());
 	if (binary_to_csv) {
 		if (beadset_order && (bpm_fname == NULL || csv_fname == NULL))
 			error("The --beadset-order option requires both the --bpm and the --csv options\n%s",
@@ -3464,13 +6543,70 @@ int run(int argc, char *argv[])
 		if (gs_fname && (argc - optind > 0 || pathname || output_type == FT_TAB_TEXT))
 			error("If a GenomeStudio final report file is provided, do not pass GTC files and do not output to GenomeStudio format\n%s",
 			      usage_text());
+		if (skip_columns && !gs_fname)
+			error("The --skip-columns option requires the --genome-studio option\n%s",
+			      usage_text());
 		if (argc - optind > 0 && pathname)
 			error("GTC files cannot be listed through both command interface and file list\n%s",
 			      usage_text());
+		if ((flags & SORT_OUTPUT) && (gs_fname || output_type == FT_TAB_TEXT || !bpm_fname))
+			error("The --sort and --write-index options require the --bpm option and VCF output from GTC files\n%s",
+			      usage_text());
+		if (n_shards && (gs_fname || output_type == FT_TAB_TEXT || !bpm_fname))
+			error("The --shard option requires the --bpm option and VCF output from GTC files\n%s",
+			      usage_text());
+		if (append_fname && (gs_fname || output_type == FT_TAB_TEXT || !bpm_fname))
+			error("The --append option requires the --bpm option and VCF output from GTC files\n%s",
+			      usage_text());
+		if (cluster_stats_out_fname
+		    && (gs_fname || output_type == FT_TAB_TEXT || !bpm_fname || !egt_fname))
+			error("The --cluster-stats-out option requires the --bpm and --egt options and GTC files\n%s",
+			      usage_text());
+		if (cluster_stats_out_fname && (append_fname || (flags & ADJUST_CLUSTERS)))
+			error("The --cluster-stats-out option cannot be used with the --append, --adjust-clusters, or --cluster-stats options\n%s",
+			      usage_text());
+		if ((flags & LOAD_IDAT) && (gs_fname || output_type == FT_TAB_TEXT || !bpm_fname))
+			error("Converting IDAT files requires the --bpm option and VCF output\n%s",
+			      usage_text());
+		if ((flags & LOAD_IDAT) && ((flags & ADJUST_CLUSTERS) || cluster_stats_out_fname))
+			error("IDAT files have no genotypes and cannot be used with the --adjust-clusters, --cluster-stats, or --cluster-stats-out options\n%s",
+			      usage_text());
+		if (cluster_stats_fname && (gs_fname || !bpm_fname))
+			error("The --cluster-stats option requires the --bpm option and GTC files\n%s",
+			      usage_text());
+		if (append_fname && !strcmp(append_fname, output_fname))
+			error("The --append option requires an output file different from the appended file\n%s",
+			      usage_text());
+		if ((flags & WRITE_INDEX) && (!strcmp(output_fname, "-") || !(output_type & FT_GZ)))
+			error("The --write-index option requires compressed output to a file\n%s",
+			      usage_text());
+		if (stats_fname && output_type == FT_TAB_TEXT)
+			error("The --stats option requires VCF output\n%s", usage_text());
+		if (stats_fname && !strcmp(stats_fname, "-") && !strcmp(output_fname, "-"))
+			error("The --stats option can only write to standard output with the --output option\n%s",
+			      usage_text());
+		if (intensities_fname && (gs_fname || output_type == FT_TAB_TEXT || !bpm_fname))
+			error("The --intensities option requires the --bpm option and VCF output from GTC files\n%s",
+			      usage_text());
+		if (intensities_fname && (append_fname || cluster_stats_out_fname))
+			error("The --intensities option cannot be used with the --append or --cluster-stats-out options\n%s",
+			      usage_text());
 		if (!gs_fname && output_type != FT_TAB_TEXT && sex_fname)
 			out_sex = get_file_handle(sex_fname);
 	}
 	flags |= parse_tags(tag_list);
+	// IDAT files only provide raw intensities
+	if ((flags & LOAD_IDAT) && !binary_to_csv)
+		flags &= ~(FORMAT_IGC | FORMAT_BAF | FORMAT_LRR | FORMAT_NORMX | FORMAT_NORMY
+			   | FORMAT_R | FORMAT_THETA);
+	// intensities written to the sidecar are left out of the VCF
+	int intensities_flags = 0;
+	if (intensities_fname && !binary_to_csv) {
+		intensities_flags = flags
+				    & (FORMAT_BAF | FORMAT_LRR | FORMAT_NORMX | FORMAT_NORMY
+				       | FORMAT_R | FORMAT_THETA | FORMAT_X | FORMAT_Y);
+		flags &= ~intensities_flags;
+	}
 
 	// beginning of plugin run
 	fprintf(stderr, "gtc2vcf " GTC2VCF_VERSION " https://github.com/freeseek/gtc2vcf\n");
@@ -3479,37 +6615,74 @@ int run(int argc, char *argv[])
 	char **filenames = NULL;
 	if (pathname) {
 		filenames =
-			get_file_list(pathname, flags & LOAD_IDAT ? "idat" : "gtc", &nfiles);
+			get_file_list(pathname, flags & LOAD_IDAT ? "idat" : "gtc", 1, &nfiles);
 	} else {
 		nfiles = argc - optind;
 		filenames = argv + optind;
 	}
 	void **files = (void **)malloc(nfiles * sizeof(void *));
 
+	// each worker and prefetch thread might need to hold one file open at once
+	int n_open_files = nfiles;
+	if (max_open_files > 0) {
+		if (max_open_files < n_threads + n_prefetch + 1)
+			max_open_files = n_threads + n_prefetch + 1;
+		if (max_open_files < nfiles)
+			n_open_files = max_open_files;
+		file_handles.max_open = max_open_files;
+	}
+
 	// make sure the process is allowed to open enough files
 	struct rlimit lim;
 	getrlimit(RLIMIT_NOFILE, &lim);
-	if (nfiles + 7 > lim.rlim_max)
-		error("On this system you cannot open more than %ld files at once while %d is required\n",
-		      lim.rlim_max, nfiles + 7);
-	if (nfiles + 7 > lim.rlim_cur) {
-		lim.rlim_cur = nfiles + 7;
+	if (n_open_files + 7 > lim.rlim_max)
+		error("On this system you cannot open more than %ld files at once while %d is required\nUse --max-open-files to limit the number of files open at once\n",
+		      lim.rlim_max, n_open_files + 7);
+	if (n_open_files + 7 > lim.rlim_cur) {
+		lim.rlim_cur = n_open_files + 7;
 		setrlimit(RLIMIT_NOFILE, &lim);
 	}
 
-	if ((flags & ADJUST_CLUSTERS) && nfiles < 100)
+	// split the buffer memory budget across the arrays of all input files
+	size_t capacity = BUFFER_CAPACITY;
+	if (buffer_memory > 0 && nfiles > 0) {
+		// IDAT files have five arrays and GTC files have seven arrays
+		size_t item_bytes =
+			flags & LOAD_IDAT
+				? sizeof(int32_t) + 2 * sizeof(uint16_t) + 2 * sizeof(uint8_t)
+				: 2 * sizeof(uint16_t) + sizeof(uint8_t) + sizeof(BaseCall)
+					  + 3 * sizeof(float);
+		capacity = ((size_t)buffer_memory << 20) / ((size_t)nfiles * item_bytes);
+		if (capacity < 1)
+			capacity = 1;
+	}
+	if (max_open_files > 0 || buffer_memory > 0)
+		fprintf(stderr, "Buffering %zu elements per array with at most %d open files\n",
+			capacity, n_open_files);
+
+	if ((flags & ADJUST_CLUSTERS) && !(flags & CLUSTER_STATS) && nfiles < 100)
 		fprintf(stderr,
 			"Warning: adjusting clusters with %d sample(s) is not recommended\n",
 			nfiles);
 
+	if (n_threads) {
+		tpool.pool = hts_tpool_init(n_threads);
+		if (!tpool.pool)
+			error("Failed to create thread pool with %d threads\n", n_threads);
+	}
+	if (n_prefetch)
+		buffer_prefetch = prefetch_init(n_prefetch);
+
 	if (binary_to_csv || output_type == FT_TAB_TEXT) {
 		out_txt = get_file_handle(output_fname);
-	} else {
+	} else if (!cluster_stats_out_fname) {
 		out_fh = hts_open(output_fname, hts_bcf_wmode(output_type));
 		if (out_fh == NULL)
 			error("Can't write to \"%s\": %s\n", output_fname, strerror(errno));
-		if (n_threads)
-			hts_set_threads(out_fh, n_threads);
+		if (tpool.pool)
+			hts_set_thread_pool(out_fh, &tpool);
+	}
+	if (!binary_to_csv && output_type != FT_TAB_TEXT) {
 		if (!ref_fname)
 			error("VCF output requires the --fasta-ref option\n");
 		fai = fai_load(ref_fname);
@@ -3517,6 +6690,11 @@ int run(int argc, char *argv[])
 			error("Could not load the reference %s\n", ref_fname);
 		if (cache_size)
 			fai_set_cache_size(fai, cache_size);
+		ref = ref_cache_init(fai, (size_t)ref_cache_size << 20);
+		if (stats_fname) {
+			progress = progress_init(get_file_handle(stats_fname), ref);
+			progress->prefetch = buffer_prefetch;
+		}
 	}
 
 	bpm_t *bpm = NULL;
@@ -3536,6 +6714,21 @@ int run(int argc, char *argv[])
 			bpm_to_csv(bpm, out_txt, flags);
 	}
 
+	// resolved marker alleles make the SAM realignment unnecessary
+	uint8_t cache_key[16];
+	sites_t *sites = NULL;
+	int save_manifest_cache = 0;
+	if (manifest_cache_fname && bpm && ref_fname && !binary_to_csv && !fasta_flank && !gs_fname
+	    && output_type != FT_TAB_TEXT) {
+		manifest_cache_key(bpm_fname, csv_fname, sam_fname, ref_fname, genome_build,
+				   cache_key);
+		sites = sites_load(manifest_cache_fname, cache_key, bpm->num_loci);
+		if (sites)
+			fprintf(stderr, "Reading manifest cache %s\n", manifest_cache_fname);
+		else
+			save_manifest_cache = 1;
+	}
+
 	// output source sequences in FASTA format to be realigned by bwa mem
 	if (fasta_flank) {
 		for (int i = 0; i < bpm->num_loci; i++)
@@ -3545,9 +6738,9 @@ int run(int argc, char *argv[])
 
 	// input source sequence alignments in SAM format to generate new coordinates for the
 	// CSV manifest file
-	if (sam_fname) {
+	if (sam_fname && !sites) {
 		fprintf(stderr, "Reading SAM file %s\n", sam_fname);
-		bpm = sam_csv_init(sam_fname, bpm, genome_build, flags);
+		bpm = sam_csv_init(sam_fname, bpm, genome_build, &tpool, flags);
 		if (binary_to_csv)
 			bpm_to_csv(bpm, out_txt, flags);
 	}
@@ -3597,27 +6790,57 @@ int run(int argc, char *argv[])
 			flags |= EGT_LOADED;
 	}
 
+	if (cluster_stats_fname) {
+		uint8_t key[16];
+		cluster_stats_key(bpm_fname, egt_fname, key);
+		cluster_stats_t *stats =
+			cluster_stats_load(cluster_stats_fname, bpm->num_loci, key);
+		fprintf(stderr, "Adjusting clusters with statistics from %d sample(s)\n",
+			stats->n_samples);
+		cluster_stats_apply(stats, egt);
+		cluster_stats_destroy(stats);
+	}
+	if (bpm && !binary_to_csv)
+		bpm_loci_init(bpm, egt);
+
 	if (gs_fname)
 		flags |= GENOME_STUDIO;
 
-	for (int i = 0; i < nfiles; i++) {
-		if (flags & LOAD_IDAT) {
-			fprintf(stderr, "Reading IDAT file %s\n", filenames[i]);
-			idat_t *idat = idat_init(filenames[i]);
-			files[i] = (void *)idat;
-		} else {
-			fprintf(stderr, "Reading GTC file %s\n", filenames[i]);
-			gtc_t *gtc = gtc_init(filenames[i]);
-			// GenCall fills the GTC SNP manifest with the BPM file name rather than
-			// the BPM manifest name
-			if (bpm_check && bpm && strcmp(bpm->manifest_name, gtc->snp_manifest)
-			    && strcmp(strrchr(bpm->fn, '/') ? strrchr(bpm->fn, '/') + 1
-							    : bpm->fn,
-				      gtc->snp_manifest))
-				error("Manifest name %s in BPM file %s does not match manifest name %s in GTC file %s\nUse --do-not-check-bpm to suppress this check\n",
-				      bpm->manifest_name, bpm->fn, gtc->snp_manifest, gtc->fn);
-			files[i] = (void *)gtc;
+	regidx_t *regions = regions_list ? regions_init(regions_list, regions_is_file) : NULL;
+	int targets_exclude = targets_list && targets_list[0] == '^';
+	regidx_t *targets =
+		targets_list ? regions_init(targets_list + targets_exclude, targets_is_file) : NULL;
+	void *include_ids = NULL;
+	if (include_ids_fname) {
+		int n_ids;
+		char **ids = hts_readlist(include_ids_fname, 1, &n_ids);
+		if (!ids)
+			error("Failed to read the IDs from %s\n", include_ids_fname);
+		include_ids = khash_str2int_init();
+		for (int i = 0; i < n_ids; i++) {
+			if (khash_str2int_has_key(include_ids, ids[i]))
+				free(ids[i]);
+			else
+				khash_str2int_set(include_ids, ids[i], i);
 		}
+		free(ids);
+	}
+	int select_loci = regions || targets || include_ids;
+	if (select_loci && (!bpm || gs_fname))
+		error("Selecting markers requires a manifest file and GTC files\n");
+	int *loci = NULL, n_selected = 0, shard_beg = 0;
+
+	files_load(filenames, nfiles, capacity, bpm_check ? bpm : NULL, tpool.pool, flags, files);
+	int n_filenames = nfiles;
+	if ((flags & LOAD_IDAT) && !binary_to_csv) {
+		int n_pairs;
+		gtc_t **gtcs = idats_to_gtcs((idat_t **)files, nfiles, bpm, tpool.pool, &n_pairs);
+		for (int i = 0; i < nfiles; i++)
+			idat_destroy((idat_t *)files[i]);
+		free(files);
+		files = (void **)gtcs;
+		nfiles = n_pairs;
+		flags &= ~LOAD_IDAT;
 	}
 
 	if (binary_to_csv && nfiles > 0) {
@@ -3640,9 +6863,16 @@ int run(int argc, char *argv[])
 				"Warning: it is recommended to convert multiple GTC files at once\n");
 		if (output_type == FT_TAB_TEXT) {
 			fprintf(stderr, "Writing GenomeStudio final report file\n");
-			gtcs_to_gs((gtc_t **)files, nfiles, bpm, egt, out_txt);
+			if (select_loci)
+				loci = loci_select(bpm, NULL, NULL, regions, targets,
+						   targets_exclude, include_ids, 0, &n_selected);
+			gtcs_to_gs((gtc_t **)files, nfiles, bpm, egt, loci, n_selected, out_txt,
+				   tpool.pool);
 		} else {
 			fprintf(stderr, "Writing VCF file\n");
+			// the header only declares the normalized intensities with the lookups
+			if (!(flags & BPM_LOOKUPS) && !(flags & GENOME_STUDIO))
+				flags &= ~(FORMAT_NORMX | FORMAT_NORMY | FORMAT_R | FORMAT_THETA);
 			bcf_hdr_t *hdr = hdr_init(fai, flags);
 			if (bpm_fname)
 				bcf_hdr_printf(hdr, "##BPM=%s",
@@ -3666,6 +6896,15 @@ int run(int argc, char *argv[])
 						       : sam_fname);
 			if (bpm && flags & BPM_LOOKUPS)
 				bcf_hdr_printf(hdr, "##BeadSet_Order=%s", str.s);
+			// lets --append check the clusters come from the same files
+			if (flags & ADJUST_CLUSTERS) {
+				char bpm_md5[33] = ".", egt_md5[33];
+				if (bpm_fname)
+					md5_file_hex(bpm_fname, bpm_md5);
+				md5_file_hex(egt_fname, egt_md5);
+				bcf_hdr_printf(hdr, "##gtc2vcf_adjust_clusters=%s:%s", bpm_md5,
+					       egt_md5);
+			}
 			if (record_cmd_line)
 				bcf_hdr_append_version(hdr, argc, argv, "bcftools_+gtc2vcf");
 			if (gs_fname) {
@@ -3674,8 +6913,24 @@ int run(int argc, char *argv[])
 					       strrchr(gs_fname, '/')
 						       ? strrchr(gs_fname, '/') + 1
 						       : gs_fname);
-				gs_to_vcf(fai, gs_fh, out_fh, hdr, flags);
+				gs_to_vcf(ref, gs_fh, out_fh, hdr, skip_columns, tpool.pool,
+					  progress, flags);
 			} else {
+				htsFile *append_fh = NULL;
+				bcf_hdr_t *append_hdr = NULL;
+				if (append_fname) {
+					fprintf(stderr, "Appending to VCF file %s\n", append_fname);
+					append_fh = hts_open(append_fname, "r");
+					if (!append_fh)
+						error("Could not read %s\n", append_fname);
+					append_hdr = bcf_hdr_read(append_fh);
+					if (!append_hdr)
+						error("Could not read the header of %s\n",
+						      append_fname);
+					append_check_header(append_hdr, hdr, append_fname, flags);
+					for (int i = 0; i < bcf_hdr_nsamples(append_hdr); i++)
+						bcf_hdr_add_sample(hdr, append_hdr->samples[i]);
+				}
 				for (int i = 0; i < nfiles; i++) {
 					gtc_t *gtc = (gtc_t *)files[i];
 					const char *sample_name =
@@ -3688,18 +6943,96 @@ int run(int argc, char *argv[])
 						fprintf(out_sex, "%s\t%c\n", gtc->display_name,
 							gtc->gender);
 				}
-				gtcs_to_vcf(fai, bpm, egt, (gtc_t **)files, nfiles, out_fh, hdr,
-					    flags);
+				// the manifest cache always covers all markers and is resolved
+				// before the selection so that a cache hit and a cache miss select
+				// the same markers
+				if (!sites && save_manifest_cache && !cluster_stats_out_fname) {
+					sites = sites_init(ref, bpm, hdr, NULL, 0, flags);
+					fprintf(stderr, "Writing manifest cache %s\n",
+						manifest_cache_fname);
+					sites_save(sites, manifest_cache_fname, cache_key);
+				}
+				int preselect = !sites && !cluster_stats_out_fname;
+				if (select_loci)
+					loci = loci_select(bpm, hdr, sites, regions, targets,
+							   targets_exclude, include_ids, preselect,
+							   &n_selected);
+				if (preselect)
+					sites = sites_init(ref, bpm, hdr, loci, n_selected, flags);
+				// as on a cache hit, by the coordinates of the records
+				if (preselect && (regions || targets)) {
+					free(loci);
+					loci = loci_select(bpm, hdr, sites, regions, targets,
+							   targets_exclude, include_ids, 0,
+							   &n_selected);
+				}
+				if (sites && (flags & SORT_OUTPUT))
+					loci = loci_sort(sites, loci, &n_selected);
+				if (n_shards) {
+					loci = loci_shard(loci, &n_selected, bpm->num_loci, shard,
+							  n_shards, &shard_beg);
+					fprintf(stderr, "Converting shard %d/%d with %d loci\n", shard,
+						n_shards, n_selected);
+				}
+				if (cluster_stats_out_fname) {
+					cluster_stats_t *stats = cluster_stats_init(bpm->num_loci);
+					cluster_stats_key(bpm_fname, egt_fname, stats->key);
+					cluster_stats_samples_key(hdr, stats->samples_key);
+					cluster_stats_compute(stats, (gtc_t **)files, nfiles, bpm,
+							      egt, loci, n_selected, tpool.pool);
+					fprintf(stderr, "Writing cluster statistics file %s\n",
+						cluster_stats_out_fname);
+					cluster_stats_save(stats, cluster_stats_out_fname);
+					cluster_stats_destroy(stats);
+					bcf_hdr_destroy(hdr);
+				} else {
+					intensities_t *intensities = NULL;
+					if (intensities_fname) {
+						fprintf(stderr, "Writing intensities file %s\n",
+							intensities_fname);
+						intensities = intensities_init(
+							intensities_fname, intensities_encoding,
+							intensities_flags, tpool.pool);
+					}
+					gtcs_to_vcf(sites, bpm, egt, (gtc_t **)files, nfiles, loci,
+						    n_selected, out_fh, hdr, append_fh, append_hdr,
+						    intensities, tpool.pool, progress, flags);
+					intensities_destroy(intensities);
+				}
+				if (append_fh) {
+					bcf_hdr_destroy(append_hdr);
+					if (hts_close(append_fh) < 0)
+						error("Close failed: %s\n", append_fname);
+				}
+				if (n_shards && strcmp(output_fname, "-")) {
+					str.l = 0;
+					ksprintf(&str, "%s.shard", output_fname);
+					shard_write(str.s, bpm, loci, n_selected, shard, n_shards,
+						    shard_beg, nfiles, flags);
+				}
 			}
+			if (flags & VERBOSE)
+				ref_cache_print_stats(ref, stderr);
 		}
 	}
 
 	free(str.s);
+	free(loci);
+	if (regions)
+		regidx_destroy(regions);
+	if (targets)
+		regidx_destroy(targets);
+	if (include_ids)
+		khash_str2int_destroy_free(include_ids);
+	if (sites)
+		sites_destroy(sites);
+	progress_destroy(progress);
+	ref_cache_destroy(ref);
 	fai_destroy(fai);
 	egt_destroy(egt);
 	bpm_destroy(bpm);
 	if (pathname) {
-		for (int i = 0; i < nfiles; i++)
+		for (int i = 0; i < n_filenames; i++)
 			free(filenames[i]);
 		free(filenames);
 	}
@@ -3710,6 +7043,14 @@ int run(int argc, char *argv[])
 			gtc_destroy((gtc_t *)files[i]);
 	}
 	free(files);
+	if ((flags & VERBOSE) && file_handles.max_open > 0)
+		fprintf(stderr, "Files reopened after being closed: %d\nFiles open at once at most: %d\n",
+			file_handles.n_reopened, file_handles.n_peak);
+	if ((flags & VERBOSE) && buffer_prefetch)
+		prefetch_print_stats(buffer_prefetch, stderr);
+	prefetch_destroy(buffer_prefetch);
+	if (tpool.pool)
+		hts_tpool_destroy(tpool.pool);
 	if (out_txt && out_txt != stdout && out_txt != stderr)
 		fclose(out_txt);
 	if (out_sex && out_sex != stdout && out_sex != stderr)
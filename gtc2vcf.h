@@ -25,9 +25,17 @@
  */
 
 #include <dirent.h>
+#include <time.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <htslib/hfile.h>
+#include <htslib/thread_pool.h>
 #include <htslib/faidx.h>
 #include <htslib/sam.h>
+#include <htslib/khash.h>
+#include <htslib/khash_str2int.h>
 
 #define min(a, b)                                                                              \
 	({                                                                                     \
@@ -43,7 +51,35 @@
 		_a > _b ? _a : _b;                                                             \
 	})
 
-static inline char **get_file_list(const char *pathname, const char *extension, int *nfiles)
+static inline double wall_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// conversion rate and peak memory, to compare runs of the same inputs across versions
+static inline void print_throughput(FILE *stream, double seconds, int n_loci, int n_samples)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	double rate = seconds > 0.0 ? n_loci / seconds : 0.0;
+	fprintf(stream, "Loci/cells per second:\t%.0f/%.0f\n", rate, rate * n_samples);
+	fprintf(stream, "Peak memory in MB:\t%.1f\n", usage.ru_maxrss / 1024.0);
+}
+
+// length of the .gz suffix of a compressed file name or 0 if there is none
+static inline int gz_suffix_len(const char *fn)
+{
+	size_t len = strlen(fn);
+	return len >= 3 && strcmp(fn + len - 3, ".gz") == 0 ? 3 : 0;
+}
+
+// files in a directory are matched by extension, optionally followed by .gz if compressed, in
+// which case a compressed file is skipped when its uncompressed version is also in the directory,
+// as written by the --recompress option, so that each sample is listed once
+static inline char **get_file_list(const char *pathname, const char *extension, int compressed,
+				   int *nfiles)
 {
 	char **filenames = NULL;
 	struct stat statbuf;
@@ -54,15 +90,26 @@ static inline char **get_file_list(const char *pathname, const char *extension,
 		struct dirent *dir;
 		int mfiles = 0;
 		int p = strlen(pathname);
+		int e = strlen(extension);
 		while ((dir = readdir(d))) {
-			const char *ptr = strrchr(dir->d_name, '.');
-			if (ptr && strcmp(ptr + 1, extension) == 0) {
+			int q = strlen(dir->d_name);
+			int r = q - (compressed ? gz_suffix_len(dir->d_name) : 0);
+			if (r > e && dir->d_name[r - e - 1] == '.'
+			    && strncmp(dir->d_name + r - e, extension, e) == 0) {
 				hts_expand0(char *, *nfiles + 1, mfiles, filenames);
-				int q = strlen(dir->d_name);
 				filenames[*nfiles] = (char *)malloc((p + q + 2) * sizeof(char));
 				memcpy(filenames[*nfiles], pathname, p);
 				filenames[*nfiles][p] = '/';
 				memcpy(filenames[*nfiles] + p + 1, dir->d_name, q + 1);
+				if (r < q) {
+					filenames[*nfiles][p + 1 + r] = '\0';
+					int is_twin = stat(filenames[*nfiles], &statbuf) == 0;
+					filenames[*nfiles][p + 1 + r] = '.';
+					if (is_twin) {
+						free(filenames[*nfiles]);
+						continue;
+					}
+				}
 				(*nfiles)++;
 			}
 		}
@@ -224,26 +271,157 @@ static inline void flank_left_shift(char *flank)
 	}
 }
 
-// returns 1 if the first sequence is the best alignment, and 2 if the second sequence is
-// if neither sequence is better or neither provides an alignment, it returns 0
-// if it fails to read from the hts file, it returns -1
-static inline int get_position(htsFile *hts, sam_hdr_t *sam_hdr, bam1_t *b, const char *name,
-			       const char *flank, int left_shift, const char **chromosome,
-			       int *position, int *strand)
+/****************************************
+ * STRING ARENA                         *
+ ****************************************/
+
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+typedef struct arena_block_t {
+	struct arena_block_t *next;
+	size_t size, used;
+	char data[];
+} arena_block_t;
+
+// strings of the records of a file are packed into large blocks that are released all at
+// once, a zeroed arena is empty and ready to use
+typedef struct {
+	arena_block_t *head;
+} arena_t;
+
+// memory is not aligned as the arena is meant for strings
+static inline void *arena_alloc(arena_t *arena, size_t size)
 {
-	const char *left = strchr(flank, '[');
-	const char *middle = strchr(flank, '/');
-	const char *right = strchr(flank, ']');
-	int cnv = !left && !middle && !right;
-	if (!cnv && (!left || !middle || !right))
-		error("Flank sequence is malformed: %s\n", flank);
-	const char *chromosome_pair[2];
-	int position_pair[2], strand_pair[2];
-	int64_t aln_score_pair[2];
+	arena_block_t *block = arena->head;
+	if (!block || block->size - block->used < size) {
+		// large requests get their own block so that the current block is not wasted
+		int dedicated = size > ARENA_BLOCK_SIZE / 4;
+		size_t block_size = dedicated ? size : ARENA_BLOCK_SIZE;
+		block = (arena_block_t *)malloc(sizeof(arena_block_t) + block_size);
+		if (!block)
+			error("Failed to allocate memory for arena\n");
+		block->size = block_size;
+		block->used = 0;
+		if (arena->head && dedicated) {
+			block->next = arena->head->next;
+			arena->head->next = block;
+		} else {
+			block->next = arena->head;
+			arena->head = block;
+		}
+	}
+	void *ptr = block->data + block->used;
+	block->used += size;
+	return ptr;
+}
+
+static inline char *arena_strndup(arena_t *arena, const char *str, size_t len)
+{
+	char *ptr = (char *)arena_alloc(arena, len + 1);
+	memcpy(ptr, str, len);
+	ptr[len] = '\0';
+	return ptr;
+}
+
+static inline char *arena_strdup(arena_t *arena, const char *str)
+{
+	return arena_strndup(arena, str, strlen(str));
+}
+
+static inline void arena_destroy(arena_t *arena)
+{
+	while (arena->head) {
+		arena_block_t *block = arena->head;
+		arena->head = block->next;
+		free(block);
+	}
+}
+
+/****************************************
+ * FLANK ALIGNMENTS                     *
+ ****************************************/
+
+#define FLANK_CHUNK 4096 // markers whose alignments are resolved by each job
+
+// last primary alignments read for the two flanks of a marker, ending with :1 and :2
+typedef struct {
+	bam1_t *b[2];
+	int seen; // bitmask of the flanks read
+} flank_aln_t;
+
+// alignments of a run of consecutive markers that can be resolved by a separate thread
+typedef struct {
+	sam_hdr_t *sam_hdr;
+	int left_shift;
+	int n, m;
+	const char **flanks;
+	flank_aln_t *alns;
+	int *rets; // as returned by flank_aln_resolve()
+	const char **chromosomes;
+	int *positions;
+	int *strands;
+	bam1_t *b;
+} flank_job_t;
+
+static inline void flank_job_init(flank_job_t *job, sam_hdr_t *sam_hdr, int left_shift)
+{
+	memset(job, 0, sizeof(flank_job_t));
+	job->sam_hdr = sam_hdr;
+	job->left_shift = left_shift;
+	job->b = bam_init1();
+	if (job->b == NULL)
+		error("Cannot create SAM record\n");
+}
+
+static inline void flank_job_destroy(flank_job_t *job)
+{
+	for (int i = 0; i < job->m; i++) {
+		bam_destroy1(job->alns[i].b[0]);
+		bam_destroy1(job->alns[i].b[1]);
+	}
+	bam_destroy1(job->b);
+	free(job->flanks);
+	free(job->alns);
+	free(job->rets);
+	free(job->chromosomes);
+	free(job->positions);
+	free(job->strands);
+}
+
+static inline int is_cnv_flank(const char *flank)
+{
+	return !strchr(flank, '[') && !strchr(flank, '/') && !strchr(flank, ']');
+}
+
+// reads the primary alignments of the next marker, which must come in the order of the
+// markers, and returns -1 if it fails to read from the hts file
+static inline int flank_job_read(flank_job_t *job, htsFile *hts, const char *name,
+				 const char *flank)
+{
+	if (job->n == job->m) {
+		int m = job->m;
+		hts_expand(flank_aln_t, job->n + 1, job->m, job->alns);
+		job->flanks = (const char **)realloc(job->flanks, job->m * sizeof(const char *));
+		job->rets = (int *)realloc(job->rets, job->m * sizeof(int));
+		job->chromosomes =
+			(const char **)realloc(job->chromosomes, job->m * sizeof(const char *));
+		job->positions = (int *)realloc(job->positions, job->m * sizeof(int));
+		job->strands = (int *)realloc(job->strands, job->m * sizeof(int));
+		for (int i = m; i < job->m; i++) {
+			job->alns[i].b[0] = bam_init1();
+			job->alns[i].b[1] = bam_init1();
+			if (!job->alns[i].b[0] || !job->alns[i].b[1])
+				error("Cannot create SAM record\n");
+		}
+	}
+	flank_aln_t *aln = &job->alns[job->n];
+	job->flanks[job->n++] = flank;
+	aln->seen = 0;
+	int cnv = is_cnv_flank(flank);
 	int idx = -1, ret;
-	while (idx < 1 - cnv && (ret = sam_read1(hts, sam_hdr, b)) >= 0) {
-		const char *qname = bam_get_qname(b);
-		if (b->core.flag & BAM_FSECONDARY || b->core.flag & BAM_FSUPPLEMENTARY)
+	while (idx < 1 - cnv && (ret = sam_read1(hts, job->sam_hdr, job->b)) >= 0) {
+		const char *qname = bam_get_qname(job->b);
+		if (job->b->core.flag & BAM_FSECONDARY || job->b->core.flag & BAM_FSUPPLEMENTARY)
 			continue;
 		int qname_l = strlen(qname);
 		if (strncmp(qname, name, qname_l - 2) != 0)
@@ -253,85 +431,126 @@ static inline int get_position(htsFile *hts, sam_hdr_t *sam_hdr, bam1_t *b, cons
 		if (idx < 0)
 			error("Query ID %s found in SAM file does not end with :1 or :2\n",
 			      qname);
+		bam1_t *tmp = aln->b[idx];
+		aln->b[idx] = job->b;
+		job->b = tmp;
+		aln->seen |= 1 << idx;
+	}
+	return ret < -1 ? -1 : 0;
+}
+
+// flank sequence with the brackets of the marker alleles located once for both alignments
+typedef struct {
+	const char *seq, *left, *middle, *right;
+	int len;
+	int cnv;
+	int indel;
+} flank_t;
 
-		chromosome_pair[idx] = sam_hdr_tid2name(sam_hdr, b->core.tid);
-		position_pair[idx] = 0;
-		strand_pair[idx] = -1;
-		if (!(b->core.flag & BAM_FUNMAP)) {
-			strand_pair[idx] = bam_is_rev(b);
-			int n_cigar = b->core.n_cigar;
-			const uint32_t *cigar = bam_get_cigar(b);
-			position_pair[idx] = b->core.pos;
-
-			int qlen = cnv ? (strlen(flank) + 1) / 2
-				       : (bam_is_rev(b) ? strlen(flank) - (right - flank)
-							: left - flank + 1);
-			if (strchr(flank, '-')) {
-				if (left_shift) {
-					int len = (int)(right - middle) - 1;
-					char nt = toupper(*(middle + 1));
-					const char *ptr;
-					for (ptr = middle + 2; ptr < right; ptr++)
-						if (*ptr != nt)
-							nt = -1;
-					if (bam_is_rev(b)) {
-						ptr = right + 1;
-						while (strncasecmp(middle + 1, ptr, len) == 0) {
-							qlen -= len;
-							ptr += len;
-						}
-						while (nt > 0 && toupper(*ptr) == nt) {
-							qlen--;
-							ptr++;
-						}
-					} else {
-						ptr = left - len;
-						while (ptr >= flank
-						       && (strncasecmp(ptr, middle + 1, len)
-							   == 0)) {
-							qlen -= len;
-							ptr -= len;
-						}
-						ptr += len - 1;
-						while (nt > 0 && toupper(*ptr) == nt) {
-							qlen--;
-							ptr--;
-						}
+// position of the marker base in the alignment of one of the two flanks
+static inline void flank_position(const bam1_t *b, const flank_t *f, int idx, int left_shift,
+				  const sam_hdr_t *sam_hdr, const char **chromosome,
+				  int *position, int *strand)
+{
+	const char *flank = f->seq, *left = f->left, *middle = f->middle, *right = f->right;
+	int cnv = f->cnv;
+	*chromosome = sam_hdr_tid2name(sam_hdr, b->core.tid);
+	*position = 0;
+	*strand = -1;
+	if (!(b->core.flag & BAM_FUNMAP)) {
+		*strand = bam_is_rev(b);
+		int n_cigar = b->core.n_cigar;
+		const uint32_t *cigar = bam_get_cigar(b);
+		*position = b->core.pos;
+
+		int qlen = cnv ? (f->len + 1) / 2
+			       : (bam_is_rev(b) ? f->len - (right - flank) : left - flank + 1);
+		if (f->indel) {
+			if (left_shift) {
+				int len = (int)(right - middle) - 1;
+				char nt = toupper(*(middle + 1));
+				const char *ptr;
+				for (ptr = middle + 2; ptr < right; ptr++)
+					if (*ptr != nt)
+						nt = -1;
+				if (bam_is_rev(b)) {
+					ptr = right + 1;
+					while (strncasecmp(middle + 1, ptr, len) == 0) {
+						qlen -= len;
+						ptr += len;
+					}
+					while (nt > 0 && toupper(*ptr) == nt) {
+						qlen--;
+						ptr++;
+					}
+				} else {
+					ptr = left - len;
+					while (ptr >= flank
+					       && (strncasecmp(ptr, middle + 1, len)
+						   == 0)) {
+						qlen -= len;
+						ptr -= len;
+					}
+					ptr += len - 1;
+					while (nt > 0 && toupper(*ptr) == nt) {
+						qlen--;
+						ptr--;
 					}
 				}
-				if (idx == 0)
-					qlen--;
 			}
+			if (idx == 0)
+				qlen--;
+		}
 
-			for (int k = 0; k < n_cigar && qlen > 1; k++) {
-				int type = bam_cigar_type(bam_cigar_op(cigar[k]));
-				int len = bam_cigar_oplen(cigar[k]);
-				if ((type & 1)
-				    && (type & 2)) { // consume reference sequence ( case M )
-					position_pair[idx] += min(len, qlen);
-					qlen -= len;
-				} else if (type & 1) { // consume query sequence ( case I )
-					qlen -= len;
-					if (qlen <= 0) // we skipped the base pair that needed
-						       // to be localized
-					{
-						position_pair[idx] = 0;
-					}
-				} else if (type & 2) {
-					position_pair[idx] +=
-						len; // consume reference sequence ( case D )
+		for (int k = 0; k < n_cigar && qlen > 1; k++) {
+			int type = bam_cigar_type(bam_cigar_op(cigar[k]));
+			int len = bam_cigar_oplen(cigar[k]);
+			if ((type & 1)
+			    && (type & 2)) { // consume reference sequence ( case M )
+				*position += min(len, qlen);
+				qlen -= len;
+			} else if (type & 1) { // consume query sequence ( case I )
+				qlen -= len;
+				if (qlen <= 0) // we skipped the base pair that needed
+					       // to be localized
+				{
+					*position = 0;
 				}
+			} else if (type & 2) {
+				*position +=
+					len; // consume reference sequence ( case D )
 			}
-			if (qlen == 1)
-				position_pair[idx]++;
 		}
-		uint8_t *as = bam_aux_get(b, "AS");
+		if (qlen == 1)
+			(*position)++;
+	}
+}
+
+// returns 1 if the first sequence is the best alignment, and 2 if the second sequence is
+// if neither sequence is better or neither provides an alignment, it returns 0
+static inline int flank_aln_resolve(const flank_aln_t *aln, const sam_hdr_t *sam_hdr,
+				    const char *flank, int left_shift, const char **chromosome,
+				    int *position, int *strand)
+{
+	flank_t f = {flank, strchr(flank, '['), strchr(flank, '/'), strchr(flank, ']'),
+		     strlen(flank), 0, strchr(flank, '-') != NULL};
+	f.cnv = !f.left && !f.middle && !f.right;
+	if (!f.cnv && (!f.left || !f.middle || !f.right))
+		error("Flank sequence is malformed: %s\n", flank);
+	const char *chromosome_pair[2] = {NULL, NULL};
+	int position_pair[2] = {0, 0}, strand_pair[2] = {-1, -1};
+	int64_t aln_score_pair[2] = {0, 0};
+	for (int idx = 0; idx < 2; idx++) {
+		if (!(aln->seen & (1 << idx)))
+			continue;
+		flank_position(aln->b[idx], &f, idx, left_shift, sam_hdr, &chromosome_pair[idx],
+			       &position_pair[idx], &strand_pair[idx]);
+		uint8_t *as = bam_aux_get(aln->b[idx], "AS");
 		aln_score_pair[idx] = bam_aux2i(as);
 	}
-	if (ret < -1)
-		return -1;
 
-	if (!cnv
+	int idx;
+	if (!f.cnv
 	    && ((aln_score_pair[0] == aln_score_pair[1] && position_pair[0] != position_pair[1])
 		|| (position_pair[0] == 0 && position_pair[1] == 0))) {
 		idx = -1;
@@ -339,7 +558,7 @@ static inline int get_position(htsFile *hts, sam_hdr_t *sam_hdr, bam1_t *b, cons
 		*position = 0;
 		*strand = -1;
 	} else {
-		idx = cnv ? 0 : (aln_score_pair[1] > aln_score_pair[0]);
+		idx = f.cnv ? 0 : (aln_score_pair[1] > aln_score_pair[0]);
 		*chromosome = chromosome_pair[idx];
 		*position = position_pair[idx];
 		*strand = strand_pair[idx];
@@ -347,16 +566,469 @@ static inline int get_position(htsFile *hts, sam_hdr_t *sam_hdr, bam1_t *b, cons
 	return idx + 1;
 }
 
-static inline char get_ref_base(faidx_t *fai, const bcf_hdr_t *hdr, bcf1_t *rec)
+static inline void *flank_job_run(void *arg)
+{
+	flank_job_t *job = (flank_job_t *)arg;
+	for (int i = 0; i < job->n; i++)
+		job->rets[i] = flank_aln_resolve(&job->alns[i], job->sam_hdr, job->flanks[i],
+						 job->left_shift, &job->chromosomes[i],
+						 &job->positions[i], &job->strands[i]);
+	return arg;
+}
+
+/****************************************
+ * REFERENCE CACHE                      *
+ ****************************************/
+
+#define REF_CACHE_SIZE 256 // default memory in MB used to cache reference sequences
+#define REF_CACHE_WINDOW (1 << 16)
+#define REF_CACHE_OVERLAP 1024 // extra bases loaded past each window to serve flank lookups
+
+KHASH_MAP_INIT_INT64(ref_window, int)
+
+// the reference is loaded in fixed windows indexed by contig and window number and the least
+// recently used windows are evicted once the memory budget is exhausted
+typedef struct {
+	uint64_t key;
+	int beg, end; // cached interval [beg, end)
+	char *seq;
+	int prev, next;
+} ref_window_t;
+
+typedef struct {
+	faidx_t *fai;
+	size_t max_size, size;
+	void *seqnames; // contig names to contig indexes
+	khash_t(ref_window) *hash;
+	int n_windows, m_windows, head, tail;
+	ref_window_t *windows;
+	uint64_t n_hits, n_misses;
+	uint64_t n_fetches; // sequences fetched from the fasta file
+	kstring_t str;
+} ref_cache_t;
+
+static inline ref_cache_t *ref_cache_init(faidx_t *fai, size_t max_size)
+{
+	ref_cache_t *cache = (ref_cache_t *)calloc(1, sizeof(ref_cache_t));
+	cache->fai = fai;
+	cache->max_size = max_size;
+	cache->seqnames = khash_str2int_init();
+	cache->hash = kh_init(ref_window);
+	cache->head = cache->tail = -1;
+	return cache;
+}
+
+static inline void ref_cache_destroy(ref_cache_t *cache)
+{
+	if (!cache)
+		return;
+	for (int i = 0; i < cache->n_windows; i++)
+		free(cache->windows[i].seq);
+	free(cache->windows);
+	khash_str2int_destroy_free(cache->seqnames);
+	kh_destroy(ref_window, cache->hash);
+	free(cache->str.s);
+	free(cache);
+}
+
+static inline void ref_cache_unlink(ref_cache_t *cache, int idx)
+{
+	ref_window_t *window = &cache->windows[idx];
+	if (window->prev >= 0)
+		cache->windows[window->prev].next = window->next;
+	else
+		cache->head = window->next;
+	if (window->next >= 0)
+		cache->windows[window->next].prev = window->prev;
+	else
+		cache->tail = window->prev;
+}
+
+static inline void ref_cache_push(ref_cache_t *cache, int idx)
+{
+	ref_window_t *window = &cache->windows[idx];
+	window->prev = -1;
+	window->next = cache->head;
+	if (cache->head >= 0)
+		cache->windows[cache->head].prev = idx;
+	else
+		cache->tail = idx;
+	cache->head = idx;
+}
+
+// returns the cached sequence for interval [beg, end) or NULL if the interval spans windows
+static inline const char *ref_cache_window(ref_cache_t *cache, const char *seqname, int beg,
+					   int end, int seq_len)
+{
+	int cid;
+	if (khash_str2int_get(cache->seqnames, seqname, &cid) < 0) {
+		cid = khash_str2int_size(cache->seqnames);
+		khash_str2int_set(cache->seqnames, strdup(seqname), cid);
+	}
+	uint64_t key = (uint64_t)cid << 32 | (uint32_t)(beg / REF_CACHE_WINDOW);
+
+	int ret, idx;
+	khiter_t k = kh_put(ref_window, cache->hash, key, &ret);
+	if (ret == 0) {
+		idx = kh_val(cache->hash, k);
+		ref_window_t *window = &cache->windows[idx];
+		if (end > window->end)
+			return NULL;
+		cache->n_hits++;
+		if (cache->head != idx) {
+			ref_cache_unlink(cache, idx);
+			ref_cache_push(cache, idx);
+		}
+		return window->seq + (beg - window->beg);
+	}
+
+	cache->n_misses++;
+	int window_beg = beg - beg % REF_CACHE_WINDOW;
+	int window_end = min(seq_len, window_beg + REF_CACHE_WINDOW + REF_CACHE_OVERLAP);
+	if (cache->n_windows > 0 && cache->size + (window_end - window_beg) > cache->max_size) {
+		// recycle the least recently used window
+		idx = cache->tail;
+		ref_window_t *window = &cache->windows[idx];
+		ref_cache_unlink(cache, idx);
+		kh_del(ref_window, cache->hash, kh_get(ref_window, cache->hash, window->key));
+		cache->size -= window->end - window->beg;
+		free(window->seq);
+	} else {
+		hts_expand0(ref_window_t, cache->n_windows + 1, cache->m_windows, cache->windows);
+		idx = cache->n_windows++;
+	}
+	k = kh_get(ref_window, cache->hash, key);
+	kh_val(cache->hash, k) = idx;
+
+	ref_window_t *window = &cache->windows[idx];
+	int len;
+	window->seq = faidx_fetch_seq(cache->fai, seqname, window_beg, window_end - 1, &len);
+	cache->n_fetches++;
+	if (!window->seq || len != window_end - window_beg)
+		error("faidx_fetch_seq failed at %s:%d-%d\n", seqname, window_beg + 1, window_end);
+	window->key = key;
+	window->beg = window_beg;
+	window->end = window_end;
+	cache->size += window_end - window_beg;
+	ref_cache_push(cache, idx);
+	return end > window_end ? NULL : window->seq + (beg - window_beg);
+}
+
+// fetches the reference sequence in [p_beg, p_end] clamping coordinates like faidx_fetch_seq()
+static inline char *ref_cache_fetch(ref_cache_t *cache, const char *seqname, int p_beg,
+				    int p_end, int *len)
+{
+	if (cache->max_size == 0) {
+		free(cache->str.s);
+		cache->str.s = faidx_fetch_seq(cache->fai, seqname, p_beg, p_end, len);
+		cache->n_fetches++;
+		cache->str.l = cache->str.m = cache->str.s ? *len + 1 : 0;
+		return cache->str.s;
+	}
+	int seq_len = faidx_seq_len(cache->fai, seqname);
+	if (seq_len < 0)
+		return NULL;
+	if (p_end < p_beg)
+		p_beg = p_end;
+	if (p_beg < 0)
+		p_beg = 0;
+	else if (seq_len <= p_beg)
+		p_beg = seq_len;
+	if (p_end < 0)
+		p_end = 0;
+	else if (seq_len <= p_end)
+		p_end = seq_len - 1;
+	*len = p_end + 1 - p_beg;
+	cache->str.l = 0;
+	if (*len > 0) {
+		const char *seq = ref_cache_window(cache, seqname, p_beg, p_end + 1, seq_len);
+		if (!seq) {
+			char *ref = faidx_fetch_seq(cache->fai, seqname, p_beg, p_end, len);
+			cache->n_fetches++;
+			free(cache->str.s);
+			cache->str.s = ref;
+			cache->str.l = cache->str.m = ref ? *len + 1 : 0;
+			return ref;
+		}
+		kputsn(seq, *len, &cache->str);
+	} else {
+		kputs("", &cache->str);
+	}
+	return cache->str.s;
+}
+
+static inline void ref_cache_print_stats(const ref_cache_t *cache, FILE *stream)
+{
+	uint64_t n = cache->n_hits + cache->n_misses;
+	fprintf(stream, "Reference cache hits/misses:\t%" PRIu64 "/%" PRIu64 " (%.2f%% hit rate)\n",
+		cache->n_hits, cache->n_misses, n ? 100.0 * cache->n_hits / n : 0.0);
+}
+
+/****************************************
+ * PREFETCHING READS                    *
+ ****************************************/
+
+#define PREFETCH_QUEUE 64 // reads that can be queued for each I/O thread
+
+#define PREFETCH_IDLE 0
+#define PREFETCH_PENDING 1
+#define PREFETCH_DONE 2
+#define PREFETCH_FAILED 3
+
+// windows of the input files that will be needed next are read ahead of the conversion by a
+// separate pool of I/O threads, so that remote files are read with large range requests issued
+// in parallel rather than with small requests issued on demand
+typedef struct {
+	hts_tpool *pool;
+	hts_tpool_process *q;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint64_t n_fetched; // bytes read ahead
+	uint64_t n_used;    // bytes read ahead that were then used
+} prefetch_t;
+
+// a window read ahead into a buffer, each slot has at most one read in flight and is waited
+// for before its buffer is used or the file is read otherwise
+typedef struct {
+	prefetch_t *prefetch;
+	int (*read)(void *data, char *buf, int64_t off, size_t len);
+	void *data;
+	char *buf;
+	int64_t off;
+	size_t len;
+	int state;
+} prefetch_slot_t;
+
+static inline prefetch_t *prefetch_init(int n_threads)
+{
+	prefetch_t *prefetch = (prefetch_t *)calloc(1, sizeof(prefetch_t));
+	prefetch->pool = hts_tpool_init(n_threads);
+	if (!prefetch->pool)
+		error("Failed to create thread pool with %d threads\n", n_threads);
+	prefetch->q = hts_tpool_process_init(prefetch->pool, PREFETCH_QUEUE * n_threads, 1);
+	if (!prefetch->q)
+		error("Failed to create the prefetch queue\n");
+	pthread_mutex_init(&prefetch->lock, NULL);
+	pthread_cond_init(&prefetch->cond, NULL);
+	return prefetch;
+}
+
+static inline void prefetch_destroy(prefetch_t *prefetch)
+{
+	if (!prefetch)
+		return;
+	if (hts_tpool_process_flush(prefetch->q) < 0)
+		error("Failed to flush the thread pool\n");
+	hts_tpool_process_destroy(prefetch->q);
+	hts_tpool_destroy(prefetch->pool);
+	pthread_mutex_destroy(&prefetch->lock);
+	pthread_cond_destroy(&prefetch->cond);
+	free(prefetch);
+}
+
+static inline void prefetch_slot_init(prefetch_slot_t *slot, prefetch_t *prefetch,
+				      int (*read)(void *, char *, int64_t, size_t), void *data)
+{
+	memset((void *)slot, 0, sizeof(prefetch_slot_t));
+	slot->prefetch = prefetch;
+	slot->read = read;
+	slot->data = data;
+}
+
+static inline void *prefetch_run(void *arg)
+{
+	prefetch_slot_t *slot = (prefetch_slot_t *)arg;
+	int ret = slot->read(slot->data, slot->buf, slot->off, slot->len);
+	prefetch_t *prefetch = slot->prefetch;
+	pthread_mutex_lock(&prefetch->lock);
+	slot->state = ret < 0 ? PREFETCH_FAILED : PREFETCH_DONE;
+	if (ret >= 0)
+		prefetch->n_fetched += slot->len;
+	pthread_cond_broadcast(&prefetch->cond);
+	pthread_mutex_unlock(&prefetch->lock);
+	return NULL;
+}
+
+// issue the read of a window, if the queue is full the window is left to be read on demand
+static inline void prefetch_issue(prefetch_slot_t *slot, char *buf, int64_t off, size_t len)
+{
+	slot->buf = buf;
+	slot->off = off;
+	slot->len = len;
+	slot->state = PREFETCH_PENDING;
+	if (hts_tpool_dispatch2(slot->prefetch->pool, slot->prefetch->q, prefetch_run,
+				(void *)slot, 1)
+	    < 0)
+		slot->state = PREFETCH_IDLE;
+}
+
+// wait for the read issued for the slot, if any, returning how it ended and resetting the slot
+static inline int prefetch_wait(prefetch_slot_t *slot)
+{
+	prefetch_t *prefetch = slot->prefetch;
+	pthread_mutex_lock(&prefetch->lock);
+	while (slot->state == PREFETCH_PENDING)
+		pthread_cond_wait(&prefetch->cond, &prefetch->lock);
+	int state = slot->state;
+	slot->state = PREFETCH_IDLE;
+	pthread_mutex_unlock(&prefetch->lock);
+	return state;
+}
+
+static inline void prefetch_used(prefetch_t *prefetch, size_t len)
+{
+	pthread_mutex_lock(&prefetch->lock);
+	prefetch->n_used += len;
+	pthread_mutex_unlock(&prefetch->lock);
+}
+
+static inline void prefetch_counts(prefetch_t *prefetch, uint64_t *n_fetched, uint64_t *n_used)
+{
+	*n_fetched = *n_used = 0;
+	if (!prefetch)
+		return;
+	pthread_mutex_lock(&prefetch->lock);
+	*n_fetched = prefetch->n_fetched;
+	*n_used = prefetch->n_used;
+	pthread_mutex_unlock(&prefetch->lock);
+}
+
+static inline void prefetch_print_stats(prefetch_t *prefetch, FILE *stream)
+{
+	uint64_t n_fetched, n_used;
+	prefetch_counts(prefetch, &n_fetched, &n_used);
+	fprintf(stream, "Prefetched bytes used/fetched:\t%" PRIu64 "/%" PRIu64 " (%.2f%% used)\n",
+		n_used, n_fetched, n_fetched ? 100.0 * n_used / n_fetched : 0.0);
+}
+
+/****************************************
+ * PROGRESS STATISTICS                  *
+ ****************************************/
+
+#define PROGRESS_INTERVAL 10.0 // seconds between two snapshots
+#define PROGRESS_STRIDE 1024   // loci between two checks of the clock
+
+// counters of a conversion written as JSON lines, they are only updated by the thread driving
+// the conversion with the counters of the worker threads merged at their synchronization points
+typedef struct {
+	FILE *stream;
+	const ref_cache_t *ref;
+	prefetch_t *prefetch; // set if the input files are read ahead
+	const char *input;    // type of the input files
+	int n_total;	   // loci expected, or 0 if unknown
+	int n_loci;
+	int n_samples;
+	uint64_t n_bytes; // bytes read from the input files
+	uint64_t n_refills;
+	double write; // seconds spent in bcf_write()
+	double t_beg, t_next;
+	int n_checked; // loci at the last check of the clock
+} progress_t;
+
+static inline progress_t *progress_init(FILE *stream, const ref_cache_t *ref)
+{
+	progress_t *progress = (progress_t *)calloc(1, sizeof(progress_t));
+	progress->stream = stream;
+	progress->ref = ref;
+	return progress;
+}
+
+static inline void progress_destroy(progress_t *progress)
+{
+	if (!progress)
+		return;
+	if (progress->stream != stdout && progress->stream != stderr)
+		fclose(progress->stream);
+	free(progress);
+}
+
+static inline void progress_begin(progress_t *progress, const char *input, int n_total,
+				  int n_samples)
+{
+	progress->input = input;
+	progress->n_total = n_total;
+	progress->n_samples = n_samples;
+	progress->t_beg = wall_time();
+	progress->t_next = progress->t_beg + PROGRESS_INTERVAL;
+}
+
+// resident memory from /proc when available, otherwise the peak resident memory
+static inline double resident_mb(void)
+{
+	long pages = 0;
+	FILE *fp = fopen("/proc/self/statm", "r");
+	if (fp) {
+		if (fscanf(fp, "%*d %ld", &pages) != 1)
+			pages = 0;
+		fclose(fp);
+	}
+	if (pages > 0)
+		return pages * (sysconf(_SC_PAGESIZE) / 1024.0) / 1024.0;
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024.0;
+}
+
+static inline void progress_write(progress_t *progress, int done)
+{
+	double elapsed = wall_time() - progress->t_beg;
+	uint64_t n_fetched, n_used;
+	prefetch_counts(progress->prefetch, &n_fetched, &n_used);
+	fprintf(progress->stream,
+		"{\"elapsed\":%.3f,\"input\":\"%s\",\"loci\":%d,\"total\":%d,\"samples\":%d,"
+		"\"bytes_read\":%" PRIu64 ",\"refills\":%" PRIu64 ",\"prefetched_bytes\":%" PRIu64
+		",\"prefetch_used_bytes\":%" PRIu64 ",\"fasta_fetches\":%" PRIu64
+		",\"write_seconds\":%.3f,\"rss_mb\":%.1f,",
+		elapsed, progress->input, progress->n_loci, progress->n_total,
+		progress->n_samples, progress->n_bytes, progress->n_refills, n_fetched, n_used,
+		progress->ref ? progress->ref->n_fetches : 0, progress->write, resident_mb());
+	if (done)
+		fputs("\"eta\":0,\"done\":true}\n", progress->stream);
+	else if (progress->n_total > 0 && progress->n_loci > 0)
+		fprintf(progress->stream, "\"eta\":%.1f,\"done\":false}\n",
+			elapsed * (progress->n_total - progress->n_loci) / progress->n_loci);
+	else
+		fputs("\"eta\":null,\"done\":false}\n", progress->stream);
+	fflush(progress->stream);
+}
+
+// whether a snapshot is due, cheap enough to be called for every locus as the clock is only
+// checked every so many loci
+static inline int progress_update(progress_t *progress, int n_loci)
+{
+	progress->n_loci = n_loci;
+	if (n_loci - progress->n_checked < PROGRESS_STRIDE)
+		return 0;
+	progress->n_checked = n_loci;
+	double now = wall_time();
+	if (now < progress->t_next)
+		return 0;
+	progress->t_next = now + PROGRESS_INTERVAL;
+	return 1;
+}
+
+static inline void progress_end(progress_t *progress, int n_loci)
+{
+	progress->n_loci = n_loci;
+	progress_write(progress, 1);
+}
+
+// compressed bytes read so far from a file opened with hts_open()
+static inline uint64_t hts_bytes_read(htsFile *fp)
+{
+	hFILE *hfile = fp ? hts_hfile(fp) : NULL;
+	off_t off = hfile ? htell(hfile) : 0;
+	return off > 0 ? off : 0;
+}
+
+static inline char get_ref_base(ref_cache_t *cache, const bcf_hdr_t *hdr, bcf1_t *rec)
 {
 	int len;
-	char *ref = faidx_fetch_seq(fai, bcf_seqname(hdr, rec), rec->pos, rec->pos, &len);
+	char *ref = ref_cache_fetch(cache, bcf_seqname(hdr, rec), rec->pos, rec->pos, &len);
 	if (!ref)
 		error("faidx_fetch_seq failed at %s:%" PRId64 "\n", bcf_seqname(hdr, rec),
 		      rec->pos + 1);
-	char ref_base = ref[0];
-	free(ref);
-	return ref_base;
+	return ref[0];
 }
 
 static inline void strupper(char *str)
@@ -394,7 +1066,7 @@ static inline int len_common_prefix(const char *s1, const char *s2, size_t n)
 // For an insertion relative to the reference, the position of the base immediately 5' to the
 // insertion (on the plus strand) is given. For a deletion relative to the reference, the
 // position of the most 5' deleted based (on the plus strand) is given.
-static inline int get_indel_alleles(const char *flank, faidx_t *fai, const char *seqname,
+static inline int get_indel_alleles(const char *flank, ref_cache_t *cache, const char *seqname,
 				    hts_pos_t pos, int allele_b_is_del, char *ref_base,
 				    kstring_t *allele_a, kstring_t *allele_b)
 {
@@ -406,7 +1078,7 @@ static inline int get_indel_alleles(const char *flank, faidx_t *fai, const char
 
 	int len;
 	char *ref =
-		faidx_fetch_seq(fai, seqname, pos - (int)(left - flank),
+		ref_cache_fetch(cache, seqname, pos - (int)(left - flank),
 				pos - 1 + (int)(right - middle) - 1 + strlen(right + 1), &len);
 	if (!ref)
 		error("faidx_fetch_seq failed at %s:%" PRId64 "\n", seqname, pos + 1);
@@ -432,7 +1104,6 @@ static inline int get_indel_alleles(const char *flank, faidx_t *fai, const char
 		kputsn(ref_is_del ? middle + 1 : ref + (left - flank), right - middle - 1,
 		       allele_b_is_del ? allele_a : allele_b);
 	}
-	free(ref);
 	return ref_is_del;
 }
 
@@ -25,53 +25,143 @@
  */
 
 #include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define N_BINS 12
+#define N_SHIFTED_BINS 11
+
+// scratch space owned by the caller and reused across calls, so that the search is reentrant
+// and can run on several loci at once with one context per thread
+typedef struct {
+	int bin_off[N_BINS + N_SHIFTED_BINS + 1]; // bins followed by the shifted bins
+	int bin_len[N_BINS + N_SHIFTED_BINS];
+	int *idx;
+	float *x;
+	float *y;
+	int m; // number of elements allocated
+} nn_ctx_t;
+
+nn_ctx_t *nn_ctx_init(void)
+{
+	return (nn_ctx_t *)calloc(1, sizeof(nn_ctx_t));
+}
 
-int elementsInBin[12];
-int *binData[12];
-int elementsInShiftedBin[11];
-int *binDataShifted[11];
+void nn_ctx_destroy(nn_ctx_t *ctx)
+{
+	if (!ctx)
+		return;
+	free(ctx->idx);
+	free(ctx);
+}
 
-int findClosestSitesToPointsAlongAxis(int n_raw, float *raw_x, float *raw_y, int n_axis,
-				      float *axis_x, float *axis_y, int *ret)
+static int nn_ctx_expand(nn_ctx_t *ctx, int n)
+{
+	if (n <= ctx->m)
+		return 0;
+	// a single block for the indexes and the coordinates of the points in each bin
+	void *ptr = realloc(ctx->idx, (size_t)n * (sizeof(int) + 2 * sizeof(float)));
+	if (!ptr)
+		return -1;
+	ctx->idx = (int *)ptr;
+	ctx->x = (float *)(ctx->idx + n);
+	ctx->y = ctx->x + n;
+	ctx->m = n;
+	return 0;
+}
+
+static inline void raw_bins(float raw_a, float bin_width, int *bin_idx, int *shifted_bin_idx)
+{
+	*bin_idx = (int)(raw_a / bin_width);
+	if (*bin_idx < 0)
+		*bin_idx = 0;
+	if (*bin_idx > N_BINS - 1)
+		*bin_idx = N_BINS - 1;
+	*shifted_bin_idx = (int)(raw_a / bin_width - 0.5f);
+	if (*shifted_bin_idx < 0)
+		*shifted_bin_idx = 0;
+	if (*shifted_bin_idx > N_SHIFTED_BINS - 1)
+		*shifted_bin_idx = N_SHIFTED_BINS - 1;
+	*shifted_bin_idx += N_BINS;
+}
+
+// returns the position of the first point with the smallest squared distance or -1 if none
+static int closest_in_bin(const float *x, const float *y, int n, float axis_x, float axis_y)
+{
+	// squared distances are compared in single precision exactly as the scalar search did
+	float best_val = 1e20f;
+	int best_j = -1;
+	int j = 0;
+#ifdef __SSE2__
+	if (n >= 4) {
+		__m128 v_axis_x = _mm_set1_ps(axis_x);
+		__m128 v_axis_y = _mm_set1_ps(axis_y);
+		__m128 v_best_val = _mm_set1_ps(best_val);
+		__m128i v_best_j = _mm_set1_epi32(-1);
+		__m128i v_j = _mm_setr_epi32(0, 1, 2, 3);
+		for (; j + 4 <= n; j += 4) {
+			__m128 x_dist = _mm_sub_ps(_mm_loadu_ps(&x[j]), v_axis_x);
+			__m128 y_dist = _mm_sub_ps(_mm_loadu_ps(&y[j]), v_axis_y);
+			__m128 sq_dist =
+				_mm_add_ps(_mm_mul_ps(x_dist, x_dist), _mm_mul_ps(y_dist, y_dist));
+			__m128 lt = _mm_cmplt_ps(sq_dist, v_best_val);
+			v_best_val =
+				_mm_or_ps(_mm_and_ps(lt, sq_dist), _mm_andnot_ps(lt, v_best_val));
+			__m128i lt_i = _mm_castps_si128(lt);
+			v_best_j = _mm_or_si128(_mm_and_si128(lt_i, v_j),
+						_mm_andnot_si128(lt_i, v_best_j));
+			v_j = _mm_add_epi32(v_j, _mm_set1_epi32(4));
+		}
+		// each lane holds its first minimum so ties across lanes go to the earliest point
+		float lane_val[4];
+		int lane_j[4];
+		_mm_storeu_ps(lane_val, v_best_val);
+		_mm_storeu_si128((__m128i *)lane_j, v_best_j);
+		for (int k = 0; k < 4; k++) {
+			if (lane_j[k] < 0)
+				continue;
+			if (lane_val[k] < best_val
+			    || (lane_val[k] == best_val && lane_j[k] < best_j)) {
+				best_val = lane_val[k];
+				best_j = lane_j[k];
+			}
+		}
+	}
+#endif
+	for (; j < n; j++) {
+		float x_dist = x[j] - axis_x;
+		float y_dist = y[j] - axis_y;
+		float sq_dist = x_dist * x_dist + y_dist * y_dist;
+		if (sq_dist < best_val) {
+			best_val = sq_dist;
+			best_j = j;
+		}
+	}
+	return best_j;
+}
+
+int nn_find_closest(nn_ctx_t *ctx, int n_raw, const float *raw_x, const float *raw_y, int n_axis,
+		    const float *axis_x, const float *axis_y, int *ret)
 {
-	int i;
-	float *raw_a = NULL;
-	float *raw_b = NULL;
-	float *axis_a = NULL;
-	float axis_max_val;
-	float bin_width;
-	int bin_idx;
-	float quotient;
-	float reminder;
-	int *curr_bin_data;
-	int curr_bin_size;
-	float curr_axis_x;
-	float curr_axis_y;
-	float x_dist;
-	float y_dist;
-	double best_val;
-	int best_idx;
-	int j;
-	int curr_idx;
-	double sq_dist;
-	double axis_max_dist;
 	int use_y = 1;
 	int use_x = 1;
 
-	for (i = 0; i < n_axis; i++) {
+	for (int i = 0; i < n_axis; i++) {
 		if (axis_x[i] > 0.0001) {
 			use_y = 0;
 			break;
 		}
 	}
 
-	for (i = 0; i < n_axis; i++) {
+	for (int i = 0; i < n_axis; i++) {
 		if (axis_y[i] > 0.0001) {
 			use_x = 0;
 			break;
 		}
 	}
 
+	const float *raw_a, *raw_b, *axis_a;
 	if (use_y) {
 		raw_a = raw_y;
 		raw_b = raw_x;
@@ -84,115 +174,75 @@ int findClosestSitesToPointsAlongAxis(int n_raw, float *raw_x, float *raw_y, int
 		return -1;
 	}
 
-	axis_max_val = axis_a[n_axis - 1];
-	bin_width = axis_max_val / 12.0f;
-	axis_max_dist = (double)bin_width;
+	float bin_width = axis_a[n_axis - 1] / 12.0f;
+	double axis_max_dist = (double)bin_width;
 
-	for (i = 0; i < n_raw; i++) {
+	// count the points in each bin and in each shifted bin
+	int *bin_len = ctx->bin_len;
+	for (int k = 0; k < N_BINS + N_SHIFTED_BINS; k++)
+		bin_len[k] = 0;
+	for (int i = 0; i < n_raw; i++) {
 		if ((double)raw_b[i] > axis_max_dist)
 			continue;
-		bin_idx = (int)(raw_a[i] / bin_width);
-		if (bin_idx < 0)
-			bin_idx = 0;
-		if (bin_idx > 11)
-			bin_idx = 11;
-		elementsInBin[bin_idx]++;
-		bin_idx = (int)(raw_a[i] / bin_width - 0.5f);
-		if (bin_idx < 0)
-			bin_idx = 0;
-		if (bin_idx > 10)
-			bin_idx = 10;
-		elementsInShiftedBin[bin_idx]++;
+		int bin_idx, shifted_bin_idx;
+		raw_bins(raw_a[i], bin_width, &bin_idx, &shifted_bin_idx);
+		bin_len[bin_idx]++;
+		bin_len[shifted_bin_idx]++;
 	}
-
-	for (i = 0; i <= 11; i++) {
-		binData[i] = (int *)malloc((size_t)elementsInBin[i] * sizeof(int));
-		elementsInBin[i] = 0;
-		if (i == 11)
-			continue;
-		binDataShifted[i] =
-			(int *)malloc((size_t)elementsInShiftedBin[i] * sizeof(int));
-		elementsInShiftedBin[i] = 0;
+	int *bin_off = ctx->bin_off;
+	bin_off[0] = 0;
+	for (int k = 0; k < N_BINS + N_SHIFTED_BINS; k++) {
+		bin_off[k + 1] = bin_off[k] + bin_len[k];
+		bin_len[k] = 0;
 	}
+	if (nn_ctx_expand(ctx, bin_off[N_BINS + N_SHIFTED_BINS]) < 0)
+		return -1;
 
-	for (i = 0; i < n_raw; i++) {
+	// copy the coordinates next to each other so that the distance search is contiguous
+	for (int i = 0; i < n_raw; i++) {
 		if ((double)raw_b[i] > axis_max_dist)
 			continue;
-		bin_idx = (int)(raw_a[i] / bin_width);
-		if (bin_idx < 0)
-			bin_idx = 0;
-		if (bin_idx > 11)
-			bin_idx = 11;
-		binData[bin_idx][elementsInBin[bin_idx]] = i;
-		elementsInBin[bin_idx]++;
-		bin_idx = (int)(raw_a[i] / bin_width - 0.5f);
-		if (bin_idx < 0)
-			bin_idx = 0;
-		if (bin_idx > 10)
-			bin_idx = 10;
-		binDataShifted[bin_idx][elementsInShiftedBin[bin_idx]] = i;
-		elementsInShiftedBin[bin_idx]++;
+		int bins[2];
+		raw_bins(raw_a[i], bin_width, &bins[0], &bins[1]);
+		for (int k = 0; k < 2; k++) {
+			int j = bin_off[bins[k]] + bin_len[bins[k]]++;
+			ctx->idx[j] = i;
+			ctx->x[j] = raw_x[i];
+			ctx->y[j] = raw_y[i];
+		}
 	}
 
-	for (i = 0; i < n_axis; i++) {
-		quotient = axis_a[i] / bin_width;
-		bin_idx = (int)quotient;
-		reminder = quotient - (float)bin_idx;
-		curr_bin_data = NULL;
-		curr_bin_size = 0;
+	for (int i = 0; i < n_axis; i++) {
+		float quotient = axis_a[i] / bin_width;
+		int bin_idx = (int)quotient;
+		float reminder = quotient - (float)bin_idx;
 		if (bin_idx < 0)
 			bin_idx = 0;
-		if (bin_idx > 11)
-			bin_idx = 11;
-
-		if (0.25f <= reminder && reminder <= 0.75f) {
-			curr_bin_data = binData[bin_idx];
-			curr_bin_size = elementsInBin[bin_idx];
-		} else {
-			if (reminder < 0.25f) {
-				if (bin_idx == 0) {
-					curr_bin_data = binData[bin_idx];
-					curr_bin_size = elementsInBin[bin_idx];
-				} else {
-					curr_bin_data = binDataShifted[bin_idx - 1];
-					curr_bin_size = elementsInShiftedBin[bin_idx - 1];
-				}
-			} else if (bin_idx == 11) {
-				curr_bin_data = binData[bin_idx];
-				curr_bin_size = elementsInBin[bin_idx];
-			} else {
-				curr_bin_data = binDataShifted[bin_idx];
-				curr_bin_size = elementsInShiftedBin[bin_idx];
-			}
-		}
-
-		curr_axis_x = axis_x[i];
-		curr_axis_y = axis_y[i];
-		best_val = 1e20;
-		best_idx = -1;
-
-		for (j = 0; j < curr_bin_size; j++) {
-			curr_idx = curr_bin_data[j];
-			x_dist = raw_x[curr_idx] - curr_axis_x;
-			y_dist = raw_y[curr_idx] - curr_axis_y;
-			sq_dist = (double)(x_dist * x_dist + y_dist * y_dist);
-			if (sq_dist < best_val) {
-				best_val = sq_dist;
-				best_idx = curr_idx;
-			}
-		}
-
-		ret[i] = best_idx;
-	}
-
-	for (i = 0; i <= 11; i++) {
-		free((void *)binData[i]);
-		elementsInBin[i] = 0;
-		if (i > 10)
-			continue;
-		free((void *)binDataShifted[i]);
-		elementsInShiftedBin[i] = 0;
+		if (bin_idx > N_BINS - 1)
+			bin_idx = N_BINS - 1;
+
+		int k;
+		if (0.25f <= reminder && reminder <= 0.75f)
+			k = bin_idx;
+		else if (reminder < 0.25f)
+			k = bin_idx == 0 ? bin_idx : N_BINS + bin_idx - 1;
+		else
+			k = bin_idx == N_BINS - 1 ? bin_idx : N_BINS + bin_idx;
+
+		int off = bin_off[k];
+		int j = closest_in_bin(&ctx->x[off], &ctx->y[off], bin_len[k], axis_x[i],
+				       axis_y[i]);
+		ret[i] = j < 0 ? -1 : ctx->idx[off + j];
 	}
 
 	return 0;
 }
+
+int findClosestSitesToPointsAlongAxis(int n_raw, float *raw_x, float *raw_y, int n_axis,
+				      float *axis_x, float *axis_y, int *ret)
+{
+	nn_ctx_t ctx = {{0}, {0}, NULL, NULL, NULL, 0};
+	int ret_val = nn_find_closest(&ctx, n_raw, raw_x, raw_y, n_axis, axis_x, axis_y, ret);
+	free(ctx.idx);
+	return ret_val;
+}
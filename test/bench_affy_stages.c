@@ -0,0 +1,120 @@
+/* The MIT License
+
+   Copyright (c) 2018-2020 Giulio Genovese
+
+   Author: Giulio Genovese <giulio.genovese@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+
+ */
+
+// times each stage of the CHP conversion on its own over the inputs written by make_fixtures:
+// ingest of the annotation and CHP files, reading of the CHP rows, and the conversion, which
+// reads the rows again as process() fuses reading, encoding, and writing of the records
+
+#include "../affy2vcf.c"
+
+static agcc_t **chps_init(char **filenames, int n)
+{
+	agcc_t **agcc = (agcc_t **)malloc(n * sizeof(agcc_t *));
+	for (int i = 0; i < n; i++) {
+		hFILE *fp = hopen(filenames[i], "rb");
+		if (!fp)
+			error("Could not open %s: %s\n", filenames[i], strerror(errno));
+		agcc[i] = agcc_init(filenames[i], fp, n > 1);
+	}
+	return agcc;
+}
+
+static void chps_destroy(agcc_t **agcc, int n)
+{
+	for (int i = 0; i < n; i++)
+		agcc_destroy(agcc[i]);
+	free(agcc);
+}
+
+static void print_stage(const char *stage, double seconds, int n_loci, int n_samples)
+{
+	fprintf(stderr, "Stage:\t%s\n", stage);
+	fprintf(stderr, "Seconds:\t%.3f\n", seconds);
+	print_throughput(stderr, seconds, n_loci, n_samples);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2)
+		error("Usage: bench_affy_stages <directory written by make_fixtures>\n");
+	const char *dir = argv[1];
+	kstring_t str = {0, 0, NULL};
+
+	double t0 = wall_time();
+	ksprintf(&str, "%s/ref.fa", dir);
+	faidx_t *fai = fai_load(str.s);
+	if (!fai)
+		error("Could not load the reference %s\n", str.s);
+	ref_cache_t *ref = ref_cache_init(fai, (size_t)REF_CACHE_SIZE << 20);
+	str.l = 0;
+	ksprintf(&str, "%s/annot.csv", dir);
+	annot_t *annot = annot_init(str.s, NULL, NULL, 0);
+	int n = 0;
+	char **filenames = get_file_list(dir, "chp", 1, &n);
+	agcc_t **agcc = chps_init(filenames, n);
+	double ingest = wall_time() - t0;
+	int n_loci = annot->n_records;
+
+	// the rows are read once on their own and once more by the conversion
+	bcf_hdr_t *hdr = hdr_init(fai, 0);
+	varitr_t *varitr = varitr_init_cc(hdr, agcc, n, NULL, 0);
+	t0 = wall_time();
+	while (varitr_loop(varitr) >= 0)
+		;
+	double read = wall_time() - t0;
+	varitr_destroy(varitr);
+	bcf_hdr_destroy(hdr);
+	chps_destroy(agcc, n);
+
+	agcc = chps_init(filenames, n);
+	hdr = hdr_init(fai, 0);
+	varitr = varitr_init_cc(hdr, agcc, n, NULL, 0);
+	htsFile *out_fh = hts_open("/dev/null", "wbu");
+	if (!out_fh)
+		error("Failed to open /dev/null\n");
+	t0 = wall_time();
+	process(ref, annot, NULL, varitr, out_fh, hdr, NULL, 0);
+	double convert = wall_time() - t0;
+	if (hts_close(out_fh) < 0)
+		error("Failed to close /dev/null\n");
+
+	fprintf(stderr, "Loci/samples:\t%d/%d\n", n_loci, n);
+	print_stage("ingest", ingest, n_loci, n);
+	print_stage("read", read, n_loci, n);
+	print_stage("convert", convert, n_loci, n);
+
+	varitr_destroy(varitr);
+	bcf_hdr_destroy(hdr);
+	chps_destroy(agcc, n);
+	for (int i = 0; i < n; i++)
+		free(filenames[i]);
+	free(filenames);
+	annot_destroy(annot);
+	ref_cache_destroy(ref);
+	fai_destroy(fai);
+	free(str.s);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+/* The MIT License
+
+   Copyright (c) 2018-2020 Giulio Genovese
+
+   Author: Giulio Genovese <giulio.genovese@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+
+ */
+
+// times each stage of the GTC conversion on its own, without the thread pool, over the inputs
+// written by make_fixtures: ingest of the manifest, cluster, and GTC files, normalization of
+// the intensities into tiles, encoding of the records, and writing of the records
+
+#include "../gtc2vcf.c"
+
+#define BENCH_FLAGS                                                                            \
+	(BPM_LOADED | BPM_LOOKUPS | EGT_LOADED | FORMAT_IGC | FORMAT_BAF | FORMAT_LRR          \
+	 | FORMAT_NORMX | FORMAT_NORMY | FORMAT_R | FORMAT_THETA | FORMAT_X | FORMAT_Y)
+
+static void print_stage(const char *stage, double seconds, int n_loci, int n_samples)
+{
+	fprintf(stderr, "Stage:\t%s\n", stage);
+	fprintf(stderr, "Seconds:\t%.3f\n", seconds);
+	print_throughput(stderr, seconds, n_loci, n_samples);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 2)
+		error("Usage: bench_stages <directory written by make_fixtures>\n");
+	const char *dir = argv[1];
+	int flags = BENCH_FLAGS;
+	kstring_t str = {0, 0, NULL};
+
+	double t0 = wall_time();
+	ksprintf(&str, "%s/ref.fa", dir);
+	faidx_t *fai = fai_load(str.s);
+	if (!fai)
+		error("Could not load the reference %s\n", str.s);
+	ref_cache_t *ref = ref_cache_init(fai, (size_t)REF_CACHE_SIZE << 20);
+	str.l = 0;
+	ksprintf(&str, "%s/manifest.bpm", dir);
+	bpm_t *bpm = bpm_init(str.s);
+	str.l = 0;
+	ksprintf(&str, "%s/clusters.egt", dir);
+	egt_t *egt = egt_init(str.s);
+	bpm_loci_init(bpm, egt);
+	int n = 0;
+	char **filenames = get_file_list(dir, "gtc", 1, &n);
+	gtc_t **gtc = (gtc_t **)malloc(n * sizeof(gtc_t *));
+	files_load(filenames, n, BUFFER_CAPACITY, bpm, NULL, flags, (void **)gtc);
+	bcf_hdr_t *hdr = hdr_init(fai, flags);
+	for (int i = 0; i < n; i++)
+		if (bcf_hdr_add_sample(hdr, gtc[i]->display_name) < 0)
+			error("GTC files must correspond to different samples\n");
+	if (bcf_hdr_sync(hdr) < 0)
+		error("Failed to update the header\n");
+	sites_t *sites = sites_init(ref, bpm, hdr, NULL, 0, flags);
+	double ingest = wall_time() - t0;
+	int n_loci = bpm->num_loci;
+
+	htsFile *out_fh = hts_open("/dev/null", "wbu");
+	if (!out_fh || bcf_hdr_write(out_fh, hdr) < 0)
+		error("Failed to open /dev/null\n");
+	tile_t *tile = tile_init(gtc, n, n_loci);
+	int m_loci = tile->m_loci;
+	bcf1_t **recs = (bcf1_t **)malloc(m_loci * sizeof(bcf1_t *));
+	for (int k = 0; k < m_loci; k++)
+		recs[k] = bcf_init();
+	int tag_ids[N_TAGS];
+	tag_ids_init(tag_ids, hdr, flags);
+	encode_job_t job = {0};
+	job.sites = sites;
+	job.bpm = bpm;
+	job.egt = egt;
+	job.tile = tile;
+	job.hdr = hdr;
+	job.flags = flags;
+	job.tag_ids = tag_ids;
+	job.recs = recs;
+	job.gt_arr = (int32_t *)malloc(n * 2 * sizeof(int32_t));
+
+	// the write stage is timed by write_records() and the encode stage by encode_records()
+	stage_times_t times = {0};
+	double normalization = 0.0;
+	for (int locus_beg = 0; locus_beg < n_loci; locus_beg += m_loci) {
+		double t1 = wall_time();
+		tile_fill(gtc, bpm, egt, tile, locus_beg, min(m_loci, n_loci - locus_beg), NULL,
+			  NULL);
+		normalization += wall_time() - t1;
+		job.locus_beg = locus_beg;
+		job.k_beg = 0;
+		job.k_end = tile->n_loci;
+		encode_records(&job);
+		write_records(&job, out_fh, &times);
+	}
+	if (hts_close(out_fh) < 0)
+		error("Failed to close /dev/null\n");
+
+	fprintf(stderr, "Loci/samples:\t%d/%d\n", n_loci, n);
+	print_stage("ingest", ingest, n_loci, n);
+	print_stage("normalization", normalization, n_loci, n);
+	print_stage("encode", times.encode, n_loci, n);
+	print_stage("write", times.write, n_loci, n);
+
+	free(job.gt_arr);
+	for (int k = 0; k < m_loci; k++)
+		bcf_destroy(recs[k]);
+	free(recs);
+	tile_destroy(tile);
+	sites_destroy(sites);
+	bcf_hdr_destroy(hdr);
+	for (int i = 0; i < n; i++) {
+		gtc_destroy(gtc[i]);
+		free(filenames[i]);
+	}
+	free(gtc);
+	free(filenames);
+	egt_destroy(egt);
+	bpm_destroy(bpm);
+	ref_cache_destroy(ref);
+	fai_destroy(fai);
+	free(str.s);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,698 @@
+/* The MIT License
+
+   Copyright (c) 2018-2020 Giulio Genovese
+
+   Author: Giulio Genovese <giulio.genovese@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+
+ */
+
+// writes a synthetic reference, BPM manifest, EGT cluster file, GTC files, Affymetrix
+// annotation file, and AGCC CHP files describing the same markers, so that the conversions can
+// be benchmarked on inputs of any size without access to real array data
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+static void error(const char *format, ...) __attribute__((format(printf, 1, 2)));
+static void error(const char *format, ...)
+{
+	va_list ap;
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	va_end(ap);
+	exit(EXIT_FAILURE);
+}
+
+/****************************************
+ * OUTPUT BUFFER                        *
+ ****************************************/
+
+// files are assembled in memory so that the offsets of later sections can be patched in
+typedef struct {
+	size_t l, m;
+	uint8_t *s;
+} buf_t;
+
+static void buf_put(buf_t *buf, const void *data, size_t len)
+{
+	if (buf->l + len > buf->m) {
+		buf->m = (buf->l + len) * 2;
+		buf->s = (uint8_t *)realloc(buf->s, buf->m);
+		if (!buf->s)
+			error("Failed to allocate memory\n");
+	}
+	memcpy(buf->s + buf->l, data, len);
+	buf->l += len;
+}
+
+static inline void buf_u8(buf_t *buf, uint8_t value)
+{
+	buf_put(buf, &value, 1);
+}
+
+// the Illumina formats are little endian
+static void buf_le(buf_t *buf, uint64_t value, int len)
+{
+	for (int i = 0; i < len; i++)
+		buf_u8(buf, (uint8_t)(value >> (8 * i)));
+}
+
+static void buf_le_float(buf_t *buf, float value)
+{
+	uint32_t u;
+	memcpy(&u, &value, 4);
+	buf_le(buf, u, 4);
+}
+
+// length-prefixed string with the length as a LEB128 integer
+static void buf_pfx_string(buf_t *buf, const char *str)
+{
+	size_t n = str ? strlen(str) : 0;
+	do {
+		uint8_t byte = n & 0x7F;
+		n >>= 7;
+		buf_u8(buf, byte | (n ? 0x80 : 0));
+	} while (n);
+	if (str)
+		buf_put(buf, str, strlen(str));
+}
+
+// the AGCC format is big endian
+static void buf_be32(buf_t *buf, uint32_t value)
+{
+	for (int i = 3; i >= 0; i--)
+		buf_u8(buf, (uint8_t)(value >> (8 * i)));
+}
+
+static void buf_be_float(buf_t *buf, float value)
+{
+	uint32_t u;
+	memcpy(&u, &value, 4);
+	buf_be32(buf, u);
+}
+
+static void buf_patch_be32(buf_t *buf, size_t off, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		buf->s[off + i] = (uint8_t)(value >> (8 * (3 - i)));
+}
+
+static void buf_patch_le32(buf_t *buf, size_t off, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		buf->s[off + i] = (uint8_t)(value >> (8 * i));
+}
+
+static void buf_string8(buf_t *buf, const char *str)
+{
+	buf_be32(buf, strlen(str));
+	buf_put(buf, str, strlen(str));
+}
+
+static void buf_string16(buf_t *buf, const char *str)
+{
+	buf_be32(buf, strlen(str));
+	for (const char *p = str; *p; p++) {
+		buf_u8(buf, 0);
+		buf_u8(buf, (uint8_t)*p);
+	}
+}
+
+static void buf_write(const buf_t *buf, const char *dir, const char *name)
+{
+	char fn[4096];
+	snprintf(fn, sizeof(fn), "%s/%s", dir, name);
+	FILE *fp = fopen(fn, "wb");
+	if (!fp || fwrite(buf->s, 1, buf->l, fp) != buf->l || fclose(fp) != 0)
+		error("Failed to write %s\n", fn);
+}
+
+/****************************************
+ * MARKERS                              *
+ ****************************************/
+
+#define FLANK_LEN 25
+#define N_NORM_IDS 4
+
+static const char bases[] = "ACGT";
+
+typedef struct {
+	char name[32];
+	int pos; // 1-based
+	char allele_a, allele_b;
+	uint8_t norm_id;
+	float theta_mean[3], r_mean[3];
+	float theta_dev[3], r_dev[3];
+	float freq; // frequency of the B allele
+} marker_t;
+
+static inline float rand_unif(float min, float max)
+{
+	return min + (max - min) * (float)drand48();
+}
+
+static float rand_norm(void)
+{
+	double u = drand48(), v = drand48();
+	return (float)(sqrt(-2.0 * log(u + 1e-12)) * cos(2.0 * M_PI * v));
+}
+
+// markers are spread evenly along a single contig with the A allele mostly matching the
+// reference so that both the biallelic and the triallelic encodings are exercised
+static marker_t *markers_init(int n_loci, char **ref, int *ref_len)
+{
+	int spacing = 2 * FLANK_LEN + 10;
+	*ref_len = (n_loci + 2) * spacing;
+	*ref = (char *)malloc(*ref_len + 1);
+	for (int i = 0; i < *ref_len; i++)
+		(*ref)[i] = bases[lrand48() % 4];
+	(*ref)[*ref_len] = '\0';
+	marker_t *markers = (marker_t *)calloc(n_loci, sizeof(marker_t));
+	for (int j = 0; j < n_loci; j++) {
+		marker_t *marker = &markers[j];
+		snprintf(marker->name, sizeof(marker->name), "rs%d", 1000000 + j);
+		marker->pos = (j + 1) * spacing;
+		char ref_base = (*ref)[marker->pos - 1];
+		int ref_idx = strchr(bases, ref_base) - bases;
+		int alt_idx = (ref_idx + 1 + lrand48() % 3) % 4;
+		marker->allele_a = lrand48() % 10 ? ref_base : bases[(alt_idx + 1) % 4];
+		marker->allele_b = bases[alt_idx] == marker->allele_a ? bases[(alt_idx + 2) % 4]
+								    : bases[alt_idx];
+		marker->norm_id = j % N_NORM_IDS;
+		float theta[3] = {rand_unif(0.02f, 0.1f), rand_unif(0.4f, 0.6f),
+				  rand_unif(0.9f, 0.98f)};
+		for (int g = 0; g < 3; g++) {
+			marker->theta_mean[g] = theta[g];
+			marker->theta_dev[g] = rand_unif(0.01f, 0.04f);
+			marker->r_mean[g] = rand_unif(0.8f, 1.6f);
+			marker->r_dev[g] = rand_unif(0.05f, 0.15f);
+		}
+		marker->freq = rand_unif(0.05f, 0.5f);
+	}
+	return markers;
+}
+
+static void write_reference(const char *dir, const char *ref, int ref_len)
+{
+	buf_t buf = {0, 0, NULL};
+	buf_put(&buf, ">1\n", 3);
+	for (int i = 0; i < ref_len; i += 60) {
+		buf_put(&buf, ref + i, ref_len - i < 60 ? ref_len - i : 60);
+		buf_u8(&buf, '\n');
+	}
+	buf_write(&buf, dir, "ref.fa");
+	free(buf.s);
+}
+
+// flanking sequence on the plus strand in the [A/B] notation shared by both manifests
+static void marker_flank(const marker_t *marker, const char *ref, char *flank)
+{
+	int beg = marker->pos - 1 - FLANK_LEN;
+	sprintf(flank, "%.*s[%c/%c]%.*s", FLANK_LEN, ref + beg, marker->allele_a,
+		marker->allele_b, FLANK_LEN, ref + marker->pos);
+}
+
+/****************************************
+ * ILLUMINA FILES                       *
+ ****************************************/
+
+#define MANIFEST_NAME "FIXTURE-24v1-0_A1"
+
+// http://github.com/Illumina/BeadArrayFiles/blob/develop/module/BeadPoolManifest.py
+static void write_bpm(const char *dir, const marker_t *markers, int n_loci, const char *ref)
+{
+	buf_t buf = {0, 0, NULL};
+	buf_put(&buf, "BPM\1", 4);
+	buf_le(&buf, 5, 4);
+	buf_pfx_string(&buf, MANIFEST_NAME);
+	buf_pfx_string(&buf, "");
+	buf_le(&buf, n_loci, 4);
+	for (int j = 0; j < n_loci; j++)
+		buf_le(&buf, j + 1, 4);
+	for (int j = 0; j < n_loci; j++)
+		buf_pfx_string(&buf, markers[j].name);
+	for (int j = 0; j < n_loci; j++)
+		buf_u8(&buf, markers[j].norm_id);
+
+	// locus entries of version 8 with an Infinium II assay for every marker
+	char flank[2 * FLANK_LEN + 6], snp[6], ilmn_id[64], map_info[16];
+	for (int j = 0; j < n_loci; j++) {
+		const marker_t *marker = &markers[j];
+		marker_flank(marker, ref, flank);
+		snprintf(snp, sizeof(snp), "[%c/%c]", marker->allele_a, marker->allele_b);
+		snprintf(ilmn_id, sizeof(ilmn_id), "%s-128_T_F_2304%d", marker->name, j);
+		snprintf(map_info, sizeof(map_info), "%d", marker->pos);
+		buf_le(&buf, 8, 4);
+		buf_pfx_string(&buf, ilmn_id);
+		buf_pfx_string(&buf, marker->name);
+		for (int k = 0; k < 3; k++)
+			buf_pfx_string(&buf, NULL);
+		buf_le(&buf, j + 1, 4);
+		buf_pfx_string(&buf, NULL);
+		buf_pfx_string(&buf, "TOP");
+		buf_pfx_string(&buf, snp);
+		buf_pfx_string(&buf, "1");
+		buf_pfx_string(&buf, "diploid");
+		buf_pfx_string(&buf, "Homo sapiens");
+		buf_pfx_string(&buf, map_info);
+		buf_pfx_string(&buf, NULL);
+		buf_pfx_string(&buf, "TOP");
+		buf_le(&buf, 10000000 + j, 4);
+		buf_le(&buf, 0, 4);
+		buf_pfx_string(&buf, NULL);
+		buf_pfx_string(&buf, NULL);
+		buf_pfx_string(&buf, "37");
+		buf_pfx_string(&buf, "dbSNP");
+		buf_pfx_string(&buf, "0");
+		buf_pfx_string(&buf, "TOP");
+		buf_pfx_string(&buf, flank);
+		buf_u8(&buf, 0);
+		buf_u8(&buf, 3); // expected clusters
+		buf_u8(&buf, 0); // intensity only
+		buf_u8(&buf, 0); // assay type
+		for (int k = 0; k < 4; k++)
+			buf_le_float(&buf, 0.25f);
+		buf_pfx_string(&buf, "+");
+	}
+	buf_le(&buf, 1, 4);
+	buf_pfx_string(&buf, "Synthetic manifest written by make_fixtures");
+	buf_write(&buf, dir, "manifest.bpm");
+	free(buf.s);
+}
+
+// http://github.com/Illumina/BeadArrayFiles/blob/develop/module/ClusterFile.py
+static void write_egt(const char *dir, const marker_t *markers, int n_loci, int n_samples)
+{
+	buf_t buf = {0, 0, NULL};
+	buf_le(&buf, 3, 4);
+	buf_pfx_string(&buf, "1.0.0");
+	buf_pfx_string(&buf, "GenTrain 3.0");
+	buf_pfx_string(&buf, "GenCall 3.0");
+	buf_pfx_string(&buf, "Normalization 1.1.1");
+	buf_pfx_string(&buf, "1/1/2020 12:00:00 PM");
+	buf_u8(&buf, 1);
+	buf_pfx_string(&buf, MANIFEST_NAME);
+	buf_le(&buf, 8, 4);
+	buf_pfx_string(&buf, "");
+	buf_le(&buf, n_loci, 4);
+	int32_t *counts = (int32_t *)malloc(n_loci * 3 * sizeof(int32_t));
+	for (int j = 0; j < n_loci; j++) {
+		const marker_t *marker = &markers[j];
+		float p = marker->freq;
+		counts[3 * j] = (int32_t)(n_samples * (1 - p) * (1 - p));
+		counts[3 * j + 1] = (int32_t)(n_samples * 2 * p * (1 - p));
+		counts[3 * j + 2] = (int32_t)(n_samples * p * p);
+		for (int g = 0; g < 3; g++)
+			buf_le(&buf, (uint32_t)counts[3 * j + g], 4);
+		for (int g = 0; g < 3; g++)
+			buf_le_float(&buf, marker->r_dev[g]);
+		for (int g = 0; g < 3; g++)
+			buf_le_float(&buf, marker->r_mean[g]);
+		for (int g = 0; g < 3; g++)
+			buf_le_float(&buf, marker->theta_dev[g]);
+		for (int g = 0; g < 3; g++)
+			buf_le_float(&buf, marker->theta_mean[g]);
+		buf_le_float(&buf, 0.2f); // intensity threshold
+		for (int k = 0; k < 14; k++)
+			buf_le_float(&buf, 0.0f);
+	}
+	for (int j = 0; j < n_loci; j++) {
+		buf_le_float(&buf, rand_unif(0.3f, 0.9f)); // cluster separation
+		buf_le_float(&buf, rand_unif(0.6f, 0.95f)); // GenTrain score
+		buf_le_float(&buf, rand_unif(0.6f, 0.95f)); // original score
+		buf_u8(&buf, lrand48() % 20 == 0);
+	}
+	for (int j = 0; j < n_loci; j++)
+		buf_pfx_string(&buf, "aa_ab_bb");
+	for (int j = 0; j < n_loci; j++)
+		buf_pfx_string(&buf, markers[j].name);
+	for (int j = 0; j < n_loci; j++)
+		buf_le(&buf, 10000000 + j, 4);
+	for (int j = 0; j < 3 * n_loci; j++)
+		buf_le(&buf, (uint32_t)counts[j], 4);
+	free(counts);
+	buf_write(&buf, dir, "clusters.egt");
+	free(buf.s);
+}
+
+// genotype of a sample drawn from the allele frequency, with Theta and R drawn around the
+// cluster centers, returned as 0 for no call and 1, 2, 3 for AA, AB, BB
+static int sample_genotype(const marker_t *marker, float *theta, float *r)
+{
+	float u = (float)drand48(), p = marker->freq;
+	int g = u < (1 - p) * (1 - p) ? 0 : (u < 1 - p * p ? 1 : 2);
+	*theta = marker->theta_mean[g] + marker->theta_dev[g] * rand_norm();
+	*r = marker->r_mean[g] + marker->r_dev[g] * rand_norm();
+	if (*theta < 0.0f)
+		*theta = 0.0f;
+	if (*theta > 1.0f)
+		*theta = 1.0f;
+	if (*r < 0.01f)
+		*r = 0.01f;
+	return lrand48() % 100 == 0 ? 0 : g + 1;
+}
+
+// inverse of Theta = atan(Y / X) * 2 / pi and R = X + Y
+static void theta_r_to_xy(float theta, float r, float *x, float *y)
+{
+	float t = tanf(theta * (float)M_PI_2);
+	*x = r / (1.0f + t);
+	*y = r - *x;
+}
+
+static uint16_t raw_intensity(float norm, float scale, float offset)
+{
+	float raw = norm * scale + offset;
+	return raw < 0.0f ? 0 : (raw > 65535.0f ? 65535 : (uint16_t)lrintf(raw));
+}
+
+#define GTC_NUM_SNPS 1
+#define GTC_PLOIDY 2
+#define GTC_PLOIDY_TYPE 3
+#define GTC_SAMPLE_NAME 10
+#define GTC_SNP_MANIFEST 101
+#define GTC_NORMALIZATION_TRANSFORMS 400
+#define GTC_RAW_X 1000
+#define GTC_RAW_Y 1001
+#define GTC_GENOTYPES 1002
+#define GTC_GENOTYPE_SCORES 1004
+#define GTC_GENDER 1007
+#define GTC_N_TOC 11
+
+// the normalization transforms have no rotation and shear so the raw intensities are the
+// normalized intensities scaled and offset
+// http://github.com/Illumina/BeadArrayFiles/blob/develop/docs/GTC_File_Format_v5.pdf
+static void write_gtc(const char *dir, int sample, const marker_t *markers, int n_loci)
+{
+	float scale_x[N_NORM_IDS], scale_y[N_NORM_IDS], offset_x[N_NORM_IDS],
+		offset_y[N_NORM_IDS];
+	for (int k = 0; k < N_NORM_IDS; k++) {
+		scale_x[k] = rand_unif(4000.0f, 8000.0f);
+		scale_y[k] = rand_unif(4000.0f, 8000.0f);
+		offset_x[k] = rand_unif(50.0f, 300.0f);
+		offset_y[k] = rand_unif(50.0f, 300.0f);
+	}
+	uint16_t *raw_x = (uint16_t *)malloc(n_loci * sizeof(uint16_t));
+	uint16_t *raw_y = (uint16_t *)malloc(n_loci * sizeof(uint16_t));
+	uint8_t *genotypes = (uint8_t *)malloc(n_loci);
+	float *scores = (float *)malloc(n_loci * sizeof(float));
+	for (int j = 0; j < n_loci; j++) {
+		const marker_t *marker = &markers[j];
+		float theta, r, x, y;
+		genotypes[j] = sample_genotype(marker, &theta, &r);
+		theta_r_to_xy(theta, r, &x, &y);
+		int k = marker->norm_id;
+		raw_x[j] = raw_intensity(x, scale_x[k], offset_x[k]);
+		raw_y[j] = raw_intensity(y, scale_y[k], offset_y[k]);
+		scores[j] = genotypes[j] ? rand_unif(0.5f, 0.99f) : rand_unif(0.0f, 0.15f);
+	}
+
+	char name[32];
+	snprintf(name, sizeof(name), "SAMPLE%05d", sample + 1);
+	buf_t buf = {0, 0, NULL};
+	buf_put(&buf, "gtc\5", 4);
+	buf_le(&buf, GTC_N_TOC, 4);
+	static const uint16_t ids[GTC_N_TOC] = {GTC_NUM_SNPS,
+						 GTC_PLOIDY,
+						 GTC_PLOIDY_TYPE,
+						 GTC_SAMPLE_NAME,
+						 GTC_SNP_MANIFEST,
+						 GTC_NORMALIZATION_TRANSFORMS,
+						 GTC_RAW_X,
+						 GTC_RAW_Y,
+						 GTC_GENOTYPES,
+						 GTC_GENOTYPE_SCORES,
+						 GTC_GENDER};
+	size_t toc = buf.l;
+	for (int i = 0; i < GTC_N_TOC; i++) {
+		buf_le(&buf, ids[i], 2);
+		buf_le(&buf, 0, 4);
+	}
+	// the first entries hold values rather than offsets
+	buf_patch_le32(&buf, toc + 2, n_loci);
+	buf_patch_le32(&buf, toc + 6 + 2, 2);
+	buf_patch_le32(&buf, toc + 12 + 2, 1);
+	for (int i = 3; i < GTC_N_TOC; i++) {
+		buf_patch_le32(&buf, toc + 6 * i + 2, buf.l);
+		switch (ids[i]) {
+		case GTC_SAMPLE_NAME:
+			buf_pfx_string(&buf, name);
+			break;
+		case GTC_SNP_MANIFEST:
+			buf_pfx_string(&buf, MANIFEST_NAME);
+			break;
+		case GTC_NORMALIZATION_TRANSFORMS:
+			buf_le(&buf, N_NORM_IDS, 4);
+			for (int k = 0; k < N_NORM_IDS; k++) {
+				buf_le(&buf, 1, 4);
+				buf_le_float(&buf, offset_x[k]);
+				buf_le_float(&buf, offset_y[k]);
+				buf_le_float(&buf, scale_x[k]);
+				buf_le_float(&buf, scale_y[k]);
+				buf_le_float(&buf, 0.0f); // shear
+				buf_le_float(&buf, 0.0f); // theta
+				for (int l = 0; l < 6; l++)
+					buf_le_float(&buf, 0.0f);
+			}
+			break;
+		case GTC_RAW_X:
+		case GTC_RAW_Y:
+			buf_le(&buf, n_loci, 4);
+			for (int j = 0; j < n_loci; j++)
+				buf_le(&buf, ids[i] == GTC_RAW_X ? raw_x[j] : raw_y[j], 2);
+			break;
+		case GTC_GENOTYPES:
+			buf_le(&buf, n_loci, 4);
+			buf_put(&buf, genotypes, n_loci);
+			break;
+		case GTC_GENOTYPE_SCORES:
+			buf_le(&buf, n_loci, 4);
+			for (int j = 0; j < n_loci; j++)
+				buf_le_float(&buf, scores[j]);
+			break;
+		case GTC_GENDER:
+			buf_u8(&buf, sample % 2 ? 'M' : 'F');
+			break;
+		}
+	}
+	char fn[64];
+	snprintf(fn, sizeof(fn), "%s.gtc", name);
+	buf_write(&buf, dir, fn);
+	free(buf.s);
+	free(raw_x);
+	free(raw_y);
+	free(genotypes);
+	free(scores);
+}
+
+/****************************************
+ * AFFYMETRIX FILES                     *
+ ****************************************/
+
+static void write_annot(const char *dir, const marker_t *markers, int n_loci, const char *ref)
+{
+	buf_t buf = {0, 0, NULL};
+	char line[256], flank[2 * FLANK_LEN + 6];
+	const char *header =
+		"#%netaffx-annotation-tabular-format-version=1.5\n"
+		"\"Probe Set ID\",\"Affy SNP ID\",\"dbSNP RS ID\",\"Chromosome\","
+		"\"Physical Position\",\"Position End\",\"Strand\",\"Flank\",\"Allele A\","
+		"\"Allele B\"\n";
+	buf_put(&buf, header, strlen(header));
+	for (int j = 0; j < n_loci; j++) {
+		const marker_t *marker = &markers[j];
+		marker_flank(marker, ref, flank);
+		int len = snprintf(line, sizeof(line),
+				   "\"AX-%d\",\"Affx-%d\",\"%s\",\"1\",\"%d\",\"%d\",\"+\",\"%s\","
+				   "\"%c\",\"%c\"\n",
+				   10000000 + j, 20000000 + j, marker->name, marker->pos,
+				   marker->pos, flank, marker->allele_a, marker->allele_b);
+		buf_put(&buf, line, len);
+	}
+	buf_write(&buf, dir, "annot.csv");
+	free(buf.s);
+}
+
+#define AGCC_UBYTE 1
+#define AGCC_FLOAT 6
+#define AGCC_STRING 7
+#define PROBE_SET_NAME_LEN 11
+
+// a multi data CHP file with the genotype data set of the Axiom genotyping algorithm
+// http://www.affymetrix.com/support/developer/powertools/changelog/gcos-agcc/index.html
+static void write_chp(const char *dir, int sample, const marker_t *markers, int n_loci)
+{
+	static const int calls[4] = {11, 6, 8, 7}; // NC, AA, AB, BB
+	static const struct {
+		const char *name;
+		int8_t type;
+		int32_t size;
+	} cols[] = {{"ProbeSetName", AGCC_STRING, 4 + PROBE_SET_NAME_LEN},
+		    {"Call", AGCC_UBYTE, 1},
+		    {"Confidence", AGCC_FLOAT, 4},
+		    {"Log Ratio", AGCC_FLOAT, 4},
+		    {"Strength", AGCC_FLOAT, 4},
+		    {"Forced Call", AGCC_UBYTE, 1}};
+	int n_cols = sizeof(cols) / sizeof(cols[0]);
+
+	buf_t buf = {0, 0, NULL};
+	buf_u8(&buf, 59);
+	buf_u8(&buf, 1);
+	buf_be32(&buf, 1); // number of data groups
+	size_t pos_first_data_group = buf.l;
+	buf_be32(&buf, 0);
+	buf_string8(&buf, "affymetrix-multi-data-type-analysis");
+	buf_string8(&buf, "00000000-0000-0000-0000-000000000000");
+	buf_string16(&buf, "2020-01-01T12:00:00Z");
+	buf_string16(&buf, "en-US");
+	buf_be32(&buf, 0); // parameters
+	buf_be32(&buf, 0); // parents
+
+	buf_patch_be32(&buf, pos_first_data_group, buf.l);
+	buf_be32(&buf, 0); // the data set is followed by the end of the file
+	size_t pos_first_data_set = buf.l;
+	buf_be32(&buf, 0);
+	buf_be32(&buf, 1);
+	buf_string16(&buf, "MultiData");
+	buf_patch_be32(&buf, pos_first_data_set, buf.l);
+
+	size_t pos_first_element = buf.l;
+	buf_be32(&buf, 0);
+	size_t pos_next_data_set = buf.l;
+	buf_be32(&buf, 0);
+	buf_string16(&buf, "Genotype");
+	buf_be32(&buf, 0); // parameters
+	buf_be32(&buf, n_cols);
+	for (int i = 0; i < n_cols; i++) {
+		buf_string16(&buf, cols[i].name);
+		buf_u8(&buf, (uint8_t)cols[i].type);
+		buf_be32(&buf, cols[i].size);
+	}
+	buf_be32(&buf, n_loci);
+	buf_patch_be32(&buf, pos_first_element, buf.l);
+	char name[PROBE_SET_NAME_LEN + 1];
+	for (int j = 0; j < n_loci; j++) {
+		float theta, r, x, y;
+		int gt = sample_genotype(&markers[j], &theta, &r);
+		theta_r_to_xy(theta, r, &x, &y);
+		x = x * 1000.0f + 1.0f;
+		y = y * 1000.0f + 1.0f;
+		memset(name, 0, sizeof(name));
+		snprintf(name, sizeof(name), "AX-%d", 10000000 + j);
+		buf_be32(&buf, strlen(name));
+		buf_put(&buf, name, PROBE_SET_NAME_LEN);
+		buf_u8(&buf, calls[gt]);
+		buf_be_float(&buf, gt ? rand_unif(0.0f, 0.05f) : rand_unif(0.1f, 0.2f));
+		buf_be_float(&buf, log2f(x) - log2f(y));
+		buf_be_float(&buf, (log2f(x) + log2f(y)) * 0.5f);
+		buf_u8(&buf, calls[gt]);
+	}
+	buf_patch_be32(&buf, pos_next_data_set, buf.l);
+
+	char fn[64];
+	snprintf(fn, sizeof(fn), "SAMPLE%05d.AxiomGT1.chp", sample + 1);
+	buf_write(&buf, dir, fn);
+	free(buf.s);
+}
+
+/****************************************
+ * MAIN                                 *
+ ****************************************/
+
+static const char *usage_text(void)
+{
+	return "\n"
+	       "About: write synthetic Illumina and Affymetrix inputs for benchmarking\n"
+	       "Usage: make_fixtures [options] <directory>\n"
+	       "\n"
+	       "Options:\n"
+	       "    -l, --loci <int>     number of markers [50000]\n"
+	       "    -s, --samples <int>  number of GTC and CHP files [100]\n"
+	       "        --seed <int>     seed of the random number generator [20200526]\n"
+	       "\n"
+	       "Writes ref.fa, manifest.bpm, clusters.egt, annot.csv, and SAMPLE*.gtc and\n"
+	       "SAMPLE*.AxiomGT1.chp into the directory, which is created if needed\n"
+	       "\n";
+}
+
+int main(int argc, char **argv)
+{
+	int n_loci = 50000, n_samples = 100;
+	long seed = 20200526;
+	static struct option loptions[] = {{"loci", required_argument, NULL, 'l'},
+					   {"samples", required_argument, NULL, 's'},
+					   {"seed", required_argument, NULL, 1},
+					   {NULL, 0, NULL, 0}};
+	int c;
+	char *tmp;
+	while ((c = getopt_long(argc, argv, "h?l:s:", loptions, NULL)) >= 0) {
+		switch (c) {
+		case 'l':
+			n_loci = strtol(optarg, &tmp, 0);
+			if (*tmp || n_loci <= 0)
+				error("Could not parse: --loci %s\n", optarg);
+			break;
+		case 's':
+			n_samples = strtol(optarg, &tmp, 0);
+			if (*tmp || n_samples <= 0)
+				error("Could not parse: --samples %s\n", optarg);
+			break;
+		case 1:
+			seed = strtol(optarg, &tmp, 0);
+			if (*tmp)
+				error("Could not parse: --seed %s\n", optarg);
+			break;
+		case 'h':
+		case '?':
+		default:
+			error("%s", usage_text());
+		}
+	}
+	if (optind + 1 != argc)
+		error("%s", usage_text());
+	const char *dir = argv[optind];
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+		error("Failed to create directory %s\n", dir);
+	srand48(seed);
+
+	char *ref;
+	int ref_len;
+	marker_t *markers = markers_init(n_loci, &ref, &ref_len);
+	write_reference(dir, ref, ref_len);
+	write_bpm(dir, markers, n_loci, ref);
+	write_egt(dir, markers, n_loci, n_samples);
+	write_annot(dir, markers, n_loci, ref);
+	for (int i = 0; i < n_samples; i++) {
+		write_gtc(dir, i, markers, n_loci);
+		write_chp(dir, i, markers, n_loci);
+	}
+	fprintf(stderr, "Wrote %d markers and %d samples to %s\n", n_loci, n_samples, dir);
+	free(markers);
+	free(ref);
+	return EXIT_SUCCESS;
+}
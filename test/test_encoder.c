@@ -0,0 +1,349 @@
+/* The MIT License
+
+   Copyright (c) 2018-2020 Giulio Genovese
+
+   Author: Giulio Genovese <giulio.genovese@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+
+ */
+
+// checks that the direct record encoder produces the same bytes as bcf_update_*() for random
+// records, and with the bench argument times both encoders writing 1,000 samples records
+
+#include "../gtc2vcf.c"
+
+#define ALL_FLAGS                                                                              \
+	(BPM_LOADED | CSV_LOADED | BPM_LOOKUPS | EGT_LOADED | FORMAT_IGC | FORMAT_BAF          \
+	 | FORMAT_LRR | FORMAT_NORMX | FORMAT_NORMY | FORMAT_R | FORMAT_THETA | FORMAT_X       \
+	 | FORMAT_Y)
+
+#define N_FLOAT_TAGS 7
+
+// the values of one marker across all samples, as encode_records() sees them
+typedef struct {
+	char id[32];
+	const char *alleles[3];
+	int nals;
+	int32_t allele_a_idx, allele_b_idx;
+	float frac[4];
+	int32_t norm_id, beadset_id, assay_type;
+	float scores[3];
+	int edited;
+	int32_t counts[3];
+	float stats[12];
+	float intensity_threshold;
+	int32_t *gt_arr;
+	int32_t *gq_arr;
+	float *float_arr[N_FLOAT_TAGS];
+	int32_t *raw_x_arr;
+	int32_t *raw_y_arr;
+} marker_t;
+
+static const int float_tags[N_FLOAT_TAGS] = {TAG_IGC,   TAG_BAF, TAG_LRR,  TAG_NORMX,
+					     TAG_NORMY, TAG_R,	 TAG_THETA};
+
+static float rand_float(void)
+{
+	switch (lrand48() % 16) {
+	case 0:
+		return NAN;
+	case 1:
+		return 0.0f;
+	default:
+		return (float)(drand48() * 4.0 - 1.0);
+	}
+}
+
+static marker_t *marker_init(int n)
+{
+	marker_t *marker = (marker_t *)calloc(1, sizeof(marker_t));
+	marker->gt_arr = (int32_t *)malloc(n * 2 * sizeof(int32_t));
+	marker->gq_arr = (int32_t *)malloc(n * sizeof(int32_t));
+	for (int i = 0; i < N_FLOAT_TAGS; i++)
+		marker->float_arr[i] = (float *)malloc(n * sizeof(float));
+	marker->raw_x_arr = (int32_t *)malloc(n * sizeof(int32_t));
+	marker->raw_y_arr = (int32_t *)malloc(n * sizeof(int32_t));
+	return marker;
+}
+
+static void marker_destroy(marker_t *marker)
+{
+	free(marker->gt_arr);
+	free(marker->gq_arr);
+	for (int i = 0; i < N_FLOAT_TAGS; i++)
+		free(marker->float_arr[i]);
+	free(marker->raw_x_arr);
+	free(marker->raw_y_arr);
+	free(marker);
+}
+
+// random values spanning the integer widths and special values the encoders distinguish
+static void marker_fill(marker_t *marker, int n)
+{
+	static const char *bases[] = {"A", "C", "G", "T", "AT", "."};
+	if (lrand48() % 8)
+		snprintf(marker->id, sizeof(marker->id), "rs%ld", lrand48());
+	else
+		strcpy(marker->id, ".");
+	marker->nals = 2 + lrand48() % 2;
+	for (int i = 0; i < marker->nals; i++)
+		marker->alleles[i] = bases[lrand48() % 5];
+	marker->allele_a_idx = lrand48() % marker->nals;
+	marker->allele_b_idx = lrand48() % marker->nals;
+	for (int i = 0; i < 4; i++)
+		marker->frac[i] = rand_float();
+	marker->norm_id = lrand48() % 256;
+	marker->beadset_id = lrand48() % 100000;
+	marker->assay_type = lrand48() % 3;
+	for (int i = 0; i < 3; i++) {
+		marker->scores[i] = rand_float();
+		marker->counts[i] = lrand48() % 100000;
+	}
+	marker->edited = lrand48() % 2;
+	for (int i = 0; i < 12; i++)
+		marker->stats[i] = rand_float();
+	marker->intensity_threshold = rand_float();
+
+	uint8_t *gts = (uint8_t *)malloc(n);
+	for (int i = 0; i < n; i++)
+		gts[i] = lrand48() % 4;
+	gts_to_gt_arr(marker->gt_arr, gts, n, marker->allele_a_idx, marker->allele_b_idx);
+	free(gts);
+	// small ranges exercise the int8 and int16 encodings of the integer fields
+	int32_t range = lrand48() % 3 == 0 ? 100 : (lrand48() % 2 ? 30000 : 65535);
+	for (int i = 0; i < n; i++) {
+		marker->gq_arr[i] = lrand48() % 100;
+		for (int j = 0; j < N_FLOAT_TAGS; j++)
+			marker->float_arr[j][i] = rand_float();
+		marker->raw_x_arr[i] = lrand48() % range;
+		marker->raw_y_arr[i] = lrand48() % range;
+	}
+}
+
+/****************************************
+ * ENCODERS                             *
+ ****************************************/
+
+// the same sequence of calls as encode_records()
+static void encode_direct(bcf1_t *rec, const int *ids, marker_t *marker, int n)
+{
+	bcf_clear(rec);
+	rec->n_sample = n;
+	rec->rid = 0;
+	rec->pos = 99;
+	enc_shared(rec, marker->id, marker->alleles, marker->nals);
+	enc_info_int32(rec, ids[TAG_ALLELE_A], marker->allele_a_idx);
+	enc_info_int32(rec, ids[TAG_ALLELE_B], marker->allele_b_idx);
+	for (int i = 0; i < 4; i++)
+		enc_info_float(rec, ids[TAG_FRAC_A + i], marker->frac[i]);
+	enc_info_int32(rec, ids[TAG_NORM_ID], marker->norm_id);
+	enc_info_int32(rec, ids[TAG_BEADSET_ID], marker->beadset_id);
+	enc_info_int32(rec, ids[TAG_ASSAY_TYPE], marker->assay_type);
+	enc_info_float(rec, ids[TAG_GENTRAIN_SCORE], marker->scores[0]);
+	enc_info_float(rec, ids[TAG_ORIG_SCORE], marker->scores[1]);
+	if (marker->edited)
+		enc_info_flag(rec, ids[TAG_EDITED]);
+	enc_info_float(rec, ids[TAG_CLUSTER_SEP], marker->scores[2]);
+	for (int i = 0; i < 3; i++)
+		enc_info_int32(rec, ids[TAG_N_AA + i], marker->counts[i]);
+	for (int i = 0; i < 12; i++)
+		enc_info_float(rec, ids[TAG_DEVR_AA + i], marker->stats[i]);
+	enc_info_float(rec, ids[TAG_INTENSITY_THRESHOLD], marker->intensity_threshold);
+	enc_format_int32(rec, ids[TAG_GT], marker->gt_arr, n * 2, 2);
+	enc_format_int32(rec, ids[TAG_GQ], marker->gq_arr, n, 1);
+	for (int i = 0; i < N_FLOAT_TAGS; i++)
+		enc_format_float(rec, ids[float_tags[i]], marker->float_arr[i], n);
+	enc_format_int32(rec, ids[TAG_X], marker->raw_x_arr, n, 1);
+	enc_format_int32(rec, ids[TAG_Y], marker->raw_y_arr, n, 1);
+}
+
+// the calls used before the direct encoder was introduced
+static void encode_update(const bcf_hdr_t *hdr, bcf1_t *rec, marker_t *marker, int n)
+{
+	bcf_clear(rec);
+	rec->n_sample = n;
+	rec->rid = 0;
+	rec->pos = 99;
+	bcf_update_id(hdr, rec, marker->id);
+	bcf_update_alleles(hdr, rec, marker->alleles, marker->nals);
+	bcf_update_info_int32(hdr, rec, "ALLELE_A", &marker->allele_a_idx, 1);
+	bcf_update_info_int32(hdr, rec, "ALLELE_B", &marker->allele_b_idx, 1);
+	for (int i = 0; i < 4; i++)
+		bcf_update_info_float(hdr, rec, tag_names[TAG_FRAC_A + i], &marker->frac[i], 1);
+	bcf_update_info_int32(hdr, rec, "NORM_ID", &marker->norm_id, 1);
+	bcf_update_info_int32(hdr, rec, "BEADSET_ID", &marker->beadset_id, 1);
+	bcf_update_info_int32(hdr, rec, "ASSAY_TYPE", &marker->assay_type, 1);
+	bcf_update_info_float(hdr, rec, "GenTrain_Score", &marker->scores[0], 1);
+	bcf_update_info_float(hdr, rec, "Orig_Score", &marker->scores[1], 1);
+	if (marker->edited)
+		bcf_update_info_flag(hdr, rec, "Edited", NULL, 1);
+	bcf_update_info_float(hdr, rec, "Cluster_Sep", &marker->scores[2], 1);
+	for (int i = 0; i < 3; i++)
+		bcf_update_info_int32(hdr, rec, tag_names[TAG_N_AA + i], &marker->counts[i], 1);
+	for (int i = 0; i < 12; i++)
+		bcf_update_info_float(hdr, rec, tag_names[TAG_DEVR_AA + i], &marker->stats[i], 1);
+	bcf_update_info_float(hdr, rec, "Intensity_Threshold", &marker->intensity_threshold, 1);
+	bcf_update_genotypes(hdr, rec, marker->gt_arr, n * 2);
+	bcf_update_format_int32(hdr, rec, "GQ", marker->gq_arr, n);
+	for (int i = 0; i < N_FLOAT_TAGS; i++)
+		bcf_update_format_float(hdr, rec, tag_names[float_tags[i]], marker->float_arr[i],
+					n);
+	bcf_update_format_int32(hdr, rec, "X", marker->raw_x_arr, n);
+	bcf_update_format_int32(hdr, rec, "Y", marker->raw_y_arr, n);
+}
+
+/****************************************
+ * HEADER                               *
+ ****************************************/
+
+// the header is built by hdr_init() from a one contig reference in a temporary directory
+static bcf_hdr_t *test_hdr_init(int n)
+{
+	char dir[] = "/tmp/gtc2vcf_test_XXXXXX";
+	if (!mkdtemp(dir))
+		error("Failed to create a temporary directory\n");
+	kstring_t fasta = {0, 0, NULL}, fai = {0, 0, NULL};
+	ksprintf(&fasta, "%s/ref.fa", dir);
+	ksprintf(&fai, "%s/ref.fa.fai", dir);
+	FILE *fp = fopen(fasta.s, "w");
+	if (!fp)
+		error("Failed to write %s\n", fasta.s);
+	fputs(">1\nACGTACGTACGTACGTACGTACGTACGTACGT\n", fp);
+	fclose(fp);
+	faidx_t *fai_idx = fai_load(fasta.s);
+	if (!fai_idx)
+		error("Failed to index %s\n", fasta.s);
+	bcf_hdr_t *hdr = hdr_init(fai_idx, ALL_FLAGS);
+	fai_destroy(fai_idx);
+	unlink(fai.s);
+	unlink(fasta.s);
+	rmdir(dir);
+	free(fasta.s);
+	free(fai.s);
+
+	kstring_t str = {0, 0, NULL};
+	for (int i = 0; i < n; i++) {
+		str.l = 0;
+		ksprintf(&str, "SAMPLE%d", i + 1);
+		bcf_hdr_add_sample(hdr, str.s);
+	}
+	free(str.s);
+	if (bcf_hdr_sync(hdr) < 0)
+		error("Failed to sync the header\n");
+	return hdr;
+}
+
+/****************************************
+ * CHECKS AND BENCHMARK                 *
+ ****************************************/
+
+// bcf_dup() packs the fields set by bcf_update_*() into the shared and indiv blocks
+static int compare_records(const bcf1_t *rec, bcf1_t *ref_rec)
+{
+	bcf1_t *ref = bcf_dup(ref_rec);
+	int ret = rec->n_allele != ref->n_allele || rec->n_info != ref->n_info
+		  || rec->n_fmt != ref->n_fmt || rec->n_sample != ref->n_sample
+		  || rec->rlen != ref->rlen || rec->shared.l != ref->shared.l
+		  || rec->indiv.l != ref->indiv.l
+		  || memcmp(rec->shared.s, ref->shared.s, rec->shared.l)
+		  || memcmp(rec->indiv.s, ref->indiv.s, rec->indiv.l);
+	bcf_destroy(ref);
+	return ret;
+}
+
+static int run_checks(void)
+{
+	int n_failures = 0, n_checks = 0;
+	int lengths[] = {1, 2, 7, 100, 1000};
+	for (int k = 0; k < sizeof(lengths) / sizeof(int); k++) {
+		int n = lengths[k];
+		bcf_hdr_t *hdr = test_hdr_init(n);
+		int ids[N_TAGS];
+		tag_ids_init(ids, hdr, ALL_FLAGS);
+		for (int i = 0; i < N_TAGS; i++)
+			if (ids[i] < 0)
+				error("Tag %s missing from the header\n", tag_names[i]);
+		marker_t *marker = marker_init(n);
+		bcf1_t *rec = bcf_init();
+		bcf1_t *ref = bcf_init();
+		for (int rep = 0; rep < 200; rep++) {
+			marker_fill(marker, n);
+			encode_direct(rec, ids, marker, n);
+			encode_update(hdr, ref, marker, n);
+			n_checks++;
+			if (compare_records(rec, ref)) {
+				if (n_failures < 20)
+					fprintf(stderr,
+						"Encoders differ for marker %s with %d samples\n",
+						marker->id, n);
+				n_failures++;
+			}
+		}
+		bcf_destroy(rec);
+		bcf_destroy(ref);
+		marker_destroy(marker);
+		bcf_hdr_destroy(hdr);
+	}
+	fprintf(stderr, "%d of %d checks failed\n", n_failures, n_checks);
+	return n_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// both encoders write to an uncompressed BCF so that the packing done by bcf_write() for the
+// records built by bcf_update_*() is timed as well
+static int run_bench(int n, int n_markers)
+{
+	bcf_hdr_t *hdr = test_hdr_init(n);
+	int ids[N_TAGS];
+	tag_ids_init(ids, hdr, ALL_FLAGS);
+	marker_t *marker = marker_init(n);
+	marker_fill(marker, n);
+	bcf1_t *rec = bcf_init();
+	for (int direct = 0; direct < 2; direct++) {
+		htsFile *out_fh = hts_open("/dev/null", "wbu");
+		if (!out_fh || bcf_hdr_write(out_fh, hdr) < 0)
+			error("Failed to open /dev/null\n");
+		double t0 = wall_time();
+		for (int j = 0; j < n_markers; j++) {
+			if (direct)
+				encode_direct(rec, ids, marker, n);
+			else
+				encode_update(hdr, rec, marker, n);
+			if (bcf_write(out_fh, hdr, rec) < 0)
+				error("Failed to write to /dev/null\n");
+		}
+		double seconds = wall_time() - t0;
+		hts_close(out_fh);
+		fprintf(stderr, "Encoder:\t%s\n", direct ? "direct" : "bcf_update");
+		fprintf(stderr, "Seconds:\t%.3f\n", seconds);
+		print_throughput(stderr, seconds, n_markers, n);
+	}
+	bcf_destroy(rec);
+	marker_destroy(marker);
+	bcf_hdr_destroy(hdr);
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+	srand48(20200526);
+	if (argc > 1 && !strcmp(argv[1], "bench"))
+		return run_bench(argc > 2 ? atoi(argv[2]) : 1000, argc > 3 ? atoi(argv[3]) : 10000);
+	return run_checks();
+}
@@ -0,0 +1,290 @@
+/* The MIT License
+
+   Copyright (c) 2018-2020 Giulio Genovese
+
+   Author: Giulio Genovese <giulio.genovese@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+
+ */
+
+// checks that the intensity sidecar written across tiles and chunks decodes back to the values
+// of the tiles, with the uint16 encoding within half a step of the clamped values, the float16
+// encoding within half precision, and the raw intensities as integers, and that values reached
+// with bgzf_useek() at the offsets documented in the header match those read in sequence
+
+#include "../gtc2vcf.c"
+
+#define N_LOCI 2600
+#define N_SAMPLES 1000
+#define TILE_LOCI 300
+#define FLAGS (FORMAT_BAF | FORMAT_LRR | FORMAT_THETA | FORMAT_X)
+#define N_FIELDS 4
+
+static const int fields[N_FIELDS] = {0, 1, 5, 6};
+static const char *contigs[] = {"1", "2", "X"};
+
+static int n_checks = 0;
+static int n_failures = 0;
+
+static void check(int ok, const char *fmt, const char *what)
+{
+	n_checks++;
+	if (!ok) {
+		fprintf(stderr, fmt, what);
+		n_failures++;
+	}
+}
+
+static uint32_t hash(uint32_t j, uint32_t s, uint32_t f)
+{
+	uint32_t x = j * 2654435761u ^ s * 40503u ^ f * 2246822519u;
+	x ^= x >> 15;
+	x *= 0x2C1B3C6Du;
+	x ^= x >> 12;
+	x *= 0x297A2D39u;
+	x ^= x >> 15;
+	return x;
+}
+
+// values extend beyond the range of each field so that clamping is exercised
+static float expected_value(int f, int j, int s)
+{
+	uint32_t h = hash(j, s, f);
+	float u = (float)(h >> 8) / 16777216.0f;
+	if (intensity_is_raw(f))
+		return floorf(u * 70000.0f);
+	if (h % 16 == 0)
+		return NAN;
+	float min = intensity_fields[f].min, max = intensity_fields[f].max;
+	return min - 0.1f * (max - min) + 1.2f * (max - min) * u;
+}
+
+static float half_to_float(uint16_t h)
+{
+	int e = (h >> 10) & 0x1F, m = h & 0x3FF;
+	float f = e == 0    ? ldexpf((float)m, -24)
+		  : e == 31 ? (m ? NAN : INFINITY)
+			    : ldexpf((float)(m | 0x400), e - 25);
+	return h & 0x8000 ? -f : f;
+}
+
+static int decoded_matches(int f, int encoding, float offset, float scale, uint16_t value,
+			   float expected)
+{
+	float min = intensity_fields[f].min, max = intensity_fields[f].max;
+	if (intensity_is_raw(f))
+		return scale == 1.0f && offset == 0.0f && value == fminf(expected, 65534.0f);
+	if (encoding == INTENSITIES_FLOAT16) {
+		float decoded = half_to_float(value);
+		if (isnan(expected))
+			return isnan(decoded);
+		return scale == 0.0f
+		       && fabsf(decoded - expected) <= fabsf(expected) * 0x1p-11f + 0x1p-25f;
+	}
+	if (isnan(expected))
+		return value == INTENSITIES_MISSING;
+	float decoded = offset + scale * value;
+	float clamped = fminf(fmaxf(expected, min), max);
+	return value < INTENSITIES_MISSING
+	       && fabsf(decoded - clamped) <= 0.5f * scale + 0x1p-20f * max;
+}
+
+static void write_sidecar(const char *fn, int encoding, const bcf_hdr_t *hdr,
+			  const sites_t *sites)
+{
+	intensities_t *intensities = intensities_init(fn, encoding, FLAGS, NULL);
+	intensities_write_header(intensities, hdr, sites, NULL, N_LOCI);
+	tile_t tile = {0};
+	tile.n_samples = N_SAMPLES;
+	float **float_arrs[] = {&tile.baf_arr,	  &tile.lrr_arr,    &tile.norm_x_arr,
+				&tile.norm_y_arr, &tile.ilmn_r_arr, &tile.ilmn_theta_arr};
+	for (int f = 0; f < 6; f++)
+		*float_arrs[f] = (float *)malloc(TILE_LOCI * N_SAMPLES * sizeof(float));
+	tile.raw_x_arr = (int32_t *)malloc(TILE_LOCI * N_SAMPLES * sizeof(int32_t));
+	tile.raw_y_arr = (int32_t *)malloc(TILE_LOCI * N_SAMPLES * sizeof(int32_t));
+	for (int locus_beg = 0; locus_beg < N_LOCI; locus_beg += TILE_LOCI) {
+		tile.n_loci = min(TILE_LOCI, N_LOCI - locus_beg);
+		for (int k = 0; k < tile.n_loci; k++) {
+			int j = locus_beg + k;
+			for (int s = 0; s < N_SAMPLES; s++) {
+				int cell = k * N_SAMPLES + s;
+				for (int f = 0; f < 6; f++)
+					(*float_arrs[f])[cell] = expected_value(f, j, s);
+				tile.raw_x_arr[cell] = (int32_t)expected_value(6, j, s);
+				tile.raw_y_arr[cell] = (int32_t)expected_value(7, j, s);
+			}
+		}
+		intensities_add_tile(intensities, sites, &tile, locus_beg);
+	}
+	intensities_destroy(intensities);
+	for (int f = 0; f < 6; f++)
+		free(*float_arrs[f]);
+	free(tile.raw_x_arr);
+	free(tile.raw_y_arr);
+}
+
+static int32_t read_int32(BGZF *fp)
+{
+	int32_t value = 0;
+	if (bgzf_read(fp, &value, 4) != 4)
+		error("Failed to read from the sidecar\n");
+	return value;
+}
+
+static int read_str(BGZF *fp, const char *expected)
+{
+	int32_t len = read_int32(fp);
+	char buffer[64] = {0};
+	if (len < 0 || len >= (int32_t)sizeof(buffer) || bgzf_read(fp, buffer, len) != len)
+		return 0;
+	return strcmp(buffer, expected) == 0;
+}
+
+static void read_sidecar(const char *fn, int encoding, const bcf_hdr_t *hdr,
+			 const sites_t *sites)
+{
+	const char *what = encoding == INTENSITIES_FLOAT16 ? "float16" : "uint16";
+	BGZF *fp = bgzf_open(fn, "r");
+	if (!fp || bgzf_index_load(fp, fn, ".gzi") < 0)
+		error("Failed to open %s with its index\n", fn);
+	char magic[8];
+	check(bgzf_read(fp, magic, 8) == 8 && memcmp(magic, INTENSITIES_MAGIC, 8) == 0,
+	      "Wrong magic for the %s encoding\n", what);
+	int32_t n_rows = 0;
+	for (int j = 0; j < N_LOCI; j++)
+		n_rows += sites->sites[j].rid >= 0;
+	int32_t values[5];
+	for (int i = 0; i < 5; i++)
+		values[i] = read_int32(fp);
+	check(values[0] == encoding && values[1] == N_FIELDS && values[2] == N_SAMPLES
+		      && values[3] == n_rows && values[4] == INTENSITIES_CHUNK_CELLS / N_SAMPLES,
+	      "Wrong header values for the %s encoding\n", what);
+	int32_t chunk_rows = values[4];
+	float offsets[N_FIELDS], scales[N_FIELDS];
+	int ok = 1;
+	for (int i = 0; i < N_FIELDS; i++) {
+		char name[8];
+		ok &= bgzf_read(fp, name, 8) == 8
+		      && strncmp(name, intensity_fields[fields[i]].name, 8) == 0;
+		ok &= bgzf_read(fp, &offsets[i], 4) == 4 && bgzf_read(fp, &scales[i], 4) == 4;
+	}
+	check(ok, "Wrong fields for the %s encoding\n", what);
+	ok = read_int32(fp) == 3;
+	for (int rid = 0; ok && rid < 3; rid++)
+		ok = read_str(fp, contigs[rid]);
+	for (int i = 0; ok && i < N_SAMPLES; i++)
+		ok = read_str(fp, hdr->samples[i]);
+	check(ok, "Wrong contigs or samples for the %s encoding\n", what);
+
+	// the row table lists the placed markers in order
+	int *rows = (int *)malloc(n_rows * sizeof(int));
+	ok = 1;
+	for (int j = 0, row = 0; j < N_LOCI; j++) {
+		const site_t *site = &sites->sites[j];
+		if (site->rid < 0)
+			continue;
+		rows[row++] = j;
+		ok &= read_int32(fp) == site->rid;
+		ok &= read_int32(fp) == site->pos;
+	}
+	check(ok, "Wrong row table for the %s encoding\n", what);
+
+	// the chunks are read in sequence and each value is checked at its documented offset
+	int64_t data_beg = bgzf_utell(fp);
+	size_t n_values = (size_t)n_rows * N_SAMPLES * N_FIELDS;
+	uint16_t *data = (uint16_t *)malloc(n_values * sizeof(uint16_t));
+	check(bgzf_read(fp, data, n_values * sizeof(uint16_t))
+			      == (ssize_t)(n_values * sizeof(uint16_t))
+		      && bgzf_read(fp, magic, 1) == 0,
+	      "Wrong size of the values for the %s encoding\n", what);
+	int n_mismatches[N_FIELDS] = {0};
+	for (int row = 0; row < n_rows; row++) {
+		int chunk = row / chunk_rows;
+		int n_chunk_rows = min(chunk_rows, n_rows - chunk * chunk_rows);
+		for (int i = 0; i < N_FIELDS; i++) {
+			size_t beg = (size_t)chunk * chunk_rows * N_SAMPLES * N_FIELDS
+				     + ((size_t)i * n_chunk_rows + row % chunk_rows) * N_SAMPLES;
+			for (int s = 0; s < N_SAMPLES; s++)
+				n_mismatches[i] += !decoded_matches(
+					fields[i], encoding, offsets[i], scales[i], data[beg + s],
+					expected_value(fields[i], rows[row], s));
+		}
+	}
+	for (int i = 0; i < N_FIELDS; i++)
+		check(n_mismatches[i] == 0, "Wrong values of a field for the %s encoding\n",
+		      what);
+	ok = 1;
+	for (int k = 0; k < 1000; k++) {
+		size_t idx = lrand48() % n_values;
+		uint16_t value;
+		ok &= bgzf_useek(fp, data_beg + idx * sizeof(uint16_t), SEEK_SET) == 0
+		      && bgzf_read(fp, &value, 2) == 2 && value == data[idx];
+	}
+	check(ok, "Values reached with bgzf_useek() differ for the %s encoding\n", what);
+	if (bgzf_close(fp) < 0)
+		error("Error closing %s\n", fn);
+	free(data);
+	free(rows);
+}
+
+int main(int argc, char **argv)
+{
+	srand48(argc > 1 ? strtol(argv[1], NULL, 0) : 20200526);
+	char dir[] = "/tmp/test_intensities.XXXXXX";
+	if (!mkdtemp(dir))
+		error("Failed to create a temporary directory\n");
+	bcf_hdr_t *hdr = bcf_hdr_init("w");
+	for (int rid = 0; rid < 3; rid++)
+		bcf_hdr_printf(hdr, "##contig=<ID=%s,length=100000000>", contigs[rid]);
+	for (int s = 0; s < N_SAMPLES; s++) {
+		char name[16];
+		snprintf(name, sizeof(name), "sample%d", s);
+		bcf_hdr_add_sample(hdr, name);
+	}
+	if (bcf_hdr_sync(hdr) < 0)
+		error("Failed to build the header\n");
+
+	// a tenth of the markers are unplaced and have no row
+	sites_t sites = {0};
+	sites.n_sites = N_LOCI;
+	sites.sites = (site_t *)calloc(N_LOCI, sizeof(site_t));
+	for (int j = 0; j < N_LOCI; j++) {
+		sites.sites[j].rid = lrand48() % 10 ? lrand48() % 3 : -1;
+		sites.sites[j].pos = lrand48() % 100000000;
+	}
+
+	kstring_t fn = {0, 0, NULL}, fnidx = {0, 0, NULL};
+	ksprintf(&fn, "%s/sidecar.int.gz", dir);
+	ksprintf(&fnidx, "%s.gzi", fn.s);
+	int encodings[] = {INTENSITIES_UINT16, INTENSITIES_FLOAT16};
+	for (int e = 0; e < 2; e++) {
+		write_sidecar(fn.s, encodings[e], hdr, &sites);
+		read_sidecar(fn.s, encodings[e], hdr, &sites);
+		unlink(fn.s);
+		unlink(fnidx.s);
+	}
+	rmdir(dir);
+	free(fn.s);
+	free(fnidx.s);
+	free(sites.sites);
+	bcf_hdr_destroy(hdr);
+	fprintf(stderr, "%d of %d checks failed\n", n_failures, n_checks);
+	return n_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,246 @@
+/* The MIT License
+
+   Copyright (c) 2018-2020 Giulio Genovese
+
+   Author: Giulio Genovese <giulio.genovese@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+
+ */
+
+// checks the row kernels get_intensities_row() and get_baf_lrr_row() against the scalar
+// functions get_norm_xy(), get_ilmn_theta_r() and get_baf_lrr() for random and edge inputs
+
+#include <float.h>
+#include "../gtc2vcf.c"
+
+#define TOLERANCE 1e-5f
+
+static int n_checks = 0;
+static int n_failures = 0;
+
+// NaN matches NaN, infinities match exactly, anything else within a relative tolerance
+static void check_float(const char *what, const char *input, int n, int i, float vec,
+			float ref)
+{
+	int ok;
+	n_checks++;
+	if (isnan(ref) || isnan(vec))
+		ok = isnan(ref) && isnan(vec);
+	else if (isinf(ref) || isinf(vec))
+		ok = vec == ref;
+	else
+		ok = fabsf(vec - ref) <= TOLERANCE * fmaxf(1.0f, fabsf(ref));
+	if (!ok) {
+		if (n_failures < 20)
+			fprintf(stderr, "%s mismatch for %s input with n=%d at i=%d: %.9g != %.9g\n",
+				what, input, n, i, vec, ref);
+		n_failures++;
+	}
+}
+
+static float rand_float(float min, float max)
+{
+	return min + (max - min) * (float)drand48();
+}
+
+/****************************************
+ * INPUT GENERATION                     *
+ ****************************************/
+
+typedef enum { INPUT_RANDOM, INPUT_ZERO, INPUT_NEGATIVE, INPUT_NAN, INPUT_EXTREME } input_t;
+
+static const char *input_names[] = {"random", "zero", "negative", "NaN", "extreme"};
+
+// fills raw intensities and normalization coefficients, the edge inputs are interleaved with
+// random values so that they hit both the vector lanes and the scalar tail
+static void fill_intensities(input_t input, int n, uint16_t *raw_x, uint16_t *raw_y,
+			     float *coeffs)
+{
+	for (int i = 0; i < n; i++) {
+		raw_x[i] = (uint16_t)(lrand48() % 30000);
+		raw_y[i] = (uint16_t)(lrand48() % 30000);
+		float theta = rand_float(-0.1f, 0.1f);
+		coeffs[i] = rand_float(0.0f, 500.0f);
+		coeffs[n + i] = rand_float(0.0f, 500.0f);
+		coeffs[2 * n + i] = cosf(theta);
+		coeffs[3 * n + i] = sinf(theta);
+		coeffs[4 * n + i] = rand_float(-0.05f, 0.05f);
+		coeffs[5 * n + i] = rand_float(1000.0f, 10000.0f);
+		coeffs[6 * n + i] = rand_float(1000.0f, 10000.0f);
+		if (i % 3)
+			continue;
+		switch (input) {
+		case INPUT_ZERO:
+			raw_x[i] = 0;
+			raw_y[i] = i % 2 ? raw_y[i] : 0;
+			coeffs[i] = coeffs[n + i] = 0.0f;
+			break;
+		case INPUT_NEGATIVE:
+			// offsets larger than the raw intensities give negative transformed values
+			coeffs[i] = (float)raw_x[i] + rand_float(1.0f, 1000.0f);
+			coeffs[n + i] = (float)raw_y[i] + rand_float(1.0f, 1000.0f);
+			coeffs[4 * n + i] = -coeffs[4 * n + i];
+			break;
+		case INPUT_NAN:
+			// samples missing a normalization ID have NaN coefficients
+			for (int c = 0; c < XFORM_COEFFS; c++)
+				coeffs[c * n + i] = NAN;
+			break;
+		case INPUT_EXTREME:
+			raw_x[i] = 65535;
+			raw_y[i] = i % 2 ? 65535 : 1;
+			coeffs[5 * n + i] = 1e-3f;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static void fill_theta_r(input_t input, int n, float *ilmn_theta, float *ilmn_r,
+			 const locus_t *locus)
+{
+	for (int i = 0; i < n; i++) {
+		ilmn_theta[i] = rand_float(0.0f, 1.0f);
+		ilmn_r[i] = rand_float(0.1f, 3.0f);
+		if (i % 4 == 1)
+			ilmn_theta[i] = locus->theta_mean[1];
+		if (i % 3)
+			continue;
+		switch (input) {
+		case INPUT_ZERO:
+			ilmn_theta[i] = 0.0f;
+			ilmn_r[i] = 0.0f;
+			break;
+		case INPUT_NEGATIVE:
+			ilmn_theta[i] = -ilmn_theta[i];
+			ilmn_r[i] = -ilmn_r[i];
+			break;
+		case INPUT_NAN:
+			if (i % 2)
+				ilmn_theta[i] = NAN;
+			else
+				ilmn_r[i] = NAN;
+			break;
+		case INPUT_EXTREME:
+			ilmn_theta[i] = i % 2 ? 1.0f : 0.0f;
+			ilmn_r[i] = i % 2 ? FLT_MAX : FLT_MIN;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static void fill_locus(input_t input, locus_t *locus)
+{
+	memset(locus, 0, sizeof(locus_t));
+	locus->theta_mean[0] = rand_float(0.0f, 0.2f);
+	locus->theta_mean[1] = rand_float(0.4f, 0.6f);
+	locus->theta_mean[2] = rand_float(0.8f, 1.0f);
+	for (int j = 0; j < 3; j++)
+		locus->r_mean[j] = rand_float(0.5f, 2.0f);
+	if (input == INPUT_NAN) {
+		// loci without cluster definitions have NaN cluster centers
+		locus->theta_mean[lrand48() % 3] = NAN;
+	} else if (input == INPUT_ZERO) {
+		locus->r_mean[lrand48() % 3] = 0.0f;
+	} else if (input == INPUT_EXTREME) {
+		// collapsed clusters
+		locus->theta_mean[0] = locus->theta_mean[1];
+	}
+}
+
+/****************************************
+ * CHECKS                               *
+ ****************************************/
+
+static void test_intensities_row(input_t input, int n)
+{
+	uint16_t *raw_x = (uint16_t *)malloc(n * sizeof(uint16_t));
+	uint16_t *raw_y = (uint16_t *)malloc(n * sizeof(uint16_t));
+	float *coeffs = (float *)malloc((size_t)n * XFORM_COEFFS * sizeof(float));
+	float *out = (float *)malloc((size_t)n * 4 * sizeof(float));
+	fill_intensities(input, n, raw_x, raw_y, coeffs);
+	xform_row_t xform = {coeffs,	     coeffs + n,     coeffs + 2 * n, coeffs + 3 * n,
+			     coeffs + 4 * n, coeffs + 5 * n, coeffs + 6 * n};
+
+	for (int with_xform = 0; with_xform < 2; with_xform++) {
+		const xform_row_t *ptr = with_xform ? &xform : NULL;
+		get_intensities_row(raw_x, raw_y, ptr, n, out, out + n, out + 2 * n, out + 3 * n);
+		for (int i = 0; i < n; i++) {
+			float norm_x, norm_y, ilmn_theta, ilmn_r;
+			get_norm_xy(raw_x[i], raw_y[i], ptr, i, &norm_x, &norm_y);
+			get_ilmn_theta_r(norm_x, norm_y, &ilmn_theta, &ilmn_r);
+			check_float("X", input_names[input], n, i, out[i], norm_x);
+			check_float("Y", input_names[input], n, i, out[n + i], norm_y);
+			check_float("Theta", input_names[input], n, i, out[2 * n + i], ilmn_theta);
+			check_float("R", input_names[input], n, i, out[3 * n + i], ilmn_r);
+		}
+	}
+
+	free(raw_x);
+	free(raw_y);
+	free(coeffs);
+	free(out);
+}
+
+static void test_baf_lrr_row(input_t input, int n)
+{
+	locus_t locus;
+	fill_locus(input, &locus);
+	float *ilmn_theta = (float *)malloc(n * sizeof(float));
+	float *ilmn_r = (float *)malloc(n * sizeof(float));
+	float *baf = (float *)malloc(n * sizeof(float));
+	float *lrr = (float *)malloc(n * sizeof(float));
+	fill_theta_r(input, n, ilmn_theta, ilmn_r, &locus);
+
+	get_baf_lrr_row(ilmn_theta, ilmn_r, n, &locus, baf, lrr);
+	for (int i = 0; i < n; i++) {
+		float ref_baf, ref_lrr;
+		get_baf_lrr(ilmn_theta[i], ilmn_r[i], locus.theta_mean[0], locus.theta_mean[1],
+			    locus.theta_mean[2], locus.r_mean[0], locus.r_mean[1],
+			    locus.r_mean[2], &ref_baf, &ref_lrr);
+		check_float("BAF", input_names[input], n, i, baf[i], ref_baf);
+		check_float("LRR", input_names[input], n, i, lrr[i], ref_lrr);
+	}
+
+	free(ilmn_theta);
+	free(ilmn_r);
+	free(baf);
+	free(lrr);
+}
+
+int main(int argc, char **argv)
+{
+	// row lengths below, equal to and not a multiple of the vector length
+	int lengths[] = {1, VEC_LEN - 1, VEC_LEN, VEC_LEN + 1, 2 * VEC_LEN + 1, 1000, 1003};
+	srand48(argc > 1 ? strtol(argv[1], NULL, 0) : 20200526);
+	for (int rep = 0; rep < 10; rep++) {
+		for (int input = INPUT_RANDOM; input <= INPUT_EXTREME; input++) {
+			for (int k = 0; k < sizeof(lengths) / sizeof(int); k++) {
+				test_intensities_row((input_t)input, lengths[k]);
+				test_baf_lrr_row((input_t)input, lengths[k]);
+			}
+		}
+	}
+	fprintf(stderr, "%d of %d checks failed\n", n_failures, n_checks);
+	return n_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
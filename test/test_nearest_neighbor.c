@@ -0,0 +1,303 @@
+/* The MIT License
+
+   Copyright (c) 2018 Giulio Genovese
+
+   Author: Giulio Genovese <giulio.genovese@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+
+ */
+
+// checks that nn_find_closest() returns the same points as the implementation with file-scope
+// bins it replaced, and with the bench argument times both at 1k, 10k and 100k points
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "../nearest_neighbor.c"
+
+/****************************************
+ * REFERENCE IMPLEMENTATION             *
+ ****************************************/
+
+static int elementsInBin[12];
+static int *binData[12];
+static int elementsInShiftedBin[11];
+static int *binDataShifted[11];
+
+static int ref_find_closest(int n_raw, float *raw_x, float *raw_y, int n_axis,
+			    float *axis_x, float *axis_y, int *ret)
+{
+	int i;
+	float *raw_a = NULL;
+	float *raw_b = NULL;
+	float *axis_a = NULL;
+	float axis_max_val;
+	float bin_width;
+	int bin_idx;
+	float quotient;
+	float reminder;
+	int *curr_bin_data;
+	int curr_bin_size;
+	float curr_axis_x;
+	float curr_axis_y;
+	float x_dist;
+	float y_dist;
+	double best_val;
+	int best_idx;
+	int j;
+	int curr_idx;
+	double sq_dist;
+	double axis_max_dist;
+	int use_y = 1;
+	int use_x = 1;
+
+	for (i = 0; i < n_axis; i++) {
+		if (axis_x[i] > 0.0001) {
+			use_y = 0;
+			break;
+		}
+	}
+
+	for (i = 0; i < n_axis; i++) {
+		if (axis_y[i] > 0.0001) {
+			use_x = 0;
+			break;
+		}
+	}
+
+	if (use_y) {
+		raw_a = raw_y;
+		raw_b = raw_x;
+		axis_a = axis_y;
+	} else if (use_x) {
+		raw_a = raw_x;
+		raw_b = raw_y;
+		axis_a = axis_x;
+	} else {
+		return -1;
+	}
+
+	axis_max_val = axis_a[n_axis - 1];
+	bin_width = axis_max_val / 12.0f;
+	axis_max_dist = (double)bin_width;
+
+	for (i = 0; i < n_raw; i++) {
+		if ((double)raw_b[i] > axis_max_dist)
+			continue;
+		bin_idx = (int)(raw_a[i] / bin_width);
+		if (bin_idx < 0)
+			bin_idx = 0;
+		if (bin_idx > 11)
+			bin_idx = 11;
+		elementsInBin[bin_idx]++;
+		bin_idx = (int)(raw_a[i] / bin_width - 0.5f);
+		if (bin_idx < 0)
+			bin_idx = 0;
+		if (bin_idx > 10)
+			bin_idx = 10;
+		elementsInShiftedBin[bin_idx]++;
+	}
+
+	for (i = 0; i <= 11; i++) {
+		binData[i] = (int *)malloc((size_t)elementsInBin[i] * sizeof(int));
+		elementsInBin[i] = 0;
+		if (i == 11)
+			continue;
+		binDataShifted[i] =
+			(int *)malloc((size_t)elementsInShiftedBin[i] * sizeof(int));
+		elementsInShiftedBin[i] = 0;
+	}
+
+	for (i = 0; i < n_raw; i++) {
+		if ((double)raw_b[i] > axis_max_dist)
+			continue;
+		bin_idx = (int)(raw_a[i] / bin_width);
+		if (bin_idx < 0)
+			bin_idx = 0;
+		if (bin_idx > 11)
+			bin_idx = 11;
+		binData[bin_idx][elementsInBin[bin_idx]] = i;
+		elementsInBin[bin_idx]++;
+		bin_idx = (int)(raw_a[i] / bin_width - 0.5f);
+		if (bin_idx < 0)
+			bin_idx = 0;
+		if (bin_idx > 10)
+			bin_idx = 10;
+		binDataShifted[bin_idx][elementsInShiftedBin[bin_idx]] = i;
+		elementsInShiftedBin[bin_idx]++;
+	}
+
+	for (i = 0; i < n_axis; i++) {
+		quotient = axis_a[i] / bin_width;
+		bin_idx = (int)quotient;
+		reminder = quotient - (float)bin_idx;
+		curr_bin_data = NULL;
+		curr_bin_size = 0;
+		if (bin_idx < 0)
+			bin_idx = 0;
+		if (bin_idx > 11)
+			bin_idx = 11;
+
+		if (0.25f <= reminder && reminder <= 0.75f) {
+			curr_bin_data = binData[bin_idx];
+			curr_bin_size = elementsInBin[bin_idx];
+		} else {
+			if (reminder < 0.25f) {
+				if (bin_idx == 0) {
+					curr_bin_data = binData[bin_idx];
+					curr_bin_size = elementsInBin[bin_idx];
+				} else {
+					curr_bin_data = binDataShifted[bin_idx - 1];
+					curr_bin_size = elementsInShiftedBin[bin_idx - 1];
+				}
+			} else if (bin_idx == 11) {
+				curr_bin_data = binData[bin_idx];
+				curr_bin_size = elementsInBin[bin_idx];
+			} else {
+				curr_bin_data = binDataShifted[bin_idx];
+				curr_bin_size = elementsInShiftedBin[bin_idx];
+			}
+		}
+
+		curr_axis_x = axis_x[i];
+		curr_axis_y = axis_y[i];
+		best_val = 1e20;
+		best_idx = -1;
+
+		for (j = 0; j < curr_bin_size; j++) {
+			curr_idx = curr_bin_data[j];
+			x_dist = raw_x[curr_idx] - curr_axis_x;
+			y_dist = raw_y[curr_idx] - curr_axis_y;
+			sq_dist = (double)(x_dist * x_dist + y_dist * y_dist);
+			if (sq_dist < best_val) {
+				best_val = sq_dist;
+				best_idx = curr_idx;
+			}
+		}
+
+		ret[i] = best_idx;
+	}
+
+	for (i = 0; i <= 11; i++) {
+		free((void *)binData[i]);
+		elementsInBin[i] = 0;
+		if (i > 10)
+			continue;
+		free((void *)binDataShifted[i]);
+		elementsInShiftedBin[i] = 0;
+	}
+
+	return 0;
+}
+
+/****************************************
+ * CHECKS AND BENCHMARK                 *
+ ****************************************/
+
+static double wall_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// intensities scattered around the two axes as in a normalization fit, with the points of
+// the axis sorted so that the last one is the largest
+static void fill_points(int n_raw, float *raw_x, float *raw_y, int n_axis, float *axis_x,
+			float *axis_y, int along_y)
+{
+	for (int i = 0; i < n_raw; i++) {
+		float a = (float)(drand48() * 10000.0);
+		float b = (float)(drand48() * drand48() * 3000.0);
+		raw_x[i] = along_y ? b : a;
+		raw_y[i] = along_y ? a : b;
+	}
+	for (int i = 0; i < n_axis; i++) {
+		float a = 10000.0f * (float)(i + 1) / (float)n_axis;
+		axis_x[i] = along_y ? 0.0f : a;
+		axis_y[i] = along_y ? a : 0.0f;
+	}
+}
+
+static int run(int n_raw, int n_axis, int bench)
+{
+	float *raw_x = (float *)malloc(n_raw * sizeof(float));
+	float *raw_y = (float *)malloc(n_raw * sizeof(float));
+	float *axis_x = (float *)malloc(n_axis * sizeof(float));
+	float *axis_y = (float *)malloc(n_axis * sizeof(float));
+	int *ret = (int *)malloc(n_axis * sizeof(int));
+	int *ref_ret = (int *)malloc(n_axis * sizeof(int));
+	nn_ctx_t *ctx = nn_ctx_init();
+	int n_failures = 0;
+
+	for (int along_y = 0; along_y < 2; along_y++) {
+		fill_points(n_raw, raw_x, raw_y, n_axis, axis_x, axis_y, along_y);
+		if (nn_find_closest(ctx, n_raw, raw_x, raw_y, n_axis, axis_x, axis_y, ret) < 0
+		    || ref_find_closest(n_raw, raw_x, raw_y, n_axis, axis_x, axis_y, ref_ret) < 0) {
+			fprintf(stderr, "Search failed with %d points\n", n_raw);
+			return 1;
+		}
+		for (int i = 0; i < n_axis; i++) {
+			if (ret[i] == ref_ret[i])
+				continue;
+			if (n_failures < 20)
+				fprintf(stderr, "Axis point %d with %d points: %d != %d\n", i,
+					n_raw, ret[i], ref_ret[i]);
+			n_failures++;
+		}
+	}
+
+	// enough repetitions for each size to take a measurable time
+	int reps = bench ? (n_raw < 1000000 ? 1000000 / n_raw : 1) * 10 : 0;
+	for (int impl = 0; impl < 2 && reps; impl++) {
+		double t0 = wall_time();
+		for (int rep = 0; rep < reps; rep++) {
+			if (impl)
+				nn_find_closest(ctx, n_raw, raw_x, raw_y, n_axis, axis_x, axis_y,
+						ret);
+			else
+				ref_find_closest(n_raw, raw_x, raw_y, n_axis, axis_x, axis_y, ret);
+		}
+		double seconds = (wall_time() - t0) / reps;
+		fprintf(stderr, "Points:\t%d\tImplementation:\t%s\tMicroseconds per call:\t%.1f\n",
+			n_raw, impl ? "nn_find_closest" : "file-scope bins", seconds * 1e6);
+	}
+
+	nn_ctx_destroy(ctx);
+	free(raw_x);
+	free(raw_y);
+	free(axis_x);
+	free(axis_y);
+	free(ret);
+	free(ref_ret);
+	return n_failures;
+}
+
+int main(int argc, char **argv)
+{
+	int bench = argc > 1 && !strcmp(argv[1], "bench");
+	int sizes[] = {1, 10, 1000, 10000, 100000};
+	int n_failures = 0;
+	srand48(20200526);
+	for (int k = bench ? 2 : 0; k < sizeof(sizes) / sizeof(int); k++)
+		n_failures += run(sizes[k], 400, bench);
+	fprintf(stderr, "%d mismatches\n", n_failures);
+	return n_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,206 @@
+/* The MIT License
+
+   Copyright (c) 2018-2020 Giulio Genovese
+
+   Author: Giulio Genovese <giulio.genovese@gmail.com>
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+
+ */
+
+// checks that with loci selected out of manifest order, as with --sort, the GTC arrays read
+// from BGZF streams are read about once per sample rather than once per tile, and that the
+// tiles still hold the values of the selected loci
+
+#include "../gtc2vcf.c"
+
+#define N_LOCI 20000
+#define N_SAMPLES 3
+#define CAPACITY 512
+#define M_LOCI 700
+
+static inline uint16_t expected_raw_x(int j, int i)
+{
+	return (uint16_t)(j * 7 + i);
+}
+
+static inline uint16_t expected_raw_y(int j, int i)
+{
+	return (uint16_t)(j ^ (0x5555 + i));
+}
+
+static inline uint8_t expected_genotype(int j, int i)
+{
+	return (uint8_t)((j + i) % 4);
+}
+
+static inline float expected_score(int j, int i)
+{
+	return (float)j / N_LOCI + (float)i;
+}
+
+static void ks_put32(kstring_t *str, int32_t value)
+{
+	kputsn((const char *)&value, 4, str);
+}
+
+// a GTC file with only the arrays, compressed with BGZF next to a .gzi index so that it is read
+// through the buffers rather than memory mapped
+static void write_gtc(const char *fn, int i)
+{
+	static const uint16_t ids[] = {NUM_SNPS, RAW_X, RAW_Y, GENOTYPES, GENOTYPE_SCORES};
+	int n_toc = sizeof(ids) / sizeof(ids[0]);
+	kstring_t str = {0, 0, NULL};
+	kputsn("gtc\5", 4, &str);
+	ks_put32(&str, n_toc);
+	size_t toc = str.l;
+	for (int k = 0; k < n_toc; k++) {
+		kputsn((const char *)&ids[k], 2, &str);
+		ks_put32(&str, 0);
+	}
+	int32_t value = N_LOCI;
+	memcpy(str.s + toc + 2, &value, 4);
+	for (int k = 1; k < n_toc; k++) {
+		value = (int32_t)str.l;
+		memcpy(str.s + toc + 6 * k + 2, &value, 4);
+		ks_put32(&str, N_LOCI);
+		for (int j = 0; j < N_LOCI; j++) {
+			uint16_t x = expected_raw_x(j, i), y = expected_raw_y(j, i);
+			uint8_t gt = expected_genotype(j, i);
+			float score = expected_score(j, i);
+			switch (ids[k]) {
+			case RAW_X:
+				kputsn((const char *)&x, 2, &str);
+				break;
+			case RAW_Y:
+				kputsn((const char *)&y, 2, &str);
+				break;
+			case GENOTYPES:
+				kputc(gt, &str);
+				break;
+			case GENOTYPE_SCORES:
+				kputsn((const char *)&score, 4, &str);
+				break;
+			}
+		}
+	}
+	BGZF *fp = bgzf_open(fn, "w");
+	if (!fp || bgzf_index_build_init(fp) < 0 || bgzf_write(fp, str.s, str.l) != str.l
+	    || bgzf_flush(fp) < 0 || bgzf_index_dump(fp, fn, ".gzi") < 0 || bgzf_close(fp) < 0)
+		error("Failed to write %s\n", fn);
+	free(str.s);
+}
+
+// reads the selected loci tile by tile as tile_compute() does and returns the bytes read per
+// sample, or -1 if a value does not match
+static double read_tiles(char **fnames, const int *loci, int stage)
+{
+	gtc_t *gtc[N_SAMPLES];
+	for (int i = 0; i < N_SAMPLES; i++)
+		gtc[i] = gtc_init(fnames[i], CAPACITY);
+	uint64_t n_refills, n_bytes, n_refills_end, n_bytes_end;
+	gtc_io_counts(gtc, 0, N_SAMPLES, &n_refills, &n_bytes);
+	if (stage)
+		gtcs_stage_loci(gtc, N_SAMPLES, loci, N_LOCI, NULL);
+	gtc_block_t *block = gtc_block_init(N_SAMPLES, M_LOCI);
+	tile_t tile = {0};
+	tile.loci = loci;
+	tile.m_loci = M_LOCI;
+	float *buffer = (float *)malloc(M_LOCI * sizeof(float));
+	int ret = 0;
+	for (int beg = 0; beg < N_LOCI; beg += M_LOCI) {
+		tile.n_loci = min(M_LOCI, N_LOCI - beg);
+		tile_order(&tile, beg);
+		gtc_block_read(gtc, block, beg, tile.n_loci, loci, tile.order, 0, N_SAMPLES,
+			       (void *)buffer);
+		for (int k = 0; k < tile.n_loci; k++) {
+			int j = loci[beg + k];
+			for (int i = 0; i < N_SAMPLES; i++) {
+				size_t idx = (size_t)k * N_SAMPLES + i;
+				if (block->raw_x[idx] != expected_raw_x(j, i)
+				    || block->raw_y[idx] != expected_raw_y(j, i)
+				    || block->genotypes[idx] != expected_genotype(j, i)
+				    || block->genotype_scores[idx] != expected_score(j, i)
+				    || block->base_calls[idx][0] != '-')
+					ret = -1;
+			}
+		}
+	}
+	gtc_io_counts(gtc, 0, N_SAMPLES, &n_refills_end, &n_bytes_end);
+	free(buffer);
+	free(tile.order);
+	gtc_block_destroy(block);
+	for (int i = 0; i < N_SAMPLES; i++)
+		gtc_destroy(gtc[i]);
+	return ret < 0 ? -1.0 : (double)(n_bytes_end - n_bytes) / N_SAMPLES;
+}
+
+int main(int argc, char **argv)
+{
+	srand48(argc > 1 ? strtol(argv[1], NULL, 0) : 20200526);
+	char dir[] = "/tmp/test_sorted_reads.XXXXXX";
+	if (!mkdtemp(dir))
+		error("Failed to create a temporary directory\n");
+	char *fnames[N_SAMPLES];
+	for (int i = 0; i < N_SAMPLES; i++) {
+		kstring_t str = {0, 0, NULL};
+		ksprintf(&str, "%s/sample%d.gtc.gz", dir, i);
+		write_gtc(str.s, i);
+		fnames[i] = str.s;
+	}
+
+	// a random permutation stands for the coordinate order of the markers
+	int *loci = (int *)malloc(N_LOCI * sizeof(int));
+	for (int j = 0; j < N_LOCI; j++)
+		loci[j] = j;
+	for (int j = N_LOCI - 1; j > 0; j--) {
+		int k = lrand48() % (j + 1), tmp = loci[j];
+		loci[j] = loci[k];
+		loci[k] = tmp;
+	}
+
+	// one pass over the four arrays, with the headers read by gtc_init()
+	double one_pass = (double)N_LOCI * (2 + 2 + 1 + 4);
+	double staged = read_tiles(fnames, loci, 1);
+	double unstaged = read_tiles(fnames, loci, 0);
+	fprintf(stderr, "Bytes read per sample staged/unstaged/one pass:\t%.0f/%.0f/%.0f\n",
+		staged, unstaged, one_pass);
+	int n_checks = 2, n_failures = 0;
+	if (staged < 0 || unstaged < 0) {
+		fprintf(stderr, "Tiles do not hold the values of the selected loci\n");
+		n_failures++;
+	}
+	if (staged > 1.05 * one_pass + 4 * CAPACITY * sizeof(float)) {
+		fprintf(stderr, "Staged arrays are read more than once\n");
+		n_failures++;
+	}
+
+	for (int i = 0; i < N_SAMPLES; i++) {
+		kstring_t str = {0, 0, NULL};
+		ksprintf(&str, "%s.gzi", fnames[i]);
+		unlink(str.s);
+		unlink(fnames[i]);
+		free(str.s);
+		free(fnames[i]);
+	}
+	rmdir(dir);
+	free(loci);
+	fprintf(stderr, "%d of %d checks failed\n", n_failures, n_checks);
+	return n_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}